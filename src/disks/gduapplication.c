@@ -17,6 +17,7 @@
 #include <unistd.h>
 
 #include "gduapplication.h"
+#include "gdubenchmarkdialog.h"
 #include "gduformatvolumedialog.h"
 #include "gdurestorediskimagedialog.h"
 #include "gduwindow.h"
@@ -144,6 +145,8 @@ static GOptionEntry opt_entries[] = {
     {"format-device", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Format selected device"), NULL },
     {"xid", 0, 0, G_OPTION_ARG_INT, NULL, N_("Parent window XID for the format dialog"), "ID" },
     {"restore-disk-image", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Restore disk image"), "FILE" },
+    {"benchmark", 0, 0, G_OPTION_ARG_STRING, NULL, N_("Benchmark device and print the results as JSON"), "DEVICE" },
+    {"benchmark-write", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Also benchmark writing when using --benchmark"), NULL },
     {NULL}
 };
 
@@ -165,6 +168,8 @@ gdu_application_command_line (GApplication            *_app,
   gchar *error_message = NULL;
   gboolean opt_format = FALSE;
   const gchar *opt_restore_disk_image = NULL;
+  const gchar *opt_benchmark = NULL;
+  gboolean opt_benchmark_write = FALSE;
   gint opt_xid = -1;
   GVariantDict *options;
 
@@ -174,6 +179,8 @@ gdu_application_command_line (GApplication            *_app,
   g_variant_dict_lookup (options, "format-device", "b", &opt_format);
   g_variant_dict_lookup (options, "xid", "i", &opt_xid);
   g_variant_dict_lookup (options, "restore-disk-image", "^&ay", &opt_restore_disk_image);
+  g_variant_dict_lookup (options, "benchmark", "&s", &opt_benchmark);
+  g_variant_dict_lookup (options, "benchmark-write", "b", &opt_benchmark_write);
  
   if (opt_format && opt_block_device == NULL)
     {
@@ -187,8 +194,33 @@ gdu_application_command_line (GApplication            *_app,
       goto out;
     }
 
+  if (opt_benchmark_write && opt_benchmark == NULL)
+    {
+      g_application_command_line_printerr (command_line, _("--benchmark-write must be used together with --benchmark\n"));
+      goto out;
+    }
+
   gdu_application_ensure_client (app);
 
+  /* benchmarking from the command-line doesn't involve the window at all */
+  if (opt_benchmark != NULL)
+    {
+      UDisksObject *object;
+
+      object = gdu_application_object_from_block_device (app, opt_benchmark, &error_message);
+      if (object == NULL)
+        {
+          g_application_command_line_printerr (command_line, "%s\n", error_message);
+          g_free (error_message);
+          goto out;
+        }
+      /* the exit status is set once the benchmark is done */
+      if (gdu_benchmark_run_for_command_line (_app, app->client, object, opt_benchmark_write, command_line))
+        ret = 0;
+      g_object_unref (object);
+      goto out;
+    }
+
   if (opt_block_device != NULL)
     {
       object_to_select = gdu_application_object_from_block_device (app, opt_block_device, &error_message);
@@ -9,21 +9,30 @@
 
 #include "config.h"
 
-#define _FILE_OFFSET_BITS 64
 #include <glib/gi18n.h>
 #include <gio/gunixfdlist.h>
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 
 #include <glib-unix.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <linux/fs.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <math.h>
 
 #include "gduapplication.h"
 #include "gduwindow.h"
 #include "gdubenchmarkdialog.h"
+#include "gduhistogram.h"
+#include "gduiotrace.h"
+#include "gducopyutils.h"
+#include "gdubufferring.h"
 
 /* ---------------------------------------------------------------------------------------------------- */
 
@@ -34,28 +43,155 @@ typedef struct {
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* A run as recorded in the history of benchmarks of a disk */
+typedef struct {
+  gint64 timestamp_usec;
+  gchar *firmware;
+  gdouble read_rate;
+  gdouble write_rate;
+  gdouble access_time;
+
+  /* the settings of the run - only runs with the same settings are compared */
+  guint64 sample_size;
+  gint num_samples;
+  gboolean refine;
+  gboolean write;
+} BMHistoryEntry;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 typedef enum {
   BM_STATE_NONE,
   BM_STATE_OPENING_DEVICE,
+  BM_STATE_CREATING_FILE,
   BM_STATE_TRANSFER_RATE,
+  BM_STATE_REFINING_TRANSFER_RATE,
   BM_STATE_ACCESS_TIME,
+  BM_STATE_IOPS,
+  BM_STATE_STREAMS,
+  BM_STATE_BLOCK_SIZE,
+  BM_STATE_SUSTAINED_WRITE,
+  BM_STATE_CONCURRENT,
+  BM_STATE_METADATA,
+  BM_STATE_SYNC_LATENCY,
+  BM_STATE_REPLAY,
+  BM_STATE_STANDBY,
 } BMState;
 
+typedef enum {
+  BM_METADATA_OP_CREATE,
+  BM_METADATA_OP_STAT,
+  BM_METADATA_OP_RENAME,
+  BM_METADATA_OP_UNLINK,
+  BM_METADATA_NUM_OPS
+} BMMetadataOp;
+
+/* Used for the keys in the file with the cached results */
+static const gchar *metadata_op_keys[BM_METADATA_NUM_OPS] = {"create", "stat", "rename", "unlink"};
+
+/* After the evenly spaced transfer rate samples, more samples are taken
+ * between neighbouring samples whose transfer rates differ by more than
+ * this fraction, for at most REFINE_TIME_RATIO times as long as the evenly
+ * spaced samples took
+ */
+#define REFINE_THRESHOLD 0.1
+#define REFINE_TIME_RATIO 0.5
+
+/* Queue depths at which random IOPS are measured */
+static const guint iops_queue_depths[] = {1, 4, 16, 32, 64};
+
+/* How many pages each worker writes in a pass when measuring write IOPS */
+#define IOPS_WRITE_PASS_NUM_OPS 128
+
+/* Number of parallel sequential streams to measure the transfer rate with */
+static const guint stream_counts[] = {1, 2, 4, 8};
+
+/* How long to measure each number of streams and the largest request each stream does */
+#define STREAMS_DURATION_SEC 5
+#define STREAMS_MAX_REQUEST_SIZE (4 * 1024 * 1024)
+
+/* How much each stream writes in a pass when measuring writes */
+#define STREAMS_WRITE_PASS_SIZE (8 * 1024 * 1024)
+
+/* The request sizes swept are the powers of two in this range */
+#define BLOCK_SIZE_MIN (4 * 1024)
+#define BLOCK_SIZE_MAX (16 * 1024 * 1024)
+
+/* How long to measure each request size and the most data to read for each */
+#define BLOCK_SIZE_DURATION_SEC 2
+#define BLOCK_SIZE_MAX_BYTES (256 * 1024 * 1024)
+
+/* The sustained write test writes in requests of this size and records
+ * the transfer rate every SUSTAINED_WINDOW_SIZE bytes. Reading what is
+ * written back may run up to a window ahead of writing.
+ */
+#define SUSTAINED_REQUEST_SIZE (4 * 1024 * 1024)
+#define SUSTAINED_WINDOW_SIZE (256 * 1024 * 1024)
+
+/* The write cache is considered exhausted once the transfer rate drops
+ * below this fraction of the initial transfer rate and stays there
+ */
+#define SUSTAINED_CLIFF_RATIO 0.5
+
+/* How long all disks are read from at the same time in the concurrent transfer rate test */
+#define CONCURRENT_DURATION_SEC 10
+
+/* In the metadata benchmark each of METADATA_NUM_THREADS threads creates
+ * METADATA_NUM_FILES files of METADATA_FILE_SIZE bytes spread over
+ * METADATA_NUM_DIRS directories of its own, then stats, renames and
+ * deletes them
+ */
+#define METADATA_NUM_THREADS 4
+#define METADATA_NUM_DIRS 16
+#define METADATA_NUM_FILES 2500
+#define METADATA_FILE_SIZE 4096
+
+/* The sync write latency test writes SYNC_NUM_WRITES times in each of these
+ * sizes, each write followed by fdatasync() as when a database commits
+ */
+static const guint sync_write_sizes[] = {4 * 1024, 8 * 1024, 16 * 1024};
+#define SYNC_NUM_WRITES 250
+
+/* How many times the drive is put into standby and woken up again by a
+ * read and how long to wait for it to report being in standby each time
+ */
+#define STANDBY_NUM_RUNS 3
+#define STANDBY_TIMEOUT_SEC 30
+
+typedef struct {
+  gchar *device;
+  gdouble read_rate; /* bytes/sec while all disks were being read from */
+} BMConcurrentResult;
+
 typedef struct
 {
   volatile gint ref_count;
 
+  UDisksClient *client;
   UDisksObject *object;
   UDisksBlock *block;
 
   GCancellable *cancellable;
 
+  /* NULL when run from the command-line, see gdu_benchmark_run_for_command_line() */
   GduWindow *window;
   GtkBuilder *builder;
 
   GtkWidget *dialog;
 
   GtkWidget *graph_drawing_area;
+  /* static parts of the transfer rate graph, see on_drawing_area_draw() */
+  cairo_surface_t *graph_surface;
+  gint graph_surface_width;
+  gint graph_surface_height;
+  gdouble graph_surface_max_speed;
+  gdouble graph_surface_max_time;
+  gdouble graph_gx, graph_gy, graph_gw, graph_gh;
+  GtkWidget *iops_drawing_area;
+  GtkWidget *streams_drawing_area;
+  GtkWidget *block_size_drawing_area;
+  GtkWidget *sustained_drawing_area;
+  GtkWidget *history_drawing_area;
 
   GtkWidget *device_label;
   GtkWidget *updated_label;
@@ -63,6 +199,22 @@ typedef struct
   GtkWidget *read_rate_label;
   GtkWidget *write_rate_label;
   GtkWidget *access_time_label;
+  GtkWidget *iops_label;
+  GtkWidget *read_latency_label;
+  GtkWidget *write_latency_label;
+  GtkWidget *streams_label;
+  GtkWidget *block_size_label;
+  GtkWidget *sustained_label;
+  GtkWidget *history_label;
+  GtkWidget *concurrent_label;
+  GtkWidget *metadata_label;
+  GtkWidget *sync_latency_label;
+  GtkWidget *replay_label;
+  GtkWidget *wake_label;
+
+  GtkWidget *infobar_vbox;
+  GtkWidget *regression_infobar;
+  GtkWidget *regression_label;
 
   GtkWidget *start_benchmark_button;
   GtkWidget *stop_benchmark_button;
@@ -73,9 +225,29 @@ typedef struct
 
   /* retrieved from preferences dialog */
   gint bm_num_samples;
+  gboolean bm_do_refine;
   gint bm_sample_size_mib;
   gboolean bm_do_write;
   gint bm_num_access_samples;
+  gboolean bm_do_iops;
+  gint bm_iops_duration_sec;
+  gboolean bm_do_streams;
+  gboolean bm_do_block_size;
+  gboolean bm_do_sustained;
+  gint bm_sustained_start_percent;
+  gint bm_sustained_size_gb;
+  GList *bm_concurrent_blocks; /* of UDisksBlock, other disks to read from at the same time */
+  gchar *bm_file_dir; /* if not NULL, a temporary file in this directory is benchmarked instead of the device */
+  guint64 bm_file_size;
+  gchar *bm_metadata_dir; /* if not NULL, the metadata benchmark is done in this directory */
+  gboolean bm_metadata_fsync;
+  gboolean bm_do_sync_latency;
+  gchar *bm_replay_filename;
+  GduIOTrace *bm_replay_trace; /* if not NULL, this trace is replayed */
+  gboolean bm_replay_fast; /* as fast as possible instead of at the original timing */
+  gint bm_replay_concurrency;
+  gboolean bm_do_standby;
+  UDisksDriveAta *bm_standby_ata; /* if not NULL, the wake-up time from standby is measured */
 
   /* must hold bm_lock when reading/writing these */
   GThread *bm_thread;
@@ -83,14 +255,56 @@ typedef struct
   gboolean bm_in_progress;
   BMState bm_state;
   GError *bm_error; /* set by benchmark thread on termination */
+  GError *bm_history_error; /* set if the run couldn't be added to the history */
   gboolean bm_update_timeout_pending;
 
   gint64 bm_time_benchmarked_usec; /* 0 if never benchmarked, otherwise micro-seconds since Epoch */
   guint64 bm_size;
   guint64 bm_sample_size;
+  guint64 bm_file_written; /* bytes of the temporary file written so far */
   GArray *bm_read_samples;
   GArray *bm_write_samples;
   GArray *bm_access_time_samples;
+  guint bm_iops_queue_depth; /* queue depth currently being measured */
+  GArray *bm_iops_read_samples; /* offset is the queue depth, value is IOPS */
+  GArray *bm_iops_write_samples;
+  /* latency of every random access time and IOPS request */
+  GduHistogram *bm_read_latency;
+  GduHistogram *bm_write_latency;
+  guint bm_num_streams; /* number of streams currently being measured */
+  GArray *bm_stream_read_samples; /* offset is the number of streams, value is bytes/sec */
+  GArray *bm_stream_write_samples;
+  guint64 bm_block_size; /* request size currently being measured */
+  GArray *bm_block_size_read_samples; /* offset is the request size, value is bytes/sec */
+  GArray *bm_block_size_latency_samples; /* offset is the request size, value is seconds per request */
+  guint64 bm_sustained_size; /* bytes to write in the sustained write test */
+  GArray *bm_sustained_samples; /* offset is the number of bytes written so far, value is bytes/sec */
+  guint64 bm_sustained_cliff; /* bytes written before the write cache ran out, 0 if it didn't */
+  GArray *bm_concurrent_results; /* of BMConcurrentResult, the disk being benchmarked first */
+  gdouble bm_concurrent_aggregate_rate; /* bytes/sec of all disks combined */
+  BMMetadataOp bm_metadata_op; /* operation currently being measured */
+  gdouble bm_metadata_rates[BM_METADATA_NUM_OPS]; /* operations/sec, 0 if not measured */
+  GduHistogram *bm_metadata_latency[BM_METADATA_NUM_OPS];
+  guint bm_sync_write_size; /* size of the synchronous writes currently being measured */
+  GduHistogram *bm_sync_latency[G_N_ELEMENTS (sync_write_sizes)]; /* of each write + fdatasync() */
+  gint bm_sync_write_cache; /* whether the write cache was enabled, -1 if not known */
+  gint bm_replay_num_done; /* requests of the trace replayed so far, only use atomically */
+  guint64 bm_replay_num_requests; /* 0 if no trace was replayed */
+  guint64 bm_replay_duration_usec;
+  guint64 bm_replay_trace_duration_usec; /* how long the trace took when it was captured */
+  GduHistogram *bm_replay_read_latency;
+  GduHistogram *bm_replay_write_latency;
+  guint bm_standby_run; /* run currently being measured */
+  GArray *bm_wake_samples; /* offset is the run, value is seconds until the first read completed */
+  GArray *bm_history; /* of BMHistoryEntry, oldest first */
+  gchar *bm_firmware; /* firmware revision of the drive being benchmarked */
+
+  /* from the org.gnome.Disks benchmark-regression-threshold setting */
+  gint regression_threshold;
+
+  /* only set when run from the command-line, until the benchmark is done */
+  GApplication *application;
+  GApplicationCommandLine *command_line;
 
 } DialogData;
 
@@ -101,12 +315,30 @@ static const struct {
   const gchar *name;
 } widget_mapping[] = {
   {G_STRUCT_OFFSET (DialogData, graph_drawing_area), "graph-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, iops_drawing_area), "iops-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, streams_drawing_area), "streams-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, block_size_drawing_area), "block-size-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, sustained_drawing_area), "sustained-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, history_drawing_area), "history-drawing-area"},
   {G_STRUCT_OFFSET (DialogData, device_label), "device-label"},
   {G_STRUCT_OFFSET (DialogData, updated_label), "updated-label"},
   {G_STRUCT_OFFSET (DialogData, sample_size_label), "sample-size-label"},
   {G_STRUCT_OFFSET (DialogData, read_rate_label), "read-rate-label"},
   {G_STRUCT_OFFSET (DialogData, write_rate_label), "write-rate-label"},
   {G_STRUCT_OFFSET (DialogData, access_time_label), "access-time-label"},
+  {G_STRUCT_OFFSET (DialogData, iops_label), "iops-label"},
+  {G_STRUCT_OFFSET (DialogData, read_latency_label), "read-latency-label"},
+  {G_STRUCT_OFFSET (DialogData, write_latency_label), "write-latency-label"},
+  {G_STRUCT_OFFSET (DialogData, streams_label), "streams-label"},
+  {G_STRUCT_OFFSET (DialogData, block_size_label), "block-size-label"},
+  {G_STRUCT_OFFSET (DialogData, sustained_label), "sustained-label"},
+  {G_STRUCT_OFFSET (DialogData, history_label), "history-label"},
+  {G_STRUCT_OFFSET (DialogData, concurrent_label), "concurrent-label"},
+  {G_STRUCT_OFFSET (DialogData, metadata_label), "metadata-label"},
+  {G_STRUCT_OFFSET (DialogData, sync_latency_label), "sync-latency-label"},
+  {G_STRUCT_OFFSET (DialogData, replay_label), "replay-label"},
+  {G_STRUCT_OFFSET (DialogData, wake_label), "wake-label"},
+  {G_STRUCT_OFFSET (DialogData, infobar_vbox), "infobar-vbox"},
   {0, NULL}
 };
 
@@ -115,6 +347,18 @@ static void update_dialog (DialogData *data);
 static gboolean maybe_load_data (DialogData  *data,
                                  GError     **error);
 
+static void clear_history (GArray *history);
+
+static void clear_concurrent_results (GArray *results);
+
+static void clear_metadata_results (DialogData *data);
+
+static void clear_sync_latency_results (DialogData *data);
+
+static void clear_replay_results (DialogData *data);
+
+static gboolean bmt_on_command_line_done (gpointer user_data);
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 static DialogData *
@@ -127,6 +371,8 @@ dialog_data_ref (DialogData *data)
 static void
 dialog_data_unref (DialogData *data)
 {
+  guint n;
+
   if (g_atomic_int_dec_and_test (&data->ref_count))
     {
       if (data->dialog != NULL)
@@ -136,6 +382,7 @@ dialog_data_unref (DialogData *data)
           data->dialog = NULL;
         }
 
+      g_clear_object (&data->client);
       g_clear_object (&data->object);
       g_clear_object (&data->window);
       g_clear_object (&data->builder);
@@ -143,13 +390,113 @@ dialog_data_unref (DialogData *data)
       g_array_unref (data->bm_read_samples);
       g_array_unref (data->bm_write_samples);
       g_array_unref (data->bm_access_time_samples);
+      g_array_unref (data->bm_iops_read_samples);
+      g_array_unref (data->bm_iops_write_samples);
+      gdu_histogram_free (data->bm_read_latency);
+      gdu_histogram_free (data->bm_write_latency);
+      g_array_unref (data->bm_stream_read_samples);
+      g_array_unref (data->bm_stream_write_samples);
+      g_array_unref (data->bm_block_size_read_samples);
+      g_array_unref (data->bm_block_size_latency_samples);
+      g_array_unref (data->bm_sustained_samples);
+      g_list_free_full (data->bm_concurrent_blocks, g_object_unref);
+      g_free (data->bm_file_dir);
+      g_free (data->bm_metadata_dir);
+      for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+        gdu_histogram_free (data->bm_metadata_latency[n]);
+      for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+        gdu_histogram_free (data->bm_sync_latency[n]);
+      g_free (data->bm_replay_filename);
+      if (data->bm_replay_trace != NULL)
+        gdu_io_trace_free (data->bm_replay_trace);
+      gdu_histogram_free (data->bm_replay_read_latency);
+      gdu_histogram_free (data->bm_replay_write_latency);
+      g_clear_object (&data->bm_standby_ata);
+      g_array_unref (data->bm_wake_samples);
+      clear_concurrent_results (data->bm_concurrent_results);
+      g_array_unref (data->bm_concurrent_results);
+      clear_history (data->bm_history);
+      g_array_unref (data->bm_history);
+      g_free (data->bm_firmware);
+      g_clear_object (&data->regression_infobar);
+      if (data->graph_surface != NULL)
+        cairo_surface_destroy (data->graph_surface);
       g_clear_object (&data->bm_cancellable);
       g_clear_error (&data->bm_error);
+      g_clear_error (&data->bm_history_error);
+      g_clear_object (&data->command_line);
+      g_clear_object (&data->application);
 
       g_free (data);
     }
 }
 
+static DialogData *
+dialog_data_new (UDisksClient *client,
+                 UDisksObject *object)
+{
+  DialogData *data;
+  guint n;
+
+  data = g_new0 (DialogData, 1);
+  data->ref_count = 1;
+  data->client = g_object_ref (client);
+  data->object = g_object_ref (object);
+  data->block = udisks_object_peek_block (data->object);
+  data->bm_cancellable = g_cancellable_new ();
+
+  data->bm_read_samples = g_array_new (FALSE, /* zero-terminated */
+                                       FALSE, /* clear */
+                                       sizeof (BMSample));
+  data->bm_write_samples = g_array_new (FALSE, /* zero-terminated */
+                                        FALSE, /* clear */
+                                        sizeof (BMSample));
+  data->bm_access_time_samples = g_array_new (FALSE, /* zero-terminated */
+                                              FALSE, /* clear */
+                                              sizeof (BMSample));
+  data->bm_iops_read_samples = g_array_new (FALSE, /* zero-terminated */
+                                            FALSE, /* clear */
+                                            sizeof (BMSample));
+  data->bm_iops_write_samples = g_array_new (FALSE, /* zero-terminated */
+                                             FALSE, /* clear */
+                                             sizeof (BMSample));
+  data->bm_read_latency = gdu_histogram_new ();
+  data->bm_stream_read_samples = g_array_new (FALSE, /* zero-terminated */
+                                              FALSE, /* clear */
+                                              sizeof (BMSample));
+  data->bm_stream_write_samples = g_array_new (FALSE, /* zero-terminated */
+                                               FALSE, /* clear */
+                                               sizeof (BMSample));
+  data->bm_block_size_read_samples = g_array_new (FALSE, /* zero-terminated */
+                                                  FALSE, /* clear */
+                                                  sizeof (BMSample));
+  data->bm_block_size_latency_samples = g_array_new (FALSE, /* zero-terminated */
+                                                     FALSE, /* clear */
+                                                     sizeof (BMSample));
+  data->bm_sustained_samples = g_array_new (FALSE, /* zero-terminated */
+                                            FALSE, /* clear */
+                                            sizeof (BMSample));
+  data->bm_concurrent_results = g_array_new (FALSE, /* zero-terminated */
+                                             FALSE, /* clear */
+                                             sizeof (BMConcurrentResult));
+  data->bm_wake_samples = g_array_new (FALSE, /* zero-terminated */
+                                       FALSE, /* clear */
+                                       sizeof (BMSample));
+  data->bm_history = g_array_new (FALSE, /* zero-terminated */
+                                  FALSE, /* clear */
+                                  sizeof (BMHistoryEntry));
+  data->bm_write_latency = gdu_histogram_new ();
+  for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+    data->bm_metadata_latency[n] = gdu_histogram_new ();
+  for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+    data->bm_sync_latency[n] = gdu_histogram_new ();
+  data->bm_sync_write_cache = -1;
+  data->bm_replay_read_latency = gdu_histogram_new ();
+  data->bm_replay_write_latency = gdu_histogram_new ();
+
+  return data;
+}
+
 static void
 dialog_data_close (DialogData *data)
 {
@@ -200,6 +547,39 @@ get_max_min_avg (GArray  *array,
     *out_avg = avg;
 }
 
+/* Like the average of get_max_min_avg() but weighs each sample by the
+ * distance to the next one (or to @size for the last one). Used for
+ * transfer rate samples since they aren't evenly spaced once the
+ * transfer rate has been refined.
+ */
+static gdouble
+get_transfer_rate_avg (GArray  *array,
+                       guint64  size)
+{
+  gdouble sum = 0.0;
+  guint64 covered;
+  guint n;
+
+  if (array->len == 0)
+    return 0.0;
+
+  covered = size - g_array_index (array, BMSample, 0).offset;
+  if (covered == 0)
+    return 0.0;
+
+  for (n = 0; n < array->len; n++)
+    {
+      BMSample *s = &g_array_index (array, BMSample, n);
+      guint64 next_offset;
+
+      next_offset = n + 1 < array->len ? g_array_index (array, BMSample, n + 1).offset : size;
+      if (next_offset < s->offset)
+        next_offset = s->offset;
+      sum += s->value * (next_offset - s->offset);
+    }
+  return sum / covered;
+}
+
 static gdouble
 measure_width (cairo_t     *cr,
                const gchar *s)
@@ -218,110 +598,69 @@ measure_height (cairo_t     *cr,
   return te.height;
 }
 
-static gboolean
-on_drawing_area_draw (GtkWidget      *widget,
-                      cairo_t        *cr,
-                      gpointer        user_data)
+/* Creates a layout for drawing graph markers in a small version of @widget's font */
+static PangoLayout *
+create_graph_layout (GtkWidget *widget,
+                     cairo_t   *cr,
+                     GdkRGBA   *out_fg)
 {
-  DialogData *data = user_data;
-  GtkAllocation allocation;
-  gdouble width, height;
+  GtkStyleContext *context;
+  PangoFontDescription *font_desc;
+  PangoLayout *layout;
+  gint size;
+
+  context = gtk_widget_get_style_context (widget);
+  gtk_style_context_get_color (context, GTK_STATE_FLAG_NORMAL, out_fg);
+  gtk_style_context_get (context,
+                         GTK_STATE_FLAG_NORMAL,
+                         GTK_STYLE_PROPERTY_FONT,
+                         &font_desc,
+                         NULL);
+  size = pango_font_description_get_size (font_desc);
+  if (pango_font_description_get_size_is_absolute (font_desc))
+    size *= PANGO_SCALE;
+  pango_font_description_set_size (font_desc, PANGO_SCALE_X_SMALL * size);
+  layout = pango_cairo_create_layout (cr);
+  pango_layout_set_font_description (layout, font_desc);
+  pango_font_description_free (font_desc);
+
+  return layout;
+}
+
+#define GRAPH_NUM_Y_MARKERS 10
+
+/* Draws the parts of the transfer rate graph that only depend on the size
+ * of the widget and the scale of the axes - the markers, the background
+ * and the grid - and returns the area the samples are to be drawn in.
+ */
+static void
+draw_graph_background (GtkWidget *widget,
+                       cairo_t   *cr,
+                       gdouble    width,
+                       gdouble    height,
+                       gdouble    max_visible_speed,
+                       gdouble    max_visible_time,
+                       gdouble   *out_gx,
+                       gdouble   *out_gy,
+                       gdouble   *out_gw,
+                       gdouble   *out_gh)
+{
+  const guint num_y_markers = GRAPH_NUM_Y_MARKERS;
+  gdouble speed_res = max_visible_speed / num_y_markers;
+  gdouble time_res = max_visible_time / num_y_markers;
   gdouble gx, gy, gw, gh;
   guint n;
   gdouble w, h;
   gdouble x, y;
   gdouble x_marker_height;
   gchar *s;
-  gdouble max_speed;
-  gdouble max_visible_speed;
-  gdouble speed_res;
-  gdouble max_time;
-  gdouble time_res;
-  gdouble max_visible_time;
   gchar **y_left_markers;
   gchar **y_right_markers;
-  guint num_y_markers;
   GPtrArray *p;
   GPtrArray *p2;
-  gdouble read_transfer_rate_max = 0.0;
-  gdouble write_transfer_rate_max = 0.0;
-  gdouble access_time_max = 0.0;
-  gdouble prev_x;
-  gdouble prev_y;
-  GtkStyleContext *context;
-  PangoFontDescription *font_desc;
-  gint size;
   GdkRGBA fg;
   PangoLayout *layout;
 
-  G_LOCK (bm_lock);
-
-  //g_print ("drawing: %d %d %d\n",
-  //         data->bm_read_samples->len,
-  //         data->bm_write_samples->len,
-  //         data->bm_access_time_samples->len);
-
-  get_max_min_avg (data->bm_read_samples,
-                   &read_transfer_rate_max,
-                   NULL,
-                   NULL);
-  get_max_min_avg (data->bm_write_samples,
-                   &write_transfer_rate_max,
-                   NULL,
-                   NULL);
-  get_max_min_avg (data->bm_access_time_samples,
-                   &access_time_max,
-                   NULL,
-                   NULL);
-
-  max_speed = MAX (read_transfer_rate_max, write_transfer_rate_max);
-  max_time = access_time_max;
-
-  if (max_speed == 0)
-    max_speed = 100 * 1000 * 1000;
-
-  if (max_time == 0)
-    max_time = 50 / 1000.0;
-
-  //speed_res = (floor (((gdouble) max_speed) / (100 * 1000 * 1000)) + 1) * 1000 * 1000;
-  //speed_res *= 10.0;
-
-  speed_res = max_speed / 10.0;
-  /* round up to nearest multiple of 10 MB/s */
-  max_visible_speed = ceil (max_speed / (10*1000*1000)) * 10*1000*1000;
-  speed_res = max_visible_speed / 10.0;
-  num_y_markers = 10;
-
-  time_res = max_time / num_y_markers;
-  if (time_res < 0.0001)
-    {
-      time_res = 0.0001;
-    }
-  else if (time_res < 0.0005)
-    {
-      time_res = 0.0005;
-    }
-  else if (time_res < 0.001)
-    {
-      time_res = 0.001;
-    }
-  else if (time_res < 0.0025)
-    {
-      time_res = 0.0025;
-    }
-  else if (time_res < 0.005)
-    {
-      time_res = 0.005;
-    }
-  else
-    {
-      time_res = ceil (((gdouble) time_res) / 0.005) * 0.005;
-    }
-  max_visible_time = time_res * num_y_markers;
-
-  //g_print ("max_visible_speed=%f, max_speed=%f, speed_res=%f\n", max_visible_speed, max_speed, speed_res);
-  //g_print ("max_visible_time=%f, max_time=%f, time_res=%f\n", max_visible_time, max_time, time_res);
-
   p = g_ptr_array_new ();
   p2 = g_ptr_array_new ();
   for (n = 0; n <= num_y_markers; n++)
@@ -343,19 +682,8 @@ on_drawing_area_draw (GtkWidget      *widget,
   y_left_markers = (gchar **) g_ptr_array_free (p, FALSE);
   y_right_markers = (gchar **) g_ptr_array_free (p2, FALSE);
 
-  gtk_widget_get_allocation (widget, &allocation);
-  width = allocation.width;
-  height = allocation.height;
-
   cairo_set_line_width (cr, 1.0);
 
-#if 0
-  cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
-  cairo_rectangle (cr, 0, 0, width, height);
-  cairo_set_line_width (cr, 0.0);
-  cairo_fill (cr);
-#endif
-
   gx = 0;
   gy = 0;
   gw = width;
@@ -411,20 +739,7 @@ on_drawing_area_draw (GtkWidget      *widget,
       gh -= needed;
     }
 
-  context = gtk_widget_get_style_context (widget);
-  gtk_style_context_get_color (context, GTK_STATE_FLAG_NORMAL, &fg);
-  gtk_style_context_get (context,
-                         GTK_STATE_FLAG_NORMAL,
-                         GTK_STYLE_PROPERTY_FONT,
-                         &font_desc,
-                         NULL);
-  size = pango_font_description_get_size (font_desc);
-  if (pango_font_description_get_size_is_absolute (font_desc))
-    size *= PANGO_SCALE;
-  pango_font_description_set_size (font_desc, PANGO_SCALE_X_SMALL * size);
-  layout = pango_cairo_create_layout (cr);
-  pango_layout_set_font_description (layout, font_desc);
-  pango_font_description_free (font_desc);
+  layout = create_graph_layout (widget, cr, &fg);
 
   /* draw x markers ("%d%%") + vertical grid */
   for (n = 0; n <= 10; n++)
@@ -492,7 +807,7 @@ on_drawing_area_draw (GtkWidget      *widget,
   /* grid - first a rect */
   cairo_set_source_rgba (cr, 0, 0, 0, 0.25);
   cairo_set_line_width (cr, 1.0);
-  /* rect - also clip to rect for all future drawing operations */
+  /* rect - also clip to rect for the grid */
   cairo_stroke_preserve (cr);
   cairo_clip (cr);
   /* vertical lines */
@@ -512,655 +827,4355 @@ on_drawing_area_draw (GtkWidget      *widget,
       cairo_stroke (cr);
     }
 
-  /* draw read graph */
-  cairo_set_source_rgb (cr, 0.5, 0.5, 1.0);
-  cairo_set_line_width (cr, 1.5);
-  for (n = 0; n < data->bm_read_samples->len; n++)
-    {
-      BMSample *sample = &g_array_index (data->bm_read_samples, BMSample, n);
+  g_strfreev (y_left_markers);
+  g_strfreev (y_right_markers);
 
-      x = gx + gw * sample->offset / data->bm_size;
-      y = gy + gh - gh * sample->value / max_visible_speed;
+  *out_gx = gx;
+  *out_gy = gy;
+  *out_gw = gw;
+  *out_gh = gh;
+}
 
-      if (n == 0)
-        cairo_move_to (cr, x, y);
-      else
-        cairo_line_to (cr, x, y);
-    }
-  cairo_stroke (cr);
+/* Used for building a path through points with increasing x. For all
+ * points falling into the same pixel column only the first, lowest,
+ * highest and last ones are added, so drawing costs the same no matter
+ * how many samples there are.
+ */
+typedef struct
+{
+  cairo_t *cr;
+  gboolean started;
+  gboolean have_column;
+  gdouble column;
+  gdouble x;
+  gdouble first_y;
+  gdouble last_y;
+  gdouble min_y;
+  gdouble max_y;
+} BMDecimator;
 
-  /* draw write graph */
-  cairo_set_source_rgb (cr, 1.0, 0.5, 0.5);
-  cairo_set_line_width (cr, 1.5);
-  for (n = 0; n < data->bm_write_samples->len; n++)
-    {
-      BMSample *sample = &g_array_index (data->bm_write_samples, BMSample, n);
-      x = gx + gw * sample->offset / data->bm_size;
-      y = gy + gh - gh * sample->value / max_visible_speed;
+static void
+decimator_flush (BMDecimator *d)
+{
+  if (!d->have_column)
+    return;
 
-      if (n == 0)
-        cairo_move_to (cr, x, y);
-      else
-        cairo_line_to (cr, x, y);
+  if (!d->started)
+    cairo_move_to (d->cr, d->x, d->first_y);
+  else
+    cairo_line_to (d->cr, d->x, d->first_y);
+  if (d->min_y < d->max_y)
+    {
+      cairo_line_to (d->cr, d->x, d->min_y);
+      cairo_line_to (d->cr, d->x, d->max_y);
     }
-  cairo_stroke (cr);
+  cairo_line_to (d->cr, d->x, d->last_y);
+  d->started = TRUE;
+  d->have_column = FALSE;
+}
 
-  /* draw access time dots + lines */
-  cairo_set_line_width (cr, 0.5);
-  for (n = 0; n < data->bm_access_time_samples->len; n++)
+static void
+decimator_add (BMDecimator *d,
+               gdouble      x,
+               gdouble      y)
+{
+  if (d->have_column && floor (x) == d->column)
     {
-      BMSample *sample = &g_array_index (data->bm_access_time_samples, BMSample, n);
-
-      x = gx + gw * sample->offset / data->bm_size;
-      y = gy + gh - gh * sample->value / max_visible_time;
-
-      /*g_debug ("time = %f @ %f", point->value, x);*/
-
-      cairo_set_source_rgba (cr, 0.4, 1.0, 0.4, 0.5);
-      cairo_arc (cr, x, y, 1.5, 0, 2 * M_PI);
-      cairo_fill (cr);
-
-      if (n > 0)
-        {
-          cairo_set_source_rgba (cr, 0.2, 0.5, 0.2, 0.10);
-          cairo_move_to (cr, prev_x, prev_y);
-          cairo_line_to (cr, x, y);
-          cairo_stroke (cr);
-        }
-
-      prev_x = x;
-      prev_y = y;
+      d->last_y = y;
+      d->min_y = MIN (d->min_y, y);
+      d->max_y = MAX (d->max_y, y);
+      return;
     }
 
-#if 0
-  if (dialog->priv->benchmark_data != NULL) {
-                BenchmarkData *data = dialog->priv->benchmark_data;
-                gdouble prev_x;
-                gdouble prev_y;
-
-                /* draw access time dots + lines */
-                cairo_set_line_width (cr, 0.5);
-                for (n = 0; n < data->access_time_samples->len; n++) {
-                        BenchmarkPoint *point = &g_array_index (data->access_time_samples, BenchmarkPoint, n);
-
-                        x = gx + gw * point->offset / data->disk_size;
-                        y = gy + gh - gh * point->value / max_visible_time;
-
-                        /*g_debug ("time = %f @ %f", point->value, x);*/
-
-                        cairo_set_source_rgba (cr, 0.4, 1.0, 0.4, 0.5);
-                        cairo_arc (cr, x, y, 1.5, 0, 2 * M_PI);
-                        cairo_fill (cr);
-
-                        if (n > 0) {
-                                cairo_set_source_rgba (cr, 0.2, 0.5, 0.2, 0.10);
-                                cairo_move_to (cr, prev_x, prev_y);
-                                cairo_line_to (cr, x, y);
-                                cairo_stroke (cr);
-                        }
-
-                        prev_x = x;
-                        prev_y = y;
-                }
+  decimator_flush (d);
+  d->have_column = TRUE;
+  d->column = floor (x);
+  d->x = x;
+  d->first_y = d->last_y = d->min_y = d->max_y = y;
+}
 
-                /* draw write transfer rate graph */
-                cairo_set_source_rgb (cr, 1.0, 0.5, 0.5);
-                cairo_set_line_width (cr, 2.0);
-                for (n = 0; n < data->write_transfer_rate_samples->len; n++) {
-                        BenchmarkPoint *point = &g_array_index (data->write_transfer_rate_samples, BenchmarkPoint, n);
+/* Returns a copy of @samples that can be used without holding bm_lock */
+static GArray *
+copy_samples (GArray *samples)
+{
+  GArray *ret;
 
-                        x = gx + gw * point->offset / data->disk_size;
-                        y = gy + gh - gh * point->value / max_visible_speed;
+  ret = g_array_sized_new (FALSE, FALSE, sizeof (BMSample), samples->len);
+  g_array_append_vals (ret, samples->data, samples->len);
+  return ret;
+}
 
-                        if (n == 0)
-                                cairo_move_to (cr, x, y);
-                        else
-                                cairo_line_to (cr, x, y);
-                }
-                cairo_stroke (cr);
+static void
+draw_transfer_rate_line (cairo_t *cr,
+                         GArray  *samples,
+                         guint64  size,
+                         gdouble  max_visible_speed,
+                         gdouble  gx,
+                         gdouble  gy,
+                         gdouble  gw,
+                         gdouble  gh)
+{
+  BMDecimator d = {0};
+  guint n;
 
-                /* draw read transfer rate graph */
-                cairo_set_source_rgb (cr, 0.5, 0.5, 1.0);
-                cairo_set_line_width (cr, 1.5);
-                for (n = 0; n < data->read_transfer_rate_samples->len; n++) {
-                        BenchmarkPoint *point = &g_array_index (data->read_transfer_rate_samples, BenchmarkPoint, n);
+  d.cr = cr;
+  for (n = 0; n < samples->len; n++)
+    {
+      BMSample *sample = &g_array_index (samples, BMSample, n);
+      decimator_add (&d,
+                     gx + gw * sample->offset / size,
+                     gy + gh - gh * sample->value / max_visible_speed);
+    }
+  decimator_flush (&d);
+  cairo_stroke (cr);
+}
 
-                        x = gx + gw * point->offset / data->disk_size;
-                        y = gy + gh - gh * point->value / max_visible_speed;
+static void
+on_drawing_area_style_updated (GtkWidget *widget,
+                               gpointer   user_data)
+{
+  DialogData *data = user_data;
 
-                        if (n == 0)
-                                cairo_move_to (cr, x, y);
-                        else
-                                cairo_line_to (cr, x, y);
-                }
-                cairo_stroke (cr);
+  /* the markers use the color and font of the widget so redraw them */
+  if (data->graph_surface != NULL)
+    {
+      cairo_surface_destroy (data->graph_surface);
+      data->graph_surface = NULL;
+    }
+}
 
-        } else {
-                /* TODO: draw some text saying we don't have any data */
+static gboolean
+on_drawing_area_draw (GtkWidget      *widget,
+                      cairo_t        *cr,
+                      gpointer        user_data)
+{
+  DialogData *data = user_data;
+  GtkAllocation allocation;
+  gdouble gx, gy, gw, gh;
+  guint n;
+  gdouble x, y;
+  gdouble max_speed;
+  gdouble max_visible_speed;
+  gdouble max_time;
+  gdouble time_res;
+  gdouble max_visible_time;
+  gdouble read_transfer_rate_max = 0.0;
+  gdouble write_transfer_rate_max = 0.0;
+  gdouble access_time_max = 0.0;
+  GArray *read_samples;
+  GArray *write_samples;
+  GArray *access_time_samples;
+  guint64 size;
+  gsize dots_stride;
+  guint8 *dots;
+
+  /* only hold the lock for as long as it takes to copy the samples so
+   * the benchmark thread is never held up by drawing
+   */
+  G_LOCK (bm_lock);
+  read_samples = copy_samples (data->bm_read_samples);
+  write_samples = copy_samples (data->bm_write_samples);
+  access_time_samples = copy_samples (data->bm_access_time_samples);
+  size = data->bm_size;
+  G_UNLOCK (bm_lock);
+
+  get_max_min_avg (read_samples,
+                   &read_transfer_rate_max,
+                   NULL,
+                   NULL);
+  get_max_min_avg (write_samples,
+                   &write_transfer_rate_max,
+                   NULL,
+                   NULL);
+  get_max_min_avg (access_time_samples,
+                   &access_time_max,
+                   NULL,
+                   NULL);
+
+  max_speed = MAX (read_transfer_rate_max, write_transfer_rate_max);
+  max_time = access_time_max;
+
+  if (max_speed == 0)
+    max_speed = 100 * 1000 * 1000;
+
+  if (max_time == 0)
+    max_time = 50 / 1000.0;
+
+  /* round up to nearest multiple of 10 MB/s */
+  max_visible_speed = ceil (max_speed / (10*1000*1000)) * 10*1000*1000;
+
+  time_res = max_time / GRAPH_NUM_Y_MARKERS;
+  if (time_res < 0.0001)
+    {
+      time_res = 0.0001;
+    }
+  else if (time_res < 0.0005)
+    {
+      time_res = 0.0005;
+    }
+  else if (time_res < 0.001)
+    {
+      time_res = 0.001;
+    }
+  else if (time_res < 0.0025)
+    {
+      time_res = 0.0025;
+    }
+  else if (time_res < 0.005)
+    {
+      time_res = 0.005;
+    }
+  else
+    {
+      time_res = ceil (((gdouble) time_res) / 0.005) * 0.005;
+    }
+  max_visible_time = time_res * GRAPH_NUM_Y_MARKERS;
+
+  gtk_widget_get_allocation (widget, &allocation);
+
+  /* the markers and the grid only change with the size and the scale */
+  if (data->graph_surface == NULL ||
+      data->graph_surface_width != allocation.width ||
+      data->graph_surface_height != allocation.height ||
+      data->graph_surface_max_speed != max_visible_speed ||
+      data->graph_surface_max_time != max_visible_time)
+    {
+      cairo_t *surface_cr;
+
+      if (data->graph_surface != NULL)
+        cairo_surface_destroy (data->graph_surface);
+      data->graph_surface = gdk_window_create_similar_surface (gtk_widget_get_window (widget),
+                                                               CAIRO_CONTENT_COLOR_ALPHA,
+                                                               allocation.width,
+                                                               allocation.height);
+      surface_cr = cairo_create (data->graph_surface);
+      draw_graph_background (widget, surface_cr, allocation.width, allocation.height,
+                             max_visible_speed, max_visible_time,
+                             &data->graph_gx, &data->graph_gy, &data->graph_gw, &data->graph_gh);
+      cairo_destroy (surface_cr);
+      data->graph_surface_width = allocation.width;
+      data->graph_surface_height = allocation.height;
+      data->graph_surface_max_speed = max_visible_speed;
+      data->graph_surface_max_time = max_visible_time;
+    }
+  gx = data->graph_gx;
+  gy = data->graph_gy;
+  /* the graph area is empty (or negative) if the widget is tiny */
+  gw = MAX (data->graph_gw, 0);
+  gh = MAX (data->graph_gh, 0);
+
+  cairo_set_source_surface (cr, data->graph_surface, 0, 0);
+  cairo_paint (cr);
+
+  /* nothing has been benchmarked yet - the samples are positioned relative to the size */
+  if (size == 0)
+    goto out;
+
+  /* clip to the graph area for drawing the samples */
+  cairo_rectangle (cr, gx + 0.5, gy + 0.5, gw, gh);
+  cairo_clip (cr);
+
+  /* draw read graph */
+  cairo_set_source_rgb (cr, 0.5, 0.5, 1.0);
+  cairo_set_line_width (cr, 1.5);
+  draw_transfer_rate_line (cr, read_samples, size, max_visible_speed, gx, gy, gw, gh);
+
+  /* draw write graph */
+  cairo_set_source_rgb (cr, 1.0, 0.5, 0.5);
+  cairo_set_line_width (cr, 1.5);
+  draw_transfer_rate_line (cr, write_samples, size, max_visible_speed, gx, gy, gw, gh);
+
+  /* draw access time lines - as a single path */
+  cairo_set_source_rgba (cr, 0.2, 0.5, 0.2, 0.10);
+  cairo_set_line_width (cr, 0.5);
+  for (n = 0; n < access_time_samples->len; n++)
+    {
+      BMSample *sample = &g_array_index (access_time_samples, BMSample, n);
+
+      x = gx + gw * sample->offset / size;
+      y = gy + gh - gh * sample->value / max_visible_time;
+      if (n == 0)
+        cairo_move_to (cr, x, y);
+      else
+        cairo_line_to (cr, x, y);
+    }
+  cairo_stroke (cr);
+
+  /* draw access time dots - the samples are at random offsets so they
+   * can't be decimated like the transfer rate but there's no point in
+   * drawing more than one dot per pixel
+   */
+  dots_stride = (gsize) gw + 1;
+  dots = g_new0 (guint8, dots_stride * ((gsize) gh + 1));
+  cairo_set_source_rgba (cr, 0.4, 1.0, 0.4, 0.5);
+  for (n = 0; n < access_time_samples->len; n++)
+    {
+      BMSample *sample = &g_array_index (access_time_samples, BMSample, n);
+      gsize dot_x, dot_y;
+
+      x = gx + gw * sample->offset / size;
+      y = gy + gh - gh * sample->value / max_visible_time;
+
+      dot_x = (gsize) CLAMP (x - gx, 0, gw);
+      dot_y = (gsize) CLAMP (y - gy, 0, gh);
+      if (dots[dot_y * dots_stride + dot_x])
+        continue;
+      dots[dot_y * dots_stride + dot_x] = 1;
+
+      cairo_new_sub_path (cr);
+      cairo_arc (cr, x, y, 1.5, 0, 2 * M_PI);
+    }
+  cairo_fill (cr);
+  g_free (dots);
+
+ out:
+  g_array_unref (read_samples);
+  g_array_unref (write_samples);
+  g_array_unref (access_time_samples);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* A line graph for measurements that are not done over the surface of
+ * the device, e.g. IOPS at various queue depths. The x axis is either
+ * linear or logarithmic with a marker for every x value in the first
+ * non-empty series (which must be sorted by x). Series can optionally
+ * be drawn against a second y axis on the right.
+ */
+typedef struct
+{
+  GArray *samples; /* of BMSample, the offset member is the x value */
+  gdouble red;
+  gdouble green;
+  gdouble blue;
+  gboolean right_axis;
+} BMSeries;
+
+/* rounds @value up to the nearest number that divides nicely into @num_markers steps */
+static gdouble
+round_up_for_axis (gdouble value,
+                   guint   num_markers)
+{
+  gdouble step;
+  gdouble magnitude;
+
+  if (value <= 0.0)
+    return num_markers;
+
+  step = value / num_markers;
+  magnitude = pow (10.0, floor (log10 (step)));
+  if (step <= magnitude)
+    step = magnitude;
+  else if (step <= 2 * magnitude)
+    step = 2 * magnitude;
+  else if (step <= 5 * magnitude)
+    step = 5 * magnitude;
+  else
+    step = 10 * magnitude;
+  return step * num_markers;
+}
+
+static void
+draw_layout_centered (cairo_t     *cr,
+                      PangoLayout *layout,
+                      const gchar *text,
+                      gdouble      x,
+                      gdouble      y)
+{
+  PangoRectangle extents;
+
+  pango_layout_set_text (layout, text, -1);
+  pango_layout_get_extents (layout, NULL, &extents);
+  cairo_move_to (cr,
+                 x - extents.width/PANGO_SCALE/2,
+                 y - extents.height/PANGO_SCALE/2);
+  pango_cairo_show_layout (cr, layout);
+}
+
+static void
+draw_xy_graph (GtkWidget       *widget,
+               cairo_t         *cr,
+               const BMSeries  *series,
+               guint            num_series,
+               gboolean         linear_x,
+               guint64          mark_x,
+               gchar         *(*format_x) (guint64 x),
+               gchar         *(*format_y) (gdouble y),
+               gchar         *(*format_y2) (gdouble y))
+{
+  const guint num_y_markers = 5;
+  const guint num_linear_x_markers = 10;
+  GtkAllocation allocation;
+  PangoLayout *layout;
+  PangoRectangle extents;
+  GdkRGBA fg;
+  GArray *x_markers;
+  gdouble max_y = 0.0;
+  gdouble max_y2 = 0.0;
+  guint64 max_x = 0;
+  gdouble max_visible_y;
+  gdouble max_visible_y2;
+  gdouble right_margin;
+  gdouble x_min = 0.0;
+  gdouble x_max = 0.0;
+  gdouble gx, gy, gw, gh;
+  gdouble x, y;
+  gdouble label_height;
+  gchar *s;
+  guint n, m;
+
+  gtk_widget_get_allocation (widget, &allocation);
+  layout = create_graph_layout (widget, cr, &fg);
+
+  x_markers = g_array_new (FALSE, FALSE, sizeof (guint64));
+  for (n = 0; n < num_series; n++)
+    {
+      gdouble max;
+      get_max_min_avg (series[n].samples, &max, NULL, NULL);
+      if (series[n].right_axis)
+        max_y2 = MAX (max_y2, max);
+      else
+        max_y = MAX (max_y, max);
+      for (m = 0; m < series[n].samples->len; m++)
+        max_x = MAX (max_x, g_array_index (series[n].samples, BMSample, m).offset);
+      /* on a logarithmic axis there is a marker for every x value in the first series */
+      if (!linear_x && x_markers->len == 0)
+        {
+          for (m = 0; m < series[n].samples->len; m++)
+            g_array_append_val (x_markers, g_array_index (series[n].samples, BMSample, m).offset);
+        }
+    }
+  max_visible_y = round_up_for_axis (max_y, num_y_markers);
+  max_visible_y2 = round_up_for_axis (max_y2, num_y_markers);
+  if (linear_x)
+    {
+      /* at least 1 per marker since x values are integers */
+      x_max = max_x > 0 ? MAX (round_up_for_axis (max_x, num_linear_x_markers), num_linear_x_markers) : 0.0;
+      for (n = 0; x_max > 0.0 && n <= num_linear_x_markers; n++)
+        {
+          guint64 value = x_max * n / num_linear_x_markers;
+          g_array_append_val (x_markers, value);
+        }
+    }
+  else if (x_markers->len > 0)
+    {
+      x_min = log (MAX (g_array_index (x_markers, guint64, 0), 1));
+      x_max = log (MAX (g_array_index (x_markers, guint64, x_markers->len - 1), 1));
+    }
+
+  /* make horizontal room for the y markers and vertical room for the x markers */
+  gx = 0;
+  for (n = 0; n <= num_y_markers; n++)
+    {
+      s = format_y (n * max_visible_y / num_y_markers);
+      pango_layout_set_text (layout, s, -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      gx = MAX (gx, ceil (extents.width/PANGO_SCALE) + 2 * 3);
+      g_free (s);
+    }
+  label_height = ceil (extents.height/PANGO_SCALE);
+  right_margin = 3 * label_height;
+  for (n = 0; format_y2 != NULL && n <= num_y_markers; n++)
+    {
+      s = format_y2 (n * max_visible_y2 / num_y_markers);
+      pango_layout_set_text (layout, s, -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      right_margin = MAX (right_margin, ceil (extents.width/PANGO_SCALE) + 2 * 3);
+      g_free (s);
+    }
+  gy = ceil (label_height / 2.0);
+  gw = allocation.width - gx - right_margin;
+  gh = allocation.height - gy - label_height - 10;
+
+#define X_TO_POS(_x) (x_max <= x_min ? gx + gw / 2.0 :                    \
+                      gx + gw * ((linear_x ? (_x) : log (MAX ((_x), 1))) - x_min) / (x_max - x_min))
+
+  /* draw y markers */
+  gdk_cairo_set_source_rgba (cr, &fg);
+  for (n = 0; n <= num_y_markers; n++)
+    {
+      s = format_y (n * max_visible_y / num_y_markers);
+      draw_layout_centered (cr, layout, s, gx / 2.0, gy + gh - gh * n / num_y_markers);
+      g_free (s);
+    }
+  for (n = 0; format_y2 != NULL && n <= num_y_markers; n++)
+    {
+      s = format_y2 (n * max_visible_y2 / num_y_markers);
+      draw_layout_centered (cr, layout, s, gx + gw + right_margin / 2.0, gy + gh - gh * n / num_y_markers);
+      g_free (s);
+    }
+
+  /* draw x markers */
+  for (n = 0; n < x_markers->len; n++)
+    {
+      guint64 x_value = g_array_index (x_markers, guint64, n);
+      s = format_x (x_value);
+      draw_layout_centered (cr, layout, s, X_TO_POS (x_value), gy + gh + (label_height + 10) / 2.0);
+      g_free (s);
+    }
+  g_object_unref (layout);
+
+  /* fill graph area and clip to it */
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_rectangle (cr, gx + 0.5, gy + 0.5, gw, gh);
+  cairo_fill_preserve (cr);
+  cairo_set_source_rgba (cr, 0, 0, 0, 0.25);
+  cairo_set_line_width (cr, 1.0);
+  cairo_stroke_preserve (cr);
+  cairo_clip (cr);
+
+  /* grid */
+  for (n = 1; n < num_y_markers; n++)
+    {
+      y = gy + ceil (n * gh / num_y_markers);
+      cairo_move_to (cr, gx + 0.5, y + 0.5);
+      cairo_line_to (cr, gx + gw + 0.5, y + 0.5);
+      cairo_stroke (cr);
+    }
+  for (n = 0; n < x_markers->len; n++)
+    {
+      x = ceil (X_TO_POS (g_array_index (x_markers, guint64, n)));
+      cairo_move_to (cr, x + 0.5, gy + 0.5);
+      cairo_line_to (cr, x + 0.5, gy + gh + 0.5);
+      cairo_stroke (cr);
+    }
+
+  /* lines with a dot for each sample (unless there are too many to tell apart) */
+  for (n = 0; n < num_series; n++)
+    {
+      gdouble max_visible = series[n].right_axis ? max_visible_y2 : max_visible_y;
+      BMDecimator d = {0};
+
+      d.cr = cr;
+      cairo_set_source_rgb (cr, series[n].red, series[n].green, series[n].blue);
+      cairo_set_line_width (cr, 1.5);
+      for (m = 0; m < series[n].samples->len; m++)
+        {
+          BMSample *sample = &g_array_index (series[n].samples, BMSample, m);
+          decimator_add (&d,
+                         X_TO_POS (sample->offset),
+                         gy + gh - gh * sample->value / max_visible);
+        }
+      decimator_flush (&d);
+      cairo_stroke (cr);
+      for (m = 0; series[n].samples->len < gw / 8 && m < series[n].samples->len; m++)
+        {
+          BMSample *sample = &g_array_index (series[n].samples, BMSample, m);
+          cairo_arc (cr, X_TO_POS (sample->offset), gy + gh - gh * sample->value / max_visible, 2.5, 0, 2 * M_PI);
+          cairo_fill (cr);
+        }
+    }
+
+  /* vertical line marking something noteworthy */
+  if (mark_x > 0)
+    {
+      static const double dashes[] = {4.0, 4.0};
+      x = ceil (X_TO_POS (mark_x));
+      cairo_set_source_rgb (cr, 0.8, 0.0, 0.0);
+      cairo_set_line_width (cr, 1.5);
+      cairo_set_dash (cr, dashes, G_N_ELEMENTS (dashes), 0.0);
+      cairo_move_to (cr, x + 0.5, gy + 0.5);
+      cairo_line_to (cr, x + 0.5, gy + gh + 0.5);
+      cairo_stroke (cr);
+      cairo_set_dash (cr, NULL, 0, 0.0);
+    }
+
+  g_array_unref (x_markers);
+
+#undef X_TO_POS
+}
+
+static gchar *
+format_queue_depth (guint64 queue_depth)
+{
+  /* Translators: This is used in the benchmark graph - %u is the queue depth, e.g. the
+   * number of I/O requests that are outstanding at the same time
+   */
+  return g_strdup_printf (C_("benchmark-graph", "QD %u"), (guint) queue_depth);
+}
+
+static gchar *
+format_iops (gdouble iops)
+{
+  return g_strdup_printf ("%.0f", iops);
+}
+
+static gboolean
+on_iops_drawing_area_draw (GtkWidget      *widget,
+                           cairo_t        *cr,
+                           gpointer        user_data)
+{
+  DialogData *data = user_data;
+  BMSeries series[2] = {{0}};
+
+  G_LOCK (bm_lock);
+  /* same colors as the read and write graphs */
+  series[0].samples = copy_samples (data->bm_iops_read_samples);
+  series[0].red = 0.5;
+  series[0].green = 0.5;
+  series[0].blue = 1.0;
+  series[1].samples = copy_samples (data->bm_iops_write_samples);
+  series[1].red = 1.0;
+  series[1].green = 0.5;
+  series[1].blue = 0.5;
+  G_UNLOCK (bm_lock);
+
+  draw_xy_graph (widget, cr, series, G_N_ELEMENTS (series), FALSE, 0, format_queue_depth, format_iops, NULL);
+  g_array_unref (series[0].samples);
+  g_array_unref (series[1].samples);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+static gchar *
+format_num_streams (guint64 num_streams)
+{
+  /* Translators: This is used in the benchmark graph - %u is the number of parallel streams */
+  return g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                       "%u stream",
+                                       "%u streams",
+                                       num_streams),
+                          (guint) num_streams);
+}
+
+static gchar *
+format_graph_transfer_rate (gdouble bytes_per_sec)
+{
+  /* Translators: This is used in the benchmark graph - %d is megabytes per second */
+  return g_strdup_printf (C_("benchmark-graph", "%d MB/s"), (gint) (bytes_per_sec / (1000 * 1000)));
+}
+
+static gboolean
+on_streams_drawing_area_draw (GtkWidget      *widget,
+                              cairo_t        *cr,
+                              gpointer        user_data)
+{
+  DialogData *data = user_data;
+  BMSeries series[2] = {{0}};
+
+  G_LOCK (bm_lock);
+  series[0].samples = copy_samples (data->bm_stream_read_samples);
+  series[0].red = 0.5;
+  series[0].green = 0.5;
+  series[0].blue = 1.0;
+  series[1].samples = copy_samples (data->bm_stream_write_samples);
+  series[1].red = 1.0;
+  series[1].green = 0.5;
+  series[1].blue = 0.5;
+  G_UNLOCK (bm_lock);
+
+  draw_xy_graph (widget, cr, series, G_N_ELEMENTS (series), FALSE, 0, format_num_streams, format_graph_transfer_rate, NULL);
+  g_array_unref (series[0].samples);
+  g_array_unref (series[1].samples);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+static gchar *
+format_block_size (guint64 block_size)
+{
+  /* Translators: These are used in the benchmark graph - %u is a number of KiB or MiB */
+  if (block_size >= 1024 * 1024)
+    return g_strdup_printf (C_("benchmark-graph", "%u MiB"), (guint) (block_size / (1024 * 1024)));
+  else
+    return g_strdup_printf (C_("benchmark-graph", "%u KiB"), (guint) (block_size / 1024));
+}
+
+static gchar *
+format_graph_time (gdouble seconds)
+{
+  /* Translators: This is used in the benchmark graph - %g is number of milliseconds */
+  return g_strdup_printf (C_("benchmark-graph", "%3g ms"), seconds * 1000.0);
+}
+
+static gboolean
+on_block_size_drawing_area_draw (GtkWidget      *widget,
+                                 cairo_t        *cr,
+                                 gpointer        user_data)
+{
+  DialogData *data = user_data;
+  BMSeries series[2] = {{0}};
+
+  G_LOCK (bm_lock);
+  /* same colors as the read and access time graphs */
+  series[0].samples = copy_samples (data->bm_block_size_read_samples);
+  series[0].red = 0.5;
+  series[0].green = 0.5;
+  series[0].blue = 1.0;
+  series[1].samples = copy_samples (data->bm_block_size_latency_samples);
+  series[1].red = 0.2;
+  series[1].green = 0.7;
+  series[1].blue = 0.2;
+  series[1].right_axis = TRUE;
+  G_UNLOCK (bm_lock);
+
+  draw_xy_graph (widget, cr, series, G_N_ELEMENTS (series), FALSE, 0, format_block_size, format_graph_transfer_rate, format_graph_time);
+  g_array_unref (series[0].samples);
+  g_array_unref (series[1].samples);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+static gchar *
+format_amount_written (guint64 num_bytes)
+{
+  return g_format_size (num_bytes);
+}
+
+static gboolean
+on_sustained_drawing_area_draw (GtkWidget      *widget,
+                                cairo_t        *cr,
+                                gpointer        user_data)
+{
+  DialogData *data = user_data;
+  BMSeries series[1] = {{0}};
+  guint64 cliff;
+
+  G_LOCK (bm_lock);
+  series[0].samples = copy_samples (data->bm_sustained_samples);
+  series[0].red = 1.0;
+  series[0].green = 0.5;
+  series[0].blue = 0.5;
+  cliff = data->bm_sustained_cliff;
+  G_UNLOCK (bm_lock);
+
+  draw_xy_graph (widget, cr, series, G_N_ELEMENTS (series), TRUE, cliff,
+                 format_amount_written, format_graph_transfer_rate, NULL);
+  g_array_unref (series[0].samples);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+static gchar *
+format_run_number (guint64 run)
+{
+  return g_strdup_printf ("%u", (guint) run);
+}
+
+static gboolean
+on_history_drawing_area_draw (GtkWidget      *widget,
+                              cairo_t        *cr,
+                              gpointer        user_data)
+{
+  DialogData *data = user_data;
+  BMSeries series[3] = {{0}};
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (series); n++)
+    series[n].samples = g_array_new (FALSE, FALSE, sizeof (BMSample));
+
+  G_LOCK (bm_lock);
+  for (n = 0; n < data->bm_history->len; n++)
+    {
+      BMHistoryEntry *entry = &g_array_index (data->bm_history, BMHistoryEntry, n);
+      BMSample sample;
+
+      /* runs are numbered from 1 */
+      sample.offset = n + 1;
+      sample.value = entry->read_rate;
+      g_array_append_val (series[0].samples, sample);
+      if (entry->write_rate > 0.0)
+        {
+          sample.value = entry->write_rate;
+          g_array_append_val (series[1].samples, sample);
+        }
+      sample.value = entry->access_time;
+      g_array_append_val (series[2].samples, sample);
+    }
+  G_UNLOCK (bm_lock);
+
+  /* same colors as the transfer rate graph */
+  series[0].red = 0.5;
+  series[0].green = 0.5;
+  series[0].blue = 1.0;
+  series[1].red = 1.0;
+  series[1].green = 0.5;
+  series[1].blue = 0.5;
+  series[2].red = 0.2;
+  series[2].green = 0.7;
+  series[2].blue = 0.2;
+  series[2].right_axis = TRUE;
+  draw_xy_graph (widget, cr, series, G_N_ELEMENTS (series), TRUE, 0,
+                 format_run_number, format_graph_transfer_rate, format_graph_time);
+
+  for (n = 0; n < G_N_ELEMENTS (series); n++)
+    g_array_unref (series[n].samples);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gchar *
+format_transfer_rate (gdouble bytes_per_sec)
+{
+  gchar *ret = NULL;
+  gchar *s;
+
+  s = g_format_size ((guint64) bytes_per_sec);
+  /* Translators: %s is the formatted size, e.g. "42 MB" and the trailing "/s" means per second */
+  ret = g_strdup_printf (C_("benchmark-transfer-rate", "%s/s"), s);
+  g_free (s);
+  return ret;
+}
+
+static gchar *
+format_transfer_rate_and_num_samples (gdouble bytes_per_sec,
+                                      guint   num_samples)
+{
+  gchar *ret = NULL;
+  gchar *s;
+  gchar *s2;
+
+  s = format_transfer_rate (bytes_per_sec);
+  s2 = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                     "%u sample",
+                                     "%u samples",
+                                     num_samples),
+                        num_samples);
+  ret = g_strdup_printf ("%s <small>(%s)</small>", s, s2);
+  g_free (s2);
+  g_free (s);
+  return ret;
+}
+
+static gchar *
+format_latency (guint64 usec)
+{
+  /* Translators: %.2f is number of milliseconds and msec means "milli-second" */
+  return g_strdup_printf (C_("benchmark-latency", "%.2f msec"), usec / 1000.0);
+}
+
+/* Returns NULL if nothing has been recorded in @histogram */
+static gchar *
+format_latency_percentiles (GduHistogram *histogram)
+{
+  gchar *ret = NULL;
+  gchar *p50, *p90, *p99, *p999;
+  gchar *s;
+  guint64 count;
+
+  count = gdu_histogram_get_count (histogram);
+  if (count == 0)
+    goto out;
+
+  p50 = format_latency (gdu_histogram_get_percentile (histogram, 50.0));
+  p90 = format_latency (gdu_histogram_get_percentile (histogram, 90.0));
+  p99 = format_latency (gdu_histogram_get_percentile (histogram, 99.0));
+  p999 = format_latency (gdu_histogram_get_percentile (histogram, 99.9));
+  s = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                    "%u sample",
+                                    "%u samples",
+                                    (guint) count),
+                       (guint) count);
+  /* Translators: The first four %s are latencies, e.g. "0.12 msec", below which
+   * 50%, 90%, 99% and 99.9% of all requests completed. The last %s is the number
+   * of samples, e.g. "1000 samples"
+   */
+  ret = g_strdup_printf (C_("benchmark-latency", "p50 %s, p90 %s, p99 %s, p99.9 %s <small>(%s)</small>"),
+                         p50, p90, p99, p999, s);
+  g_free (s);
+  g_free (p999);
+  g_free (p99);
+  g_free (p90);
+  g_free (p50);
+
+ out:
+  return ret;
+}
+
+/* Returns NULL if the concurrent transfer rate test hasn't been done */
+static gchar *
+format_concurrent_results (GArray  *results,
+                           gdouble  aggregate_rate)
+{
+  GString *str;
+  gchar *s;
+  gchar *s2;
+  guint n;
+
+  if (results->len == 0)
+    return NULL;
+
+  str = g_string_new (NULL);
+  for (n = 0; n < results->len; n++)
+    {
+      BMConcurrentResult *result = &g_array_index (results, BMConcurrentResult, n);
+      s = format_transfer_rate (result->read_rate);
+      if (str->len > 0)
+        g_string_append (str, ", ");
+      /* Translators: The first %s is the device, e.g. "/dev/sda", the second %s the
+       * transfer rate it achieved, e.g. "120 MB/s"
+       */
+      s2 = g_markup_printf_escaped (C_("benchmark-concurrent", "%s: %s"), result->device, s);
+      g_string_append (str, s2);
+      g_free (s2);
+      g_free (s);
+    }
+
+  s = format_transfer_rate (aggregate_rate);
+  /* Translators: The first %s is the combined transfer rate of all disks, e.g. "240 MB/s",
+   * the second %s is the transfer rate of each, e.g. "/dev/sda: 120 MB/s, /dev/sdb: 120 MB/s"
+   */
+  s2 = g_strdup_printf (C_("benchmark-concurrent", "%s combined <small>(%s)</small>"), s, str->str);
+  g_free (s);
+  g_string_free (str, TRUE);
+  return s2;
+}
+
+static const gchar *
+metadata_op_to_string (BMMetadataOp op)
+{
+  switch (op)
+    {
+    case BM_METADATA_OP_CREATE:
+      return C_("benchmark-metadata", "Create");
+    case BM_METADATA_OP_STAT:
+      return C_("benchmark-metadata", "Stat");
+    case BM_METADATA_OP_RENAME:
+      return C_("benchmark-metadata", "Rename");
+    case BM_METADATA_OP_UNLINK:
+      return C_("benchmark-metadata", "Delete");
+    default:
+      g_assert_not_reached ();
+      return NULL;
+    }
+}
+
+/* Returns one line per operation that was measured or NULL if none were */
+static gchar *
+format_metadata_results (const gdouble  *rates,
+                         GduHistogram  **latency)
+{
+  GString *str = NULL;
+  guint n;
+
+  for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+    {
+      gchar *p50, *p99;
+
+      if (rates[n] <= 0.0)
+        continue;
+
+      if (str == NULL)
+        str = g_string_new (NULL);
+      else
+        g_string_append_c (str, '\n');
+      p50 = format_latency (gdu_histogram_get_percentile (latency[n], 50.0));
+      p99 = format_latency (gdu_histogram_get_percentile (latency[n], 99.0));
+      /* Translators: The first %s is the kind of operation, e.g. "Create", %.0f is the number of
+       * operations per second and the last two %s are latencies, e.g. "0.12 msec", below which
+       * 50% and 99% of the operations completed
+       */
+      g_string_append_printf (str, C_("benchmark-metadata", "%s: %.0f/s <small>(p50 %s, p99 %s)</small>"),
+                              metadata_op_to_string (n), rates[n], p50, p99);
+      g_free (p99);
+      g_free (p50);
+    }
+
+  return str != NULL ? g_string_free (str, FALSE) : NULL;
+}
+
+/* Returns one line per write size that was measured or NULL if none were */
+static gchar *
+format_sync_latency (GduHistogram **histograms,
+                     gint           write_cache)
+{
+  GString *str = NULL;
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+    {
+      gchar *size_str;
+      gchar *latency_str;
+
+      latency_str = format_latency_percentiles (histograms[n]);
+      if (latency_str == NULL)
+        continue;
+
+      if (str == NULL)
+        str = g_string_new (NULL);
+      else
+        g_string_append_c (str, '\n');
+      size_str = format_block_size (sync_write_sizes[n]);
+      /* Translators: The first %s is the size of the writes, e.g. "4 KiB", the second %s their latency
+       * percentiles, e.g. "p50 0.12 msec, p90 ..."
+       */
+      g_string_append_printf (str, C_("benchmark-sync-latency", "%s: %s"), size_str, latency_str);
+      g_free (size_str);
+      g_free (latency_str);
+    }
+
+  if (str != NULL && write_cache >= 0)
+    {
+      g_string_append_c (str, '\n');
+      g_string_append_printf (str, "<small>%s</small>",
+                              write_cache ?
+                              C_("benchmark-sync-latency", "The write cache of the disk was enabled") :
+                              C_("benchmark-sync-latency", "The write cache of the disk was disabled"));
+    }
+
+  return str != NULL ? g_string_free (str, FALSE) : NULL;
+}
+
+/* Returns NULL if no trace was replayed */
+static gchar *
+format_replay_results (guint64        num_requests,
+                       guint64        duration_usec,
+                       guint64        trace_duration_usec,
+                       GduHistogram  *read_latency,
+                       GduHistogram  *write_latency)
+{
+  GString *str;
+  gchar *duration_str;
+  gchar *trace_duration_str;
+  gchar *latency_str;
+  gchar *s;
+
+  if (num_requests == 0)
+    return NULL;
+
+  str = g_string_new (NULL);
+  duration_str = gdu_utils_format_duration_usec (duration_usec, GDU_FORMAT_DURATION_FLAGS_SUBSECOND_PRECISION);
+  trace_duration_str = gdu_utils_format_duration_usec (trace_duration_usec, GDU_FORMAT_DURATION_FLAGS_SUBSECOND_PRECISION);
+  /* Translators: %u is the number of requests replayed and %s the time it took, e.g. "10 seconds" */
+  s = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                    "%u request in %s",
+                                    "%u requests in %s",
+                                    (guint) num_requests),
+                       (guint) num_requests, duration_str);
+  /* Translators: The first %s is e.g. "1000 requests in 10 seconds", %.0f is the number of
+   * requests per second and the last %s is how long the trace took when it was captured,
+   * e.g. "12 seconds"
+   */
+  g_string_append_printf (str, C_("benchmark-replay", "%s <small>(%.0f IOPS, the trace took %s)</small>"),
+                          s,
+                          duration_usec > 0 ? ((gdouble) G_USEC_PER_SEC) * num_requests / duration_usec : 0.0,
+                          trace_duration_str);
+  g_free (s);
+  g_free (trace_duration_str);
+  g_free (duration_str);
+
+  latency_str = format_latency_percentiles (read_latency);
+  if (latency_str != NULL)
+    {
+      g_string_append_c (str, '\n');
+      /* Translators: %s are the latency percentiles of the reads, e.g. "p50 0.12 msec, p90 ..." */
+      g_string_append_printf (str, C_("benchmark-replay", "Reads: %s"), latency_str);
+      g_free (latency_str);
+    }
+  latency_str = format_latency_percentiles (write_latency);
+  if (latency_str != NULL)
+    {
+      g_string_append_c (str, '\n');
+      /* Translators: %s are the latency percentiles of the writes, e.g. "p50 0.12 msec, p90 ..." */
+      g_string_append_printf (str, C_("benchmark-replay", "Writes: %s"), latency_str);
+      g_free (latency_str);
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* Returns NULL if the wake-up time wasn't measured */
+static gchar *
+format_wake_latency (GArray *samples)
+{
+  gdouble sum = 0.0;
+  gdouble min = G_MAXDOUBLE;
+  gdouble max = 0.0;
+  gchar *s;
+  gchar *ret;
+  guint n;
+
+  if (samples->len == 0)
+    return NULL;
+
+  for (n = 0; n < samples->len; n++)
+    {
+      gdouble value = g_array_index (samples, BMSample, n).value;
+      sum += value;
+      min = MIN (min, value);
+      max = MAX (max, value);
+    }
+
+  s = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                    "%u run",
+                                    "%u runs",
+                                    samples->len),
+                       samples->len);
+  /* Translators: The first three numbers are the average, shortest and longest time in seconds
+   * it took to read from the drive after putting it into standby. The %s is the number of
+   * times this was measured, e.g. "3 runs"
+   */
+  ret = g_strdup_printf (C_("benchmark-wake", "%.2f sec <small>(min %.2f sec, max %.2f sec, %s)</small>"),
+                         sum / samples->len, min, max, s);
+  g_free (s);
+  return ret;
+}
+
+/* Returns the average sustained write rate before and after the write cache ran out at @cliff */
+static void
+get_sustained_write_rates (GArray  *samples,
+                           guint64  cliff,
+                           gdouble *out_before,
+                           gdouble *out_after)
+{
+  gdouble before = 0.0;
+  gdouble after = 0.0;
+  guint num_before = 0;
+  guint num_after = 0;
+  guint n;
+
+  for (n = 0; n < samples->len; n++)
+    {
+      BMSample *s = &g_array_index (samples, BMSample, n);
+      if (cliff == 0 || s->offset <= cliff)
+        {
+          before += s->value;
+          num_before++;
+        }
+      else
+        {
+          after += s->value;
+          num_after++;
+        }
+    }
+  *out_before = num_before > 0 ? before / num_before : 0.0;
+  *out_after = num_after > 0 ? after / num_after : 0.0;
+}
+
+/* Returns the smallest request size reaching 90% of the highest transfer rate in @samples, or 0 */
+static guint64
+get_full_speed_block_size (GArray  *samples,
+                           gdouble *out_peak)
+{
+  gdouble peak = 0.0;
+  guint n;
+
+  get_max_min_avg (samples, &peak, NULL, NULL);
+  *out_peak = peak;
+  for (n = 0; n < samples->len; n++)
+    {
+      BMSample *s = &g_array_index (samples, BMSample, n);
+      if (s->value >= 0.9 * peak)
+        return s->offset;
+    }
+  return 0;
+}
+
+/* Returns the highest value in @samples and the offset (e.g. the queue depth) it was achieved at */
+static gdouble
+get_peak (GArray *samples,
+          guint  *out_offset)
+{
+  gdouble peak = 0.0;
+  guint n;
+
+  for (n = 0; n < samples->len; n++)
+    {
+      BMSample *s = &g_array_index (samples, BMSample, n);
+      if (s->value > peak)
+        {
+          peak = s->value;
+          *out_offset = s->offset;
+        }
+    }
+  return peak;
+}
+
+static void
+update_updated_label (DialogData *data)
+{
+  gchar *s = NULL;
+
+  G_LOCK (bm_lock);
+  switch (data->bm_state)
+    {
+    case BM_STATE_NONE:
+      if (data->bm_time_benchmarked_usec > 0)
+        {
+          gint64 now_usec;
+          gchar *s2;
+          GDateTime *time_benchmarked_dt;
+          GDateTime *time_benchmarked_dt_local;
+          gchar *time_benchmarked_str;
+
+          now_usec = g_get_real_time ();
+
+          time_benchmarked_dt = g_date_time_new_from_unix_utc (data->bm_time_benchmarked_usec / G_USEC_PER_SEC);
+          time_benchmarked_dt_local = g_date_time_to_local (time_benchmarked_dt);
+          time_benchmarked_str = g_date_time_format (time_benchmarked_dt_local, "%c");
+
+          s = gdu_utils_format_duration_usec ((now_usec - data->bm_time_benchmarked_usec),
+                                              GDU_FORMAT_DURATION_FLAGS_NO_SECONDS);
+          /* Translators: The first %s is the date and time the benchmark took place in the preferred
+           * format for the locale (e.g. "%c" for strftime()/g_date_time_format()), for example
+           * "Tue 12 Jun 2012 03:57:08 PM EDT". The second %s is how long ago that is from right
+           * now, for example "3 days" or "2 hours" or "12 minutes".
+           */
+          s2 = g_strdup_printf (C_("benchmark-updated", "%s (%s ago)"),
+                                time_benchmarked_str,
+                                s);
+          gtk_label_set_text (GTK_LABEL (data->updated_label), s2);
+          g_free (s2);
+          g_free (s);
+          g_free (time_benchmarked_str);
+          g_date_time_unref (time_benchmarked_dt_local);
+          g_date_time_unref (time_benchmarked_dt);
+        }
+      else
+        {
+          gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "No benchmark data available"));
+        }
+      break;
+
+    case BM_STATE_OPENING_DEVICE:
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "Opening Device…"));
+      break;
+
+    case BM_STATE_CREATING_FILE:
+      s = g_strdup_printf (C_("benchmark-updated", "Creating temporary file (%2.1f%% complete)…"),
+                           data->bm_file_written * 100.0 / MAX (data->bm_file_size, 1));
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_TRANSFER_RATE:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring transfer rate (%2.1f%% complete)…"),
+                           data->bm_read_samples->len * 100.0 / data->bm_num_samples);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_REFINING_TRANSFER_RATE:
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "Refining transfer rate…"));
+      break;
+
+    case BM_STATE_ACCESS_TIME:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring access time (%2.1f%% complete)…"),
+                           data->bm_access_time_samples->len * 100.0 / data->bm_num_access_samples);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_STREAMS:
+      s = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                        "Measuring transfer rate with %u stream…",
+                                        "Measuring transfer rate with %u parallel streams…",
+                                        data->bm_num_streams),
+                           data->bm_num_streams);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_BLOCK_SIZE:
+      {
+        gchar *size_str;
+        size_str = g_format_size_full (data->bm_block_size, G_FORMAT_SIZE_IEC_UNITS);
+        /* Translators: %s is the size of each request, e.g. "64 KiB" */
+        s = g_strdup_printf (C_("benchmark-updated", "Measuring transfer rate with %s requests…"), size_str);
+        gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+        g_free (size_str);
+        g_free (s);
+      }
+      break;
+
+    case BM_STATE_SUSTAINED_WRITE:
+      s = g_strdup_printf (C_("benchmark-updated", "Writing continuously (%2.1f%% complete)…"),
+                           data->bm_sustained_samples->len * 100.0 * SUSTAINED_WINDOW_SIZE / MAX (data->bm_sustained_size, 1));
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_CONCURRENT:
+      s = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                        "Reading from %u disk at the same time…",
+                                        "Reading from %u disks at the same time…",
+                                        g_list_length (data->bm_concurrent_blocks) + 1),
+                           g_list_length (data->bm_concurrent_blocks) + 1);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_METADATA:
+      /* Translators: %s is the kind of operation, e.g. "Create" */
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring metadata operations (%s)…"),
+                           metadata_op_to_string (data->bm_metadata_op));
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_SYNC_LATENCY:
+      {
+        gchar *size_str;
+        size_str = format_block_size (data->bm_sync_write_size);
+        /* Translators: %s is the size of each write, e.g. "4 KiB" */
+        s = g_strdup_printf (C_("benchmark-updated", "Measuring latency of synchronous %s writes…"), size_str);
+        gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+        g_free (size_str);
+        g_free (s);
+      }
+      break;
+
+    case BM_STATE_REPLAY:
+      s = g_strdup_printf (C_("benchmark-updated", "Replaying I/O trace (%2.1f%% complete)…"),
+                           g_atomic_int_get (&data->bm_replay_num_done) * 100.0 /
+                           gdu_io_trace_get_num_entries (data->bm_replay_trace));
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_STANDBY:
+      /* Translators: The first %u is the current run, the second the number of runs */
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring wake-up time from standby (run %u of %u)…"),
+                           data->bm_standby_run + 1, STANDBY_NUM_RUNS);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case BM_STATE_IOPS:
+      /* Translators: %u is the queue depth, e.g. the number of I/O requests outstanding at the same time */
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring random IOPS at queue depth %u…"),
+                           data->bm_iops_queue_depth);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+  G_UNLOCK (bm_lock);
+}
+
+/* returns NULL if it doesn't make sense to load/save benchmark data (removable media,
+ * non-drive devices etc.)
+ */
+static gchar *
+get_bm_filename (DialogData *data)
+{
+  gchar *ret = NULL;
+  gchar *bench_dir = NULL;
+  const gchar *id = NULL;
+
+  id = udisks_block_get_id (data->block);
+  if (id == NULL || strlen (id) == 0)
+    goto out;
+
+  bench_dir = g_strdup_printf ("%s/gnome-disks/benchmarks", g_get_user_cache_dir ());
+  if (g_mkdir_with_parents (bench_dir, 0777) != 0)
+    {
+      g_warning ("Error creating directory %s: %m", bench_dir);
+      goto out;
+    }
+
+  /* results for a file on the filesystem include the overhead of the
+   * filesystem so keep them apart from the results for the device
+   */
+  if (data->bm_file_dir != NULL)
+    ret = g_strdup_printf ("%s/%s.gnome-disks-file-benchmark", bench_dir, id);
+  else
+    ret = g_strdup_printf ("%s/%s.gnome-disks-benchmark", bench_dir, id);
+
+ out:
+  g_free (bench_dir);
+  return ret;
+}
+
+static gchar *
+get_bm_history_filename (DialogData *data)
+{
+  gchar *ret = NULL;
+  gchar *filename;
+
+  filename = get_bm_filename (data);
+  if (filename != NULL)
+    ret = g_strdup_printf ("%s-history", filename);
+  g_free (filename);
+  return ret;
+}
+
+static void
+clear_history (GArray *history)
+{
+  guint n;
+
+  for (n = 0; n < history->len; n++)
+    g_free (g_array_index (history, BMHistoryEntry, n).firmware);
+  g_array_set_size (history, 0);
+}
+
+static void
+clear_concurrent_results (GArray *results)
+{
+  guint n;
+
+  for (n = 0; n < results->len; n++)
+    g_free (g_array_index (results, BMConcurrentResult, n).device);
+  g_array_set_size (results, 0);
+}
+
+static void
+clear_metadata_results (DialogData *data)
+{
+  guint n;
+
+  for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+    {
+      data->bm_metadata_rates[n] = 0.0;
+      gdu_histogram_clear (data->bm_metadata_latency[n]);
+    }
+}
+
+static void
+clear_sync_latency_results (DialogData *data)
+{
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+    gdu_histogram_clear (data->bm_sync_latency[n]);
+  data->bm_sync_write_cache = -1;
+}
+
+static void
+clear_replay_results (DialogData *data)
+{
+  data->bm_replay_num_requests = 0;
+  data->bm_replay_duration_usec = 0;
+  data->bm_replay_trace_duration_usec = 0;
+  gdu_histogram_clear (data->bm_replay_read_latency);
+  gdu_histogram_clear (data->bm_replay_write_latency);
+}
+
+/* The history is a text file with one GVariant dictionary per line, one
+ * line per run. New runs are only ever appended to it.
+ */
+static gboolean
+maybe_load_history (DialogData  *data,
+                    GError     **error)
+{
+  gboolean ret = FALSE;
+  gchar *filename = NULL;
+  gchar *contents = NULL;
+  gchar **lines = NULL;
+  GError *local_error = NULL;
+  guint n;
+
+  clear_history (data->bm_history);
+
+  filename = get_bm_history_filename (data);
+  if (filename == NULL)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!g_file_get_contents (filename, &contents, NULL, &local_error))
+    {
+      if (local_error->domain == G_FILE_ERROR && local_error->code == G_FILE_ERROR_NOENT)
+        {
+          g_clear_error (&local_error);
+          ret = TRUE;
+          goto out;
+        }
+      g_propagate_error (error, local_error);
+      goto out;
+    }
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (n = 0; lines[n] != NULL; n++)
+    {
+      BMHistoryEntry entry = {0};
+      GVariant *value;
+
+      if (strlen (lines[n]) == 0)
+        continue;
+
+      /* skip lines we don't understand, e.g. if we crashed half-way through writing one */
+      value = g_variant_parse (G_VARIANT_TYPE_VARDICT, lines[n], NULL, NULL, NULL);
+      if (value == NULL)
+        continue;
+      if (g_variant_lookup (value, "timestamp-usec", "x", &entry.timestamp_usec) &&
+          g_variant_lookup (value, "read-rate", "d", &entry.read_rate))
+        {
+          g_variant_lookup (value, "firmware", "s", &entry.firmware);
+          g_variant_lookup (value, "write-rate", "d", &entry.write_rate);
+          g_variant_lookup (value, "access-time", "d", &entry.access_time);
+          g_variant_lookup (value, "sample-size", "t", &entry.sample_size);
+          g_variant_lookup (value, "num-samples", "i", &entry.num_samples);
+          g_variant_lookup (value, "refine", "b", &entry.refine);
+          g_variant_lookup (value, "write", "b", &entry.write);
+          g_array_append_val (data->bm_history, entry);
+        }
+      g_variant_unref (value);
+    }
+
+  ret = TRUE;
+
+ out:
+  g_strfreev (lines);
+  g_free (contents);
+  g_free (filename);
+  return ret;
+}
+
+/* called in the benchmark thread once a run has completed */
+static gboolean
+maybe_append_history (DialogData  *data,
+                      GError     **error)
+{
+  gboolean ret = FALSE;
+  gchar *filename = NULL;
+  GVariantBuilder builder;
+  GVariant *value = NULL;
+  BMHistoryEntry entry = {0};
+  gchar *line = NULL;
+  gchar *s = NULL;
+  gint fd = -1;
+
+  filename = get_bm_history_filename (data);
+  if (filename == NULL)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  G_LOCK (bm_lock);
+  entry.timestamp_usec = data->bm_time_benchmarked_usec;
+  entry.firmware = g_strdup (data->bm_firmware != NULL ? data->bm_firmware : "");
+  entry.read_rate = get_transfer_rate_avg (data->bm_read_samples, data->bm_size);
+  entry.write_rate = get_transfer_rate_avg (data->bm_write_samples, data->bm_size);
+  get_max_min_avg (data->bm_access_time_samples, NULL, NULL, &entry.access_time);
+  G_UNLOCK (bm_lock);
+  entry.sample_size = data->bm_sample_size;
+  entry.num_samples = data->bm_num_samples;
+  entry.refine = data->bm_do_refine;
+  entry.write = data->bm_do_write;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "timestamp-usec", g_variant_new_int64 (entry.timestamp_usec));
+  g_variant_builder_add (&builder, "{sv}", "firmware", g_variant_new_string (entry.firmware));
+  g_variant_builder_add (&builder, "{sv}", "device-size", g_variant_new_uint64 (data->bm_size));
+  g_variant_builder_add (&builder, "{sv}", "read-rate", g_variant_new_double (entry.read_rate));
+  g_variant_builder_add (&builder, "{sv}", "write-rate", g_variant_new_double (entry.write_rate));
+  g_variant_builder_add (&builder, "{sv}", "access-time", g_variant_new_double (entry.access_time));
+  g_variant_builder_add (&builder, "{sv}", "sample-size", g_variant_new_uint64 (entry.sample_size));
+  g_variant_builder_add (&builder, "{sv}", "num-samples", g_variant_new_int32 (entry.num_samples));
+  g_variant_builder_add (&builder, "{sv}", "refine", g_variant_new_boolean (entry.refine));
+  g_variant_builder_add (&builder, "{sv}", "write", g_variant_new_boolean (entry.write));
+  value = g_variant_ref_sink (g_variant_builder_end (&builder));
+  s = g_variant_print (value, TRUE);
+  line = g_strdup_printf ("%s\n", s);
+
+  fd = open (filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd == -1 ||
+      write (fd, line, strlen (line)) != (ssize_t) strlen (line) ||
+      fsync (fd) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "Error appending to %s: %m", filename);
+      goto out;
+    }
+
+  G_LOCK (bm_lock);
+  g_array_append_val (data->bm_history, entry);
+  entry.firmware = NULL; /* now owned by bm_history */
+  G_UNLOCK (bm_lock);
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  if (value != NULL)
+    g_variant_unref (value);
+  g_free (entry.firmware);
+  g_free (line);
+  g_free (s);
+  g_free (filename);
+  return ret;
+}
+
+/* Returns markup describing how much worse the latest run in @history
+ * is compared to the first one with the same settings, or NULL if no
+ * number has become worse by more than @threshold percent
+ */
+static gchar *
+check_for_regression (GArray *history,
+                      gint    threshold)
+{
+  BMHistoryEntry *baseline = NULL;
+  BMHistoryEntry *latest;
+  GString *str = NULL;
+  GDateTime *dt = NULL;
+  GDateTime *dt_local = NULL;
+  gchar *date = NULL;
+  gchar *s;
+
+  guint n;
+
+  if (history->len < 2)
+    goto out;
+
+  /* e.g. a smaller sample size gives different numbers without the disk having changed */
+  latest = &g_array_index (history, BMHistoryEntry, history->len - 1);
+  for (n = 0; n < history->len - 1; n++)
+    {
+      BMHistoryEntry *entry = &g_array_index (history, BMHistoryEntry, n);
+      if (entry->sample_size == latest->sample_size &&
+          entry->num_samples == latest->num_samples &&
+          entry->refine == latest->refine &&
+          entry->write == latest->write)
+        {
+          baseline = entry;
+          break;
+        }
+    }
+  if (baseline == NULL)
+    goto out;
+
+  str = g_string_new (NULL);
+  if (baseline->read_rate > 0.0 && latest->read_rate < baseline->read_rate * (100 - threshold) / 100.0)
+    {
+      g_string_append_c (str, '\n');
+      g_string_append_printf (str, C_("benchmark-regression", "The average read rate is %d%% lower."),
+                              (gint) (100.0 - latest->read_rate * 100.0 / baseline->read_rate));
+    }
+  if (baseline->write_rate > 0.0 && latest->write_rate > 0.0 &&
+      latest->write_rate < baseline->write_rate * (100 - threshold) / 100.0)
+    {
+      g_string_append_c (str, '\n');
+      g_string_append_printf (str, C_("benchmark-regression", "The average write rate is %d%% lower."),
+                              (gint) (100.0 - latest->write_rate * 100.0 / baseline->write_rate));
+    }
+  if (baseline->access_time > 0.0 && latest->access_time > baseline->access_time * (100 + threshold) / 100.0)
+    {
+      g_string_append_c (str, '\n');
+      g_string_append_printf (str, C_("benchmark-regression", "The average access time is %d%% higher."),
+                              (gint) (latest->access_time * 100.0 / baseline->access_time - 100.0));
+    }
+  if (str->len == 0)
+    {
+      g_string_free (str, TRUE);
+      str = NULL;
+      goto out;
+    }
+
+  if (g_strcmp0 (baseline->firmware, latest->firmware) != 0)
+    {
+      g_string_append_c (str, '\n');
+      s = g_markup_printf_escaped (C_("benchmark-regression", "The firmware has changed from %s to %s since then."),
+                                   baseline->firmware != NULL ? baseline->firmware : "",
+                                   latest->firmware != NULL ? latest->firmware : "");
+      g_string_append (str, s);
+      g_free (s);
+    }
+
+  dt = g_date_time_new_from_unix_utc (baseline->timestamp_usec / G_USEC_PER_SEC);
+  dt_local = g_date_time_to_local (dt);
+  date = g_date_time_format (dt_local, "%x");
+  /* Translators: %s is the date of the first benchmark of the disk, in the preferred
+   * format for the locale (e.g. "%x" for strftime()/g_date_time_format())
+   */
+  s = g_markup_printf_escaped (C_("benchmark-regression", "<b>The disk is slower than when it was first benchmarked with the same settings on %s</b>"),
+                               date);
+  g_string_prepend (str, s);
+  g_free (s);
+
+ out:
+  g_free (date);
+  if (dt_local != NULL)
+    g_date_time_unref (dt_local);
+  if (dt != NULL)
+    g_date_time_unref (dt);
+  return str != NULL ? g_string_free (str, FALSE) : NULL;
+}
+
+static void
+update_dialog (DialogData *data)
+{
+  GError *error = NULL;
+  GdkWindow *window = NULL;
+  gdouble read_avg = 0.0;
+  gdouble write_avg = 0.0;
+  gdouble access_time_avg = 0.0;
+  gdouble iops_read_peak = 0.0;
+  gdouble iops_write_peak = 0.0;
+  guint iops_read_queue_depth = 0;
+  guint iops_write_queue_depth = 0;
+  gdouble streams_read_peak = 0.0;
+  gdouble streams_write_peak = 0.0;
+  guint streams_read_num = 0;
+  guint streams_write_num = 0;
+  guint64 full_speed_block_size = 0;
+  gdouble block_size_peak = 0.0;
+  gdouble sustained_initial = 0.0;
+  gdouble sustained_after = 0.0;
+  guint64 sustained_cliff = 0;
+  guint history_len = 0;
+  gchar *history_error = NULL;
+  gint64 history_first_usec = 0;
+  gchar *regression = NULL;
+  gchar *concurrent = NULL;
+  gchar *metadata = NULL;
+  gchar *sync_latency = NULL;
+  gchar *replay = NULL;
+  gchar *wake = NULL;
+  gchar *read_latency = NULL;
+  gchar *write_latency = NULL;
+  gchar *s = NULL;
+  UDisksDrive *drive = NULL;
+  UDisksObjectInfo *info = NULL;
+
+  G_LOCK (bm_lock);
+  if (data->bm_error != NULL)
+    {
+      error = data->bm_error;
+      data->bm_error = NULL;
+    }
+  G_UNLOCK (bm_lock);
+
+  /* first of all, present an error if something went wrong */
+  if (error != NULL)
+    {
+      if (!data->closed)
+        {
+          if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+            gdu_utils_show_error (GTK_WINDOW (data->window), C_("benchmarking", "An error occurred"), error);
+        }
+      g_clear_error (&error);
+
+      /* and reload old data */
+      if (!maybe_load_data (data, &error))
+        {
+          /* not worth complaining in dialog about */
+          g_warning ("Error loading cached data: %s (%s, %d)",
+                     error->message, g_quark_to_string (error->domain), error->code);
+          g_clear_error (&error);
+        }
+    }
+
+  update_updated_label (data);
+
+  /* disk / device label */
+  drive = udisks_client_get_drive_for_block (gdu_window_get_client (data->window), data->block);
+  info = udisks_client_get_object_info (gdu_window_get_client (data->window), data->object);
+  if (data->bm_file_dir != NULL)
+    {
+      /* Translators: Shown as the device being benchmarked when benchmarking through a temporary file.
+       * The first %s is the device, the second %s is the directory the file is created in.
+       */
+      s = g_strdup_printf (C_("benchmark", "%s — temporary file in %s"),
+                           udisks_object_info_get_one_liner (info),
+                           data->bm_file_dir);
+      gtk_label_set_text (GTK_LABEL (data->device_label), s);
+    }
+  else
+    {
+      gtk_label_set_text (GTK_LABEL (data->device_label), udisks_object_info_get_one_liner (info));
+    }
+  g_free (s);
+
+  G_LOCK (bm_lock);
+
+  if (data->bm_in_progress)
+    {
+
+      gtk_widget_hide (data->start_benchmark_button);
+      gtk_widget_show (data->stop_benchmark_button);
+    }
+  else
+    {
+      gtk_widget_show (data->start_benchmark_button);
+      gtk_widget_hide (data->stop_benchmark_button);
+    }
+
+  read_avg = get_transfer_rate_avg (data->bm_read_samples, data->bm_size);
+  write_avg = get_transfer_rate_avg (data->bm_write_samples, data->bm_size);
+  get_max_min_avg (data->bm_access_time_samples,
+                   NULL, NULL, &access_time_avg);
+  iops_read_peak = get_peak (data->bm_iops_read_samples, &iops_read_queue_depth);
+  iops_write_peak = get_peak (data->bm_iops_write_samples, &iops_write_queue_depth);
+  streams_read_peak = get_peak (data->bm_stream_read_samples, &streams_read_num);
+  streams_write_peak = get_peak (data->bm_stream_write_samples, &streams_write_num);
+  full_speed_block_size = get_full_speed_block_size (data->bm_block_size_read_samples, &block_size_peak);
+  sustained_cliff = data->bm_sustained_cliff;
+  get_sustained_write_rates (data->bm_sustained_samples, sustained_cliff, &sustained_initial, &sustained_after);
+  history_len = data->bm_history->len;
+  if (data->bm_history_error != NULL)
+    history_error = g_strdup (data->bm_history_error->message);
+  if (history_len > 0)
+    history_first_usec = g_array_index (data->bm_history, BMHistoryEntry, 0).timestamp_usec;
+  regression = check_for_regression (data->bm_history, data->regression_threshold);
+  concurrent = format_concurrent_results (data->bm_concurrent_results, data->bm_concurrent_aggregate_rate);
+  metadata = format_metadata_results (data->bm_metadata_rates, data->bm_metadata_latency);
+  sync_latency = format_sync_latency (data->bm_sync_latency, data->bm_sync_write_cache);
+  replay = format_replay_results (data->bm_replay_num_requests,
+                                  data->bm_replay_duration_usec,
+                                  data->bm_replay_trace_duration_usec,
+                                  data->bm_replay_read_latency,
+                                  data->bm_replay_write_latency);
+  wake = format_wake_latency (data->bm_wake_samples);
+  read_latency = format_latency_percentiles (data->bm_read_latency);
+  write_latency = format_latency_percentiles (data->bm_write_latency);
+
+  G_UNLOCK (bm_lock);
+
+  if (data->bm_sample_size == 0)
+    s = g_strdup ("–");
+  else
+    s = g_format_size_full (data->bm_sample_size, G_FORMAT_SIZE_IEC_UNITS | G_FORMAT_SIZE_LONG_FORMAT);
+  gtk_label_set_markup (GTK_LABEL (data->sample_size_label), s);
+  g_free (s);
+
+  if (read_avg == 0.0)
+    s = g_strdup ("–");
+  else
+    s = format_transfer_rate_and_num_samples (read_avg, data->bm_read_samples->len);
+  gtk_label_set_markup (GTK_LABEL (data->read_rate_label), s);
+  g_free (s);
+
+  if (write_avg == 0.0)
+    s = g_strdup ("–");
+  else
+    s = format_transfer_rate_and_num_samples (write_avg, data->bm_write_samples->len);
+  gtk_label_set_markup (GTK_LABEL (data->write_rate_label), s);
+  g_free (s);
+
+  if (access_time_avg == 0.0)
+    {
+      s = g_strdup ("–");
+    }
+  else
+    {
+      gchar *s2;
+      gchar *s3;
+      /* Translators: %d is number of milliseconds and msec means "milli-second" */
+      s2 = g_strdup_printf (C_("benchmark-access-time", "%.2f msec"), access_time_avg * 1000.0);
+      s3 = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                         "%u sample",
+                                         "%u samples",
+                                         data->bm_access_time_samples->len),
+                            data->bm_access_time_samples->len);
+      s = g_strdup_printf ("%s <small>(%s)</small>", s2, s3);
+      g_free (s3);
+      g_free (s2);
+    }
+  gtk_label_set_markup (GTK_LABEL (data->access_time_label), s);
+  g_free (s);
+
+  if (iops_read_peak == 0.0)
+    {
+      s = g_strdup ("–");
+    }
+  else
+    {
+      /* Translators: %.0f is the number of I/O operations per second and %u is the queue depth */
+      s = g_strdup_printf (C_("benchmark-iops", "%.0f read <small>(queue depth %u)</small>"),
+                           iops_read_peak, iops_read_queue_depth);
+      if (iops_write_peak > 0.0)
+        {
+          gchar *s2;
+          gchar *s3;
+          /* Translators: %.0f is the number of I/O operations per second and %u is the queue depth */
+          s2 = g_strdup_printf (C_("benchmark-iops", "%.0f write <small>(queue depth %u)</small>"),
+                                iops_write_peak, iops_write_queue_depth);
+          s3 = g_strdup_printf ("%s, %s", s, s2);
+          g_free (s2);
+          g_free (s);
+          s = s3;
+        }
+    }
+  gtk_label_set_markup (GTK_LABEL (data->iops_label), s);
+  g_free (s);
+
+  if (streams_read_peak == 0.0)
+    {
+      s = g_strdup ("–");
+    }
+  else
+    {
+      gchar *s2;
+      s2 = format_transfer_rate (streams_read_peak);
+      /* Translators: The first %s is a transfer rate, e.g. "120 MB/s" and %u is the number of parallel streams */
+      s = g_strdup_printf (C_("benchmark-streams", "%s read <small>(%u streams)</small>"),
+                           s2, streams_read_num);
+      g_free (s2);
+      if (streams_write_peak > 0.0)
+        {
+          gchar *s3;
+          s2 = format_transfer_rate (streams_write_peak);
+          /* Translators: The first %s is a transfer rate, e.g. "120 MB/s" and %u is the number of parallel streams */
+          s3 = g_strdup_printf (C_("benchmark-streams", "%s, %s write <small>(%u streams)</small>"),
+                                s, s2, streams_write_num);
+          g_free (s2);
+          g_free (s);
+          s = s3;
+        }
+    }
+  gtk_label_set_markup (GTK_LABEL (data->streams_label), s);
+  g_free (s);
+
+  if (full_speed_block_size == 0)
+    {
+      s = g_strdup ("–");
+    }
+  else
+    {
+      gchar *s2;
+      gchar *s3;
+      s2 = g_format_size_full (full_speed_block_size, G_FORMAT_SIZE_IEC_UNITS);
+      s3 = format_transfer_rate (block_size_peak);
+      /* Translators: The first %s is a request size, e.g. "128 KiB", the second %s is the
+       * highest transfer rate measured, e.g. "500 MB/s"
+       */
+      s = g_strdup_printf (C_("benchmark-block-size", "%s <small>(reaches 90%% of %s)</small>"), s2, s3);
+      g_free (s3);
+      g_free (s2);
+    }
+  gtk_label_set_markup (GTK_LABEL (data->block_size_label), s);
+  g_free (s);
+
+  if (sustained_initial == 0.0)
+    {
+      s = g_strdup ("–");
+    }
+  else if (sustained_cliff == 0)
+    {
+      gchar *s2;
+      s2 = format_transfer_rate (sustained_initial);
+      /* Translators: %s is a transfer rate, e.g. "120 MB/s" */
+      s = g_strdup_printf (C_("benchmark-sustained", "%s <small>(no drop detected)</small>"), s2);
+      g_free (s2);
+    }
+  else
+    {
+      gchar *s2;
+      gchar *s3;
+      gchar *s4;
+      s2 = format_transfer_rate (sustained_initial);
+      s3 = g_format_size (sustained_cliff);
+      s4 = format_transfer_rate (sustained_after);
+      /* Translators: The first %s is a transfer rate, e.g. "400 MB/s", the second is
+       * an amount of data, e.g. "12 GB", and the third is a transfer rate again
+       */
+      s = g_strdup_printf (C_("benchmark-sustained", "%s for the first %s, then %s"), s2, s3, s4);
+      g_free (s4);
+      g_free (s3);
+      g_free (s2);
+    }
+  gtk_label_set_markup (GTK_LABEL (data->sustained_label), s);
+  g_free (s);
+
+  if (history_error != NULL)
+    {
+      /* Translators: Shown in the History field if the run couldn't be recorded.
+       *              The %s is the error message.
+       */
+      s = g_markup_printf_escaped (C_("benchmark-history", "This run was not recorded: %s"),
+                                   history_error);
+    }
+  else if (history_len == 0)
+    {
+      s = g_strdup ("–");
+    }
+  else
+    {
+      GDateTime *dt;
+      GDateTime *dt_local;
+      gchar *s2;
+      dt = g_date_time_new_from_unix_utc (history_first_usec / G_USEC_PER_SEC);
+      dt_local = g_date_time_to_local (dt);
+      s2 = g_date_time_format (dt_local, "%x");
+      /* Translators: %u is the number of times the disk has been benchmarked and %s
+       * is the date of the first time, e.g. "12/06/2012"
+       */
+      s = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
+                                        "%u run since %s",
+                                        "%u runs since %s",
+                                        history_len),
+                           history_len, s2);
+      g_free (s2);
+      g_date_time_unref (dt_local);
+      g_date_time_unref (dt);
+    }
+  gtk_label_set_markup (GTK_LABEL (data->history_label), s);
+  g_free (s);
+
+  gtk_label_set_markup (GTK_LABEL (data->concurrent_label), concurrent != NULL ? concurrent : "–");
+  g_free (concurrent);
+
+  gtk_label_set_markup (GTK_LABEL (data->metadata_label), metadata != NULL ? metadata : "–");
+  g_free (metadata);
+
+  gtk_label_set_markup (GTK_LABEL (data->sync_latency_label), sync_latency != NULL ? sync_latency : "–");
+  g_free (sync_latency);
+
+  gtk_label_set_markup (GTK_LABEL (data->replay_label), replay != NULL ? replay : "–");
+  g_free (replay);
+
+  gtk_label_set_markup (GTK_LABEL (data->wake_label), wake != NULL ? wake : "–");
+  g_free (wake);
+  g_free (history_error);
+
+  if (regression != NULL)
+    {
+      gtk_label_set_markup (GTK_LABEL (data->regression_label), regression);
+      gtk_widget_show (data->regression_infobar);
+    }
+  else
+    {
+      gtk_widget_hide (data->regression_infobar);
+    }
+  g_free (regression);
+
+  gtk_label_set_markup (GTK_LABEL (data->read_latency_label), read_latency != NULL ? read_latency : "–");
+  gtk_label_set_markup (GTK_LABEL (data->write_latency_label), write_latency != NULL ? write_latency : "–");
+  g_free (read_latency);
+  g_free (write_latency);
+
+
+  window = gtk_widget_get_window (data->graph_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->iops_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->streams_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->block_size_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->sustained_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->history_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+
+  g_clear_object (&drive);
+  g_clear_object (&info);
+}
+
+
+/* called every second (on the second) */
+static gboolean
+on_timeout (gpointer user_data)
+{
+  DialogData *data = user_data;
+  update_updated_label (data);
+  return TRUE; /* keep timeout around */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+samples_from_gvariant (GArray   *array,
+                       GVariant *variant)
+{
+  GVariantIter iter;
+  BMSample sample;
+
+  g_array_set_size (array, 0);
+
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "(td)", &sample.offset, &sample.value))
+    {
+      g_array_append_val (array, sample);
+    }
+}
+
+/* For samples added after version 1 of the file format - older files simply don't have them */
+static void
+optional_samples_from_gvariant (GArray      *array,
+                                GVariant    *value,
+                                const gchar *key)
+{
+  GVariant *variant = NULL;
+
+  g_array_set_size (array, 0);
+  if (g_variant_lookup (value, key, "@a(td)", &variant))
+    {
+      samples_from_gvariant (array, variant);
+      g_variant_unref (variant);
+    }
+}
+
+static void
+optional_histogram_from_gvariant (GduHistogram *histogram,
+                                  GVariant     *value,
+                                  const gchar  *key)
+{
+  GVariant *variant = NULL;
+
+  gdu_histogram_clear (histogram);
+  if (g_variant_lookup (value, key, "@a(tt)", &variant))
+    {
+      gdu_histogram_set_from_gvariant (histogram, variant);
+      g_variant_unref (variant);
+    }
+}
+
+static gboolean
+maybe_load_data (DialogData  *data,
+                 GError     **error)
+{
+  gboolean ret = FALSE;
+  gchar *filename = NULL;
+  GVariant *value = NULL;
+  gchar *variant_data = NULL;
+  gsize variant_size;
+  GError *local_error = NULL;
+  GVariant *read_samples_variant = NULL;
+  GVariant *write_samples_variant = NULL;
+  GVariant *access_time_samples_variant = NULL;
+  GVariantIter *iter;
+  gint32 version;
+  gint64 timestamp_usec;
+  guint64 device_size;
+  guint64 sample_size;
+  guint n;
+
+  filename = get_bm_filename (data);
+  if (filename == NULL)
+    {
+      /* all good since we don't want to load data for this device */
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!g_file_get_contents (filename,
+                            &variant_data,
+                            &variant_size,
+                            &local_error))
+    {
+      if (local_error->domain == G_FILE_ERROR && local_error->code == G_FILE_ERROR_NOENT)
+        {
+          /* don't complain about a missing file */
+          g_clear_error (&local_error);
+          ret = TRUE;
+          goto out;
+        }
+      g_propagate_error (error, local_error);
+      goto out;
+    }
+
+  value = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
+                                   variant_data,
+                                   variant_size,
+                                   FALSE,
+                                   NULL, NULL);
+
+  if (!g_variant_lookup (value, "version", "i", &version))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No version key");
+      goto out;
+    }
+  if (version != 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Cannot decode version %d data", version);
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "timestamp-usec", "x", &timestamp_usec))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No timestamp-usec");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "device-size", "t", &device_size))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No device-size");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "read-samples", "@a(td)", &read_samples_variant))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No read-samples");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "write-samples", "@a(td)", &write_samples_variant))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No write-samples");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "access-time-samples", "@a(td)", &access_time_samples_variant))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No access-time-samples");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "sample-size", "t", &sample_size))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No sample-size");
+      goto out;
+    }
+
+  data->bm_time_benchmarked_usec = timestamp_usec;
+  data->bm_size = device_size;
+  data->bm_sample_size = sample_size;
+  samples_from_gvariant (data->bm_read_samples, read_samples_variant);
+  samples_from_gvariant (data->bm_write_samples, write_samples_variant);
+  samples_from_gvariant (data->bm_access_time_samples, access_time_samples_variant);
+  optional_samples_from_gvariant (data->bm_iops_read_samples, value, "iops-read-samples");
+  optional_samples_from_gvariant (data->bm_iops_write_samples, value, "iops-write-samples");
+  optional_histogram_from_gvariant (data->bm_read_latency, value, "read-latency-histogram");
+  optional_histogram_from_gvariant (data->bm_write_latency, value, "write-latency-histogram");
+  optional_samples_from_gvariant (data->bm_stream_read_samples, value, "stream-read-samples");
+  optional_samples_from_gvariant (data->bm_stream_write_samples, value, "stream-write-samples");
+  optional_samples_from_gvariant (data->bm_block_size_read_samples, value, "block-size-read-samples");
+  optional_samples_from_gvariant (data->bm_block_size_latency_samples, value, "block-size-latency-samples");
+  optional_samples_from_gvariant (data->bm_sustained_samples, value, "sustained-write-samples");
+  optional_samples_from_gvariant (data->bm_wake_samples, value, "wake-samples");
+  if (!g_variant_lookup (value, "sustained-write-cliff", "t", &data->bm_sustained_cliff))
+    data->bm_sustained_cliff = 0;
+  clear_concurrent_results (data->bm_concurrent_results);
+  data->bm_concurrent_aggregate_rate = 0.0;
+  if (g_variant_lookup (value, "concurrent-read-rates", "a(sd)", &iter))
+    {
+      BMConcurrentResult result;
+      while (g_variant_iter_next (iter, "(sd)", &result.device, &result.read_rate))
+        g_array_append_val (data->bm_concurrent_results, result);
+      g_variant_iter_free (iter);
+      g_variant_lookup (value, "concurrent-aggregate-read-rate", "d", &data->bm_concurrent_aggregate_rate);
+    }
+  for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+    {
+      gchar *key;
+
+      key = g_strdup_printf ("metadata-%s-rate", metadata_op_keys[n]);
+      if (!g_variant_lookup (value, key, "d", &data->bm_metadata_rates[n]))
+        data->bm_metadata_rates[n] = 0.0;
+      g_free (key);
+      key = g_strdup_printf ("metadata-%s-latency-histogram", metadata_op_keys[n]);
+      optional_histogram_from_gvariant (data->bm_metadata_latency[n], value, key);
+      g_free (key);
+    }
+  for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+    {
+      gchar *key;
+
+      key = g_strdup_printf ("sync-write-%u-latency-histogram", sync_write_sizes[n]);
+      optional_histogram_from_gvariant (data->bm_sync_latency[n], value, key);
+      g_free (key);
+    }
+  if (!g_variant_lookup (value, "sync-write-cache", "i", &data->bm_sync_write_cache))
+    data->bm_sync_write_cache = -1;
+  clear_replay_results (data);
+  if (g_variant_lookup (value, "replay-num-requests", "t", &data->bm_replay_num_requests))
+    {
+      g_variant_lookup (value, "replay-duration-usec", "t", &data->bm_replay_duration_usec);
+      g_variant_lookup (value, "replay-trace-duration-usec", "t", &data->bm_replay_trace_duration_usec);
+      optional_histogram_from_gvariant (data->bm_replay_read_latency, value, "replay-read-latency-histogram");
+      optional_histogram_from_gvariant (data->bm_replay_write_latency, value, "replay-write-latency-histogram");
+    }
+
+  ret = TRUE;
+
+ out:
+  if (read_samples_variant != NULL)
+    g_variant_unref (read_samples_variant);
+  if (write_samples_variant != NULL)
+    g_variant_unref (write_samples_variant);
+  if (access_time_samples_variant != NULL)
+    g_variant_unref (access_time_samples_variant);
+  if (value != NULL)
+    g_variant_unref (value);
+  g_free (variant_data);
+  g_free (filename);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static GVariant *
+samples_to_gvariant (GArray *array)
+{
+  guint n;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(td)"));
+  for (n = 0; n < array->len; n++)
+    {
+      BMSample *s = &g_array_index (array, BMSample, n);
+      g_variant_builder_add (&builder, "(td)", s->offset, s->value);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+
+static gboolean
+maybe_save_data (DialogData  *data,
+                 GError     **error)
+{
+  gboolean ret = FALSE;
+  gchar *filename = NULL;
+  GVariantBuilder builder;
+  GVariantBuilder concurrent_builder;
+  GVariant *value = NULL;
+  gconstpointer variant_data;
+  gsize variant_size;
+  guint n;
+
+  filename = get_bm_filename (data);
+  if (filename == NULL)
+    {
+      /* all good since we don't want to save data for this device */
+      ret = TRUE;
+      goto out;
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "version", g_variant_new_int32 (1));
+  g_variant_builder_add (&builder, "{sv}", "timestamp-usec", g_variant_new_int64 (data->bm_time_benchmarked_usec));
+  g_variant_builder_add (&builder, "{sv}", "device-size", g_variant_new_uint64 (data->bm_size));
+  g_variant_builder_add (&builder, "{sv}", "sample-size", g_variant_new_uint64 (data->bm_sample_size));
+  g_variant_builder_add (&builder, "{sv}", "read-samples", samples_to_gvariant (data->bm_read_samples));
+  g_variant_builder_add (&builder, "{sv}", "write-samples", samples_to_gvariant (data->bm_write_samples));
+  g_variant_builder_add (&builder, "{sv}", "access-time-samples", samples_to_gvariant (data->bm_access_time_samples));
+  g_variant_builder_add (&builder, "{sv}", "iops-read-samples", samples_to_gvariant (data->bm_iops_read_samples));
+  g_variant_builder_add (&builder, "{sv}", "iops-write-samples", samples_to_gvariant (data->bm_iops_write_samples));
+  g_variant_builder_add (&builder, "{sv}", "read-latency-histogram", gdu_histogram_to_gvariant (data->bm_read_latency));
+  g_variant_builder_add (&builder, "{sv}", "write-latency-histogram", gdu_histogram_to_gvariant (data->bm_write_latency));
+  g_variant_builder_add (&builder, "{sv}", "stream-read-samples", samples_to_gvariant (data->bm_stream_read_samples));
+  g_variant_builder_add (&builder, "{sv}", "stream-write-samples", samples_to_gvariant (data->bm_stream_write_samples));
+  g_variant_builder_add (&builder, "{sv}", "block-size-read-samples", samples_to_gvariant (data->bm_block_size_read_samples));
+  g_variant_builder_add (&builder, "{sv}", "block-size-latency-samples", samples_to_gvariant (data->bm_block_size_latency_samples));
+  g_variant_builder_add (&builder, "{sv}", "sustained-write-samples", samples_to_gvariant (data->bm_sustained_samples));
+  g_variant_builder_add (&builder, "{sv}", "wake-samples", samples_to_gvariant (data->bm_wake_samples));
+  g_variant_builder_add (&builder, "{sv}", "sustained-write-cliff", g_variant_new_uint64 (data->bm_sustained_cliff));
+  g_variant_builder_init (&concurrent_builder, G_VARIANT_TYPE ("a(sd)"));
+  for (n = 0; n < data->bm_concurrent_results->len; n++)
+    {
+      BMConcurrentResult *result = &g_array_index (data->bm_concurrent_results, BMConcurrentResult, n);
+      g_variant_builder_add (&concurrent_builder, "(sd)", result->device, result->read_rate);
+    }
+  g_variant_builder_add (&builder, "{sv}", "concurrent-read-rates", g_variant_builder_end (&concurrent_builder));
+  g_variant_builder_add (&builder, "{sv}", "concurrent-aggregate-read-rate", g_variant_new_double (data->bm_concurrent_aggregate_rate));
+  for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+    {
+      gchar *key;
+
+      key = g_strdup_printf ("metadata-%s-rate", metadata_op_keys[n]);
+      g_variant_builder_add (&builder, "{sv}", key, g_variant_new_double (data->bm_metadata_rates[n]));
+      g_free (key);
+      key = g_strdup_printf ("metadata-%s-latency-histogram", metadata_op_keys[n]);
+      g_variant_builder_add (&builder, "{sv}", key, gdu_histogram_to_gvariant (data->bm_metadata_latency[n]));
+      g_free (key);
+    }
+  for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+    {
+      gchar *key;
+
+      key = g_strdup_printf ("sync-write-%u-latency-histogram", sync_write_sizes[n]);
+      g_variant_builder_add (&builder, "{sv}", key, gdu_histogram_to_gvariant (data->bm_sync_latency[n]));
+      g_free (key);
+    }
+  g_variant_builder_add (&builder, "{sv}", "sync-write-cache", g_variant_new_int32 (data->bm_sync_write_cache));
+  g_variant_builder_add (&builder, "{sv}", "replay-num-requests", g_variant_new_uint64 (data->bm_replay_num_requests));
+  g_variant_builder_add (&builder, "{sv}", "replay-duration-usec", g_variant_new_uint64 (data->bm_replay_duration_usec));
+  g_variant_builder_add (&builder, "{sv}", "replay-trace-duration-usec", g_variant_new_uint64 (data->bm_replay_trace_duration_usec));
+  g_variant_builder_add (&builder, "{sv}", "replay-read-latency-histogram", gdu_histogram_to_gvariant (data->bm_replay_read_latency));
+  g_variant_builder_add (&builder, "{sv}", "replay-write-latency-histogram", gdu_histogram_to_gvariant (data->bm_replay_write_latency));
+  value = g_variant_builder_end (&builder);
+
+  variant_data = g_variant_get_data (value);
+  variant_size = g_variant_get_size (value);
+
+  if (!g_file_set_contents (filename,
+                            variant_data,
+                            variant_size,
+                            error))
+    goto out;
+
+  ret = TRUE;
+
+ out:
+  if (value != NULL)
+    g_variant_unref (value);
+  g_free (filename);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* called on main / UI thread */
+static gboolean
+bmt_on_timeout (gpointer user_data)
+{
+  DialogData *data = user_data;
+  if (data->dialog != NULL)
+    update_dialog (data);
+  G_LOCK (bm_lock);
+  data->bm_update_timeout_pending = FALSE;
+  G_UNLOCK (bm_lock);
+  dialog_data_unref (data);
+  return FALSE; /* don't run again */
+}
+
+static void
+bmt_schedule_update (DialogData *data)
+{
+  /* rate-limit updates */
+  G_LOCK (bm_lock);
+  if (!data->bm_update_timeout_pending)
+    {
+      g_timeout_add (200, /* ms */
+                     bmt_on_timeout,
+                     dialog_data_ref (data));
+      data->bm_update_timeout_pending = TRUE;
+    }
+  G_UNLOCK (bm_lock);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Lets a number of threads start doing I/O at the same moment, as many
+ * times as needed
+ */
+typedef struct
+{
+  GMutex mutex;
+  GCond cond;
+  guint num_threads;
+  guint num_waiting;
+  guint generation;
+  gint64 start_usec;
+} BMBarrier;
+
+/* Blocks until all @barrier->num_threads threads have called this and
+ * returns the time they were released at
+ */
+static gint64
+bm_barrier_wait (BMBarrier *barrier)
+{
+  gint64 ret;
+  guint generation;
+
+  g_mutex_lock (&barrier->mutex);
+  generation = barrier->generation;
+  barrier->num_waiting++;
+  if (barrier->num_waiting == barrier->num_threads)
+    {
+      barrier->start_usec = g_get_monotonic_time ();
+      barrier->num_waiting = 0;
+      barrier->generation++;
+      g_cond_broadcast (&barrier->cond);
+    }
+  else
+    {
+      while (generation == barrier->generation)
+        g_cond_wait (&barrier->cond, &barrier->mutex);
+    }
+  ret = barrier->start_usec;
+  g_mutex_unlock (&barrier->mutex);
+
+  return ret;
+}
+
+/* Writes are measured in passes so the contents of the disk is not
+ * changed: each worker first reads what it is going to write, then all
+ * workers write it back at the same time. Only the time from the first
+ * to the last worker being done writing counts.
+ */
+typedef struct
+{
+  BMBarrier barrier; /* num_threads is the number of workers + 1 */
+  gboolean done;
+  volatile gint failed;
+} BMWritePasses;
+
+/* Called by each worker when it has read what to write in this pass.
+ * Returns when all workers have.
+ */
+static void
+bm_write_passes_begin_write (BMWritePasses *passes)
+{
+  bm_barrier_wait (&passes->barrier);
+}
+
+/* Called by each worker when it is done writing in this pass. Returns
+ * FALSE if there are no more passes.
+ */
+static gboolean
+bm_write_passes_end_write (BMWritePasses *passes)
+{
+  bm_barrier_wait (&passes->barrier);
+  /* wait for bm_write_passes_run() to decide if we're done */
+  bm_barrier_wait (&passes->barrier);
+  return !passes->done;
+}
+
+/* Runs passes until @duration_usec have been spent writing or a worker
+ * failed and returns the time spent writing
+ */
+static gint64
+bm_write_passes_run (BMWritePasses *passes,
+                     gint64         duration_usec,
+                     GCancellable  *cancellable)
+{
+  gint64 write_usec = 0;
+
+  while (!passes->done)
+    {
+      gint64 begin_usec;
+
+      begin_usec = bm_barrier_wait (&passes->barrier);
+      write_usec += bm_barrier_wait (&passes->barrier) - begin_usec;
+      if (write_usec >= duration_usec ||
+          g_atomic_int_get (&passes->failed) ||
+          g_cancellable_is_cancelled (cancellable))
+        passes->done = TRUE;
+      bm_barrier_wait (&passes->barrier);
+    }
+  return write_usec;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* udisks only gives us a plain fd (and io_uring/libaio is not something
+ * we can depend on) so a queue depth of N is emulated by N threads each
+ * doing synchronous I/O on the (O_DIRECT) fd.
+ */
+typedef struct
+{
+  gint fd;
+  guint64 disk_size;
+  long page_size;
+  gint64 end_usec;
+  GCancellable *cancellable;
+  guint32 seed;
+  /* only set when measuring writes */
+  BMWritePasses *passes;
+
+  /* set by the worker */
+  guint64 num_ops;
+  GduHistogram *latency;
+  GError *error;
+} IopsWorker;
+
+/* Reads a random page into @buffer, returning its offset in @out_offset */
+static gboolean
+iops_read_random_page (IopsWorker *worker,
+                       GRand      *rand,
+                       guchar     *buffer,
+                       guint64    *out_offset)
+{
+  guint64 offset;
+
+  if (g_cancellable_set_error_if_cancelled (worker->cancellable, &worker->error))
+    return FALSE;
+
+  offset = (guint64) g_rand_double_range (rand, 0, (gdouble) (worker->disk_size - worker->page_size));
+  offset &= ~(worker->page_size - 1);
+
+  if (pread (worker->fd, buffer, worker->page_size, offset) != worker->page_size)
+    {
+      g_set_error (&worker->error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error reading %lld bytes from offset %lld: %m"),
+                   (long long int) worker->page_size,
+                   (long long int) offset);
+      return FALSE;
+    }
+  *out_offset = offset;
+  return TRUE;
+}
+
+static gpointer
+iops_worker_thread (gpointer user_data)
+{
+  IopsWorker *worker = user_data;
+  guint num_pages;
+  guint64 *offsets;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  GRand *rand;
+  guint n;
+
+  num_pages = worker->passes != NULL ? IOPS_WRITE_PASS_NUM_OPS : 1;
+  offsets = g_new0 (guint64, num_pages);
+  buffer_unaligned = g_new0 (guchar, (num_pages + 1) * worker->page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + worker->page_size)) & (~(worker->page_size - 1)));
+  rand = g_rand_new_with_seed (worker->seed);
+
+  if (worker->passes == NULL)
+    {
+      while (g_get_monotonic_time () < worker->end_usec)
+        {
+          gint64 begin_usec;
+          gint64 end_usec;
+
+          begin_usec = g_get_monotonic_time ();
+          if (!iops_read_random_page (worker, rand, buffer, &offsets[0]))
+            break;
+          end_usec = g_get_monotonic_time ();
+          worker->num_ops++;
+          gdu_histogram_add (worker->latency, end_usec - begin_usec);
+        }
+      goto out;
+    }
+
+  do
+    {
+      guint num_read = 0;
+
+      /* read the pages first so writing them back doesn't change the contents of the disk */
+      while (worker->error == NULL && num_read < num_pages)
+        {
+          if (!iops_read_random_page (worker, rand, buffer + num_read * worker->page_size, &offsets[num_read]))
+            g_atomic_int_set (&worker->passes->failed, TRUE);
+          else
+            num_read++;
+        }
+
+      bm_write_passes_begin_write (worker->passes);
+      for (n = 0; worker->error == NULL && n < num_read; n++)
+        {
+          gint64 begin_usec;
+          gint64 end_usec;
+
+          begin_usec = g_get_monotonic_time ();
+          if (pwrite (worker->fd, buffer + n * worker->page_size, worker->page_size, offsets[n]) != worker->page_size)
+            {
+              g_set_error (&worker->error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                           (long long int) worker->page_size,
+                           (long long int) offsets[n]);
+              g_atomic_int_set (&worker->passes->failed, TRUE);
+              break;
+            }
+          end_usec = g_get_monotonic_time ();
+          worker->num_ops++;
+          gdu_histogram_add (worker->latency, end_usec - begin_usec);
+        }
+    }
+  while (bm_write_passes_end_write (worker->passes));
+
+ out:
+  g_rand_free (rand);
+  g_free (buffer_unaligned);
+  g_free (offsets);
+  return NULL;
+}
+
+/* Runs @queue_depth workers for bm_iops_duration_sec seconds and returns the number of IOPS achieved */
+static gboolean
+measure_iops (DialogData  *data,
+              gint         fd,
+              guint64      disk_size,
+              long         page_size,
+              guint        queue_depth,
+              gboolean     do_write,
+              gdouble     *out_iops,
+              GError     **error)
+{
+  gboolean ret = FALSE;
+  IopsWorker *workers;
+  GThread **threads;
+  BMWritePasses passes = {{0}};
+  gint64 begin_usec;
+  gint64 io_usec = 0;
+  guint64 num_ops = 0;
+  guint n;
+
+  workers = g_new0 (IopsWorker, queue_depth);
+  threads = g_new0 (GThread *, queue_depth);
+
+  passes.barrier.num_threads = queue_depth + 1;
+
+  begin_usec = g_get_monotonic_time ();
+  for (n = 0; n < queue_depth; n++)
+    {
+      workers[n].fd = fd;
+      workers[n].disk_size = disk_size;
+      workers[n].page_size = page_size;
+      workers[n].end_usec = begin_usec + data->bm_iops_duration_sec * G_USEC_PER_SEC;
+      workers[n].cancellable = data->bm_cancellable;
+      workers[n].seed = 42 + n; /* want this to be repeatable, just like the access time samples */
+      workers[n].passes = do_write ? &passes : NULL;
+      workers[n].latency = gdu_histogram_new ();
+      threads[n] = g_thread_new ("benchmark-iops-thread", iops_worker_thread, &workers[n]);
+    }
+  if (do_write)
+    io_usec = bm_write_passes_run (&passes, data->bm_iops_duration_sec * G_USEC_PER_SEC, data->bm_cancellable);
+  for (n = 0; n < queue_depth; n++)
+    g_thread_join (threads[n]);
+  if (!do_write)
+    io_usec = g_get_monotonic_time () - begin_usec;
+
+  for (n = 0; n < queue_depth; n++)
+    {
+      if (workers[n].error != NULL)
+        {
+          g_propagate_error (error, workers[n].error);
+          workers[n].error = NULL;
+          goto out;
+        }
+      num_ops += workers[n].num_ops;
+      G_LOCK (bm_lock);
+      gdu_histogram_merge (do_write ? data->bm_write_latency : data->bm_read_latency, workers[n].latency);
+      G_UNLOCK (bm_lock);
+    }
+
+  *out_iops = io_usec > 0 ? ((gdouble) G_USEC_PER_SEC) * num_ops / io_usec : 0.0;
+  ret = TRUE;
+
+ out:
+  for (n = 0; n < queue_depth; n++)
+    {
+      if (workers[n].error != NULL)
+        g_error_free (workers[n].error);
+      gdu_histogram_free (workers[n].latency);
+    }
+  g_free (threads);
+  g_free (workers);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+  gint fd;
+  guint64 region_offset;
+  guint64 region_size;
+  gsize request_size;
+  long page_size;
+  gint64 end_usec;
+  GCancellable *cancellable;
+  /* only set when measuring writes */
+  BMWritePasses *passes;
+
+  /* set by the worker */
+  guint64 num_bytes;
+  GError *error;
+} StreamWorker;
+
+/* Reads the next request of the region assigned to the worker into @buffer */
+static gboolean
+stream_read_next (StreamWorker *worker,
+                  guint64      *pos,
+                  guchar       *buffer,
+                  guint64      *out_offset)
+{
+  guint64 offset;
+
+  if (g_cancellable_set_error_if_cancelled (worker->cancellable, &worker->error))
+    return FALSE;
+
+  /* start over if we reach the end of the region before time is up */
+  if (*pos + worker->request_size > worker->region_size)
+    *pos = 0;
+  offset = worker->region_offset + *pos;
+
+  if (pread (worker->fd, buffer, worker->request_size, offset) != (ssize_t) worker->request_size)
+    {
+      g_set_error (&worker->error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error reading %lld bytes from offset %lld: %m"),
+                   (long long int) worker->request_size,
+                   (long long int) offset);
+      return FALSE;
+    }
+  *pos += worker->request_size;
+  *out_offset = offset;
+  return TRUE;
+}
+
+/* Reads (or rewrites) the region assigned to the worker from start to end until time is up */
+static gpointer
+stream_worker_thread (gpointer user_data)
+{
+  StreamWorker *worker = user_data;
+  guint num_requests;
+  guint64 *offsets;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  guint64 pos = 0;
+  guint n;
+
+  num_requests = 1;
+  if (worker->passes != NULL)
+    num_requests = MAX (STREAMS_WRITE_PASS_SIZE / worker->request_size, 1);
+  offsets = g_new0 (guint64, num_requests);
+  buffer_unaligned = g_new0 (guchar, num_requests * worker->request_size + worker->page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + worker->page_size)) & (~(worker->page_size - 1)));
+
+  if (worker->passes == NULL)
+    {
+      while (g_get_monotonic_time () < worker->end_usec)
+        {
+          if (!stream_read_next (worker, &pos, buffer, &offsets[0]))
+            break;
+          worker->num_bytes += worker->request_size;
+        }
+      goto out;
+    }
+
+  /* as with random writes, see BMWritePasses */
+  do
+    {
+      guint num_read = 0;
+
+      while (worker->error == NULL && num_read < num_requests)
+        {
+          if (!stream_read_next (worker, &pos, buffer + num_read * worker->request_size, &offsets[num_read]))
+            g_atomic_int_set (&worker->passes->failed, TRUE);
+          else
+            num_read++;
+        }
+
+      bm_write_passes_begin_write (worker->passes);
+      for (n = 0; worker->error == NULL && n < num_read; n++)
+        {
+          if (pwrite (worker->fd, buffer + n * worker->request_size, worker->request_size, offsets[n]) != (ssize_t) worker->request_size)
+            {
+              g_set_error (&worker->error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                           (long long int) worker->request_size,
+                           (long long int) offsets[n]);
+              g_atomic_int_set (&worker->passes->failed, TRUE);
+              break;
+            }
+          worker->num_bytes += worker->request_size;
+        }
+    }
+  while (bm_write_passes_end_write (worker->passes));
+
+ out:
+  g_free (buffer_unaligned);
+  g_free (offsets);
+  return NULL;
+}
+
+/* Runs @num_streams sequential streams on disjoint areas of the device
+ * for STREAMS_DURATION_SEC seconds and returns the combined transfer rate
+ */
+static gboolean
+measure_streams (DialogData  *data,
+                 gint         fd,
+                 guint64      disk_size,
+                 long         page_size,
+                 guint        num_streams,
+                 gboolean     do_write,
+                 gdouble     *out_bytes_per_sec,
+                 GError     **error)
+{
+  gboolean ret = FALSE;
+  StreamWorker *workers;
+  GThread **threads;
+  BMWritePasses passes = {{0}};
+  guint64 region_size;
+  gint64 begin_usec;
+  gint64 io_usec = 0;
+  guint64 num_bytes = 0;
+  guint n;
+
+  region_size = (disk_size / num_streams) & ~(page_size - 1);
+
+  workers = g_new0 (StreamWorker, num_streams);
+  threads = g_new0 (GThread *, num_streams);
+
+  passes.barrier.num_threads = num_streams + 1;
+
+  begin_usec = g_get_monotonic_time ();
+  for (n = 0; n < num_streams; n++)
+    {
+      workers[n].fd = fd;
+      workers[n].region_offset = n * region_size;
+      workers[n].region_size = region_size;
+      workers[n].request_size = MIN (MIN (data->bm_sample_size, STREAMS_MAX_REQUEST_SIZE), region_size);
+      workers[n].page_size = page_size;
+      workers[n].end_usec = begin_usec + STREAMS_DURATION_SEC * G_USEC_PER_SEC;
+      workers[n].cancellable = data->bm_cancellable;
+      workers[n].passes = do_write ? &passes : NULL;
+      threads[n] = g_thread_new ("benchmark-stream-thread", stream_worker_thread, &workers[n]);
+    }
+  if (do_write)
+    io_usec = bm_write_passes_run (&passes, STREAMS_DURATION_SEC * G_USEC_PER_SEC, data->bm_cancellable);
+  for (n = 0; n < num_streams; n++)
+    g_thread_join (threads[n]);
+  if (!do_write)
+    io_usec = g_get_monotonic_time () - begin_usec;
+
+  for (n = 0; n < num_streams; n++)
+    {
+      if (workers[n].error != NULL)
+        {
+          g_propagate_error (error, workers[n].error);
+          workers[n].error = NULL;
+          goto out;
+        }
+      num_bytes += workers[n].num_bytes;
+    }
+
+  *out_bytes_per_sec = io_usec > 0 ? ((gdouble) G_USEC_PER_SEC) * num_bytes / io_usec : 0.0;
+  ret = TRUE;
+
+ out:
+  for (n = 0; n < num_streams; n++)
+    {
+      if (workers[n].error != NULL)
+        g_error_free (workers[n].error);
+    }
+  g_free (threads);
+  g_free (workers);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Reads sequentially using @block_size requests for BLOCK_SIZE_DURATION_SEC
+ * seconds (or BLOCK_SIZE_MAX_BYTES bytes) starting at @offset. Returns
+ * the transfer rate and the average time each request took.
+ */
+static gboolean
+measure_block_size (DialogData  *data,
+                    gint         fd,
+                    guchar      *buffer,
+                    guint64      offset,
+                    guint64      end_offset,
+                    gsize        block_size,
+                    gdouble     *out_bytes_per_sec,
+                    gdouble     *out_latency,
+                    GError     **error)
+{
+  gint64 begin_usec;
+  gint64 now_usec;
+  guint64 num_bytes = 0;
+  guint num_requests = 0;
+
+  begin_usec = now_usec = g_get_monotonic_time ();
+  while (now_usec - begin_usec < BLOCK_SIZE_DURATION_SEC * G_USEC_PER_SEC &&
+         num_bytes < BLOCK_SIZE_MAX_BYTES &&
+         offset + block_size <= end_offset)
+    {
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, error))
+        return FALSE;
+
+      if (pread (fd, buffer, block_size, offset) != (ssize_t) block_size)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error reading %lld bytes from offset %lld: %m"),
+                       (long long int) block_size,
+                       (long long int) offset);
+          return FALSE;
+        }
+      now_usec = g_get_monotonic_time ();
+      offset += block_size;
+      num_bytes += block_size;
+      num_requests++;
+    }
+
+  if (num_requests == 0 || now_usec == begin_usec)
+    {
+      *out_bytes_per_sec = 0.0;
+      *out_latency = 0.0;
+    }
+  else
+    {
+      *out_bytes_per_sec = ((gdouble) G_USEC_PER_SEC) * num_bytes / (now_usec - begin_usec);
+      *out_latency = (now_usec - begin_usec) / ((gdouble) G_USEC_PER_SEC) / num_requests;
+    }
+  return TRUE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Returns how much was written when the transfer rate in @samples dropped
+ * below SUSTAINED_CLIFF_RATIO of the initial rate for good, or 0 if it didn't
+ */
+static guint64
+find_sustained_write_cliff (GArray *samples)
+{
+  gdouble initial = 0.0;
+  gdouble remaining_sum = 0.0;
+  guint n;
+
+  if (samples->len < 4)
+    return 0;
+
+  /* the first window may include some warm-up so use the best of the first few */
+  for (n = 0; n < 3; n++)
+    initial = MAX (initial, g_array_index (samples, BMSample, n).value);
+
+  for (n = 0; n < samples->len; n++)
+    remaining_sum += g_array_index (samples, BMSample, n).value;
+
+  for (n = 0; n < samples->len; n++)
+    {
+      BMSample *s = &g_array_index (samples, BMSample, n);
+      /* ... a single slow window doesn't count, everything after it must be slow too */
+      if (s->value < SUSTAINED_CLIFF_RATIO * initial &&
+          remaining_sum / (samples->len - n) < SUSTAINED_CLIFF_RATIO * initial)
+        {
+          /* the cache ran out somewhere in the window before this sample */
+          return n > 0 ? g_array_index (samples, BMSample, n - 1).offset : 0;
+        }
+      remaining_sum -= s->value;
+    }
+  return 0;
+}
+
+typedef struct
+{
+  gint fd;
+  GduBufferRing *ring;
+  guint64 offset;
+  guint64 end_offset;
+  GError *error;
+} SustainedReader;
+
+/* Reads the area to write, request by request, into the ring */
+static gpointer
+sustained_read_thread_func (gpointer user_data)
+{
+  SustainedReader *reader = user_data;
+  guint64 offset;
+
+  for (offset = reader->offset; offset + SUSTAINED_REQUEST_SIZE <= reader->end_offset; offset += SUSTAINED_REQUEST_SIZE)
+    {
+      guchar *buffer;
+
+      buffer = gdu_buffer_ring_begin_write (reader->ring);
+      if (buffer == NULL)
+        goto out;
+      if (pread (reader->fd, buffer, SUSTAINED_REQUEST_SIZE, offset) != SUSTAINED_REQUEST_SIZE)
+        {
+          g_set_error (&reader->error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error reading %lld bytes from offset %lld: %m"),
+                       (long long int) SUSTAINED_REQUEST_SIZE,
+                       (long long int) offset);
+          gdu_buffer_ring_abort (reader->ring);
+          goto out;
         }
-#endif
+      gdu_buffer_ring_end_write (reader->ring, offset, SUSTAINED_REQUEST_SIZE);
+    }
+  gdu_buffer_ring_close (reader->ring);
 
-        g_strfreev (y_left_markers);
-        g_strfreev (y_right_markers);
+ out:
+  return NULL;
+}
+
+static void
+sustained_write_add_sample (DialogData *data,
+                            guint64     num_written,
+                            guint64     window_size,
+                            gint64      window_usec)
+{
+  BMSample sample = {0};
 
+  sample.offset = num_written;
+  sample.value = window_usec > 0 ? ((gdouble) G_USEC_PER_SEC) * window_size / window_usec : 0.0;
+  G_LOCK (bm_lock);
+  g_array_append_val (data->bm_sustained_samples, sample);
   G_UNLOCK (bm_lock);
+  bmt_schedule_update (data);
+}
 
-  /* propagate event further */
-  return FALSE;
+/* Writes continuously to the area given by the user. So the contents of
+ * the disk is not changed, what is written is what was there before -
+ * it is read by another thread, ahead of writing, so writing never
+ * stops and the disk gets no time to empty its write cache. The fd is
+ * opened with O_DIRECT so each window is timed when its last request
+ * has been written, without syncing in between.
+ */
+static gboolean
+measure_sustained_write (DialogData  *data,
+                         gint         fd,
+                         guint64      disk_size,
+                         long         page_size,
+                         GError     **error)
+{
+  gboolean ret = FALSE;
+  SustainedReader reader = {0};
+  GThread *read_thread = NULL;
+  const guchar *buffer;
+  guint64 pos;
+  gsize size;
+  guint64 num_written = 0;
+  guint64 window_written = 0;
+  gint64 window_begin_usec = -1;
+  gint64 now_usec;
+
+  reader.fd = fd;
+  reader.offset = (disk_size / 100 * data->bm_sustained_start_percent) & ~(page_size - 1);
+  reader.end_offset = MIN (reader.offset + data->bm_sustained_size, disk_size);
+  reader.ring = gdu_buffer_ring_new (SUSTAINED_WINDOW_SIZE / SUSTAINED_REQUEST_SIZE, SUSTAINED_REQUEST_SIZE, 1);
+  read_thread = g_thread_new ("sustained-read-thread", sustained_read_thread_func, &reader);
+
+  while ((buffer = gdu_buffer_ring_begin_read (reader.ring, 0, &pos, &size)) != NULL)
+    {
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, error))
+        goto out;
+
+      /* don't count waiting for the first request to be read */
+      if (window_begin_usec < 0)
+        window_begin_usec = g_get_monotonic_time ();
+
+      if (pwrite (fd, buffer, size, pos) != (ssize_t) size)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                       (long long int) size,
+                       (long long int) pos);
+          goto out;
+        }
+      gdu_buffer_ring_end_read (reader.ring, 0);
+      num_written += size;
+      window_written += size;
+
+      if (window_written == SUSTAINED_WINDOW_SIZE)
+        {
+          now_usec = g_get_monotonic_time ();
+          sustained_write_add_sample (data, num_written, window_written, now_usec - window_begin_usec);
+          window_begin_usec = now_usec;
+          window_written = 0;
+        }
+    }
+
+  /* the ring is aborted if reading failed */
+  g_thread_join (read_thread);
+  read_thread = NULL;
+  if (reader.error != NULL)
+    {
+      g_propagate_error (error, reader.error);
+      reader.error = NULL;
+      goto out;
+    }
+
+  /* the last window is shorter and includes making sure everything has been written */
+  if (fdatasync (fd) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error syncing (at offset %lld): %m"),
+                   (long long int) reader.end_offset);
+      goto out;
+    }
+  if (window_written > 0)
+    sustained_write_add_sample (data, num_written, window_written, g_get_monotonic_time () - window_begin_usec);
+
+  G_LOCK (bm_lock);
+  data->bm_sustained_cliff = find_sustained_write_cliff (data->bm_sustained_samples);
+  G_UNLOCK (bm_lock);
+
+  ret = TRUE;
+
+ out:
+  if (read_thread != NULL)
+    {
+      /* stop reading if writing failed or was canceled */
+      gdu_buffer_ring_abort (reader.ring);
+      g_thread_join (read_thread);
+    }
+  gdu_buffer_ring_free (reader.ring);
+  g_clear_error (&reader.error);
+  return ret;
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
+typedef struct
+{
+  gint fd;
+  gboolean close_fd;
+  gchar *device;
+  guint64 disk_size;
+  long page_size;
+  gsize sample_size;
+  gint num_samples;
+  BMBarrier *barrier;
+  GCancellable *cancellable;
 
-static gchar *
-format_transfer_rate (gdouble bytes_per_sec)
+  /* set by the worker */
+  guint64 num_bytes;
+  GError *error;
+} ConcurrentWorker;
+
+/* Reads @sample_size bytes at a time from the same @num_samples offsets as
+ * the transfer rate test, over and over, until CONCURRENT_DURATION_SEC
+ * seconds have passed since all workers started
+ */
+static gpointer
+concurrent_worker_thread (gpointer user_data)
 {
-  gchar *ret = NULL;
-  gchar *s;
+  ConcurrentWorker *worker = user_data;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  gint64 end_usec;
+  guint n = 0;
 
-  s = g_format_size ((guint64) bytes_per_sec);
-  /* Translators: %s is the formatted size, e.g. "42 MB" and the trailing "/s" means per second */
-  ret = g_strdup_printf (C_("benchmark-transfer-rate", "%s/s"), s);
-  g_free (s);
+  buffer_unaligned = g_new0 (guchar, worker->sample_size + worker->page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + worker->page_size)) & (~(worker->page_size - 1)));
+
+  end_usec = bm_barrier_wait (worker->barrier) + CONCURRENT_DURATION_SEC * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < end_usec)
+    {
+      gint64 offset;
+      gsize size;
+      ssize_t num_read;
+
+      if (g_cancellable_set_error_if_cancelled (worker->cancellable, &worker->error))
+        break;
+
+      offset = (n % worker->num_samples) * worker->disk_size / worker->num_samples;
+      offset &= ~(worker->page_size - 1);
+      size = MIN (worker->sample_size, worker->disk_size - offset);
+      num_read = pread (worker->fd, buffer, size, offset);
+      if (num_read < 0)
+        {
+          g_set_error (&worker->error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error reading %lld bytes from offset %lld on %s"),
+                       (long long int) size,
+                       (long long int) offset,
+                       worker->device);
+          break;
+        }
+      worker->num_bytes += num_read;
+      n++;
+    }
+
+  g_free (buffer_unaligned);
+  return NULL;
+}
+
+/* Reads from the disk being benchmarked and data->bm_concurrent_blocks at the
+ * same time and records the transfer rate of each disk and all combined
+ */
+static gboolean
+measure_concurrent (DialogData  *data,
+                    gint         fd,
+                    guint64      disk_size,
+                    long         page_size,
+                    GError     **error)
+{
+  gboolean ret = FALSE;
+  ConcurrentWorker *workers;
+  GThread **threads;
+  BMBarrier barrier = {0};
+  guint num_workers;
+  guint64 num_bytes = 0;
+  GList *l;
+  guint n;
+
+  num_workers = g_list_length (data->bm_concurrent_blocks) + 1;
+  workers = g_new0 (ConcurrentWorker, num_workers);
+  threads = g_new0 (GThread *, num_workers);
+  for (n = 0; n < num_workers; n++)
+    workers[n].fd = -1;
+
+  workers[0].fd = fd;
+  workers[0].device = g_strdup (udisks_block_get_preferred_device (data->block));
+  workers[0].disk_size = disk_size;
+
+  /* open all the other disks before starting so they can all start at the same time */
+  for (l = data->bm_concurrent_blocks, n = 1; l != NULL; l = l->next, n++)
+    {
+      UDisksBlock *block = UDISKS_BLOCK (l->data);
+
+      workers[n].device = g_strdup (udisks_block_get_preferred_device (block));
+      workers[n].fd = gdu_copy_utils_open_for_benchmark (block, FALSE, data->bm_cancellable, error);
+      workers[n].close_fd = TRUE;
+      if (workers[n].fd == -1 ||
+          !gdu_copy_utils_get_size (workers[n].fd, &workers[n].disk_size, error))
+        {
+          g_prefix_error (error, "%s: ", workers[n].device);
+          goto out;
+        }
+    }
+
+  barrier.num_threads = num_workers;
+  g_mutex_init (&barrier.mutex);
+  g_cond_init (&barrier.cond);
+  for (n = 0; n < num_workers; n++)
+    {
+      workers[n].page_size = page_size;
+      workers[n].sample_size = data->bm_sample_size_mib * 1024 * 1024;
+      workers[n].num_samples = data->bm_num_samples;
+      workers[n].barrier = &barrier;
+      workers[n].cancellable = data->bm_cancellable;
+      threads[n] = g_thread_new ("benchmark-concurrent", concurrent_worker_thread, &workers[n]);
+    }
+  for (n = 0; n < num_workers; n++)
+    g_thread_join (threads[n]);
+  g_cond_clear (&barrier.cond);
+  g_mutex_clear (&barrier.mutex);
+
+  for (n = 0; n < num_workers; n++)
+    {
+      if (workers[n].error != NULL)
+        {
+          g_propagate_error (error, workers[n].error);
+          workers[n].error = NULL;
+          goto out;
+        }
+    }
+
+  /* all disks read for exactly the same period of time */
+  G_LOCK (bm_lock);
+  for (n = 0; n < num_workers; n++)
+    {
+      BMConcurrentResult result;
+      result.device = workers[n].device;
+      result.read_rate = ((gdouble) workers[n].num_bytes) / CONCURRENT_DURATION_SEC;
+      g_array_append_val (data->bm_concurrent_results, result);
+      workers[n].device = NULL; /* now owned by bm_concurrent_results */
+      num_bytes += workers[n].num_bytes;
+    }
+  data->bm_concurrent_aggregate_rate = ((gdouble) num_bytes) / CONCURRENT_DURATION_SEC;
+  G_UNLOCK (bm_lock);
+
+  ret = TRUE;
+
+ out:
+  for (n = 0; n < num_workers; n++)
+    {
+      if (workers[n].close_fd && workers[n].fd != -1)
+        close (workers[n].fd);
+      if (workers[n].error != NULL)
+        g_error_free (workers[n].error);
+      g_free (workers[n].device);
+    }
+  g_free (threads);
+  g_free (workers);
   return ret;
 }
 
-static gchar *
-format_transfer_rate_and_num_samples (gdouble bytes_per_sec,
-                                      guint   num_samples)
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
 {
-  gchar *ret = NULL;
-  gchar *s;
-  gchar *s2;
+  DialogData *data;
+  gchar *dir; /* of this worker, with METADATA_NUM_DIRS directories in it */
+  BMBarrier *barrier;
+  gboolean report_progress;
 
-  s = format_transfer_rate (bytes_per_sec);
-  s2 = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
-                                     "%u sample",
-                                     "%u samples",
-                                     num_samples),
-                        num_samples);
-  ret = g_strdup_printf ("%s <small>(%s)</small>", s, s2);
-  g_free (s2);
-  g_free (s);
+  /* set by the worker */
+  GduHistogram *latency[BM_METADATA_NUM_OPS];
+  gint64 start_usec[BM_METADATA_NUM_OPS];
+  gint64 end_usec[BM_METADATA_NUM_OPS];
+  GError *error;
+} MetadataWorker;
+
+static gboolean
+sync_directory (const gchar *dir)
+{
+  gboolean ret = FALSE;
+  gint fd;
+
+  fd = open (dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1)
+    {
+      ret = (fsync (fd) == 0);
+      close (fd);
+    }
   return ret;
 }
 
+static gboolean
+do_metadata_op (BMMetadataOp   op,
+                const gchar   *dir,
+                const gchar   *path,
+                const gchar   *renamed_path,
+                const guchar  *buffer,
+                gboolean       do_fsync,
+                GError       **error)
+{
+  const gchar *failed_path = path;
+  struct stat statbuf;
+  gint fd;
 
-static void
-update_updated_label (DialogData *data)
+  switch (op)
+    {
+    case BM_METADATA_OP_CREATE:
+      fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+      if (fd == -1)
+        goto error;
+      if (write (fd, buffer, METADATA_FILE_SIZE) != METADATA_FILE_SIZE ||
+          (do_fsync && fsync (fd) != 0))
+        {
+          gint errsv = errno;
+          close (fd);
+          errno = errsv;
+          goto error;
+        }
+      close (fd);
+      break;
+
+    case BM_METADATA_OP_STAT:
+      if (stat (path, &statbuf) != 0)
+        goto error;
+      break;
+
+    case BM_METADATA_OP_RENAME:
+      if (rename (path, renamed_path) != 0)
+        goto error;
+      break;
+
+    case BM_METADATA_OP_UNLINK:
+      failed_path = renamed_path;
+      if (unlink (renamed_path) != 0)
+        goto error;
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  /* also make the change to the directory itself durable */
+  failed_path = dir;
+  if (do_fsync && op != BM_METADATA_OP_STAT && !sync_directory (dir))
+    goto error;
+
+  return TRUE;
+
+ error:
+  g_set_error (error,
+               G_IO_ERROR,
+               g_io_error_from_errno (errno),
+               C_("benchmarking", "Error accessing %s: %m"),
+               failed_path);
+  return FALSE;
+}
+
+/* Does each kind of operation on all the files of the worker, starting
+ * at the same moment as the other workers for each kind
+ */
+static gpointer
+metadata_worker_thread (gpointer user_data)
 {
-  gchar *s = NULL;
+  MetadataWorker *worker = user_data;
+  DialogData *data = worker->data;
+  guchar buffer[METADATA_FILE_SIZE];
+  guint op;
+  guint n;
 
-  G_LOCK (bm_lock);
-  switch (data->bm_state)
+  memset (buffer, 0, sizeof (buffer));
+
+  /* keep going through the barriers on errors so the other workers aren't stuck */
+  for (op = 0; op < BM_METADATA_NUM_OPS; op++)
     {
-    case BM_STATE_NONE:
-      if (data->bm_time_benchmarked_usec > 0)
+      worker->start_usec[op] = bm_barrier_wait (worker->barrier);
+      if (worker->report_progress)
         {
-          gint64 now_usec;
-          gchar *s2;
-          GDateTime *time_benchmarked_dt;
-          GDateTime *time_benchmarked_dt_local;
-          gchar *time_benchmarked_str;
+          G_LOCK (bm_lock);
+          data->bm_metadata_op = op;
+          G_UNLOCK (bm_lock);
+          bmt_schedule_update (data);
+        }
 
-          now_usec = g_get_real_time ();
+      for (n = 0; worker->error == NULL && n < METADATA_NUM_FILES; n++)
+        {
+          gchar *dir;
+          gchar *path;
+          gchar *renamed_path;
+          gint64 begin_usec;
+          gboolean ok;
+
+          if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &worker->error))
+            break;
+
+          dir = g_strdup_printf ("%s/%u", worker->dir, n % METADATA_NUM_DIRS);
+          path = g_strdup_printf ("%s/%u", dir, n);
+          renamed_path = g_strdup_printf ("%s/%u.renamed", dir, n);
+          begin_usec = g_get_monotonic_time ();
+          ok = do_metadata_op (op, dir, path, renamed_path, buffer, data->bm_metadata_fsync, &worker->error);
+          if (ok)
+            gdu_histogram_add (worker->latency[op], g_get_monotonic_time () - begin_usec);
+          g_free (renamed_path);
+          g_free (path);
+          g_free (dir);
+        }
+      worker->end_usec[op] = g_get_monotonic_time ();
+    }
 
-          time_benchmarked_dt = g_date_time_new_from_unix_utc (data->bm_time_benchmarked_usec / G_USEC_PER_SEC);
-          time_benchmarked_dt_local = g_date_time_to_local (time_benchmarked_dt);
-          time_benchmarked_str = g_date_time_format (time_benchmarked_dt_local, "%c");
+  return NULL;
+}
 
-          s = gdu_utils_format_duration_usec ((now_usec - data->bm_time_benchmarked_usec),
-                                              GDU_FORMAT_DURATION_FLAGS_NO_SECONDS);
-          /* Translators: The first %s is the date and time the benchmark took place in the preferred
-           * format for the locale (e.g. "%c" for strftime()/g_date_time_format()), for example
-           * "Tue 12 Jun 2012 03:57:08 PM EDT". The second %s is how long ago that is from right
-           * now, for example "3 days" or "2 hours" or "12 minutes".
-           */
-          s2 = g_strdup_printf (C_("benchmark-updated", "%s (%s ago)"),
-                                time_benchmarked_str,
-                                s);
-          gtk_label_set_text (GTK_LABEL (data->updated_label), s2);
-          g_free (s2);
-          g_free (s);
-          g_free (time_benchmarked_str);
-          g_date_time_unref (time_benchmarked_dt_local);
-          g_date_time_unref (time_benchmarked_dt);
+/* Removes whatever is left of the files and directories used by the
+ * metadata benchmark, e.g. if it was cancelled
+ */
+static void
+remove_metadata_tree (const gchar *top_dir)
+{
+  guint t, d, n;
+
+  for (t = 0; t < METADATA_NUM_THREADS; t++)
+    {
+      for (d = 0; d < METADATA_NUM_DIRS; d++)
+        {
+          gchar *dir = g_strdup_printf ("%s/%u/%u", top_dir, t, d);
+          for (n = d; n < METADATA_NUM_FILES; n += METADATA_NUM_DIRS)
+            {
+              gchar *path = g_strdup_printf ("%s/%u", dir, n);
+              gchar *renamed_path = g_strdup_printf ("%s/%u.renamed", dir, n);
+              unlink (path);
+              unlink (renamed_path);
+              g_free (renamed_path);
+              g_free (path);
+            }
+          rmdir (dir);
+          g_free (dir);
         }
-      else
+      {
+        gchar *dir = g_strdup_printf ("%s/%u", top_dir, t);
+        rmdir (dir);
+        g_free (dir);
+      }
+    }
+  rmdir (top_dir);
+}
+
+/* Creates, stats, renames and deletes many small files in a temporary
+ * directory in data->bm_metadata_dir from METADATA_NUM_THREADS threads
+ * and records the rate and latency of each kind of operation
+ */
+static gboolean
+measure_metadata (DialogData  *data,
+                  GError     **error)
+{
+  gboolean ret = FALSE;
+  MetadataWorker workers[METADATA_NUM_THREADS];
+  GThread *threads[METADATA_NUM_THREADS];
+  BMBarrier barrier = {0};
+  gchar *top_dir;
+  guint n, m;
+
+  memset (workers, 0, sizeof (workers));
+
+  top_dir = g_build_filename (data->bm_metadata_dir, ".gnome-disks-metadata-XXXXXX", NULL);
+  if (g_mkdtemp (top_dir) == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error creating temporary directory in %s: %m"),
+                   data->bm_metadata_dir);
+      g_free (top_dir);
+      return FALSE;
+    }
+
+  /* the directories are created up front, only the files are measured */
+  for (n = 0; n < METADATA_NUM_THREADS; n++)
+    {
+      workers[n].data = data;
+      workers[n].dir = g_strdup_printf ("%s/%u", top_dir, n);
+      workers[n].report_progress = (n == 0);
+      for (m = 0; m < BM_METADATA_NUM_OPS; m++)
+        workers[n].latency[m] = gdu_histogram_new ();
+      for (m = 0; m < METADATA_NUM_DIRS; m++)
         {
-          gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "No benchmark data available"));
+          gchar *dir = g_strdup_printf ("%s/%u", workers[n].dir, m);
+          if (g_mkdir_with_parents (dir, 0700) != 0)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error creating directory %s: %m"),
+                           dir);
+              g_free (dir);
+              goto out;
+            }
+          g_free (dir);
         }
-      break;
+    }
 
-    case BM_STATE_OPENING_DEVICE:
-      gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "Opening Device…"));
-      break;
+  barrier.num_threads = METADATA_NUM_THREADS;
+  g_mutex_init (&barrier.mutex);
+  g_cond_init (&barrier.cond);
+  for (n = 0; n < METADATA_NUM_THREADS; n++)
+    {
+      workers[n].barrier = &barrier;
+      threads[n] = g_thread_new ("benchmark-metadata", metadata_worker_thread, &workers[n]);
+    }
+  for (n = 0; n < METADATA_NUM_THREADS; n++)
+    g_thread_join (threads[n]);
+  g_cond_clear (&barrier.cond);
+  g_mutex_clear (&barrier.mutex);
 
-    case BM_STATE_TRANSFER_RATE:
-      s = g_strdup_printf (C_("benchmark-updated", "Measuring transfer rate (%2.1f%% complete)…"),
-                           data->bm_read_samples->len * 100.0 / data->bm_num_samples);
-      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
-      g_free (s);
-      break;
+  for (n = 0; n < METADATA_NUM_THREADS; n++)
+    {
+      if (workers[n].error != NULL)
+        {
+          g_propagate_error (error, workers[n].error);
+          workers[n].error = NULL;
+          goto out;
+        }
+    }
 
-    case BM_STATE_ACCESS_TIME:
-      s = g_strdup_printf (C_("benchmark-updated", "Measuring access time (%2.1f%% complete)…"),
-                           data->bm_access_time_samples->len * 100.0 / data->bm_num_access_samples);
-      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
-      g_free (s);
-      break;
+  /* all workers start each kind of operation at the same moment and it's done once the last one is */
+  G_LOCK (bm_lock);
+  for (m = 0; m < BM_METADATA_NUM_OPS; m++)
+    {
+      gint64 end_usec = 0;
 
-    default:
-      g_assert_not_reached ();
+      for (n = 0; n < METADATA_NUM_THREADS; n++)
+        {
+          end_usec = MAX (end_usec, workers[n].end_usec[m]);
+          gdu_histogram_merge (data->bm_metadata_latency[m], workers[n].latency[m]);
+        }
+      if (end_usec > workers[0].start_usec[m])
+        data->bm_metadata_rates[m] = ((gdouble) G_USEC_PER_SEC) * METADATA_NUM_THREADS * METADATA_NUM_FILES /
+          (end_usec - workers[0].start_usec[m]);
     }
   G_UNLOCK (bm_lock);
+
+  ret = TRUE;
+
+ out:
+  remove_metadata_tree (top_dir);
+  for (n = 0; n < METADATA_NUM_THREADS; n++)
+    {
+      for (m = 0; m < BM_METADATA_NUM_OPS; m++)
+        {
+          if (workers[n].latency[m] != NULL)
+            gdu_histogram_free (workers[n].latency[m]);
+        }
+      if (workers[n].error != NULL)
+        g_error_free (workers[n].error);
+      g_free (workers[n].dir);
+    }
+  g_free (top_dir);
+  return ret;
 }
 
-/* returns NULL if it doesn't make sense to load/save benchmark data (removable media,
- * non-drive devices etc.)
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Writes sync_write_sizes[@index] bytes at a time, one after the other and
+ * each followed by fdatasync() like a database appending to its log when
+ * committing, and records how long each write and sync took together.
+ * The data is read first and written back unchanged.
  */
-static gchar *
-get_bm_filename (DialogData *data)
+static gboolean
+measure_sync_latency (DialogData  *data,
+                      gint         fd,
+                      guint64      disk_size,
+                      long         page_size,
+                      guint        index,
+                      GError     **error)
 {
-  gchar *ret = NULL;
-  gchar *bench_dir = NULL;
-  const gchar *id = NULL;
+  gboolean ret = FALSE;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  gsize size;
+  guint64 offset;
+  guint n;
 
-  id = udisks_block_get_id (data->block);
-  if (id == NULL || strlen (id) == 0)
+  size = sync_write_sizes[index];
+  buffer_unaligned = g_new0 (guchar, size * SYNC_NUM_WRITES + page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+
+  /* use a different area for each size so the writes aren't merged with earlier ones */
+  offset = (disk_size / (G_N_ELEMENTS (sync_write_sizes) + 1) * (index + 1)) & ~(page_size - 1);
+  if (!gdu_copy_utils_pread_all (fd, buffer, size * SYNC_NUM_WRITES, offset, error))
     goto out;
 
-  bench_dir = g_strdup_printf ("%s/gnome-disks/benchmarks", g_get_user_cache_dir ());
-  if (g_mkdir_with_parents (bench_dir, 0777) != 0)
+  for (n = 0; n < SYNC_NUM_WRITES; n++)
     {
-      g_warning ("Error creating directory %s: %m", bench_dir);
-      goto out;
+      gint64 begin_usec;
+      gint64 end_usec;
+
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, error))
+        goto out;
+
+      begin_usec = g_get_monotonic_time ();
+      if (!gdu_copy_utils_pwrite_all (fd, buffer + n * size, size, offset + n * size, error))
+        goto out;
+      if (fdatasync (fd) != 0)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error syncing (at offset %lld): %m"),
+                       (long long int) (offset + n * size));
+          goto out;
+        }
+      end_usec = g_get_monotonic_time ();
+
+      G_LOCK (bm_lock);
+      gdu_histogram_add (data->bm_sync_latency[index], end_usec - begin_usec);
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
     }
 
-  ret = g_strdup_printf ("%s/%s.gnome-disks-benchmark", bench_dir, id);
+  ret = TRUE;
 
  out:
-  g_free (bench_dir);
+  g_free (buffer_unaligned);
   return ret;
 }
 
-static void
-update_dialog (DialogData *data)
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Like for IOPS, concurrency is emulated by threads each doing synchronous
+ * I/O. The threads take the requests of the trace in order so at most
+ * bm_replay_concurrency requests are outstanding at any time.
+ */
+typedef struct
 {
-  GError *error = NULL;
-  GdkWindow *window = NULL;
-  gdouble read_avg = 0.0;
-  gdouble write_avg = 0.0;
-  gdouble access_time_avg = 0.0;
-  gchar *s = NULL;
-  UDisksDrive *drive = NULL;
-  UDisksObjectInfo *info = NULL;
+  DialogData *data;
+  gint fd;
+  guint64 disk_size;
+  long page_size;
+  gint *next_index;
+  gint *stop; /* set when a worker fails so the others don't carry on */
+  BMBarrier *barrier;
+
+  /* set by the worker */
+  gint64 start_usec;
+  gint64 end_usec;
+  GduHistogram *read_latency;
+  GduHistogram *write_latency;
+  GError *error;
+} ReplayWorker;
+
+/* Waits until @due_usec, checking now and then whether to stop since traces may contain long pauses */
+static gboolean
+replay_wait_until (ReplayWorker *worker,
+                   gint64        due_usec)
+{
+  gint64 now_usec;
 
-  G_LOCK (bm_lock);
-  if (data->bm_error != NULL)
+  while ((now_usec = g_get_monotonic_time ()) < due_usec)
     {
-      error = data->bm_error;
-      data->bm_error = NULL;
+      if (g_cancellable_set_error_if_cancelled (worker->data->bm_cancellable, &worker->error) ||
+          g_atomic_int_get (worker->stop))
+        return FALSE;
+      g_usleep (MIN (due_usec - now_usec, 100000));
     }
-  G_UNLOCK (bm_lock);
+  return TRUE;
+}
 
-  /* first of all, present an error if something went wrong */
-  if (error != NULL)
+static gpointer
+replay_worker_thread (gpointer user_data)
+{
+  ReplayWorker *worker = user_data;
+  DialogData *data = worker->data;
+  GduIOTrace *trace = data->bm_replay_trace;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  gsize buffer_size;
+  guint num_entries;
+
+  num_entries = gdu_io_trace_get_num_entries (trace);
+  buffer_size = (gdu_io_trace_get_max_size (trace) + worker->page_size - 1) & ~(worker->page_size - 1);
+  buffer_unaligned = g_new0 (guchar, buffer_size + worker->page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + worker->page_size)) & (~(worker->page_size - 1)));
+
+  worker->start_usec = bm_barrier_wait (worker->barrier);
+  while (TRUE)
     {
-      if (!data->closed)
+      const GduIOTraceEntry *entry;
+      guint index;
+      gsize size;
+      guint64 offset;
+      gint64 begin_usec;
+      gint64 end_usec;
+
+      index = g_atomic_int_add (worker->next_index, 1);
+      if (index >= num_entries || g_atomic_int_get (worker->stop))
+        break;
+
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &worker->error))
+        break;
+
+      /* O_DIRECT needs requests aligned to the page size and the trace may
+       * be of a bigger disk than this one, in which case it wraps around
+       */
+      entry = gdu_io_trace_get_entry (trace, index);
+      size = (entry->size + worker->page_size - 1) & ~(worker->page_size - 1);
+      offset = (entry->offset % (worker->disk_size - size + 1)) & ~((guint64) worker->page_size - 1);
+
+      if (!data->bm_replay_fast && !replay_wait_until (worker, worker->start_usec + entry->time_usec))
+        break;
+
+      /* writes in the trace are only replayed as part of the write-benchmark */
+      if (entry->write && data->bm_do_write)
         {
-          if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
-            gdu_utils_show_error (GTK_WINDOW (data->window), C_("benchmarking", "An error occurred"), error);
+          /* write back what is there so the contents of the disk is not changed - only the write is timed */
+          if (!gdu_copy_utils_pread_all (worker->fd, buffer, size, offset, &worker->error))
+            break;
+          begin_usec = g_get_monotonic_time ();
+          if (!gdu_copy_utils_pwrite_all (worker->fd, buffer, size, offset, &worker->error))
+            break;
+          end_usec = g_get_monotonic_time ();
+          gdu_histogram_add (worker->write_latency, end_usec - begin_usec);
         }
-      g_clear_error (&error);
-
-      /* and reload old data */
-      if (!maybe_load_data (data, &error))
+      else if (!entry->write)
         {
-          /* not worth complaining in dialog about */
-          g_warning ("Error loading cached data: %s (%s, %d)",
-                     error->message, g_quark_to_string (error->domain), error->code);
-          g_clear_error (&error);
+          begin_usec = g_get_monotonic_time ();
+          if (!gdu_copy_utils_pread_all (worker->fd, buffer, size, offset, &worker->error))
+            break;
+          end_usec = g_get_monotonic_time ();
+          gdu_histogram_add (worker->read_latency, end_usec - begin_usec);
         }
+
+      g_atomic_int_inc (&data->bm_replay_num_done);
+      if ((index & 63) == 0)
+        bmt_schedule_update (data);
     }
+  worker->end_usec = g_get_monotonic_time ();
+  if (worker->error != NULL)
+    g_atomic_int_set (worker->stop, 1);
 
-  update_updated_label (data);
+  g_free (buffer_unaligned);
+  return NULL;
+}
 
-  /* disk / device label */
-  drive = udisks_client_get_drive_for_block (gdu_window_get_client (data->window), data->block);
-  info = udisks_client_get_object_info (gdu_window_get_client (data->window), data->object);
-  gtk_label_set_text (GTK_LABEL (data->device_label), udisks_object_info_get_one_liner (info));
-  g_free (s);
+/* Replays data->bm_replay_trace with data->bm_replay_concurrency requests outstanding at most */
+static gboolean
+measure_replay (DialogData  *data,
+                gint         fd,
+                guint64      disk_size,
+                long         page_size,
+                GError     **error)
+{
+  gboolean ret = FALSE;
+  ReplayWorker *workers;
+  GThread **threads;
+  BMBarrier barrier = {0};
+  guint num_workers;
+  gint next_index = 0;
+  gint stop = 0;
+  gint64 end_usec = 0;
+  guint n;
 
-  G_LOCK (bm_lock);
+  num_workers = data->bm_replay_concurrency;
+  workers = g_new0 (ReplayWorker, num_workers);
+  threads = g_new0 (GThread *, num_workers);
 
-  if (data->bm_in_progress)
+  barrier.num_threads = num_workers;
+  g_mutex_init (&barrier.mutex);
+  g_cond_init (&barrier.cond);
+  for (n = 0; n < num_workers; n++)
     {
-
-      gtk_widget_hide (data->start_benchmark_button);
-      gtk_widget_show (data->stop_benchmark_button);
+      workers[n].data = data;
+      workers[n].fd = fd;
+      workers[n].disk_size = disk_size;
+      workers[n].page_size = page_size;
+      workers[n].next_index = &next_index;
+      workers[n].stop = &stop;
+      workers[n].barrier = &barrier;
+      workers[n].read_latency = gdu_histogram_new ();
+      workers[n].write_latency = gdu_histogram_new ();
+      threads[n] = g_thread_new ("benchmark-replay", replay_worker_thread, &workers[n]);
     }
-  else
+  for (n = 0; n < num_workers; n++)
+    g_thread_join (threads[n]);
+  g_cond_clear (&barrier.cond);
+  g_mutex_clear (&barrier.mutex);
+
+  for (n = 0; n < num_workers; n++)
     {
-      gtk_widget_show (data->start_benchmark_button);
-      gtk_widget_hide (data->stop_benchmark_button);
+      if (workers[n].error != NULL)
+        {
+          g_propagate_error (error, workers[n].error);
+          workers[n].error = NULL;
+          goto out;
+        }
+      end_usec = MAX (end_usec, workers[n].end_usec);
     }
 
-  get_max_min_avg (data->bm_read_samples,
-                   NULL, NULL, &read_avg);
-  get_max_min_avg (data->bm_write_samples,
-                   NULL, NULL, &write_avg);
-  get_max_min_avg (data->bm_access_time_samples,
-                   NULL, NULL, &access_time_avg);
-
+  G_LOCK (bm_lock);
+  for (n = 0; n < num_workers; n++)
+    {
+      gdu_histogram_merge (data->bm_replay_read_latency, workers[n].read_latency);
+      gdu_histogram_merge (data->bm_replay_write_latency, workers[n].write_latency);
+    }
+  data->bm_replay_num_requests = gdu_histogram_get_count (data->bm_replay_read_latency) +
+                                 gdu_histogram_get_count (data->bm_replay_write_latency);
+  data->bm_replay_duration_usec = end_usec - workers[0].start_usec;
+  data->bm_replay_trace_duration_usec = gdu_io_trace_get_duration_usec (data->bm_replay_trace);
   G_UNLOCK (bm_lock);
+  bmt_schedule_update (data);
 
-  if (data->bm_sample_size == 0)
-    s = g_strdup ("–");
-  else
-    s = g_format_size_full (data->bm_sample_size, G_FORMAT_SIZE_IEC_UNITS | G_FORMAT_SIZE_LONG_FORMAT);
-  gtk_label_set_markup (GTK_LABEL (data->sample_size_label), s);
-  g_free (s);
-
-  if (read_avg == 0.0)
-    s = g_strdup ("–");
-  else
-    s = format_transfer_rate_and_num_samples (read_avg, data->bm_read_samples->len);
-  gtk_label_set_markup (GTK_LABEL (data->read_rate_label), s);
-  g_free (s);
-
-  if (write_avg == 0.0)
-    s = g_strdup ("–");
-  else
-    s = format_transfer_rate_and_num_samples (write_avg, data->bm_write_samples->len);
-  gtk_label_set_markup (GTK_LABEL (data->write_rate_label), s);
-  g_free (s);
+  ret = TRUE;
 
-  if (access_time_avg == 0.0)
-    {
-      s = g_strdup ("–");
-    }
-  else
+ out:
+  for (n = 0; n < num_workers; n++)
     {
-      gchar *s2;
-      gchar *s3;
-      /* Translators: %d is number of milliseconds and msec means "milli-second" */
-      s2 = g_strdup_printf (C_("benchmark-access-time", "%.2f msec"), access_time_avg * 1000.0);
-      s3 = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
-                                         "%u sample",
-                                         "%u samples",
-                                         data->bm_access_time_samples->len),
-                            data->bm_access_time_samples->len);
-      s = g_strdup_printf ("%s <small>(%s)</small>", s2, s3);
-      g_free (s3);
-      g_free (s2);
+      if (workers[n].error != NULL)
+        g_error_free (workers[n].error);
+      gdu_histogram_free (workers[n].read_latency);
+      gdu_histogram_free (workers[n].write_latency);
     }
-  gtk_label_set_markup (GTK_LABEL (data->access_time_label), s);
-  g_free (s);
-
-
-  window = gtk_widget_get_window (data->graph_drawing_area);
-  if (window != NULL)
-    gdk_window_invalidate_rect (window, NULL, TRUE);
-
-  g_clear_object (&drive);
-  g_clear_object (&info);
+  g_free (threads);
+  g_free (workers);
+  return ret;
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
 
-/* called every second (on the second) */
+/* Puts the drive into standby, waits until it reports being in standby
+ * and times the first read - which has to wait for the drive to wake up
+ * and, for disks with platters, to spin up - STANDBY_NUM_RUNS times
+ */
 static gboolean
-on_timeout (gpointer user_data)
+measure_wake_latency (DialogData  *data,
+                      gint         fd,
+                      guint64      disk_size,
+                      long         page_size,
+                      GError     **error)
 {
-  DialogData *data = user_data;
-  update_updated_label (data);
-  return TRUE; /* keep timeout around */
-}
+  gboolean ret = FALSE;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  GRand *rand;
+  guint run;
 
-/* ---------------------------------------------------------------------------------------------------- */
+  buffer_unaligned = g_new0 (guchar, 2 * page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+  rand = g_rand_new_with_seed (42); /* want this to be repeatable, just like the access time samples */
 
-static void
-samples_from_gvariant (GArray   *array,
-                       GVariant *variant)
-{
-  GVariantIter iter;
-  BMSample sample;
+  for (run = 0; run < STANDBY_NUM_RUNS; run++)
+    {
+      gint64 deadline_usec;
+      gint64 begin_usec;
+      gint64 end_usec;
+      guint64 offset;
+      guchar state = 0xff;
+      BMSample sample = {0};
+
+      G_LOCK (bm_lock);
+      data->bm_standby_run = run;
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      if (!udisks_drive_ata_call_pm_standby_sync (data->bm_standby_ata,
+                                                  g_variant_new ("a{sv}", NULL), /* options */
+                                                  data->bm_cancellable,
+                                                  error))
+        goto out;
+
+      /* the drive may take a while to get there (or be woken up again right away) so check */
+      deadline_usec = g_get_monotonic_time () + STANDBY_TIMEOUT_SEC * G_USEC_PER_SEC;
+      while (TRUE)
+        {
+          if (!udisks_drive_ata_call_pm_get_state_sync (data->bm_standby_ata,
+                                                        g_variant_new ("a{sv}", NULL), /* options */
+                                                        &state,
+                                                        data->bm_cancellable,
+                                                        error))
+            goto out;
+          if (state == 0x00)
+            break;
+          if (g_get_monotonic_time () >= deadline_usec)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_TIMED_OUT,
+                           C_("benchmarking", "The drive did not go into standby mode (power state 0x%02x)"),
+                           state);
+              goto out;
+            }
+          if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, error))
+            goto out;
+          g_usleep (G_USEC_PER_SEC / 2);
+        }
 
-  g_array_set_size (array, 0);
+      /* read somewhere else each time so the data can't come from the cache of the drive */
+      offset = (guint64) g_rand_double_range (rand, 0, (gdouble) (disk_size - page_size));
+      offset &= ~(page_size - 1);
+      begin_usec = g_get_monotonic_time ();
+      if (!gdu_copy_utils_pread_all (fd, buffer, page_size, offset, error))
+        goto out;
+      end_usec = g_get_monotonic_time ();
 
-  g_variant_iter_init (&iter, variant);
-  while (g_variant_iter_next (&iter, "(td)", &sample.offset, &sample.value))
-    {
-      g_array_append_val (array, sample);
+      sample.offset = run;
+      sample.value = ((gdouble) (end_usec - begin_usec)) / G_USEC_PER_SEC;
+      G_LOCK (bm_lock);
+      g_array_append_val (data->bm_wake_samples, sample);
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
     }
+
+  ret = TRUE;
+
+ out:
+  g_rand_free (rand);
+  g_free (buffer_unaligned);
+  return ret;
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Measures the transfer rate at @offset and inserts the samples at @index
+ * in data->bm_read_samples and data->bm_write_samples
+ */
 static gboolean
-maybe_load_data (DialogData  *data,
-                 GError     **error)
+measure_transfer_rate (DialogData  *data,
+                       gint         fd,
+                       guchar      *buffer,
+                       long         page_size,
+                       gint64       offset,
+                       guint        index,
+                       GError     **error)
 {
   gboolean ret = FALSE;
-  gchar *filename = NULL;
-  GVariant *value = NULL;
-  gchar *variant_data = NULL;
-  gsize variant_size;
-  GError *local_error = NULL;
-  GVariant *read_samples_variant = NULL;
-  GVariant *write_samples_variant = NULL;
-  GVariant *access_time_samples_variant = NULL;
-  gint32 version;
-  gint64 timestamp_usec;
-  guint64 device_size;
-  guint64 sample_size;
+  gchar *s, *s2;
+  gint64 begin_usec;
+  gint64 end_usec;
+  ssize_t num_read;
+  BMSample sample = {0};
 
-  filename = get_bm_filename (data);
-  if (filename == NULL)
+  if (lseek (fd, offset, SEEK_SET) != offset)
     {
-      /* all good since we don't want to load data for this device */
-      ret = TRUE;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error seeking to offset %lld"),
+                   (long long int) offset);
       goto out;
     }
-
-  if (!g_file_get_contents (filename,
-                            &variant_data,
-                            &variant_size,
-                            &local_error))
+  if (read (fd, buffer, page_size) != page_size)
     {
-      if (local_error->domain == G_FILE_ERROR && local_error->code == G_FILE_ERROR_NOENT)
-        {
-          /* don't complain about a missing file */
-          g_clear_error (&local_error);
-          ret = TRUE;
-          goto out;
-        }
-      g_propagate_error (error, local_error);
+      s = g_format_size_full (page_size, G_FORMAT_SIZE_LONG_FORMAT);
+      s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error pre-reading %s from offset %s"),
+                   s, s2);
+      g_free (s2);
+      g_free (s);
       goto out;
     }
-
-  value = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
-                                   variant_data,
-                                   variant_size,
-                                   FALSE,
-                                   NULL, NULL);
-
-  if (!g_variant_lookup (value, "version", "i", &version))
+  if (lseek (fd, offset, SEEK_SET) != offset)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No version key");
+      s = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error seeking to offset %s"),
+                   s);
+      g_free (s);
       goto out;
     }
-  if (version != 1)
+  begin_usec = g_get_monotonic_time ();
+  num_read = read (fd, buffer, data->bm_sample_size_mib*1024*1024);
+  if (G_UNLIKELY (num_read < 0))
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Cannot decode version %d data", version);
+      s = g_format_size_full (data->bm_sample_size_mib * 1024 * 1024, G_FORMAT_SIZE_LONG_FORMAT);
+      s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error reading %s from offset %s"),
+                   s, s2);
+      g_free (s2);
+      g_free (s);
       goto out;
     }
+  end_usec = g_get_monotonic_time ();
 
-  if (!g_variant_lookup (value, "timestamp-usec", "x", &timestamp_usec))
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No timestamp-usec");
-      goto out;
-    }
+  sample.offset = offset;
+  sample.value = ((gdouble) G_USEC_PER_SEC) * num_read / (end_usec - begin_usec);
+  G_LOCK (bm_lock);
+  g_array_insert_val (data->bm_read_samples, index, sample);
+  G_UNLOCK (bm_lock);
 
-  if (!g_variant_lookup (value, "device-size", "t", &device_size))
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No device-size");
-      goto out;
-    }
+  bmt_schedule_update (data);
 
-  if (!g_variant_lookup (value, "read-samples", "@a(td)", &read_samples_variant))
+  if (data->bm_do_write)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No read-samples");
-      goto out;
-    }
+      ssize_t num_written;
 
-  if (!g_variant_lookup (value, "write-samples", "@a(td)", &write_samples_variant))
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No write-samples");
-      goto out;
-    }
+      /* and now write the same block again... */
+      if (lseek (fd, offset, SEEK_SET) != offset)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error seeking to offset %lld"),
+                       (long long int) offset);
+          goto out;
+        }
+      if (read (fd, buffer, page_size) != page_size)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error pre-reading %lld bytes from offset %lld"),
+                       (long long int) page_size,
+                       (long long int) offset);
+          goto out;
+        }
+      if (lseek (fd, offset, SEEK_SET) != offset)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error seeking to offset %lld"),
+                       (long long int) offset);
+          goto out;
+        }
+      begin_usec = g_get_monotonic_time ();
+      num_written = write (fd, buffer, num_read);
+      if (G_UNLIKELY (num_written < 0))
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                       (long long int) num_read,
+                       (long long int) offset);
+          goto out;
+        }
+      if (num_written != num_read)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Expected to write %lld bytes, only wrote %lld: %m"),
+                       (long long int) num_read,
+                       (long long int) num_written);
+          goto out;
+        }
+      if (fsync (fd) != 0)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error syncing (at offset %lld): %m"),
+                       (long long int) offset);
+          goto out;
+        }
+      end_usec = g_get_monotonic_time ();
 
-  if (!g_variant_lookup (value, "access-time-samples", "@a(td)", &access_time_samples_variant))
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No access-time-samples");
-      goto out;
-    }
+      sample.offset = offset;
+      sample.value = ((gdouble) G_USEC_PER_SEC) * num_written / (end_usec - begin_usec);
+      G_LOCK (bm_lock);
+      g_array_insert_val (data->bm_write_samples, index, sample);
+      G_UNLOCK (bm_lock);
 
-  if (!g_variant_lookup (value, "sample-size", "t", &sample_size))
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No sample-size");
-      goto out;
+      bmt_schedule_update (data);
     }
 
-  data->bm_time_benchmarked_usec = timestamp_usec;
-  data->bm_size = device_size;
-  data->bm_sample_size = sample_size;
-  samples_from_gvariant (data->bm_read_samples, read_samples_variant);
-  samples_from_gvariant (data->bm_write_samples, write_samples_variant);
-  samples_from_gvariant (data->bm_access_time_samples, access_time_samples_variant);
-
   ret = TRUE;
 
  out:
-  if (read_samples_variant != NULL)
-    g_variant_unref (read_samples_variant);
-  if (write_samples_variant != NULL)
-    g_variant_unref (write_samples_variant);
-  if (access_time_samples_variant != NULL)
-    g_variant_unref (access_time_samples_variant);
-  if (value != NULL)
-    g_variant_unref (value);
-  g_free (variant_data);
-  g_free (filename);
   return ret;
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
-
-static GVariant *
-samples_to_gvariant (GArray *array)
+static gdouble
+relative_difference (gdouble a,
+                     gdouble b)
 {
-  guint n;
-  GVariantBuilder builder;
-
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(td)"));
-  for (n = 0; n < array->len; n++)
-    {
-      BMSample *s = &g_array_index (array, BMSample, n);
-      g_variant_builder_add (&builder, "(td)", s->offset, s->value);
-    }
-
-  return g_variant_builder_end (&builder);
+  gdouble max = MAX (a, b);
+  return max > 0.0 ? fabs (a - b) / max : 0.0;
 }
 
-
+/* Measures the transfer rate half-way between the neighbouring samples
+ * that differ the most, over and over, until @end_usec or until no
+ * neighbours differ by more than REFINE_THRESHOLD
+ */
 static gboolean
-maybe_save_data (DialogData  *data,
-                 GError     **error)
+refine_transfer_rate (DialogData  *data,
+                      gint         fd,
+                      guchar      *buffer,
+                      long         page_size,
+                      gint64       end_usec,
+                      GError     **error)
 {
-  gboolean ret = FALSE;
-  gchar *filename = NULL;
-  GVariantBuilder builder;
-  GVariant *value = NULL;
-  gconstpointer variant_data;
-  gsize variant_size;
+  gint num_added;
 
-  filename = get_bm_filename (data);
-  if (filename == NULL)
+  for (num_added = 0; num_added < data->bm_num_samples && g_get_monotonic_time () < end_usec; num_added++)
     {
-      /* all good since we don't want to save data for this device */
-      ret = TRUE;
-      goto out;
-    }
+      GArray *read_samples = data->bm_read_samples;
+      GArray *write_samples = data->bm_write_samples;
+      gdouble max_difference = REFINE_THRESHOLD;
+      guint index = 0;
+      gint64 offset;
+      guint n;
 
-  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
-  g_variant_builder_add (&builder, "{sv}", "version", g_variant_new_int32 (1));
-  g_variant_builder_add (&builder, "{sv}", "timestamp-usec", g_variant_new_int64 (data->bm_time_benchmarked_usec));
-  g_variant_builder_add (&builder, "{sv}", "device-size", g_variant_new_uint64 (data->bm_size));
-  g_variant_builder_add (&builder, "{sv}", "sample-size", g_variant_new_uint64 (data->bm_sample_size));
-  g_variant_builder_add (&builder, "{sv}", "read-samples", samples_to_gvariant (data->bm_read_samples));
-  g_variant_builder_add (&builder, "{sv}", "write-samples", samples_to_gvariant (data->bm_write_samples));
-  g_variant_builder_add (&builder, "{sv}", "access-time-samples", samples_to_gvariant (data->bm_access_time_samples));
-  value = g_variant_builder_end (&builder);
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, error))
+        return FALSE;
 
-  variant_data = g_variant_get_data (value);
-  variant_size = g_variant_get_size (value);
+      /* only this thread changes the samples so no need to hold bm_lock */
+      for (n = 1; n < read_samples->len; n++)
+        {
+          BMSample *a = &g_array_index (read_samples, BMSample, n - 1);
+          BMSample *b = &g_array_index (read_samples, BMSample, n);
+          gdouble difference;
+
+          /* no point in going further once the areas read are next to each other */
+          if (b->offset - a->offset < 2 * data->bm_sample_size)
+            continue;
+
+          difference = relative_difference (a->value, b->value);
+          if (write_samples->len == read_samples->len)
+            difference = MAX (difference,
+                              relative_difference (g_array_index (write_samples, BMSample, n - 1).value,
+                                                   g_array_index (write_samples, BMSample, n).value));
+          if (difference > max_difference)
+            {
+              max_difference = difference;
+              index = n;
+            }
+        }
+      if (index == 0)
+        break;
 
-  if (!g_file_set_contents (filename,
-                            variant_data,
-                            variant_size,
-                            error))
-    goto out;
+      offset = (g_array_index (read_samples, BMSample, index - 1).offset +
+                g_array_index (read_samples, BMSample, index).offset) / 2;
+      offset &= ~(page_size - 1);
+      if (!measure_transfer_rate (data, fd, buffer, page_size, offset, index, error))
+        return FALSE;
+    }
 
- out:
-  if (value != NULL)
-    g_variant_unref (value);
-  g_free (filename);
-  return ret;
+  return TRUE;
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Creates a temporary file of data->bm_file_size bytes in data->bm_file_dir
+ * to benchmark instead of the device and returns a file descriptor for it,
+ * opened with O_DIRECT. The file is unlinked right away so it is removed
+ * when the file descriptor is closed, no matter if the benchmark completes,
+ * is cancelled or the program crashes.
+ *
+ * Space for the file is allocated up front so it is as contiguous as the
+ * filesystem can make it, then it is written in full since reading space
+ * that was only allocated wouldn't involve the disk at all.
+ */
+static gint
+open_benchmark_file (DialogData  *data,
+                     guchar      *buffer,
+                     gsize        buffer_size,
+                     guint64     *out_size,
+                     GError     **error)
+{
+  gchar *path;
+  gint fd;
+  guint64 size;
+  guint64 offset;
+  GRand *rand;
+  gsize n;
+
+  path = g_build_filename (data->bm_file_dir, ".gnome-disks-benchmark-XXXXXX", NULL);
+  fd = g_mkstemp_full (path, O_RDWR | O_DIRECT | O_CLOEXEC, 0600);
+  if (fd == -1)
+    {
+      if (errno == EINVAL)
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_NOT_SUPPORTED,
+                     C_("benchmarking", "The filesystem at %s does not support direct I/O"),
+                     data->bm_file_dir);
+      else
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     C_("benchmarking", "Error creating temporary file in %s: %m"),
+                     data->bm_file_dir);
+      goto out;
+    }
+  unlink (path);
+
+  /* whole samples only, since O_DIRECT requires aligned requests */
+  size = data->bm_file_size - data->bm_file_size % buffer_size;
+  if (size == 0)
+    size = buffer_size;
+
+  if (fallocate (fd, 0, 0, size) != 0 && errno != EOPNOTSUPP)
+    {
+      gchar *size_str = g_format_size (size);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error allocating %s for the temporary file: %m"),
+                   size_str);
+      g_free (size_str);
+      close (fd);
+      fd = -1;
+      goto out;
+    }
+
+  /* random data so compressing filesystems and disks can't take shortcuts */
+  rand = g_rand_new_with_seed (42);
+  for (n = 0; n + sizeof (guint32) <= buffer_size; n += sizeof (guint32))
+    *((guint32 *) (buffer + n)) = g_rand_int (rand);
+  g_rand_free (rand);
 
-/* called on main / UI thread */
-static gboolean
-bmt_on_timeout (gpointer user_data)
-{
-  DialogData *data = user_data;
-  update_dialog (data);
   G_LOCK (bm_lock);
-  data->bm_update_timeout_pending = FALSE;
+  data->bm_state = BM_STATE_CREATING_FILE;
+  data->bm_file_written = 0;
   G_UNLOCK (bm_lock);
-  dialog_data_unref (data);
-  return FALSE; /* don't run again */
-}
+  for (offset = 0; offset < size; offset += buffer_size)
+    {
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, error) ||
+          !gdu_copy_utils_pwrite_all (fd, buffer, buffer_size, offset, error))
+        {
+          close (fd);
+          fd = -1;
+          goto out;
+        }
+      G_LOCK (bm_lock);
+      data->bm_file_written = offset + buffer_size;
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+    }
 
-static void
-bmt_schedule_update (DialogData *data)
-{
-  /* rate-limit updates */
-  G_LOCK (bm_lock);
-  if (!data->bm_update_timeout_pending)
+  if (fdatasync (fd) != 0)
     {
-      g_timeout_add (200, /* ms */
-                     bmt_on_timeout,
-                     dialog_data_ref (data));
-      data->bm_update_timeout_pending = TRUE;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error syncing temporary file: %m"));
+      close (fd);
+      fd = -1;
+      goto out;
     }
-  G_UNLOCK (bm_lock);
+
+  *out_size = size;
+
+ out:
+  g_free (path);
+  return fd;
 }
 
 static gpointer
 benchmark_thread (gpointer user_data)
 {
   DialogData *data = user_data;
-  GVariant *fd_index = NULL;
-  GUnixFDList *fd_list = NULL;
   GError *error = NULL;
+  GError *history_error = NULL;
   guchar *buffer_unaligned = NULL;
   guchar *buffer = NULL;
   GRand *rand = NULL;
@@ -1168,38 +5183,10 @@ benchmark_thread (gpointer user_data)
   gint n;
   long page_size;
   guint64 disk_size;
-  GVariantBuilder options_builder;
+  gint64 transfer_rate_begin_usec;
 
   //g_print ("bm thread start\n");
 
-  g_variant_builder_init (&options_builder, G_VARIANT_TYPE_VARDICT);
-  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (data->bm_do_write));
-
-  if (!udisks_block_call_open_for_benchmark_sync (data->block,
-                                                  g_variant_builder_end (&options_builder),
-                                                  NULL, /* fd_list */
-                                                  &fd_index,
-                                                  &fd_list,
-                                                  data->bm_cancellable,
-                                                  &error))
-    goto out;
-
-  fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), NULL);
-  g_clear_object (&fd_list);
-
-  /* We can't use udisks_block_get_size() because the media may have
-   * changed and udisks may not have noticed. TODO: maybe have a
-   * Block.GetSize() method instead...
-   */
-  if (ioctl (fd, BLKGETSIZE64, &disk_size) != 0)
-    {
-      g_set_error (&error,
-                   G_IO_ERROR,
-                   g_io_error_from_errno (errno),
-                   C_("benchmarking", "Error getting size of device: %m"));
-      goto out;
-    }
-
   page_size = sysconf (_SC_PAGESIZE);
   if (page_size < 1)
     {
@@ -1213,15 +5200,80 @@ benchmark_thread (gpointer user_data)
   buffer_unaligned = g_new0 (guchar, data->bm_sample_size_mib*1024*1024 + page_size);
   buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
 
+  if (data->bm_file_dir != NULL)
+    {
+      fd = open_benchmark_file (data, buffer, data->bm_sample_size_mib*1024*1024, &disk_size, &error);
+      if (fd == -1)
+        goto out;
+    }
+  else
+    {
+      fd = gdu_copy_utils_open_for_benchmark (data->block, data->bm_do_write, data->bm_cancellable, &error);
+      if (fd == -1)
+        goto out;
+
+      if (!gdu_copy_utils_get_size (fd, &disk_size, &error))
+        goto out;
+    }
+
   /* transfer rate... */
   G_LOCK (bm_lock);
   data->bm_size = disk_size;
   data->bm_sample_size = data->bm_sample_size_mib*1024*1024;
   data->bm_state = BM_STATE_TRANSFER_RATE;
   G_UNLOCK (bm_lock);
+  transfer_rate_begin_usec = g_get_monotonic_time ();
   for (n = 0; n < data->bm_num_samples; n++)
     {
-      gchar *s, *s2;
+      gint64 offset;
+
+      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &error))
+        goto out;
+
+      /* figure out offset and align to page-size */
+      offset = n * disk_size / data->bm_num_samples;
+      offset &= ~(page_size - 1);
+
+      if (!measure_transfer_rate (data, fd, buffer, page_size, offset, data->bm_read_samples->len, &error))
+        goto out;
+    }
+
+  /* ... then more samples where it changes ... */
+  if (data->bm_do_refine)
+    {
+      gint64 now_usec;
+
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_REFINING_TRANSFER_RATE;
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      now_usec = g_get_monotonic_time ();
+      if (!refine_transfer_rate (data, fd, buffer, page_size,
+                                 now_usec + (now_usec - transfer_rate_begin_usec) * REFINE_TIME_RATIO,
+                                 &error))
+        goto out;
+    }
+
+  /* ... and of all the disks at the same time */
+  if (data->bm_concurrent_blocks != NULL)
+    {
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_CONCURRENT;
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      if (!measure_concurrent (data, fd, disk_size, page_size, &error))
+        goto out;
+    }
+
+  /* access time... */
+  G_LOCK (bm_lock);
+  data->bm_state = BM_STATE_ACCESS_TIME;
+  G_UNLOCK (bm_lock);
+  rand = g_rand_new_with_seed (42); /* want this to be deterministic (per size) so it's repeatable */
+  for (n = 0; n < data->bm_num_access_samples; n++)
+    {
       gint64 begin_usec;
       gint64 end_usec;
       gint64 offset;
@@ -1231,8 +5283,7 @@ benchmark_thread (gpointer user_data)
       if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &error))
         goto out;
 
-      /* figure out offset and align to page-size */
-      offset = n * disk_size / data->bm_num_samples;
+      offset = (guint64) g_rand_double_range (rand, 0, (gdouble) disk_size);
       offset &= ~(page_size - 1);
 
       if (lseek (fd, offset, SEEK_SET) != offset)
@@ -1240,185 +5291,213 @@ benchmark_thread (gpointer user_data)
           g_set_error (&error,
                        G_IO_ERROR,
                        g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error seeking to offset %lld"),
+                       C_("benchmarking", "Error seeking to offset %lld: %m"),
                        (long long int) offset);
           goto out;
         }
-      if (read (fd, buffer, page_size) != page_size)
-        {
-          s = g_format_size_full (page_size, G_FORMAT_SIZE_LONG_FORMAT);
-          s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error pre-reading %s from offset %s"),
-                       s, s2);
-          g_free (s2);
-          g_free (s);
-          goto out;
-        }
-      if (lseek (fd, offset, SEEK_SET) != offset)
-        {
-          s = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error seeking to offset %s"),
-                       s);
-          g_free (s);
-          goto out;
-        }
+
       begin_usec = g_get_monotonic_time ();
-      num_read = read (fd, buffer, data->bm_sample_size_mib*1024*1024);
+      num_read = read (fd, buffer, page_size);
       if (G_UNLIKELY (num_read < 0))
         {
-          s = g_format_size_full (data->bm_sample_size_mib * 1024 * 1024, G_FORMAT_SIZE_LONG_FORMAT);
-          s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
           g_set_error (&error,
                        G_IO_ERROR,
                        g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error reading %s from offset %s"),
-                       s, s2);
-          g_free (s2);
-          g_free (s);
+                       C_("benchmarking", "Error reading %lld bytes from offset %lld"),
+                       (long long int) page_size,
+                       (long long int) offset);
           goto out;
         }
       end_usec = g_get_monotonic_time ();
 
       sample.offset = offset;
-      sample.value = ((gdouble) G_USEC_PER_SEC) * num_read / (end_usec - begin_usec);
+      sample.value = (end_usec - begin_usec) / ((gdouble) G_USEC_PER_SEC);
+      G_LOCK (bm_lock);
+      g_array_append_val (data->bm_access_time_samples, sample);
+      gdu_histogram_add (data->bm_read_latency, end_usec - begin_usec);
+      G_UNLOCK (bm_lock);
+
+      bmt_schedule_update (data);
+    }
+
+  /* random IOPS at various queue depths... */
+  for (n = 0; data->bm_do_iops && disk_size > 2 * page_size && n < (gint) G_N_ELEMENTS (iops_queue_depths); n++)
+    {
+      BMSample sample = {0};
+
       G_LOCK (bm_lock);
-      g_array_append_val (data->bm_read_samples, sample);
+      data->bm_state = BM_STATE_IOPS;
+      data->bm_iops_queue_depth = iops_queue_depths[n];
       G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
 
+      sample.offset = iops_queue_depths[n];
+      if (!measure_iops (data, fd, disk_size, page_size, iops_queue_depths[n], FALSE, &sample.value, &error))
+        goto out;
+      G_LOCK (bm_lock);
+      g_array_append_val (data->bm_iops_read_samples, sample);
+      G_UNLOCK (bm_lock);
       bmt_schedule_update (data);
 
       if (data->bm_do_write)
         {
-          ssize_t num_written;
+          if (!measure_iops (data, fd, disk_size, page_size, iops_queue_depths[n], TRUE, &sample.value, &error))
+            goto out;
+          G_LOCK (bm_lock);
+          g_array_append_val (data->bm_iops_write_samples, sample);
+          G_UNLOCK (bm_lock);
+          bmt_schedule_update (data);
+        }
+    }
 
-          /* and now write the same block again... */
-          if (lseek (fd, offset, SEEK_SET) != offset)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error seeking to offset %lld"),
-                           (long long int) offset);
-              goto out;
-            }
-          if (read (fd, buffer, page_size) != page_size)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error pre-reading %lld bytes from offset %lld"),
-                           (long long int) page_size,
-                           (long long int) offset);
-              goto out;
-            }
-          if (lseek (fd, offset, SEEK_SET) != offset)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error seeking to offset %lld"),
-                           (long long int) offset);
-              goto out;
-            }
-          begin_usec = g_get_monotonic_time ();
-          num_written = write (fd, buffer, num_read);
-          if (G_UNLIKELY (num_written < 0))
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
-                           (long long int) num_read,
-                           (long long int) offset);
-              goto out;
-            }
-          if (num_written != num_read)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Expected to write %lld bytes, only wrote %lld: %m"),
-                           (long long int) num_read,
-                           (long long int) num_written);
-              goto out;
-            }
-          if (fsync (fd) != 0)
+  /* transfer rate with parallel streams... */
+  for (n = 0; data->bm_do_streams && n < (gint) G_N_ELEMENTS (stream_counts); n++)
+    {
+      BMSample sample = {0};
+
+      /* each stream needs an area of at least one sample */
+      if (disk_size / stream_counts[n] < data->bm_sample_size)
+        break;
+
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_STREAMS;
+      data->bm_num_streams = stream_counts[n];
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      sample.offset = stream_counts[n];
+      if (!measure_streams (data, fd, disk_size, page_size, stream_counts[n], FALSE, &sample.value, &error))
+        goto out;
+      G_LOCK (bm_lock);
+      g_array_append_val (data->bm_stream_read_samples, sample);
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      if (data->bm_do_write)
+        {
+          if (!measure_streams (data, fd, disk_size, page_size, stream_counts[n], TRUE, &sample.value, &error))
+            goto out;
+          G_LOCK (bm_lock);
+          g_array_append_val (data->bm_stream_write_samples, sample);
+          G_UNLOCK (bm_lock);
+          bmt_schedule_update (data);
+        }
+    }
+
+  /* request size sweep... */
+  if (data->bm_do_block_size && disk_size >= BLOCK_SIZE_MAX)
+    {
+      guchar *block_size_buffer_unaligned;
+      guchar *block_size_buffer;
+      guint num_sizes;
+      guint64 block_size;
+
+      block_size_buffer_unaligned = g_new0 (guchar, BLOCK_SIZE_MAX + page_size);
+      block_size_buffer = (guchar*) (((gintptr) (block_size_buffer_unaligned + page_size)) & (~(page_size - 1)));
+
+      num_sizes = 0;
+      for (block_size = BLOCK_SIZE_MIN; block_size <= BLOCK_SIZE_MAX; block_size *= 2)
+        num_sizes++;
+
+      for (n = 0, block_size = BLOCK_SIZE_MIN; block_size <= BLOCK_SIZE_MAX; n++, block_size *= 2)
+        {
+          BMSample sample = {0};
+          BMSample latency_sample = {0};
+          guint64 offset;
+
+          G_LOCK (bm_lock);
+          data->bm_state = BM_STATE_BLOCK_SIZE;
+          data->bm_block_size = block_size;
+          G_UNLOCK (bm_lock);
+          bmt_schedule_update (data);
+
+          /* use a different area for each size so the data isn't already in the drive's cache */
+          offset = (n * disk_size / num_sizes) & ~(page_size - 1);
+          sample.offset = latency_sample.offset = block_size;
+          if (!measure_block_size (data, fd, block_size_buffer, offset, disk_size, block_size,
+                                   &sample.value, &latency_sample.value, &error))
             {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error syncing (at offset %lld): %m"),
-                           (long long int) offset);
+              g_free (block_size_buffer_unaligned);
               goto out;
             }
-          end_usec = g_get_monotonic_time ();
-
-          sample.offset = offset;
-          sample.value = ((gdouble) G_USEC_PER_SEC) * num_written / (end_usec - begin_usec);
           G_LOCK (bm_lock);
-          g_array_append_val (data->bm_write_samples, sample);
+          g_array_append_val (data->bm_block_size_read_samples, sample);
+          g_array_append_val (data->bm_block_size_latency_samples, latency_sample);
           G_UNLOCK (bm_lock);
-
           bmt_schedule_update (data);
         }
+
+      g_free (block_size_buffer_unaligned);
     }
 
-  /* access time... */
-  G_LOCK (bm_lock);
-  data->bm_state = BM_STATE_ACCESS_TIME;
-  G_UNLOCK (bm_lock);
-  rand = g_rand_new_with_seed (42); /* want this to be deterministic (per size) so it's repeatable */
-  for (n = 0; n < data->bm_num_access_samples; n++)
+  /* synchronous write latency... */
+  for (n = 0; data->bm_do_write && data->bm_do_sync_latency && n < (gint) G_N_ELEMENTS (sync_write_sizes); n++)
     {
-      gint64 begin_usec;
-      gint64 end_usec;
-      gint64 offset;
-      ssize_t num_read;
-      BMSample sample = {0};
+      /* each size needs an area of its own */
+      if (disk_size / (G_N_ELEMENTS (sync_write_sizes) + 1) < sync_write_sizes[n] * SYNC_NUM_WRITES)
+        break;
 
-      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &error))
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_SYNC_LATENCY;
+      data->bm_sync_write_size = sync_write_sizes[n];
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      if (!measure_sync_latency (data, fd, disk_size, page_size, n, &error))
         goto out;
+    }
 
-      offset = (guint64) g_rand_double_range (rand, 0, (gdouble) disk_size);
-      offset &= ~(page_size - 1);
+  /* replaying an I/O trace... */
+  if (data->bm_replay_trace != NULL &&
+      disk_size >= GDU_IO_TRACE_MAX_REQUEST_SIZE + (guint64) page_size)
+    {
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_REPLAY;
+      g_atomic_int_set (&data->bm_replay_num_done, 0);
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
 
-      if (lseek (fd, offset, SEEK_SET) != offset)
-        {
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error seeking to offset %lld: %m"),
-                       (long long int) offset);
-          goto out;
-        }
+      if (!measure_replay (data, fd, disk_size, page_size, &error))
+        goto out;
+    }
+
+  /* metadata operations on the filesystem... */
+  if (data->bm_metadata_dir != NULL)
+    {
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_METADATA;
+      data->bm_metadata_op = BM_METADATA_OP_CREATE;
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
 
-      begin_usec = g_get_monotonic_time ();
-      num_read = read (fd, buffer, page_size);
-      if (G_UNLIKELY (num_read < 0))
-        {
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error reading %lld bytes from offset %lld"),
-                       (long long int) page_size,
-                       (long long int) offset);
-          goto out;
-        }
-      end_usec = g_get_monotonic_time ();
+      if (!measure_metadata (data, &error))
+        goto out;
+    }
 
-      sample.offset = offset;
-      sample.value = (end_usec - begin_usec) / ((gdouble) G_USEC_PER_SEC);
+  /* sustained write... */
+  if (data->bm_do_write && data->bm_do_sustained)
+    {
       G_LOCK (bm_lock);
-      g_array_append_val (data->bm_access_time_samples, sample);
+      data->bm_state = BM_STATE_SUSTAINED_WRITE;
+      data->bm_sustained_size = ((guint64) data->bm_sustained_size_gb) * 1000 * 1000 * 1000;
       G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      if (!measure_sustained_write (data, fd, disk_size, page_size, &error))
+        goto out;
+    }
 
+  /* wake-up time from standby, last so spinning the drive down doesn't disturb anything else... */
+  if (data->bm_standby_ata != NULL)
+    {
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_STANDBY;
+      data->bm_standby_run = 0;
+      G_UNLOCK (bm_lock);
       bmt_schedule_update (data);
+
+      if (!measure_wake_latency (data, fd, disk_size, page_size, &error))
+        goto out;
     }
 
   G_LOCK (bm_lock);
@@ -1426,14 +5505,17 @@ benchmark_thread (gpointer user_data)
   G_UNLOCK (bm_lock);
   if (!maybe_save_data (data, &error))
     goto out;
+  /* the results are still good, so keep them and only report that they weren't recorded */
+  if (!maybe_append_history (data, &history_error))
+    {
+      G_LOCK (bm_lock);
+      data->bm_history_error = history_error;
+      G_UNLOCK (bm_lock);
+    }
 
  out:
   if (rand != NULL)
     g_rand_free (rand);
-  g_clear_object (&fd_list);
-
-  if (fd_index != NULL)
-    g_variant_unref (fd_index);
   if (fd != -1)
     close (fd);
   g_free (buffer_unaligned);
@@ -1448,6 +5530,22 @@ benchmark_thread (gpointer user_data)
       g_array_set_size (data->bm_read_samples, 0);
       g_array_set_size (data->bm_write_samples, 0);
       g_array_set_size (data->bm_access_time_samples, 0);
+      g_array_set_size (data->bm_iops_read_samples, 0);
+      g_array_set_size (data->bm_iops_write_samples, 0);
+      gdu_histogram_clear (data->bm_read_latency);
+      gdu_histogram_clear (data->bm_write_latency);
+      g_array_set_size (data->bm_stream_read_samples, 0);
+      g_array_set_size (data->bm_stream_write_samples, 0);
+      g_array_set_size (data->bm_block_size_read_samples, 0);
+      g_array_set_size (data->bm_block_size_latency_samples, 0);
+      g_array_set_size (data->bm_sustained_samples, 0);
+      data->bm_sustained_cliff = 0;
+      g_array_set_size (data->bm_wake_samples, 0);
+      clear_concurrent_results (data->bm_concurrent_results);
+      data->bm_concurrent_aggregate_rate = 0.0;
+      clear_metadata_results (data);
+      clear_sync_latency_results (data);
+      clear_replay_results (data);
       data->bm_time_benchmarked_usec = 0;
       data->bm_sample_size = 0;
       data->bm_size = 0;
@@ -1456,6 +5554,9 @@ benchmark_thread (gpointer user_data)
 
   bmt_schedule_update (data);
 
+  if (data->command_line != NULL)
+    g_idle_add (bmt_on_command_line_done, dialog_data_ref (data));
+
   dialog_data_unref (data);
 
   //g_print ("bm thread end\n");
@@ -1468,18 +5569,75 @@ abort_benchmark (DialogData *data)
   g_cancellable_cancel (data->bm_cancellable);
 }
 
+/* Returns the ATA interface of the drive being benchmarked or NULL - free with g_object_unref() */
+static UDisksDriveAta *
+get_drive_ata (DialogData *data)
+{
+  UDisksDriveAta *ret = NULL;
+  UDisksDrive *drive;
+  GDBusObject *drive_object;
+
+  drive = udisks_client_get_drive_for_block (data->client, data->block);
+  if (drive == NULL)
+    goto out;
+
+  drive_object = g_dbus_interface_get_object (G_DBUS_INTERFACE (drive));
+  if (drive_object != NULL)
+    ret = udisks_object_get_drive_ata (UDISKS_OBJECT (drive_object));
+
+ out:
+  g_clear_object (&drive);
+  return ret;
+}
+
 static void
 start_benchmark2 (DialogData *data)
 {
+  UDisksDrive *drive;
+  UDisksDriveAta *ata;
+
+  /* record the firmware revision in the history, firmware updates often change performance */
+  drive = udisks_client_get_drive_for_block (data->client, data->block);
+  g_free (data->bm_firmware);
+  data->bm_firmware = drive != NULL ? udisks_drive_dup_revision (drive) : NULL;
+
   data->bm_in_progress = TRUE;
   data->bm_state = BM_STATE_OPENING_DEVICE;
   g_clear_error (&data->bm_error);
+  g_clear_error (&data->bm_history_error);
   g_array_set_size (data->bm_read_samples, 0);
   g_array_set_size (data->bm_write_samples, 0);
   g_array_set_size (data->bm_access_time_samples, 0);
+  g_array_set_size (data->bm_iops_read_samples, 0);
+  g_array_set_size (data->bm_iops_write_samples, 0);
+  gdu_histogram_clear (data->bm_read_latency);
+  gdu_histogram_clear (data->bm_write_latency);
+  g_array_set_size (data->bm_stream_read_samples, 0);
+  g_array_set_size (data->bm_stream_write_samples, 0);
+  g_array_set_size (data->bm_block_size_read_samples, 0);
+  g_array_set_size (data->bm_block_size_latency_samples, 0);
+  g_array_set_size (data->bm_sustained_samples, 0);
+  data->bm_sustained_cliff = 0;
+  g_array_set_size (data->bm_wake_samples, 0);
+  clear_concurrent_results (data->bm_concurrent_results);
+  data->bm_concurrent_aggregate_rate = 0.0;
+  clear_metadata_results (data);
+  clear_sync_latency_results (data);
+  clear_replay_results (data);
   data->bm_time_benchmarked_usec = 0;
   g_cancellable_reset (data->bm_cancellable);
 
+  g_clear_object (&drive);
+
+  /* the sync write latency depends a lot on whether the write cache is enabled */
+  ata = get_drive_ata (data);
+  if (ata != NULL && udisks_drive_ata_get_write_cache_supported (ata))
+    data->bm_sync_write_cache = udisks_drive_ata_get_write_cache_enabled (ata) ? 1 : 0;
+  g_clear_object (&data->bm_standby_ata);
+  if (ata != NULL && data->bm_do_standby && udisks_drive_ata_get_pm_supported (ata))
+    data->bm_standby_ata = g_object_ref (ata);
+  g_clear_object (&ata);
+
   data->bm_thread = g_thread_new ("benchmark-thread",
                                   benchmark_thread,
                                   dialog_data_ref (data));
@@ -1498,6 +5656,98 @@ ensure_unused_cb (GduWindow     *window,
   dialog_data_unref (data);
 }
 
+/* Adds a check button for every disk other than the one being benchmarked
+ * to @listbox and returns how many were added
+ */
+static guint
+populate_concurrent_listbox (DialogData *data,
+                             GtkWidget  *listbox)
+{
+  GDBusObjectManager *object_manager;
+  UDisksDrive *our_drive;
+  GList *objects;
+  GList *l;
+  guint ret = 0;
+
+  our_drive = udisks_client_get_drive_for_block (data->client, data->block);
+  object_manager = udisks_client_get_object_manager (data->client);
+  objects = g_dbus_object_manager_get_objects (object_manager);
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksObject *object = UDISKS_OBJECT (l->data);
+      UDisksDrive *drive;
+      UDisksBlock *block;
+      UDisksObjectInfo *info;
+      GtkWidget *check_button;
+      gchar *s;
+
+      drive = udisks_object_peek_drive (object);
+      if (drive == NULL || drive == our_drive)
+        continue;
+
+      block = udisks_client_get_block_for_drive (data->client, drive, FALSE); /* get_physical */
+      if (block == NULL)
+        continue;
+      if (udisks_block_get_size (block) == 0)
+        {
+          g_object_unref (block);
+          continue;
+        }
+
+      info = udisks_client_get_object_info (data->client, object);
+      s = g_strdup_printf ("%s — %s",
+                           udisks_object_info_get_one_liner (info),
+                           udisks_block_get_preferred_device (block));
+      check_button = gtk_check_button_new_with_label (s);
+      g_object_set_data_full (G_OBJECT (check_button), "gdu-block", block, g_object_unref);
+      gtk_widget_show (check_button);
+      gtk_container_add (GTK_CONTAINER (listbox), check_button);
+      g_free (s);
+      g_object_unref (info);
+      ret++;
+    }
+  g_list_free_full (objects, g_object_unref);
+  g_clear_object (&our_drive);
+
+  return ret;
+}
+
+/* Returns the blocks checked in a list box populated by populate_concurrent_listbox() */
+static GList *
+get_concurrent_blocks (GtkWidget *listbox)
+{
+  GList *ret = NULL;
+  GList *rows;
+  GList *l;
+
+  rows = gtk_container_get_children (GTK_CONTAINER (listbox));
+  for (l = rows; l != NULL; l = l->next)
+    {
+      GtkWidget *check_button = gtk_bin_get_child (GTK_BIN (l->data));
+      if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (check_button)))
+        ret = g_list_append (ret, g_object_ref (g_object_get_data (G_OBJECT (check_button), "gdu-block")));
+    }
+  g_list_free (rows);
+
+  return ret;
+}
+
+/* Returns the first mount point of the filesystem on the device, if any */
+static const gchar *
+get_mount_point (DialogData *data)
+{
+  UDisksFilesystem *filesystem;
+  const gchar *const *mount_points;
+
+  filesystem = udisks_object_peek_filesystem (data->object);
+  if (filesystem == NULL)
+    return NULL;
+  mount_points = udisks_filesystem_get_mount_points (filesystem);
+  if (mount_points == NULL || mount_points[0] == NULL)
+    return NULL;
+  return mount_points[0];
+}
+
 static void
 start_benchmark (DialogData *data)
 {
@@ -1506,7 +5756,30 @@ start_benchmark (DialogData *data)
   GtkWidget *num_samples_spinbutton;
   GtkWidget *sample_size_spinbutton;
   GtkWidget *write_checkbutton;
+  GtkWidget *streams_checkbutton;
+  GtkWidget *block_size_checkbutton;
+  GtkWidget *refine_checkbutton;
+  GtkWidget *sync_latency_checkbutton;
+  GtkWidget *sustained_grid;
+  GtkWidget *sustained_checkbutton;
+  GtkWidget *sustained_start_spinbutton;
+  GtkWidget *sustained_size_spinbutton;
   GtkWidget *num_access_samples_spinbutton;
+  GtkWidget *iops_checkbutton;
+  GtkWidget *iops_duration_spinbutton;
+  GtkWidget *concurrent_listbox;
+  GtkWidget *file_checkbutton;
+  GtkWidget *file_size_spinbutton;
+  GtkWidget *metadata_checkbutton;
+  GtkWidget *metadata_fsync_checkbutton;
+  GtkWidget *replay_checkbutton;
+  GtkWidget *replay_filechooserbutton;
+  GtkWidget *replay_fast_checkbutton;
+  GtkWidget *replay_concurrency_spinbutton;
+  GtkWidget *standby_checkbutton;
+  UDisksDriveAta *ata;
+  const gchar *mount_point;
+  gchar *old_file_dir;
   gint response;
 
   g_assert (!data->bm_in_progress);
@@ -1523,7 +5796,80 @@ start_benchmark (DialogData *data)
   num_samples_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "num-samples-spinbutton"));
   sample_size_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sample-size-spinbutton"));
   write_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "write-checkbutton"));
+  streams_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "streams-checkbutton"));
+  block_size_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "block-size-checkbutton"));
+  refine_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "refine-checkbutton"));
+  sync_latency_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sync-latency-checkbutton"));
+  standby_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "standby-checkbutton"));
+  sustained_grid = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-grid"));
+  sustained_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-checkbutton"));
+  sustained_start_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-start-spinbutton"));
+  sustained_size_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-size-spinbutton"));
   num_access_samples_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "num-access-samples-spinbutton"));
+  iops_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "iops-checkbutton"));
+  iops_duration_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "iops-duration-spinbutton"));
+  concurrent_listbox = GTK_WIDGET (gtk_builder_get_object (builder, "concurrent-listbox"));
+  file_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "file-checkbutton"));
+  file_size_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "file-size-spinbutton"));
+  metadata_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "metadata-checkbutton"));
+  metadata_fsync_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "metadata-fsync-checkbutton"));
+  replay_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "replay-checkbutton"));
+  replay_filechooserbutton = GTK_WIDGET (gtk_builder_get_object (builder, "replay-filechooserbutton"));
+  replay_fast_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "replay-fast-checkbutton"));
+  replay_concurrency_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "replay-concurrency-spinbutton"));
+
+  /* no point in showing the list of other disks if there are none */
+  if (populate_concurrent_listbox (data, concurrent_listbox) == 0)
+    {
+      gtk_widget_hide (GTK_WIDGET (gtk_builder_get_object (builder, "label27")));
+      gtk_widget_hide (GTK_WIDGET (gtk_builder_get_object (builder, "concurrent-scrolledwindow")));
+    }
+
+  /* benchmarking through a file is only possible if the filesystem is mounted */
+  mount_point = get_mount_point (data);
+  if (mount_point == NULL)
+    {
+      gtk_widget_hide (GTK_WIDGET (gtk_builder_get_object (builder, "label28")));
+      gtk_widget_hide (GTK_WIDGET (gtk_builder_get_object (builder, "file-grid")));
+    }
+  else
+    {
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (file_checkbutton), data->bm_file_dir != NULL);
+      g_object_bind_property (file_checkbutton, "active",
+                              file_size_spinbutton, "sensitive",
+                              G_BINDING_SYNC_CREATE);
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (metadata_checkbutton), data->bm_metadata_dir != NULL);
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (metadata_fsync_checkbutton), data->bm_metadata_fsync);
+      g_object_bind_property (metadata_checkbutton, "active",
+                              metadata_fsync_checkbutton, "sensitive",
+                              G_BINDING_SYNC_CREATE);
+    }
+
+  /* the wake-up time can only be measured if the drive can be put into standby */
+  ata = get_drive_ata (data);
+  if (ata != NULL && udisks_drive_ata_get_pm_supported (ata))
+    {
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (standby_checkbutton), data->bm_do_standby);
+    }
+  else
+    {
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (standby_checkbutton), FALSE);
+      gtk_widget_set_sensitive (standby_checkbutton, FALSE);
+    }
+  g_clear_object (&ata);
+
+  /* remember the trace from last time */
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (replay_checkbutton), data->bm_replay_trace != NULL);
+  if (data->bm_replay_filename != NULL)
+    gtk_file_chooser_set_filename (GTK_FILE_CHOOSER (replay_filechooserbutton), data->bm_replay_filename);
+  if (data->bm_replay_concurrency > 0)
+    {
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (replay_fast_checkbutton), data->bm_replay_fast);
+      gtk_spin_button_set_value (GTK_SPIN_BUTTON (replay_concurrency_spinbutton), data->bm_replay_concurrency);
+    }
+  g_object_bind_property (replay_checkbutton, "active",
+                          GTK_WIDGET (gtk_builder_get_object (builder, "replay-grid")), "sensitive",
+                          G_BINDING_SYNC_CREATE);
 
   /* if device is read-only, uncheck the "perform write-test"
    * check-button and also make it insensitive
@@ -1540,6 +5886,14 @@ start_benchmark (DialogData *data)
       gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (write_checkbutton), FALSE);
     }
 
+  /* the sustained write test is part of the write-benchmark */
+  g_object_bind_property (write_checkbutton, "active",
+                          sustained_grid, "sensitive",
+                          G_BINDING_SYNC_CREATE);
+  g_object_bind_property (write_checkbutton, "active",
+                          sync_latency_checkbutton, "sensitive",
+                          G_BINDING_SYNC_CREATE);
+
   /* and scene... */
   response = gtk_dialog_run (GTK_DIALOG (dialog));
 
@@ -1548,17 +5902,77 @@ start_benchmark (DialogData *data)
   if (response != GTK_RESPONSE_OK)
     goto out;
 
+  data->bm_replay_fast = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (replay_fast_checkbutton));
+  data->bm_replay_concurrency = gtk_spin_button_get_value (GTK_SPIN_BUTTON (replay_concurrency_spinbutton));
+  if (data->bm_replay_trace != NULL)
+    {
+      gdu_io_trace_free (data->bm_replay_trace);
+      data->bm_replay_trace = NULL;
+    }
+  g_free (data->bm_replay_filename);
+  data->bm_replay_filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (replay_filechooserbutton));
+  if (data->bm_replay_filename != NULL && gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (replay_checkbutton)))
+    {
+      GError *error = NULL;
+      /* load it now so a bad trace is reported before anything is benchmarked */
+      data->bm_replay_trace = gdu_io_trace_load (data->bm_replay_filename, &error);
+      if (data->bm_replay_trace == NULL)
+        {
+          gdu_utils_show_error (GTK_WINDOW (data->dialog), C_("benchmarking", "Error loading I/O trace"), error);
+          g_clear_error (&error);
+          goto out;
+        }
+    }
+
   data->bm_num_samples = gtk_spin_button_get_value (GTK_SPIN_BUTTON (num_samples_spinbutton));
   data->bm_sample_size_mib = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sample_size_spinbutton));
   data->bm_do_write = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (write_checkbutton));
+  data->bm_do_streams = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (streams_checkbutton));
+  data->bm_do_block_size = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (block_size_checkbutton));
+  data->bm_do_refine = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (refine_checkbutton));
+  data->bm_do_sync_latency = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (sync_latency_checkbutton));
+  data->bm_do_standby = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (standby_checkbutton));
+  data->bm_do_sustained = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (sustained_checkbutton));
+  data->bm_sustained_start_percent = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sustained_start_spinbutton));
+  data->bm_sustained_size_gb = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sustained_size_spinbutton));
   data->bm_num_access_samples = gtk_spin_button_get_value (GTK_SPIN_BUTTON (num_access_samples_spinbutton));
+  data->bm_do_iops = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (iops_checkbutton));
+  data->bm_iops_duration_sec = gtk_spin_button_get_value (GTK_SPIN_BUTTON (iops_duration_spinbutton));
+  g_list_free_full (data->bm_concurrent_blocks, g_object_unref);
+  data->bm_concurrent_blocks = get_concurrent_blocks (concurrent_listbox);
+  old_file_dir = data->bm_file_dir;
+  data->bm_file_dir = NULL;
+  if (mount_point != NULL && gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (file_checkbutton)))
+    data->bm_file_dir = g_strdup (mount_point);
+  data->bm_file_size = ((guint64) gtk_spin_button_get_value (GTK_SPIN_BUTTON (file_size_spinbutton))) * 1000 * 1000 * 1000;
+  g_free (data->bm_metadata_dir);
+  data->bm_metadata_dir = NULL;
+  /* not when write-benchmarking the device since the filesystem is unmounted for that */
+  if (mount_point != NULL && gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (metadata_checkbutton)) &&
+      !(data->bm_do_write && data->bm_file_dir == NULL))
+    data->bm_metadata_dir = g_strdup (mount_point);
+  data->bm_metadata_fsync = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (metadata_fsync_checkbutton));
+
+  /* results and history are kept apart for files and the device, see get_bm_filename() */
+  if ((old_file_dir != NULL) != (data->bm_file_dir != NULL))
+    {
+      GError *error = NULL;
+      if (!maybe_load_history (data, &error))
+        {
+          g_warning ("Error loading benchmark history: %s (%s, %d)",
+                     error->message, g_quark_to_string (error->domain), error->code);
+          g_clear_error (&error);
+        }
+    }
+  g_free (old_file_dir);
 
   //g_print ("num_samples=%d\n", data->bm_num_samples);
   //g_print ("sample_size=%d MB\n", data->bm_sample_size_mib);
   //g_print ("do_write=%d\n", data->bm_do_write);
   //g_print ("num_access_samples=%d\n", data->bm_num_access_samples);
 
-  if (data->bm_do_write)
+  /* only the temporary file is written to when benchmarking through a file */
+  if (data->bm_do_write && data->bm_file_dir == NULL)
     {
       /* ensure the device is unused (e.g. unmounted) before formatting it... */
       gdu_window_ensure_unused (data->window,
@@ -1588,23 +6002,10 @@ gdu_benchmark_dialog_show (GduWindow    *window,
   guint n;
   guint timeout_id;
   GError *error = NULL;
+  GSettings *settings;
 
-  data = g_new0 (DialogData, 1);
-  data->ref_count = 1;
-  data->object = g_object_ref (object);
-  data->block = udisks_object_peek_block (data->object);
+  data = dialog_data_new (gdu_window_get_client (window), object);
   data->window = g_object_ref (window);
-  data->bm_cancellable = g_cancellable_new ();
-
-  data->bm_read_samples = g_array_new (FALSE, /* zero-terminated */
-                                       FALSE, /* clear */
-                                       sizeof (BMSample));
-  data->bm_write_samples = g_array_new (FALSE, /* zero-terminated */
-                                        FALSE, /* clear */
-                                        sizeof (BMSample));
-  data->bm_access_time_samples = g_array_new (FALSE, /* zero-terminated */
-                                              FALSE, /* clear */
-                                              sizeof (BMSample));
 
   data->dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (window),
                                                          "benchmark-dialog.ui",
@@ -1626,11 +6027,64 @@ gdu_benchmark_dialog_show (GduWindow    *window,
                     "draw",
                     G_CALLBACK (on_drawing_area_draw),
                     data);
+  g_signal_connect (data->graph_drawing_area,
+                    "style-updated",
+                    G_CALLBACK (on_drawing_area_style_updated),
+                    data);
+
+  g_signal_connect (data->iops_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_iops_drawing_area_draw),
+                    data);
+
+  g_signal_connect (data->streams_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_streams_drawing_area_draw),
+                    data);
+
+  g_signal_connect (data->block_size_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_block_size_drawing_area_draw),
+                    data);
+
+  g_signal_connect (data->sustained_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_sustained_drawing_area_draw),
+                    data);
+
+  g_signal_connect (data->history_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_history_drawing_area_draw),
+                    data);
 
-  /* set minimum size for the graph */
+  /* set minimum size for the graphs */
   gtk_widget_set_size_request (data->graph_drawing_area,
                                600,
                                300);
+  gtk_widget_set_size_request (data->iops_drawing_area,
+                               600,
+                               300);
+  gtk_widget_set_size_request (data->streams_drawing_area,
+                               600,
+                               300);
+  gtk_widget_set_size_request (data->block_size_drawing_area,
+                               600,
+                               300);
+  gtk_widget_set_size_request (data->sustained_drawing_area,
+                               600,
+                               300);
+  gtk_widget_set_size_request (data->history_drawing_area,
+                               600,
+                               300);
+
+  data->regression_infobar = gdu_utils_create_info_bar (GTK_MESSAGE_WARNING, "", &data->regression_label);
+  gtk_box_pack_start (GTK_BOX (data->infobar_vbox), data->regression_infobar, TRUE, TRUE, 0);
+  gtk_widget_set_no_show_all (data->regression_infobar, TRUE);
+  g_object_ref (data->regression_infobar);
+
+  settings = g_settings_new ("org.gnome.Disks");
+  data->regression_threshold = g_settings_get_int (settings, "benchmark-regression-threshold");
+  g_object_unref (settings);
 
   /* need this to update the "Updated" value */
   timeout_id = g_timeout_add_seconds (1, on_timeout, data);
@@ -1643,6 +6097,12 @@ gdu_benchmark_dialog_show (GduWindow    *window,
                  error->message, g_quark_to_string (error->domain), error->code);
       g_clear_error (&error);
     }
+  if (!maybe_load_history (data, &error))
+    {
+      g_warning ("Error loading benchmark history: %s (%s, %d)",
+                 error->message, g_quark_to_string (error->domain), error->code);
+      g_clear_error (&error);
+    }
 
   update_dialog (data);
 
@@ -1673,3 +6133,329 @@ gdu_benchmark_dialog_show (GduWindow    *window,
   g_source_remove (timeout_id);
   dialog_data_close (data);
 }
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+json_append_string (GString     *str,
+                    const gchar *value)
+{
+  const gchar *p;
+
+  g_string_append_c (str, '"');
+  for (p = value != NULL ? value : ""; *p != '\0'; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        g_string_append_printf (str, "\\%c", *p);
+      else if ((guchar) *p < 0x20)
+        g_string_append_printf (str, "\\u%04x", (guint) (guchar) *p);
+      else
+        g_string_append_c (str, *p);
+    }
+  g_string_append_c (str, '"');
+}
+
+static void
+json_append_double (GString *str,
+                    gdouble  value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* JSON has no way to express NaN or infinity */
+  if (!isfinite (value))
+    {
+      g_string_append (str, "null");
+      return;
+    }
+  /* not using printf() since the decimal separator depends on the locale */
+  g_string_append (str, g_ascii_dtostr (buf, sizeof buf, value));
+}
+
+/* Appends the separator after the previous member and the @key of the next one */
+static void
+json_append_key (GString     *str,
+                 guint        depth,
+                 const gchar *key)
+{
+  g_string_append (str, ",\n");
+  g_string_append_printf (str, "%*s", depth * 2, "");
+  json_append_string (str, key);
+  g_string_append (str, ": ");
+}
+
+static void
+json_append_samples (GString     *str,
+                     const gchar *key,
+                     GArray      *samples)
+{
+  guint n;
+
+  json_append_key (str, 1, key);
+  g_string_append_c (str, '[');
+  for (n = 0; n < samples->len; n++)
+    {
+      BMSample *s = &g_array_index (samples, BMSample, n);
+      g_string_append_printf (str, "%s[%" G_GUINT64_FORMAT ", ", n > 0 ? ", " : "", s->offset);
+      json_append_double (str, s->value);
+      g_string_append_c (str, ']');
+    }
+  g_string_append_c (str, ']');
+}
+
+/* If @size is not 0, the average is weighted as in get_transfer_rate_avg() */
+static void
+json_append_stats (GString     *str,
+                   const gchar *key,
+                   GArray      *samples,
+                   guint64      size)
+{
+  gdouble max, min, avg;
+
+  get_max_min_avg (samples, &max, &min, &avg);
+  if (size > 0)
+    avg = get_transfer_rate_avg (samples, size);
+  json_append_key (str, 2, key);
+  g_string_append (str, "{\"min\": ");
+  json_append_double (str, min);
+  g_string_append (str, ", \"max\": ");
+  json_append_double (str, max);
+  g_string_append (str, ", \"avg\": ");
+  json_append_double (str, avg);
+  g_string_append_printf (str, ", \"count\": %u}", samples->len);
+}
+
+static void
+json_append_peak (GString     *str,
+                  const gchar *key,
+                  GArray      *samples)
+{
+  guint offset = 0;
+
+  json_append_key (str, 2, key);
+  json_append_double (str, get_peak (samples, &offset));
+}
+
+static void
+json_append_latency (GString      *str,
+                     const gchar  *key,
+                     GduHistogram *histogram)
+{
+  json_append_key (str, 2, key);
+  g_string_append_printf (str,
+                          "{\"p50\": %" G_GUINT64_FORMAT
+                          ", \"p90\": %" G_GUINT64_FORMAT
+                          ", \"p99\": %" G_GUINT64_FORMAT
+                          ", \"p99.9\": %" G_GUINT64_FORMAT
+                          ", \"count\": %" G_GUINT64_FORMAT "}",
+                          gdu_histogram_get_percentile (histogram, 50.0),
+                          gdu_histogram_get_percentile (histogram, 90.0),
+                          gdu_histogram_get_percentile (histogram, 99.0),
+                          gdu_histogram_get_percentile (histogram, 99.9),
+                          gdu_histogram_get_count (histogram));
+}
+
+/* Rates are in bytes per second - except for the metadata rates which
+ * are in operations per second - times in seconds and latencies in
+ * micro-seconds. The samples use the same names as in the file with
+ * the cached results.
+ */
+static gchar *
+results_to_json (DialogData *data)
+{
+  GString *str;
+  gdouble full_speed_peak;
+  guint n;
+
+  str = g_string_new ("{\n  \"device\": ");
+  json_append_string (str, udisks_block_get_preferred_device (data->block));
+  json_append_key (str, 1, "id");
+  json_append_string (str, udisks_block_get_id (data->block));
+  json_append_key (str, 1, "firmware");
+  json_append_string (str, data->bm_firmware);
+  json_append_key (str, 1, "timestamp-usec");
+  g_string_append_printf (str, "%" G_GINT64_FORMAT, data->bm_time_benchmarked_usec);
+  json_append_key (str, 1, "device-size");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT, data->bm_size);
+  json_append_key (str, 1, "sample-size");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT, data->bm_sample_size);
+
+  json_append_key (str, 1, "summary");
+  g_string_append (str, "{\n    \"sustained-write-cliff\": ");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT, data->bm_sustained_cliff);
+  json_append_key (str, 2, "full-speed-request-size");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT,
+                          get_full_speed_block_size (data->bm_block_size_read_samples, &full_speed_peak));
+  json_append_stats (str, "read-rate", data->bm_read_samples, data->bm_size);
+  json_append_stats (str, "write-rate", data->bm_write_samples, data->bm_size);
+  json_append_stats (str, "access-time", data->bm_access_time_samples, 0);
+  json_append_peak (str, "peak-read-iops", data->bm_iops_read_samples);
+  json_append_peak (str, "peak-write-iops", data->bm_iops_write_samples);
+  json_append_peak (str, "peak-stream-read-rate", data->bm_stream_read_samples);
+  json_append_peak (str, "peak-stream-write-rate", data->bm_stream_write_samples);
+  json_append_latency (str, "read-latency-usec", data->bm_read_latency);
+  json_append_latency (str, "write-latency-usec", data->bm_write_latency);
+  for (n = 0; n < G_N_ELEMENTS (sync_write_sizes); n++)
+    {
+      gchar *key = g_strdup_printf ("sync-write-%u-latency-usec", sync_write_sizes[n]);
+      json_append_latency (str, key, data->bm_sync_latency[n]);
+      g_free (key);
+    }
+  json_append_key (str, 2, "sync-write-cache");
+  g_string_append (str, data->bm_sync_write_cache < 0 ? "null" : data->bm_sync_write_cache ? "true" : "false");
+  json_append_key (str, 2, "concurrent-aggregate-read-rate");
+  json_append_double (str, data->bm_concurrent_aggregate_rate);
+  for (n = 0; n < BM_METADATA_NUM_OPS; n++)
+    {
+      gchar *key;
+
+      key = g_strdup_printf ("metadata-%s-rate", metadata_op_keys[n]);
+      json_append_key (str, 2, key);
+      json_append_double (str, data->bm_metadata_rates[n]);
+      g_free (key);
+      key = g_strdup_printf ("metadata-%s-latency-usec", metadata_op_keys[n]);
+      json_append_latency (str, key, data->bm_metadata_latency[n]);
+      g_free (key);
+    }
+  json_append_key (str, 2, "replay-num-requests");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT, data->bm_replay_num_requests);
+  json_append_key (str, 2, "replay-duration-usec");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT, data->bm_replay_duration_usec);
+  json_append_key (str, 2, "replay-trace-duration-usec");
+  g_string_append_printf (str, "%" G_GUINT64_FORMAT, data->bm_replay_trace_duration_usec);
+  json_append_latency (str, "replay-read-latency-usec", data->bm_replay_read_latency);
+  json_append_latency (str, "replay-write-latency-usec", data->bm_replay_write_latency);
+  g_string_append (str, "\n  }");
+
+  json_append_key (str, 1, "concurrent-read-rates");
+  g_string_append_c (str, '[');
+  for (n = 0; n < data->bm_concurrent_results->len; n++)
+    {
+      BMConcurrentResult *result = &g_array_index (data->bm_concurrent_results, BMConcurrentResult, n);
+      g_string_append_printf (str, "%s[", n > 0 ? ", " : "");
+      json_append_string (str, result->device);
+      g_string_append (str, ", ");
+      json_append_double (str, result->read_rate);
+      g_string_append_c (str, ']');
+    }
+  g_string_append_c (str, ']');
+
+  json_append_samples (str, "read-samples", data->bm_read_samples);
+  json_append_samples (str, "write-samples", data->bm_write_samples);
+  json_append_samples (str, "access-time-samples", data->bm_access_time_samples);
+  json_append_samples (str, "iops-read-samples", data->bm_iops_read_samples);
+  json_append_samples (str, "iops-write-samples", data->bm_iops_write_samples);
+  json_append_samples (str, "stream-read-samples", data->bm_stream_read_samples);
+  json_append_samples (str, "stream-write-samples", data->bm_stream_write_samples);
+  json_append_samples (str, "block-size-read-samples", data->bm_block_size_read_samples);
+  json_append_samples (str, "block-size-latency-samples", data->bm_block_size_latency_samples);
+  json_append_samples (str, "sustained-write-samples", data->bm_sustained_samples);
+  json_append_samples (str, "wake-samples", data->bm_wake_samples);
+  g_string_append (str, "\n}\n");
+
+  return g_string_free (str, FALSE);
+}
+
+/* called on main / UI thread when the benchmark started by
+ * gdu_benchmark_run_for_command_line() is done
+ */
+static gboolean
+bmt_on_command_line_done (gpointer user_data)
+{
+  DialogData *data = user_data;
+  gint exit_status = 1;
+  gchar *s;
+
+  if (data->bm_error != NULL)
+    {
+      g_application_command_line_printerr (data->command_line,
+                                           _("Error benchmarking %s: %s\n"),
+                                           udisks_block_get_preferred_device (data->block),
+                                           data->bm_error->message);
+      goto out;
+    }
+
+  s = results_to_json (data);
+  g_application_command_line_print (data->command_line, "%s", s);
+  g_free (s);
+
+  if (data->bm_history_error != NULL)
+    g_application_command_line_printerr (data->command_line,
+                                         _("Error recording the benchmark of %s in its history: %s\n"),
+                                         udisks_block_get_preferred_device (data->block),
+                                         data->bm_history_error->message);
+
+  exit_status = 0;
+
+ out:
+  /* the invoking process exits once the command line object is finalized */
+  g_application_command_line_set_exit_status (data->command_line, exit_status);
+  g_clear_object (&data->command_line);
+  g_application_release (data->application);
+  g_clear_object (&data->application);
+  dialog_data_unref (data);
+  return FALSE; /* don't run again */
+}
+
+/* Starts benchmarking with the default settings, without showing any UI.
+ * Since this may be called in the primary instance of the application,
+ * with windows open, it returns right away and the results are printed
+ * as JSON once the benchmark is done - @command_line is kept alive, and
+ * @application held, until then.
+ *
+ * Returns FALSE if the benchmark can't be started, after printing why.
+ */
+gboolean
+gdu_benchmark_run_for_command_line (GApplication            *application,
+                                    UDisksClient            *client,
+                                    UDisksObject            *object,
+                                    gboolean                 do_write,
+                                    GApplicationCommandLine *command_line)
+{
+  DialogData *data;
+  gboolean ret = FALSE;
+
+  data = dialog_data_new (client, object);
+
+  if (do_write)
+    {
+      /* unlike the dialog we can't ask the user to unmount things */
+      if (udisks_block_get_read_only (data->block))
+        {
+          g_application_command_line_printerr (command_line,
+                                               _("Cannot benchmark writing since %s is read-only\n"),
+                                               udisks_block_get_preferred_device (data->block));
+          goto out;
+        }
+      if (gdu_utils_is_in_use (client, object))
+        {
+          g_application_command_line_printerr (command_line,
+                                               _("Cannot benchmark writing since %s is in use\n"),
+                                               udisks_block_get_preferred_device (data->block));
+          goto out;
+        }
+    }
+
+  /* same defaults as in the dialog */
+  data->bm_num_samples = 100;
+  data->bm_do_refine = TRUE;
+  data->bm_sample_size_mib = 10;
+  data->bm_do_write = do_write;
+  data->bm_num_access_samples = 1000;
+  data->bm_do_iops = TRUE;
+  data->bm_iops_duration_sec = 5;
+  data->bm_do_streams = TRUE;
+  data->bm_do_block_size = FALSE;
+  data->bm_do_sustained = FALSE;
+  data->bm_do_sync_latency = TRUE;
+
+  data->application = g_object_ref (application);
+  data->command_line = g_object_ref (command_line);
+  g_application_hold (application);
+  start_benchmark2 (data);
+
+  ret = TRUE;
+
+ out:
+  dialog_data_unref (data);
+  return ret;
+}
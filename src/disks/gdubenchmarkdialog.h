@@ -15,8 +15,14 @@
 
 G_BEGIN_DECLS
 
-void   gdu_benchmark_dialog_show (GduWindow    *window,
-                                  UDisksObject *object);
+void     gdu_benchmark_dialog_show          (GduWindow               *window,
+                                             UDisksObject            *object);
+
+gboolean gdu_benchmark_run_for_command_line (GApplication            *application,
+                                             UDisksClient            *client,
+                                             UDisksObject            *object,
+                                             gboolean                 do_write,
+                                             GApplicationCommandLine *command_line);
 
 G_END_DECLS
 
@@ -0,0 +1,367 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include "gdubufferring.h"
+
+/* A fixed set of page-aligned buffers passed from a single producer
+ * thread to one or more consumer threads, in order. A buffer is only
+ * reused once every consumer that is still attached is done with it,
+ * so the producer can run at most @num_buffers buffers ahead of the
+ * slowest consumer - unless lagging consumers are detached, see
+ * gdu_buffer_ring_set_detach_lagging().
+ */
+
+struct GduBufferRing
+{
+  GMutex lock;
+  GCond cond;
+
+  guint num_buffers;
+  gsize buffer_size;
+  guchar *buffers_unaligned;
+  guchar *buffers;
+  guint64 *offsets;
+  gsize *sizes;
+
+  /* the number of buffers produced so far */
+  guint64 num_written;
+
+  guint num_consumers;
+  /* the number of buffers each consumer has finished */
+  guint64 *num_read;
+  gboolean *detached;
+  /* TRUE while a consumer is between begin_read() and end_read() */
+  gboolean *reading;
+  /* TRUE if the consumer was detached for holding back the others */
+  gboolean *lagging;
+
+  gboolean detach_lagging;
+
+  gboolean closed;
+  gboolean aborted;
+};
+
+GduBufferRing *
+gdu_buffer_ring_new (guint num_buffers,
+                     gsize buffer_size,
+                     guint num_consumers)
+{
+  GduBufferRing *ring;
+  long page_size;
+
+  g_return_val_if_fail (num_buffers > 0, NULL);
+  g_return_val_if_fail (num_consumers > 0, NULL);
+
+  page_size = sysconf (_SC_PAGESIZE);
+
+  ring = g_new0 (GduBufferRing, 1);
+  g_mutex_init (&ring->lock);
+  g_cond_init (&ring->cond);
+  ring->num_buffers = num_buffers;
+  /* keep every buffer page-aligned so it can be used with O_DIRECT */
+  ring->buffer_size = (buffer_size + page_size - 1) & (~(page_size - 1));
+  ring->buffers_unaligned = g_new0 (guchar, ring->buffer_size * num_buffers + page_size);
+  ring->buffers = (guchar*) (((gintptr) (ring->buffers_unaligned + page_size)) & (~(page_size - 1)));
+  ring->offsets = g_new0 (guint64, num_buffers);
+  ring->sizes = g_new0 (gsize, num_buffers);
+  ring->num_consumers = num_consumers;
+  ring->num_read = g_new0 (guint64, num_consumers);
+  ring->detached = g_new0 (gboolean, num_consumers);
+  ring->reading = g_new0 (gboolean, num_consumers);
+  ring->lagging = g_new0 (gboolean, num_consumers);
+
+  return ring;
+}
+
+void
+gdu_buffer_ring_free (GduBufferRing *ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_mutex_clear (&ring->lock);
+  g_cond_clear (&ring->cond);
+  g_free (ring->buffers_unaligned);
+  g_free (ring->offsets);
+  g_free (ring->sizes);
+  g_free (ring->num_read);
+  g_free (ring->detached);
+  g_free (ring->reading);
+  g_free (ring->lagging);
+  g_free (ring);
+}
+
+gsize
+gdu_buffer_ring_get_buffer_size (GduBufferRing *ring)
+{
+  g_return_val_if_fail (ring != NULL, 0);
+  return ring->buffer_size;
+}
+
+/**
+ * gdu_buffer_ring_set_detach_lagging:
+ * @ring: A #GduBufferRing.
+ * @detach_lagging: Whether to detach consumers that hold back the others.
+ *
+ * If @detach_lagging is %TRUE, the producer doesn't wait for the
+ * slowest consumer once it is a full ring behind another consumer
+ * that has nothing left to read. Instead the slowest consumer is
+ * detached and gdu_buffer_ring_begin_read() returns %NULL for it, see
+ * gdu_buffer_ring_get_lagging().
+ */
+void
+gdu_buffer_ring_set_detach_lagging (GduBufferRing *ring,
+                                    gboolean       detach_lagging)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_mutex_lock (&ring->lock);
+  ring->detach_lagging = detach_lagging;
+  g_mutex_unlock (&ring->lock);
+}
+
+/* Returns TRUE if @consumer was detached because it fell too far behind */
+gboolean
+gdu_buffer_ring_get_lagging (GduBufferRing *ring,
+                             guint          consumer)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (ring != NULL, FALSE);
+  g_return_val_if_fail (consumer < ring->num_consumers, FALSE);
+
+  g_mutex_lock (&ring->lock);
+  ret = ring->lagging[consumer] && ring->detached[consumer];
+  g_mutex_unlock (&ring->lock);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* must be called with the lock held - returns FALSE if all consumers are detached */
+static gboolean
+get_min_num_read (GduBufferRing *ring,
+                  guint64       *out_min_num_read)
+{
+  gboolean ret = FALSE;
+  guint64 min_num_read = G_MAXUINT64;
+  guint n;
+
+  for (n = 0; n < ring->num_consumers; n++)
+    {
+      if (ring->detached[n])
+        continue;
+      if (ring->num_read[n] < min_num_read)
+        min_num_read = ring->num_read[n];
+      ret = TRUE;
+    }
+  *out_min_num_read = min_num_read;
+  return ret;
+}
+
+/* must be called with the lock held - detaches the consumers at
+ * @min_num_read if another consumer is waiting for the producer.
+ * A consumer still reading its buffer is detached in end_read().
+ */
+static void
+detach_lagging (GduBufferRing *ring,
+                guint64        min_num_read)
+{
+  gboolean others_waiting = FALSE;
+  guint n;
+
+  for (n = 0; n < ring->num_consumers; n++)
+    {
+      if (!ring->detached[n] && ring->num_read[n] == ring->num_written)
+        others_waiting = TRUE;
+    }
+  if (!others_waiting)
+    return;
+
+  for (n = 0; n < ring->num_consumers; n++)
+    {
+      if (ring->detached[n] || ring->num_read[n] != min_num_read)
+        continue;
+      ring->lagging[n] = TRUE;
+      if (!ring->reading[n])
+        ring->detached[n] = TRUE;
+    }
+  g_cond_broadcast (&ring->cond);
+}
+
+/**
+ * gdu_buffer_ring_begin_write:
+ * @ring: A #GduBufferRing.
+ *
+ * Waits until a buffer is available to the producer.
+ *
+ * Returns: The buffer to fill, of gdu_buffer_ring_get_buffer_size() bytes,
+ * or %NULL if the ring was aborted or if all consumers have detached.
+ */
+guchar *
+gdu_buffer_ring_begin_write (GduBufferRing *ring)
+{
+  guchar *ret = NULL;
+
+  g_return_val_if_fail (ring != NULL, NULL);
+
+  g_mutex_lock (&ring->lock);
+  while (!ring->aborted)
+    {
+      guint64 min_num_read;
+
+      if (!get_min_num_read (ring, &min_num_read))
+        break;
+
+      if (ring->num_written - min_num_read < ring->num_buffers)
+        {
+          ret = ring->buffers + (ring->num_written % ring->num_buffers) * ring->buffer_size;
+          break;
+        }
+      if (ring->detach_lagging)
+        {
+          guint64 prev_min_num_read = min_num_read;
+          detach_lagging (ring, min_num_read);
+          if (get_min_num_read (ring, &min_num_read) && min_num_read != prev_min_num_read)
+            continue;
+        }
+      g_cond_wait (&ring->cond, &ring->lock);
+    }
+  g_mutex_unlock (&ring->lock);
+
+  return ret;
+}
+
+void
+gdu_buffer_ring_end_write (GduBufferRing *ring,
+                           guint64        offset,
+                           gsize          size)
+{
+  guint slot;
+
+  g_return_if_fail (ring != NULL);
+  g_return_if_fail (size <= ring->buffer_size);
+
+  g_mutex_lock (&ring->lock);
+  slot = ring->num_written % ring->num_buffers;
+  ring->offsets[slot] = offset;
+  ring->sizes[slot] = size;
+  ring->num_written++;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+/* Called by the producer when no more buffers will be written */
+void
+gdu_buffer_ring_close (GduBufferRing *ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_mutex_lock (&ring->lock);
+  ring->closed = TRUE;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_buffer_ring_begin_read:
+ * @ring: A #GduBufferRing.
+ * @consumer: The consumer, from 0 to @num_consumers - 1.
+ * @out_offset: Return location for the offset passed to gdu_buffer_ring_end_write().
+ * @out_size: Return location for the size passed to gdu_buffer_ring_end_write().
+ *
+ * Waits until the next buffer is available to @consumer.
+ *
+ * Returns: The buffer or %NULL if the producer closed the ring and
+ * all buffers have been consumed, if the ring was aborted or if
+ * @consumer was detached.
+ */
+const guchar *
+gdu_buffer_ring_begin_read (GduBufferRing *ring,
+                            guint          consumer,
+                            guint64       *out_offset,
+                            gsize         *out_size)
+{
+  const guchar *ret = NULL;
+
+  g_return_val_if_fail (ring != NULL, NULL);
+  g_return_val_if_fail (consumer < ring->num_consumers, NULL);
+
+  g_mutex_lock (&ring->lock);
+  while (!ring->aborted && !ring->detached[consumer])
+    {
+      if (ring->num_read[consumer] < ring->num_written)
+        {
+          guint slot = ring->num_read[consumer] % ring->num_buffers;
+          ring->reading[consumer] = TRUE;
+          ret = ring->buffers + slot * ring->buffer_size;
+          if (out_offset != NULL)
+            *out_offset = ring->offsets[slot];
+          if (out_size != NULL)
+            *out_size = ring->sizes[slot];
+          break;
+        }
+      if (ring->closed)
+        break;
+      g_cond_wait (&ring->cond, &ring->lock);
+    }
+  g_mutex_unlock (&ring->lock);
+
+  return ret;
+}
+
+void
+gdu_buffer_ring_end_read (GduBufferRing *ring,
+                          guint          consumer)
+{
+  g_return_if_fail (ring != NULL);
+  g_return_if_fail (consumer < ring->num_consumers);
+
+  g_mutex_lock (&ring->lock);
+  ring->num_read[consumer]++;
+  ring->reading[consumer] = FALSE;
+  if (ring->lagging[consumer])
+    ring->detached[consumer] = TRUE;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+/* Called when @consumer won't read any more buffers, e.g. because of an
+ * error. This ensures the producer and the other consumers are not held
+ * back by it.
+ */
+void
+gdu_buffer_ring_detach (GduBufferRing *ring,
+                        guint          consumer)
+{
+  g_return_if_fail (ring != NULL);
+  g_return_if_fail (consumer < ring->num_consumers);
+
+  g_mutex_lock (&ring->lock);
+  ring->detached[consumer] = TRUE;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+/* Wakes up the producer and all consumers and makes all further waits fail */
+void
+gdu_buffer_ring_abort (GduBufferRing *ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_mutex_lock (&ring->lock);
+  ring->aborted = TRUE;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
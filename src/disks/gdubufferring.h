@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_BUFFER_RING_H__
+#define __GDU_BUFFER_RING_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+GduBufferRing *gdu_buffer_ring_new             (guint          num_buffers,
+                                                gsize          buffer_size,
+                                                guint          num_consumers);
+void           gdu_buffer_ring_free            (GduBufferRing *ring);
+gsize          gdu_buffer_ring_get_buffer_size (GduBufferRing *ring);
+void           gdu_buffer_ring_set_detach_lagging (GduBufferRing *ring,
+                                                   gboolean       detach_lagging);
+
+guchar        *gdu_buffer_ring_begin_write     (GduBufferRing *ring);
+void           gdu_buffer_ring_end_write       (GduBufferRing *ring,
+                                                guint64        offset,
+                                                gsize          size);
+void           gdu_buffer_ring_close           (GduBufferRing *ring);
+
+const guchar  *gdu_buffer_ring_begin_read      (GduBufferRing *ring,
+                                                guint          consumer,
+                                                guint64       *out_offset,
+                                                gsize         *out_size);
+void           gdu_buffer_ring_end_read        (GduBufferRing *ring,
+                                                guint          consumer);
+void           gdu_buffer_ring_detach          (GduBufferRing *ring,
+                                                guint          consumer);
+gboolean       gdu_buffer_ring_get_lagging     (GduBufferRing *ring,
+                                                guint          consumer);
+
+void           gdu_buffer_ring_abort           (GduBufferRing *ring);
+
+G_END_DECLS
+
+#endif /* __GDU_BUFFER_RING_H__ */
@@ -0,0 +1,205 @@
+/* Bzip2 Decompressor - based on GLib's GZLibDecompressor
+ *
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ *         Alexander Larsson <alexl@redhat.com>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "gdubzip2decompressor.h"
+
+#include <string.h>
+
+#include <bzlib.h>
+
+/* Handles files consisting of several bzip2 streams, e.g. as produced
+ * by pbzip2(1) or by concatenating bzip2 files.
+ */
+
+static void gdu_bzip2_decompressor_iface_init          (GConverterIface *iface);
+
+struct GduBzip2Decompressor
+{
+  GObject parent_instance;
+
+  bz_stream stream;
+  gboolean end_of_member;
+  gboolean trailing_garbage;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GduBzip2Decompressor, gdu_bzip2_decompressor, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+						gdu_bzip2_decompressor_iface_init))
+
+static void
+gdu_bzip2_decompressor_finalize (GObject *object)
+{
+  GduBzip2Decompressor *decompressor = GDU_BZIP2_DECOMPRESSOR (object);
+
+  BZ2_bzDecompressEnd (&decompressor->stream);
+
+  G_OBJECT_CLASS (gdu_bzip2_decompressor_parent_class)->finalize (object);
+}
+
+static void
+init_bzip2 (GduBzip2Decompressor *decompressor)
+{
+  int ret;
+  memset (&decompressor->stream, 0, sizeof decompressor->stream);
+  ret = BZ2_bzDecompressInit (&decompressor->stream,
+                              0,  /* verbosity */
+                              0); /* small */
+  if (ret != BZ_OK)
+    g_critical ("Error initalizing bzip2 decoder: %d", ret);
+}
+
+static void
+gdu_bzip2_decompressor_init (GduBzip2Decompressor *decompressor)
+{
+  init_bzip2 (decompressor);
+}
+
+static void
+gdu_bzip2_decompressor_class_init (GduBzip2DecompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gdu_bzip2_decompressor_finalize;
+}
+
+GduBzip2Decompressor *
+gdu_bzip2_decompressor_new (void)
+{
+  GduBzip2Decompressor *decompressor;
+
+  decompressor = g_object_new (GDU_TYPE_BZIP2_DECOMPRESSOR,
+			       NULL);
+
+  return decompressor;
+}
+
+static void
+gdu_bzip2_decompressor_reset (GConverter *converter)
+{
+  GduBzip2Decompressor *decompressor = GDU_BZIP2_DECOMPRESSOR (converter);
+  BZ2_bzDecompressEnd (&decompressor->stream);
+  init_bzip2 (decompressor);
+  decompressor->end_of_member = FALSE;
+  decompressor->trailing_garbage = FALSE;
+}
+
+static GConverterResult
+gdu_bzip2_decompressor_convert (GConverter *converter,
+			        const void *inbuf,
+			        gsize       inbuf_size,
+			        void       *outbuf,
+			        gsize       outbuf_size,
+			        GConverterFlags flags,
+			        gsize      *bytes_read,
+			        gsize      *bytes_written,
+			        GError    **error)
+{
+  GduBzip2Decompressor *decompressor = GDU_BZIP2_DECOMPRESSOR (converter);
+  int res;
+
+  /* The input ended right after a complete member */
+  if (decompressor->end_of_member && inbuf_size == 0)
+    {
+      *bytes_read = 0;
+      *bytes_written = 0;
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        return G_CONVERTER_FINISHED;
+      if (flags & G_CONVERTER_FLUSH)
+        return G_CONVERTER_FLUSHED;
+    }
+
+  if (decompressor->trailing_garbage)
+    {
+      *bytes_read = inbuf_size;
+      *bytes_written = 0;
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        return G_CONVERTER_FINISHED;
+      return G_CONVERTER_CONVERTED;
+    }
+
+  decompressor->stream.next_in = (char *)inbuf;
+  decompressor->stream.avail_in = MIN (inbuf_size, G_MAXUINT);
+
+  decompressor->stream.next_out = outbuf;
+  decompressor->stream.avail_out = MIN (outbuf_size, G_MAXUINT);
+
+  res = BZ2_bzDecompress (&decompressor->stream);
+
+  if (res == BZ_DATA_ERROR || res == BZ_DATA_ERROR_MAGIC)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			   _("Invalid compressed data"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res == BZ_MEM_ERROR)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			   _("Not enough memory"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res != BZ_OK && res != BZ_STREAM_END)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+		   _("Internal error"));
+      return G_CONVERTER_ERROR;
+    }
+
+  *bytes_read = MIN (inbuf_size, G_MAXUINT) - decompressor->stream.avail_in;
+  *bytes_written = MIN (outbuf_size, G_MAXUINT) - decompressor->stream.avail_out;
+
+  if (res == BZ_STREAM_END)
+    {
+      /* End of a stream - another one may follow */
+      BZ2_bzDecompressEnd (&decompressor->stream);
+      init_bzip2 (decompressor);
+      decompressor->end_of_member = TRUE;
+
+      if (*bytes_read < inbuf_size && ((const guint8 *) inbuf)[*bytes_read] != 'B')
+        {
+          decompressor->trailing_garbage = TRUE;
+          *bytes_read = inbuf_size;
+        }
+
+      if (*bytes_read == inbuf_size && (flags & G_CONVERTER_INPUT_AT_END))
+        return G_CONVERTER_FINISHED;
+
+      return G_CONVERTER_CONVERTED;
+    }
+
+  /* libbz2 doesn't have an equivalent of Z_BUF_ERROR so check for lack of progress ourselves */
+  if (*bytes_read == 0 && *bytes_written == 0)
+    {
+      if (flags & G_CONVERTER_FLUSH)
+	return G_CONVERTER_FLUSHED;
+
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+			   _("Need more input"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (*bytes_read > 0)
+    decompressor->end_of_member = FALSE;
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+gdu_bzip2_decompressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = gdu_bzip2_decompressor_convert;
+  iface->reset = gdu_bzip2_decompressor_reset;
+}
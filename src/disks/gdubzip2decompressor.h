@@ -0,0 +1,38 @@
+/* Bzip2 Decompressor - based on GLib's GZLibDecompressor
+ *
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ *         Alexander Larsson <alexl@redhat.com>
+ */
+
+#ifndef __GDU_BZIP2_DECOMPRESSOR_H__
+#define __GDU_BZIP2_DECOMPRESSOR_H__
+
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+#define GDU_TYPE_BZIP2_DECOMPRESSOR         (gdu_bzip2_decompressor_get_type ())
+#define GDU_BZIP2_DECOMPRESSOR(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GDU_TYPE_BZIP2_DECOMPRESSOR, GduBzip2Decompressor))
+#define GDU_BZIP2_DECOMPRESSOR_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), GDU_TYPE_BZIP2_DECOMPRESSOR, GduBzip2DecompressorClass))
+#define GDU_IS_BZIP2_DECOMPRESSOR(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), GDU_TYPE_BZIP2_DECOMPRESSOR))
+#define GDU_IS_BZIP2_DECOMPRESSOR_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), GDU_TYPE_BZIP2_DECOMPRESSOR))
+#define GDU_BZIP2_DECOMPRESSOR_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), GDU_TYPE_BZIP2_DECOMPRESSOR, GduBzip2DecompressorClass))
+
+typedef struct GduBzip2DecompressorClass   GduBzip2DecompressorClass;
+
+struct GduBzip2DecompressorClass
+{
+  GObjectClass parent_class;
+};
+
+GType                 gdu_bzip2_decompressor_get_type (void) G_GNUC_CONST;
+GduBzip2Decompressor *gdu_bzip2_decompressor_new      (void);
+
+G_END_DECLS
+
+#endif /* __GDU_BZIP2_DECOMPRESSOR_H__ */
@@ -0,0 +1,947 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+
+#include <canberra-gtk.h>
+
+#include "gduapplication.h"
+#include "gduwindow.h"
+#include "gduclonediskdialog.h"
+#include "gduestimator.h"
+#include "gdulocaljob.h"
+#include "gdudevicetreemodel.h"
+#include "gdubufferring.h"
+#include "gducopyutils.h"
+
+/* Copies a whole device to another device. The source is read by one
+ * thread and written to the destination by another so reading and
+ * writing overlap. Chunks consisting only of zeroes are not copied -
+ * the destination range is zeroed by the kernel instead which is a lot
+ * cheaper for e.g. SSDs and thinly provisioned devices.
+ */
+
+/* How many chunks reading the source may run ahead of writing the destination */
+#define RING_NUM_BUFFERS 32
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+  volatile gint ref_count;
+
+  GduWindow *window;
+  UDisksObject *object;
+  UDisksBlock *block;
+
+  UDisksObject *destination_object;
+  UDisksBlock *destination_block;
+
+  GtkBuilder *builder;
+  GtkWidget *dialog;
+
+  GtkWidget *infobar_vbox;
+  GtkWidget *error_infobar;
+  GtkWidget *error_label;
+
+  GtkWidget *source_label;
+  GtkWidget *destination_combobox;
+
+  GtkWidget *start_copying_button;
+  GtkWidget *cancel_button;
+
+  GCancellable *cancellable;
+  gsize chunk_size;
+
+  /* the source is read into this ring and written to the destination from it */
+  gint source_fd;
+  guint64 source_size;
+  GduBufferRing *ring;
+
+  /* must hold copy_lock when reading/writing these */
+  GMutex copy_lock;
+  GduEstimator *estimator;
+  guint update_id;
+  GError *read_error;
+  guint64 num_bytes_zeroed;
+
+  GError *copy_error;
+
+  gulong response_signal_handler_id;
+  gboolean completed;
+
+  guint inhibit_cookie;
+
+  GduLocalJob *local_job;
+} DialogData;
+
+static const struct {
+  goffset offset;
+  const gchar *name;
+} widget_mapping[] = {
+  {G_STRUCT_OFFSET (DialogData, infobar_vbox), "infobar-vbox"},
+  {G_STRUCT_OFFSET (DialogData, source_label), "source-label"},
+  {G_STRUCT_OFFSET (DialogData, destination_combobox), "destination-combobox"},
+
+  {G_STRUCT_OFFSET (DialogData, start_copying_button), "start-copying-button"},
+  {G_STRUCT_OFFSET (DialogData, cancel_button), "cancel-button"},
+  {0, NULL}
+};
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static DialogData *
+dialog_data_ref (DialogData *data)
+{
+  g_atomic_int_inc (&data->ref_count);
+  return data;
+}
+
+static void
+dialog_data_terminate_job (DialogData *data)
+{
+  if (data->local_job != NULL)
+    {
+      gdu_application_destroy_local_job (gdu_window_get_application (data->window), data->local_job);
+      data->local_job = NULL;
+    }
+}
+
+static void
+dialog_data_uninhibit (DialogData *data)
+{
+  if (data->inhibit_cookie > 0)
+    {
+      gtk_application_uninhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+                                 data->inhibit_cookie);
+      data->inhibit_cookie = 0;
+    }
+}
+
+static void
+dialog_data_hide (DialogData *data)
+{
+  if (data->dialog != NULL)
+    {
+      GtkWidget *dialog;
+      if (data->response_signal_handler_id != 0)
+        g_signal_handler_disconnect (data->dialog, data->response_signal_handler_id);
+      dialog = data->dialog;
+      data->dialog = NULL;
+      gtk_widget_hide (dialog);
+      gtk_widget_destroy (dialog);
+      data->dialog = NULL;
+    }
+}
+
+static void
+dialog_data_unref (DialogData *data)
+{
+  if (g_atomic_int_dec_and_test (&data->ref_count))
+    {
+      dialog_data_terminate_job (data);
+      dialog_data_uninhibit (data);
+      dialog_data_hide (data);
+
+      g_clear_object (&data->cancellable);
+      g_object_unref (data->window);
+      g_object_unref (data->object);
+      g_object_unref (data->block);
+      g_clear_object (&data->destination_object);
+      g_clear_object (&data->destination_block);
+      if (data->builder != NULL)
+        g_object_unref (data->builder);
+      g_clear_object (&data->error_infobar);
+      g_clear_object (&data->estimator);
+      g_clear_error (&data->read_error);
+      g_mutex_clear (&data->copy_lock);
+      g_free (data);
+    }
+}
+
+static gboolean
+unref_in_idle (gpointer user_data)
+{
+  DialogData *data = user_data;
+  dialog_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+static void
+dialog_data_unref_in_idle (DialogData *data)
+{
+  g_idle_add (unref_in_idle, data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+dialog_data_complete_and_unref (DialogData *data)
+{
+  if (!data->completed)
+    {
+      data->completed = TRUE;
+      g_cancellable_cancel (data->cancellable);
+    }
+  dialog_data_uninhibit (data);
+  dialog_data_hide (data);
+  dialog_data_unref (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+clone_disk_update (DialogData *data)
+{
+  gboolean can_proceed = FALSE;
+  gchar *clone_error = NULL;
+
+  if (data->dialog == NULL)
+    goto out;
+
+  if (data->destination_block != NULL)
+    {
+      guint64 source_size = udisks_block_get_size (data->block);
+      guint64 destination_size = udisks_block_get_size (data->destination_block);
+
+      if (destination_size < source_size)
+        {
+          gchar *s;
+          s = udisks_client_get_size_for_display (gdu_window_get_client (data->window),
+                                                  source_size - destination_size, FALSE, FALSE);
+          /* Translators: Shown if the disk picked as the destination is too small.
+           *              The %s is a size (ex. "1.2 GB").
+           */
+          clone_error = g_strdup_printf (_("The destination is %s smaller than the source"), s);
+          g_free (s);
+        }
+      else
+        {
+          can_proceed = TRUE;
+        }
+    }
+
+  if (clone_error != NULL)
+    {
+      gtk_label_set_text (GTK_LABEL (data->error_label), clone_error);
+      gtk_widget_show (data->error_infobar);
+    }
+  else
+    {
+      gtk_widget_hide (data->error_infobar);
+    }
+  g_free (clone_error);
+
+  gtk_dialog_set_response_sensitive (GTK_DIALOG (data->dialog), GTK_RESPONSE_OK, can_proceed);
+
+ out:
+  ;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+is_usable_destination (DialogData  *data,
+                       UDisksBlock *block)
+{
+  UDisksClient *client = gdu_window_get_client (data->window);
+  UDisksDrive *drive;
+  UDisksDrive *source_drive;
+  gboolean ret = FALSE;
+
+  if (udisks_block_get_size (block) == 0 || udisks_block_get_read_only (block))
+    goto out;
+
+  /* a disk can't be cloned to itself */
+  if (g_strcmp0 (udisks_block_get_device (block), udisks_block_get_device (data->block)) == 0)
+    goto out;
+  drive = udisks_client_get_drive_for_block (client, block);
+  source_drive = udisks_client_get_drive_for_block (client, data->block);
+  ret = (drive == NULL || drive != source_drive);
+  g_clear_object (&drive);
+  g_clear_object (&source_drive);
+
+ out:
+  return ret;
+}
+
+static void
+destination_combobox_sensitive_cb (GtkCellLayout   *cell_layout,
+                                   GtkCellRenderer *renderer,
+                                   GtkTreeModel    *model,
+                                   GtkTreeIter     *iter,
+                                   gpointer         user_data)
+{
+  DialogData *data = user_data;
+  gboolean sensitive = FALSE;
+  UDisksBlock *block = NULL;
+
+  gtk_tree_model_get (model, iter,
+                      GDU_DEVICE_TREE_MODEL_COLUMN_BLOCK, &block,
+                      -1);
+
+  if (block == NULL || is_usable_destination (data, block))
+    sensitive = TRUE;
+
+  gtk_cell_renderer_set_sensitive (renderer, sensitive);
+
+  g_clear_object (&block);
+}
+
+static void
+on_destination_combobox_notify_active (GObject    *gobject,
+                                       GParamSpec *pspec,
+                                       gpointer    user_data)
+{
+  DialogData *data = user_data;
+  GtkTreeIter iter;
+  GtkComboBox *combobox;
+
+  g_clear_object (&data->destination_object);
+  g_clear_object (&data->destination_block);
+
+  combobox = GTK_COMBO_BOX (data->destination_combobox);
+  if (gtk_combo_box_get_active_iter (combobox, &iter))
+    {
+      UDisksBlock *block = NULL;
+      gtk_tree_model_get (gtk_combo_box_get_model (combobox),
+                          &iter,
+                          GDU_DEVICE_TREE_MODEL_COLUMN_BLOCK, &block,
+                          -1);
+      if (block != NULL && is_usable_destination (data, block))
+        {
+          data->destination_block = g_object_ref (block);
+          data->destination_object = (UDisksObject *) g_dbus_interface_dup_object (G_DBUS_INTERFACE (block));
+        }
+      g_clear_object (&block);
+    }
+  clone_disk_update (data);
+}
+
+static void
+clone_disk_populate (DialogData *data)
+{
+  UDisksObjectInfo *info = NULL;
+  GduDeviceTreeModel *model;
+  GtkComboBox *combobox;
+  GtkCellRenderer *renderer;
+
+  /* Source label */
+  info = udisks_client_get_object_info (gdu_window_get_client (data->window), data->object);
+  gtk_label_set_text (GTK_LABEL (data->source_label), udisks_object_info_get_one_liner (info));
+  g_clear_object (&info);
+
+  combobox = GTK_COMBO_BOX (data->destination_combobox);
+  model = gdu_device_tree_model_new (gdu_window_get_application (data->window),
+                                     GDU_DEVICE_TREE_MODEL_FLAGS_FLAT |
+                                     GDU_DEVICE_TREE_MODEL_FLAGS_ONE_LINE_NAME |
+                                     GDU_DEVICE_TREE_MODEL_FLAGS_INCLUDE_DEVICE_NAME |
+                                     GDU_DEVICE_TREE_MODEL_FLAGS_INCLUDE_NONE_ITEM);
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (model),
+                                        GDU_DEVICE_TREE_MODEL_COLUMN_SORT_KEY,
+                                        GTK_SORT_ASCENDING);
+  gtk_combo_box_set_model (combobox, GTK_TREE_MODEL (model));
+  g_object_unref (model);
+
+  renderer = gtk_cell_renderer_pixbuf_new ();
+  g_object_set (G_OBJECT (renderer),
+                "stock-size", GTK_ICON_SIZE_MENU,
+                NULL);
+  gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (combobox), renderer, FALSE);
+  gtk_cell_layout_set_attributes (GTK_CELL_LAYOUT (combobox), renderer,
+                                  "gicon", GDU_DEVICE_TREE_MODEL_COLUMN_ICON,
+                                  NULL);
+  gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (combobox), renderer,
+                                      destination_combobox_sensitive_cb, data, NULL);
+
+  renderer = gtk_cell_renderer_text_new ();
+  gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (combobox), renderer, FALSE);
+  gtk_cell_layout_set_attributes (GTK_CELL_LAYOUT (combobox), renderer,
+                                  "markup", GDU_DEVICE_TREE_MODEL_COLUMN_NAME,
+                                  NULL);
+  gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (combobox), renderer,
+                                      destination_combobox_sensitive_cb, data, NULL);
+
+  g_signal_connect (combobox, "notify::active", G_CALLBACK (on_destination_combobox_notify_active), data);
+
+  /* Select (None) item */
+  gtk_combo_box_set_active (combobox, 0);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+update_job (DialogData *data,
+            gboolean    done)
+{
+  gchar *extra_markup = NULL;
+  guint64 bytes_completed = 0;
+  guint64 bytes_target = 0;
+  guint64 bytes_per_sec = 0;
+  guint64 usec_remaining = 0;
+  guint64 num_bytes_zeroed = 0;
+  gdouble progress = 0.0;
+
+  g_mutex_lock (&data->copy_lock);
+  if (data->estimator != NULL)
+    {
+      bytes_per_sec = gdu_estimator_get_bytes_per_sec (data->estimator);
+      usec_remaining = gdu_estimator_get_usec_remaining (data->estimator);
+      bytes_completed = gdu_estimator_get_completed_bytes (data->estimator);
+      bytes_target = gdu_estimator_get_target_bytes (data->estimator);
+    }
+  num_bytes_zeroed = data->num_bytes_zeroed;
+  data->update_id = 0;
+  g_mutex_unlock (&data->copy_lock);
+
+  if (num_bytes_zeroed > 0)
+    {
+      gchar *s;
+      s = g_format_size (num_bytes_zeroed);
+      /* Translators: Shown when cloning a disk and some of it only contains zeroes.
+       *              The %s is the amount of data that was zeroed instead of copied (ex. "512 MB").
+       */
+      extra_markup = g_strdup_printf (_("%s of zeroes skipped"), s);
+      g_free (s);
+    }
+
+  if (data->local_job != NULL)
+    {
+      udisks_job_set_bytes (UDISKS_JOB (data->local_job), bytes_target);
+      udisks_job_set_rate (UDISKS_JOB (data->local_job), bytes_per_sec);
+
+      if (done)
+        {
+          progress = 1.0;
+        }
+      else
+        {
+          if (bytes_target != 0)
+            progress = ((gdouble) bytes_completed) / ((gdouble) bytes_target);
+          else
+            progress = 0.0;
+        }
+      udisks_job_set_progress (UDISKS_JOB (data->local_job), progress);
+
+      if (usec_remaining == 0)
+        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), 0);
+      else
+        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), usec_remaining + g_get_real_time ());
+
+      gdu_local_job_set_extra_markup (data->local_job, extra_markup);
+    }
+
+  g_free (extra_markup);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+play_complete_sound (DialogData *data)
+{
+  const gchar *sound_message;
+
+  /* Translators: A descriptive string for the 'complete' sound, see CA_PROP_EVENT_DESCRIPTION */
+  sound_message = _("Disk cloning complete");
+  ca_gtk_play_for_widget (GTK_WIDGET (data->window), 0,
+                          CA_PROP_EVENT_ID, "complete",
+                          CA_PROP_EVENT_DESCRIPTION, sound_message,
+                          NULL);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+on_update_job (gpointer user_data)
+{
+  DialogData *data = user_data;
+  update_job (data, FALSE);
+  dialog_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+on_show_error (gpointer user_data)
+{
+  DialogData *data = user_data;
+
+  dialog_data_uninhibit (data);
+
+  g_assert (data->copy_error != NULL);
+  gdu_utils_show_error (GTK_WINDOW (data->window),
+                        _("Error cloning disk"),
+                        data->copy_error);
+  g_clear_error (&data->copy_error);
+
+  dialog_data_complete_and_unref (data);
+
+  dialog_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+on_success (gpointer user_data)
+{
+  DialogData *data = user_data;
+
+  update_job (data, TRUE);
+
+  play_complete_sound (data);
+  dialog_data_uninhibit (data);
+  dialog_data_complete_and_unref (data);
+
+  dialog_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+is_zeroes (const guchar *buffer,
+           gsize         size)
+{
+  return size == 0 || (buffer[0] == 0 && memcmp (buffer, buffer + 1, size - 1) == 0);
+}
+
+/* Zeroes [@start, @end) on the destination instead of copying it */
+static gboolean
+zero_range (DialogData  *data,
+            gint         fd,
+            guint64      start,
+            guint64      end,
+            guchar      *zero_buffer,
+            GError     **error)
+{
+  if (start >= end)
+    return TRUE;
+  if (!gdu_copy_utils_zero_range (fd, start, end - start, zero_buffer, data->chunk_size, error))
+    return FALSE;
+  g_mutex_lock (&data->copy_lock);
+  data->num_bytes_zeroed += end - start;
+  g_mutex_unlock (&data->copy_lock);
+  return TRUE;
+}
+
+/* Reads the source, chunk by chunk, into the ring. As opposed to creating
+ * a disk image, read errors are not ignored - silently replacing data on
+ * the destination with zeroes would make for a poor clone.
+ */
+static gpointer
+read_thread_func (gpointer user_data)
+{
+  DialogData *data = user_data;
+  GError *error = NULL;
+  guint64 pos;
+
+  for (pos = 0; pos < data->source_size; pos += data->chunk_size)
+    {
+      gsize size = MIN (data->chunk_size, data->source_size - pos);
+      guchar *buffer;
+
+      buffer = gdu_buffer_ring_begin_write (data->ring);
+      if (buffer == NULL)
+        goto out;
+      if (!gdu_copy_utils_pread_all (data->source_fd, buffer, size, pos, &error))
+        goto out;
+      gdu_buffer_ring_end_write (data->ring, pos, size);
+    }
+
+ out:
+  if (error != NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      data->read_error = error;
+      g_mutex_unlock (&data->copy_lock);
+      gdu_buffer_ring_abort (data->ring);
+    }
+  else
+    {
+      gdu_buffer_ring_close (data->ring);
+    }
+  return NULL;
+}
+
+/* Writes what read_thread_func() reads to the destination */
+static gpointer
+copy_thread_func (gpointer user_data)
+{
+  DialogData *data = user_data;
+  GThread *read_thread = NULL;
+  guchar *zero_buffer = NULL;
+  guint64 destination_size = 0;
+  GError *error = NULL;
+  GError *error2 = NULL;
+  gint64 last_update_usec = -1;
+  gint fd = -1;
+  guint64 pos;
+  guint64 zero_start;
+  GduCopyWriteback writeback;
+
+  gdu_copy_utils_writeback_init (&writeback);
+
+  data->source_fd = gdu_copy_utils_open_for_backup (data->block, &error);
+  if (data->source_fd == -1)
+    goto out;
+
+  fd = gdu_copy_utils_open_for_restore (data->destination_block, &error);
+  if (fd == -1)
+    goto out;
+
+  if (!gdu_copy_utils_get_size (data->source_fd, &data->source_size, &error) ||
+      !gdu_copy_utils_get_size (fd, &destination_size, &error))
+    goto out;
+
+  if (data->source_size == 0)
+    {
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Device is size 0"));
+      goto out;
+    }
+
+  if (destination_size < data->source_size)
+    {
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("The destination is smaller than the source"));
+      goto out;
+    }
+
+  /* we read the source exactly once, front to back */
+  posix_fadvise (data->source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  /* only used if the kernel can't zero a range for us */
+  zero_buffer = g_malloc0 (data->chunk_size);
+
+  g_mutex_lock (&data->copy_lock);
+  data->estimator = gdu_estimator_new (data->source_size);
+  data->update_id = 0;
+  data->num_bytes_zeroed = 0;
+  g_mutex_unlock (&data->copy_lock);
+
+  data->ring = gdu_buffer_ring_new (RING_NUM_BUFFERS, data->chunk_size, 1);
+  read_thread = g_thread_new ("clone-disk-read-thread",
+                              read_thread_func,
+                              data);
+
+  /* Runs of zero chunks are collected in [zero_start, pos) and zeroed in one go */
+  pos = 0;
+  zero_start = 0;
+  while (TRUE)
+    {
+      const guchar *buffer;
+      guint64 offset;
+      gsize size;
+      gint64 now_usec;
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, &error))
+        goto out;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          /* only count what actually reached the device, not what is still in the page cache */
+          if (writeback.synced_num_bytes > 0)
+            gdu_estimator_add_sample (data->estimator, writeback.synced_num_bytes);
+          if (data->update_id == 0)
+            data->update_id = g_idle_add (on_update_job, dialog_data_ref (data));
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      buffer = gdu_buffer_ring_begin_read (data->ring, 0, &offset, &size);
+      if (buffer == NULL)
+        break;
+      g_assert (offset == pos);
+
+      if (is_zeroes (buffer, size))
+        {
+          gdu_buffer_ring_end_read (data->ring, 0);
+          pos = offset + size;
+
+          /* keep collecting zeroes, unless it's time to report progress */
+          if (pos - zero_start < GDU_COPY_WRITEBACK_WINDOW_SIZE)
+            continue;
+          if (!zero_range (data, fd, zero_start, pos, zero_buffer, &error))
+            goto out;
+        }
+      else
+        {
+          if (!zero_range (data, fd, zero_start, offset, zero_buffer, &error))
+            goto out;
+          if (!gdu_copy_utils_pwrite_all (fd, buffer, size, offset, &error))
+            goto out;
+          gdu_buffer_ring_end_read (data->ring, 0);
+          pos = offset + size;
+        }
+      zero_start = pos;
+
+      if (!gdu_copy_utils_writeback_advance (&writeback, fd, pos, pos, &error))
+        goto out;
+    }
+
+  /* the ring is aborted if reading the source failed */
+  g_mutex_lock (&data->copy_lock);
+  if (data->read_error != NULL)
+    {
+      error = data->read_error;
+      data->read_error = NULL;
+    }
+  g_mutex_unlock (&data->copy_lock);
+  if (error != NULL)
+    {
+      g_prefix_error (&error, _("Error reading from source: "));
+      goto out;
+    }
+
+  /* the source may end with zeroes */
+  if (!zero_range (data, fd, zero_start, pos, zero_buffer, &error))
+    goto out;
+
+  /* don't report the job as done until all data is on the device */
+  if (!gdu_copy_utils_writeback_finish (&writeback, fd, pos, pos, &error))
+    goto out;
+
+ out:
+  if (read_thread != NULL)
+    {
+      /* stop reading if writing failed or was canceled */
+      gdu_buffer_ring_abort (data->ring);
+      g_thread_join (read_thread);
+    }
+  if (data->ring != NULL)
+    {
+      gdu_buffer_ring_free (data->ring);
+      data->ring = NULL;
+    }
+
+  if (data->source_fd != -1)
+    {
+      close (data->source_fd);
+      data->source_fd = -1;
+    }
+
+  if (fd != -1 )
+    {
+      if (close (fd) != 0)
+        g_warning ("Error closing fd: %m");
+    }
+
+  if (error != NULL)
+    {
+      /* show error in GUI */
+      if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+        {
+          data->copy_error = error; error = NULL;
+          g_idle_add (on_show_error, dialog_data_ref (data));
+        }
+      g_clear_error (&error);
+
+      /* Wipe the destination, a partial clone is of no use */
+      if (fd != -1 &&
+          !udisks_block_call_format_sync (data->destination_block,
+                                          "empty",
+                                          g_variant_new ("a{sv}", NULL), /* options */
+                                          NULL, /* cancellable */
+                                          &error2))
+        {
+          g_warning ("Error wiping device on error path: %s (%s, %d)",
+                     error2->message, g_quark_to_string (error2->domain), error2->code);
+          g_clear_error (&error2);
+        }
+    }
+  else
+    {
+      /* success */
+      g_idle_add (on_success, dialog_data_ref (data));
+    }
+
+  g_free (zero_buffer);
+
+  /* finally, request that the core OS / kernel rescans the device */
+  if (!udisks_block_call_rescan_sync (data->destination_block,
+                                      g_variant_new ("a{sv}", NULL), /* options */
+                                      NULL, /* cancellable */
+                                      &error2))
+    {
+      g_warning ("Error rescanning device: %s (%s, %d)",
+                 error2->message, g_quark_to_string (error2->domain), error2->code);
+      g_clear_error (&error2);
+    }
+
+  dialog_data_unref_in_idle (data); /* unref on main thread */
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_local_job_canceled (GduLocalJob  *job,
+                       gpointer      user_data)
+{
+  DialogData *data = user_data;
+  if (!data->completed)
+    {
+      dialog_data_terminate_job (data);
+      dialog_data_complete_and_unref (data);
+      update_job (data, FALSE);
+    }
+}
+
+static void
+start_copying (DialogData *data)
+{
+  /* default to 1 MiB blocks */
+  data->chunk_size = (1 * 1024 * 1024);
+
+  data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+                                                  GTK_WINDOW (data->dialog),
+                                                  GTK_APPLICATION_INHIBIT_SUSPEND |
+                                                  GTK_APPLICATION_INHIBIT_LOGOUT,
+                                                  /* Translators: Reason why suspend/logout is being inhibited */
+                                                  C_("clone-inhibit-message", "Copying disk to another disk"));
+
+  /* the job is shown for the destination since that's what must not be used until we're done */
+  data->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
+                                                      data->destination_object);
+  udisks_job_set_operation (UDISKS_JOB (data->local_job), "x-gdu-clone-disk");
+  /* Translators: this is the description of the job */
+  gdu_local_job_set_description (data->local_job, _("Cloning Disk"));
+  udisks_job_set_progress_valid (UDISKS_JOB (data->local_job), TRUE);
+  udisks_job_set_cancelable (UDISKS_JOB (data->local_job), TRUE);
+  g_signal_connect (data->local_job, "canceled",
+                    G_CALLBACK (on_local_job_canceled),
+                    data);
+
+  dialog_data_hide (data);
+
+  gdu_window_select_object (data->window, data->destination_object);
+
+  g_thread_new ("clone-disk-thread",
+                copy_thread_func,
+                dialog_data_ref (data));
+}
+
+static void
+ensure_unused_cb (GduWindow     *window,
+                  GAsyncResult  *res,
+                  gpointer       user_data)
+{
+  DialogData *data = user_data;
+  if (gdu_window_ensure_unused_list_finish (window, res, NULL))
+    {
+      start_copying (data);
+    }
+  else
+    {
+      dialog_data_complete_and_unref (data);
+    }
+}
+
+static void
+on_dialog_response (GtkDialog     *dialog,
+                    gint           response,
+                    gpointer       user_data)
+{
+  DialogData *data = user_data;
+  GList *objects = NULL;
+
+  if (data->dialog == NULL)
+    goto out;
+
+  switch (response)
+    {
+    case GTK_RESPONSE_OK:
+      objects = g_list_append (NULL, data->destination_object);
+      if (!gdu_utils_show_confirmation (GTK_WINDOW (data->dialog),
+                                        _("Are you sure you want to clone the disk?"),
+                                        _("All existing data on the destination will be lost"),
+                                        _("_Clone"),
+                                        NULL, NULL,
+                                        gdu_window_get_client (data->window), objects))
+        {
+          dialog_data_complete_and_unref (data);
+          goto out;
+        }
+
+      /* ensure both disks are unused (e.g. unmounted) before copying... */
+      objects = g_list_prepend (objects, data->object);
+      gdu_window_ensure_unused_list (data->window,
+                                     objects,
+                                     (GAsyncReadyCallback) ensure_unused_cb,
+                                     NULL, /* GCancellable */
+                                     data);
+      break;
+
+    default: /* explicit fallthrough */
+    case GTK_RESPONSE_CANCEL:
+      dialog_data_complete_and_unref (data);
+      break;
+    }
+ out:
+  g_list_free (objects);
+}
+
+void
+gdu_clone_disk_dialog_show (GduWindow    *window,
+                            UDisksObject *object)
+{
+  DialogData *data;
+  guint n;
+
+  data = g_new0 (DialogData, 1);
+  data->ref_count = 1;
+  g_mutex_init (&data->copy_lock);
+  data->window = g_object_ref (window);
+  data->object = g_object_ref (object);
+  data->block = udisks_object_get_block (object);
+  g_assert (data->block != NULL);
+  data->cancellable = g_cancellable_new ();
+  data->source_fd = -1;
+
+  data->dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (window),
+                                                         "clone-disk-dialog.ui",
+                                                         "clone-disk-dialog",
+                                                         &data->builder));
+  for (n = 0; widget_mapping[n].name != NULL; n++)
+    {
+      gpointer *p = (gpointer *) ((char *) data + widget_mapping[n].offset);
+      *p = gtk_builder_get_object (data->builder, widget_mapping[n].name);
+    }
+
+  data->error_infobar = gdu_utils_create_info_bar (GTK_MESSAGE_ERROR, "", &data->error_label);
+  gtk_box_pack_start (GTK_BOX (data->infobar_vbox), data->error_infobar, TRUE, TRUE, 0);
+  gtk_widget_set_no_show_all (data->error_infobar, TRUE);
+  g_object_ref (data->error_infobar);
+
+  clone_disk_populate (data);
+  clone_disk_update (data);
+
+  data->response_signal_handler_id = g_signal_connect (data->dialog,
+                                                       "response",
+                                                       G_CALLBACK (on_dialog_response),
+                                                       data);
+
+  gtk_window_set_transient_for (GTK_WINDOW (data->dialog), GTK_WINDOW (window));
+  gtk_window_present (GTK_WINDOW (data->dialog));
+
+  gtk_widget_realize (data->destination_combobox);
+  gtk_widget_grab_focus (data->destination_combobox);
+}
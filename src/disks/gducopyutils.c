@@ -0,0 +1,379 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <gio/gunixfdlist.h>
+
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "gducopyutils.h"
+
+/* Helpers for opening, reading and writing block devices, shared by the
+ * Restore Disk Image and Clone Disk dialogs and the jobs measuring disks.
+ */
+
+/* Opens @block for writing, e.g. for restoring a disk image to it */
+gint
+gdu_copy_utils_open_for_restore (UDisksBlock  *block,
+                                 GError      **error)
+{
+  gint fd = -1;
+
+  /* Most OSes put ACLs for logged-in users on /dev/sr* nodes (this is
+   * so CD burning tools etc. work) so see if we can open the device
+   * file ourselves. If so, great, since this avoids a polkit dialog.
+   *
+   * As opposed to udisks' OpenForBackup() we also avoid O_EXCL since
+   * the disc is read-only by its very nature. As a side-effect this
+   * allows creating a disk image of a mounted disc.
+   */
+  if (g_str_has_prefix (udisks_block_get_device (block), "/dev/sr"))
+    {
+      fd = open (udisks_block_get_device (block), O_RDONLY);
+    }
+
+  /* Otherwise, request the fd from udisks */
+  if (fd == -1)
+    {
+      GUnixFDList *fd_list = NULL;
+      GVariant *fd_index = NULL;
+      if (!udisks_block_call_open_for_restore_sync (block,
+                                                    g_variant_new ("a{sv}", NULL), /* options */
+                                                    NULL, /* fd_list */
+                                                    &fd_index,
+                                                    &fd_list,
+                                                    NULL, /* cancellable */
+                                                    error))
+        goto out;
+
+      fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+      if (fd == -1)
+        {
+          g_prefix_error (error,
+                          "Error extracing fd with handle %d from D-Bus message: ",
+                          g_variant_get_handle (fd_index));
+        }
+      if (fd_index != NULL)
+        g_variant_unref (fd_index);
+      g_clear_object (&fd_list);
+    }
+
+ out:
+  return fd;
+}
+
+/* Opens @block for reading, e.g. for copying all of it elsewhere */
+gint
+gdu_copy_utils_open_for_backup (UDisksBlock  *block,
+                                GError      **error)
+{
+  GUnixFDList *fd_list = NULL;
+  GVariant *fd_index = NULL;
+  gint fd = -1;
+
+  if (!udisks_block_call_open_for_backup_sync (block,
+                                               g_variant_new ("a{sv}", NULL), /* options */
+                                               NULL, /* fd_list */
+                                               &fd_index,
+                                               &fd_list,
+                                               NULL, /* cancellable */
+                                               error))
+    goto out;
+
+  fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+  if (fd == -1)
+    {
+      g_prefix_error (error,
+                      "Error extracing fd with handle %d from D-Bus message: ",
+                      g_variant_get_handle (fd_index));
+    }
+
+ out:
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  g_clear_object (&fd_list);
+  return fd;
+}
+
+/* Opens @block with O_DIRECT so reads and writes measure the device
+ * rather than the page cache, e.g. for benchmarking it
+ */
+gint
+gdu_copy_utils_open_for_benchmark (UDisksBlock   *block,
+                                   gboolean       writable,
+                                   GCancellable  *cancellable,
+                                   GError       **error)
+{
+  GUnixFDList *fd_list = NULL;
+  GVariant *fd_index = NULL;
+  GVariantBuilder options_builder;
+  gint fd = -1;
+
+  g_variant_builder_init (&options_builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (writable));
+  if (!udisks_block_call_open_for_benchmark_sync (block,
+                                                  g_variant_builder_end (&options_builder),
+                                                  NULL, /* fd_list */
+                                                  &fd_index,
+                                                  &fd_list,
+                                                  cancellable,
+                                                  error))
+    goto out;
+
+  fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+  if (fd == -1)
+    {
+      g_prefix_error (error,
+                      "Error extracing fd with handle %d from D-Bus message: ",
+                      g_variant_get_handle (fd_index));
+    }
+
+ out:
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  g_clear_object (&fd_list);
+  return fd;
+}
+
+/* Gets the size of the block device opened as @fd */
+gboolean
+gdu_copy_utils_get_size (gint      fd,
+                         guint64  *out_size,
+                         GError  **error)
+{
+  gint errsv;
+
+  /* We can't use udisks_block_get_size() because the media may have
+   * changed and udisks may not have noticed. TODO: maybe have a
+   * Block.GetSize() method instead...
+   */
+  if (ioctl (fd, BLKGETSIZE64, out_size) != 0)
+    {
+      errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "%s", g_strerror (errsv));
+      g_prefix_error (error, _("Error determining size of device: "));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+gboolean
+gdu_copy_utils_pread_all (gint      fd,
+                          guchar   *buffer,
+                          gsize     size,
+                          guint64   offset,
+                          GError  **error)
+{
+  while (size > 0)
+    {
+      ssize_t num_bytes_read;
+
+      num_bytes_read = pread (fd, buffer, size, offset);
+      if (num_bytes_read < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error reading %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": %m",
+                       size,
+                       offset);
+          return FALSE;
+        }
+      else if (num_bytes_read == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Reading from offset %" G_GUINT64_FORMAT " returned zero bytes",
+                       offset);
+          return FALSE;
+        }
+      buffer += num_bytes_read;
+      size -= num_bytes_read;
+      offset += num_bytes_read;
+    }
+  return TRUE;
+}
+
+gboolean
+gdu_copy_utils_pwrite_all (gint           fd,
+                           const guchar  *buffer,
+                           gsize          size,
+                           guint64        offset,
+                           GError       **error)
+{
+  while (size > 0)
+    {
+      ssize_t num_bytes_written;
+
+      num_bytes_written = pwrite (fd, buffer, size, offset);
+      if (num_bytes_written < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error writing %" G_GSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %m",
+                       size,
+                       offset);
+          return FALSE;
+        }
+      buffer += num_bytes_written;
+      size -= num_bytes_written;
+      offset += num_bytes_written;
+    }
+  return TRUE;
+}
+
+static gboolean
+write_zeroes (gint      fd,
+              guint64   offset,
+              guint64   size,
+              guchar   *buffer,
+              gsize     buffer_size,
+              GError  **error)
+{
+  memset (buffer, 0, MIN (size, buffer_size));
+  while (size > 0)
+    {
+      gsize num_bytes = MIN (size, buffer_size);
+      if (!gdu_copy_utils_pwrite_all (fd, buffer, num_bytes, offset, error))
+        return FALSE;
+      offset += num_bytes;
+      size -= num_bytes;
+    }
+  return TRUE;
+}
+
+void
+gdu_copy_utils_writeback_init (GduCopyWriteback *writeback)
+{
+  memset (writeback, 0, sizeof (GduCopyWriteback));
+  writeback->supported = TRUE;
+}
+
+/* Called when everything up to @offset has been written (@num_bytes bytes of the disk image) */
+gboolean
+gdu_copy_utils_writeback_advance (GduCopyWriteback  *writeback,
+                                  gint               fd,
+                                  guint64            offset,
+                                  guint64            num_bytes,
+                                  GError           **error)
+{
+  gboolean ret = FALSE;
+
+  if (!writeback->supported || offset - writeback->started_offset < GDU_COPY_WRITEBACK_WINDOW_SIZE)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  /* start writeback for the current window ... */
+  if (sync_file_range (fd,
+                       writeback->started_offset,
+                       offset - writeback->started_offset,
+                       SYNC_FILE_RANGE_WRITE) != 0)
+    {
+      if (errno == ENOSYS || errno == EINVAL || errno == ESPIPE)
+        {
+          writeback->supported = FALSE;
+          ret = TRUE;
+          goto out;
+        }
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error starting writeback at offset %" G_GUINT64_FORMAT ": %m",
+                   writeback->started_offset);
+      goto out;
+    }
+
+  /* ... and wait for the previous one to reach the device */
+  if (writeback->started_offset > writeback->synced_offset &&
+      sync_file_range (fd,
+                       writeback->synced_offset,
+                       writeback->started_offset - writeback->synced_offset,
+                       SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error waiting for writeback at offset %" G_GUINT64_FORMAT ": %m",
+                   writeback->synced_offset);
+      goto out;
+    }
+
+  writeback->synced_offset = writeback->started_offset;
+  writeback->synced_num_bytes = writeback->started_num_bytes;
+  writeback->started_offset = offset;
+  writeback->started_num_bytes = num_bytes;
+
+  ret = TRUE;
+
+ out:
+  return ret;
+}
+
+/* Waits for everything written to reach the device */
+gboolean
+gdu_copy_utils_writeback_finish (GduCopyWriteback  *writeback,
+                                 gint               fd,
+                                 guint64            offset,
+                                 guint64            num_bytes,
+                                 GError           **error)
+{
+  if (fdatasync (fd) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error syncing device: %m");
+      return FALSE;
+    }
+  writeback->synced_offset = writeback->started_offset = offset;
+  writeback->synced_num_bytes = writeback->started_num_bytes = num_bytes;
+  return TRUE;
+}
+
+/* Zeroes @size bytes at @offset on the device. For the sector-aligned part
+ * of the range the kernel is asked to do this without us transferring any
+ * data (BLKZEROOUT) and only if that isn't supported do we use @buffer to
+ * write out zeroes ourselves.
+ */
+gboolean
+gdu_copy_utils_zero_range (gint      fd,
+                           guint64   offset,
+                           guint64   size,
+                           guchar   *buffer,
+                           gsize     buffer_size,
+                           GError  **error)
+{
+  guint64 end = offset + size;
+#ifdef BLKZEROOUT
+  guint64 aligned_start = (offset + 511) & ~((guint64) 511);
+  guint64 aligned_end = end & ~((guint64) 511);
+
+  if (aligned_end > aligned_start)
+    {
+      guint64 range[2];
+
+      range[0] = aligned_start;
+      range[1] = aligned_end - aligned_start;
+      if (ioctl (fd, BLKZEROOUT, range) == 0)
+        {
+          return write_zeroes (fd, offset, aligned_start - offset, buffer, buffer_size, error) &&
+                 write_zeroes (fd, aligned_end, end - aligned_end, buffer, buffer_size, error);
+        }
+    }
+#endif
+  return write_zeroes (fd, offset, end - offset, buffer, buffer_size, error);
+}
@@ -0,0 +1,84 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_COPY_UTILS_H__
+#define __GDU_COPY_UTILS_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+/* Writes to the device go through the page cache. To avoid piling up
+ * gigabytes of dirty data (which stalls everything else doing I/O and
+ * makes the job appear to be done long before it is) writeback is
+ * started every GDU_COPY_WRITEBACK_WINDOW_SIZE bytes and we wait for the
+ * previous window to reach the device before continuing.
+ */
+#define GDU_COPY_WRITEBACK_WINDOW_SIZE (32 * 1024 * 1024)
+
+typedef struct
+{
+  /* everything before synced_offset is on the device and writeback
+   * was started for everything before started_offset
+   */
+  guint64 synced_offset;
+  guint64 started_offset;
+
+  /* the number of bytes written when reaching the offsets above */
+  guint64 synced_num_bytes;
+  guint64 started_num_bytes;
+
+  /* FALSE if sync_file_range() isn't supported */
+  gboolean supported;
+} GduCopyWriteback;
+
+gint     gdu_copy_utils_open_for_restore   (UDisksBlock       *block,
+                                            GError           **error);
+gint     gdu_copy_utils_open_for_backup    (UDisksBlock       *block,
+                                            GError           **error);
+gint     gdu_copy_utils_open_for_benchmark (UDisksBlock       *block,
+                                            gboolean           writable,
+                                            GCancellable      *cancellable,
+                                            GError           **error);
+gboolean gdu_copy_utils_get_size           (gint               fd,
+                                            guint64           *out_size,
+                                            GError           **error);
+gboolean gdu_copy_utils_pread_all          (gint               fd,
+                                            guchar            *buffer,
+                                            gsize              size,
+                                            guint64            offset,
+                                            GError           **error);
+gboolean gdu_copy_utils_pwrite_all         (gint               fd,
+                                            const guchar      *buffer,
+                                            gsize              size,
+                                            guint64            offset,
+                                            GError           **error);
+gboolean gdu_copy_utils_zero_range         (gint               fd,
+                                            guint64            offset,
+                                            guint64            size,
+                                            guchar            *buffer,
+                                            gsize              buffer_size,
+                                            GError           **error);
+
+void     gdu_copy_utils_writeback_init     (GduCopyWriteback  *writeback);
+gboolean gdu_copy_utils_writeback_advance  (GduCopyWriteback  *writeback,
+                                            gint               fd,
+                                            guint64            offset,
+                                            guint64            num_bytes,
+                                            GError           **error);
+gboolean gdu_copy_utils_writeback_finish   (GduCopyWriteback  *writeback,
+                                            gint               fd,
+                                            guint64            offset,
+                                            guint64            num_bytes,
+                                            GError           **error);
+
+G_END_DECLS
+
+#endif /* __GDU_COPY_UTILS_H__ */
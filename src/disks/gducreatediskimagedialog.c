@@ -9,7 +9,6 @@
 
 #include "config.h"
 
-#define _GNU_SOURCE
 #include <fcntl.h>
 
 #include <glib/gi18n.h>
@@ -18,8 +17,6 @@
 #include <gio/gfiledescriptorbased.h>
 
 #include <glib-unix.h>
-#include <sys/ioctl.h>
-#include <linux/fs.h>
 
 #include <canberra-gtk.h>
 
@@ -30,6 +27,7 @@
 #include "gducreatefilesystemwidget.h"
 #include "gduestimator.h"
 #include "gdulocaljob.h"
+#include "gducopyutils.h"
 
 #include "gdudvdsupport.h"
 
@@ -713,17 +711,8 @@ copy_thread_func (gpointer user_data)
 
   g_assert (fd != -1);
 
-  /* We can't use udisks_block_get_size() because the media may have
-   * changed and udisks may not have noticed. TODO: maybe have a
-   * Block.GetSize() method instead...
-   */
-  if (ioctl (fd, BLKGETSIZE64, &block_device_size) != 0)
-    {
-      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
-                           "%s", strerror (errno));
-      g_prefix_error (&error, _("Error determining size of device: "));
-      goto out;
-    }
+  if (!gdu_copy_utils_get_size (fd, &block_device_size, &error))
+    goto out;
 
   if (block_device_size == 0)
     {
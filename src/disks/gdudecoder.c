@@ -0,0 +1,317 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "gdudecoder.h"
+#include "gduxzdecompressor.h"
+#include "gdugzipdecompressor.h"
+#include "gdubzip2decompressor.h"
+#ifdef HAVE_ZSTD
+#include "gduzstddecompressor.h"
+#endif
+#ifdef HAVE_LZ4
+#include "gdulz4decompressor.h"
+#endif
+
+/* The compression formats disk images can be restored from. A format
+ * is recognized by the magic bytes at the start of the file or, if
+ * the file can't be read (yet), by its content type.
+ */
+
+#define MAX_MAGIC_SIZE 8
+
+struct GduDecoder
+{
+  const gchar *name;
+  const guint8 magic[MAX_MAGIC_SIZE];
+  gsize magic_size;
+  /* NULL-terminated */
+  const gchar *content_types[4];
+  /* e.g. "-xz-compressed" as in application/x-raw-disk-image-xz-compressed */
+  const gchar *content_type_suffix;
+
+  GConverter *(*new_converter) (void);
+  /* returns 0 if the size can't be determined without decompressing */
+  guint64     (*get_uncompressed_size) (GFile *file);
+  /* NULL if the format can only be decompressed from the start */
+  GConverter *(*new_converter_at) (GFile   *file,
+                                   guint64  offset,
+                                   guint64 *out_compressed_offset,
+                                   guint64 *out_uncompressed_offset);
+};
+
+static GConverter *
+new_xz_converter (void)
+{
+  return G_CONVERTER (gdu_xz_decompressor_new ());
+}
+
+static guint64
+get_xz_uncompressed_size (GFile *file)
+{
+  return gdu_xz_decompressor_get_uncompressed_size (file);
+}
+
+static GConverter *
+new_xz_converter_at (GFile   *file,
+                     guint64  offset,
+                     guint64 *out_compressed_offset,
+                     guint64 *out_uncompressed_offset)
+{
+  guint check;
+  if (!gdu_xz_decompressor_locate_block (file, offset, out_compressed_offset, out_uncompressed_offset, &check))
+    return NULL;
+  return G_CONVERTER (gdu_xz_decompressor_new_for_blocks (check));
+}
+
+static GConverter *
+new_gzip_converter (void)
+{
+  return G_CONVERTER (gdu_gzip_decompressor_new ());
+}
+
+static GConverter *
+new_bzip2_converter (void)
+{
+  return G_CONVERTER (gdu_bzip2_decompressor_new ());
+}
+
+#ifdef HAVE_ZSTD
+static GConverter *
+new_zstd_converter (void)
+{
+  return G_CONVERTER (gdu_zstd_decompressor_new ());
+}
+
+static guint64
+get_zstd_uncompressed_size (GFile *file)
+{
+  return gdu_zstd_decompressor_get_uncompressed_size (file);
+}
+#endif
+
+#ifdef HAVE_LZ4
+static GConverter *
+new_lz4_converter (void)
+{
+  return G_CONVERTER (gdu_lz4_decompressor_new ());
+}
+
+static guint64
+get_lz4_uncompressed_size (GFile *file)
+{
+  return gdu_lz4_decompressor_get_uncompressed_size (file);
+}
+#endif
+
+/* The uncompressed size in the gzip trailer is modulo 2^32 and only
+ * covers the last member so it's useless for disk images. Likewise,
+ * bzip2 doesn't record the uncompressed size at all.
+ */
+static const GduDecoder decoders[] =
+{
+  {
+    "xz",
+    {0xfd, '7', 'z', 'X', 'Z', 0x00}, 6,
+    {"application/x-xz", NULL},
+    "-xz-compressed",
+    new_xz_converter,
+    get_xz_uncompressed_size,
+    new_xz_converter_at
+  },
+  {
+    "gzip",
+    {0x1f, 0x8b}, 2,
+    {"application/gzip", "application/x-gzip", NULL},
+    "-gzip-compressed",
+    new_gzip_converter,
+    NULL,
+    NULL
+  },
+  {
+    "bzip2",
+    {'B', 'Z', 'h'}, 3,
+    {"application/x-bzip", "application/x-bzip2", NULL},
+    "-bzip-compressed",
+    new_bzip2_converter,
+    NULL,
+    NULL
+  },
+#ifdef HAVE_ZSTD
+  {
+    "zstd",
+    {0x28, 0xb5, 0x2f, 0xfd}, 4,
+    {"application/zstd", "application/x-zstd", NULL},
+    "-zstd-compressed",
+    new_zstd_converter,
+    get_zstd_uncompressed_size,
+    NULL
+  },
+#endif
+#ifdef HAVE_LZ4
+  {
+    "lz4",
+    {0x04, 0x22, 0x4d, 0x18}, 4,
+    {"application/x-lz4", NULL},
+    "-lz4-compressed",
+    new_lz4_converter,
+    get_lz4_uncompressed_size,
+    NULL
+  },
+#endif
+};
+
+/**
+ * gdu_decoder_find:
+ * @file: The disk image.
+ * @content_type: (allow-none): The content type of @file or %NULL.
+ *
+ * Finds the decoder for a compressed disk image.
+ *
+ * Returns: The decoder to use or %NULL if @file is not compressed
+ * (or compressed in a format we don't support).
+ */
+const GduDecoder *
+gdu_decoder_find (GFile       *file,
+                  const gchar *content_type)
+{
+  const GduDecoder *ret = NULL;
+  GFileInputStream *stream;
+  guint8 magic[MAX_MAGIC_SIZE];
+  gsize magic_size = 0;
+  guint n;
+
+  stream = g_file_read (file, NULL, NULL);
+  if (stream != NULL)
+    {
+      if (!g_input_stream_read_all (G_INPUT_STREAM (stream), magic, sizeof magic, &magic_size, NULL, NULL))
+        magic_size = 0;
+      g_object_unref (stream);
+    }
+
+  /* The magic bytes are the most reliable */
+  for (n = 0; n < G_N_ELEMENTS (decoders); n++)
+    {
+      if (magic_size >= decoders[n].magic_size &&
+          memcmp (magic, decoders[n].magic, decoders[n].magic_size) == 0)
+        {
+          ret = &decoders[n];
+          goto out;
+        }
+    }
+
+  /* If we could read the file, it's evidently not compressed in any format we know */
+  if (content_type == NULL || magic_size > 0)
+    goto out;
+
+  for (n = 0; n < G_N_ELEMENTS (decoders); n++)
+    {
+      guint m;
+      if (g_str_has_suffix (content_type, decoders[n].content_type_suffix))
+        {
+          ret = &decoders[n];
+          goto out;
+        }
+      for (m = 0; decoders[n].content_types[m] != NULL; m++)
+        {
+          if (g_strcmp0 (content_type, decoders[n].content_types[m]) == 0)
+            {
+              ret = &decoders[n];
+              goto out;
+            }
+        }
+    }
+
+ out:
+  return ret;
+}
+
+const gchar *
+gdu_decoder_get_name (const GduDecoder *decoder)
+{
+  g_return_val_if_fail (decoder != NULL, NULL);
+  return decoder->name;
+}
+
+/**
+ * gdu_decoder_new_converter:
+ * @decoder: A #GduDecoder.
+ *
+ * Creates a #GConverter for decompressing, e.g. for use with a
+ * #GConverterInputStream.
+ *
+ * Returns: A new #GConverter. Free with g_object_unref().
+ */
+GConverter *
+gdu_decoder_new_converter (const GduDecoder *decoder)
+{
+  g_return_val_if_fail (decoder != NULL, NULL);
+  return decoder->new_converter ();
+}
+
+/**
+ * gdu_decoder_get_uncompressed_size:
+ * @decoder: A #GduDecoder.
+ * @file: The compressed disk image.
+ *
+ * Gets the size of @file when decompressed, if the format allows
+ * determining that without decompressing the whole file.
+ *
+ * Returns: The uncompressed size or 0 if unknown.
+ */
+guint64
+gdu_decoder_get_uncompressed_size (const GduDecoder *decoder,
+                                   GFile            *file)
+{
+  g_return_val_if_fail (decoder != NULL, 0);
+  if (decoder->get_uncompressed_size == NULL)
+    return 0;
+  return decoder->get_uncompressed_size (file);
+}
+
+/**
+ * gdu_decoder_new_converter_at:
+ * @decoder: A #GduDecoder.
+ * @file: The compressed disk image.
+ * @offset: The offset in the uncompressed data to start at.
+ * @out_compressed_offset: Return location for where to start reading @file.
+ * @out_uncompressed_offset: Return location for the uncompressed offset the converter starts at.
+ *
+ * Like gdu_decoder_new_converter() but for only decompressing the
+ * data from @offset and on. If the format has an index (e.g. xz with
+ * several blocks) decompression starts close to @offset, otherwise
+ * everything before @offset is decompressed as well and has to be
+ * skipped by the caller.
+ *
+ * Returns: A new #GConverter. Free with g_object_unref().
+ */
+GConverter *
+gdu_decoder_new_converter_at (const GduDecoder *decoder,
+                              GFile            *file,
+                              guint64           offset,
+                              guint64          *out_compressed_offset,
+                              guint64          *out_uncompressed_offset)
+{
+  GConverter *ret = NULL;
+
+  g_return_val_if_fail (decoder != NULL, NULL);
+
+  if (decoder->new_converter_at != NULL)
+    ret = decoder->new_converter_at (file, offset, out_compressed_offset, out_uncompressed_offset);
+  if (ret == NULL)
+    {
+      ret = decoder->new_converter ();
+      *out_compressed_offset = 0;
+      *out_uncompressed_offset = 0;
+    }
+  return ret;
+}
@@ -0,0 +1,32 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_DECODER_H__
+#define __GDU_DECODER_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+const GduDecoder *gdu_decoder_find                  (GFile            *file,
+                                                     const gchar      *content_type);
+const gchar      *gdu_decoder_get_name              (const GduDecoder *decoder);
+GConverter       *gdu_decoder_new_converter         (const GduDecoder *decoder);
+guint64           gdu_decoder_get_uncompressed_size (const GduDecoder *decoder,
+                                                     GFile            *file);
+GConverter       *gdu_decoder_new_converter_at      (const GduDecoder *decoder,
+                                                     GFile            *file,
+                                                     guint64           offset,
+                                                     guint64          *out_compressed_offset,
+                                                     guint64          *out_uncompressed_offset);
+
+G_END_DECLS
+
+#endif /* __GDU_DECODER_H__ */
@@ -0,0 +1,211 @@
+/* Gzip Decompressor - based on GLib's GZLibDecompressor
+ *
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ *         Alexander Larsson <alexl@redhat.com>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "gdugzipdecompressor.h"
+
+#include <string.h>
+
+#include <zlib.h>
+
+/* As opposed to GZLibDecompressor this handles files consisting of
+ * several gzip members, e.g. as produced by pigz(1) or by simply
+ * concatenating gzip files. Like gzip(1) we also ignore trailing
+ * garbage such as the zero padding some tools add.
+ */
+
+static void gdu_gzip_decompressor_iface_init          (GConverterIface *iface);
+
+struct GduGzipDecompressor
+{
+  GObject parent_instance;
+
+  z_stream stream;
+  gboolean end_of_member;
+  gboolean trailing_garbage;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GduGzipDecompressor, gdu_gzip_decompressor, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+						gdu_gzip_decompressor_iface_init))
+
+static void
+gdu_gzip_decompressor_finalize (GObject *object)
+{
+  GduGzipDecompressor *decompressor = GDU_GZIP_DECOMPRESSOR (object);
+
+  inflateEnd (&decompressor->stream);
+
+  G_OBJECT_CLASS (gdu_gzip_decompressor_parent_class)->finalize (object);
+}
+
+static void
+init_zlib (GduGzipDecompressor *decompressor)
+{
+  int ret;
+  memset (&decompressor->stream, 0, sizeof decompressor->stream);
+  decompressor->end_of_member = FALSE;
+  decompressor->trailing_garbage = FALSE;
+  /* 16 means: only accept the gzip format */
+  ret = inflateInit2 (&decompressor->stream, MAX_WBITS + 16);
+  if (ret != Z_OK)
+    g_critical ("Error initalizing zlib decoder: %d", ret);
+}
+
+static void
+gdu_gzip_decompressor_init (GduGzipDecompressor *decompressor)
+{
+  init_zlib (decompressor);
+}
+
+static void
+gdu_gzip_decompressor_class_init (GduGzipDecompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gdu_gzip_decompressor_finalize;
+}
+
+GduGzipDecompressor *
+gdu_gzip_decompressor_new (void)
+{
+  GduGzipDecompressor *decompressor;
+
+  decompressor = g_object_new (GDU_TYPE_GZIP_DECOMPRESSOR,
+			       NULL);
+
+  return decompressor;
+}
+
+static void
+gdu_gzip_decompressor_reset (GConverter *converter)
+{
+  GduGzipDecompressor *decompressor = GDU_GZIP_DECOMPRESSOR (converter);
+  inflateEnd (&decompressor->stream);
+  init_zlib (decompressor);
+}
+
+static GConverterResult
+gdu_gzip_decompressor_convert (GConverter *converter,
+			       const void *inbuf,
+			       gsize       inbuf_size,
+			       void       *outbuf,
+			       gsize       outbuf_size,
+			       GConverterFlags flags,
+			       gsize      *bytes_read,
+			       gsize      *bytes_written,
+			       GError    **error)
+{
+  GduGzipDecompressor *decompressor = GDU_GZIP_DECOMPRESSOR (converter);
+  int res;
+
+  /* The input ended right after a complete member */
+  if (decompressor->end_of_member && inbuf_size == 0)
+    {
+      *bytes_read = 0;
+      *bytes_written = 0;
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        return G_CONVERTER_FINISHED;
+      if (flags & G_CONVERTER_FLUSH)
+        return G_CONVERTER_FLUSHED;
+    }
+
+  if (decompressor->trailing_garbage)
+    {
+      *bytes_read = inbuf_size;
+      *bytes_written = 0;
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        return G_CONVERTER_FINISHED;
+      return G_CONVERTER_CONVERTED;
+    }
+
+  decompressor->stream.next_in = (void *)inbuf;
+  decompressor->stream.avail_in = inbuf_size;
+
+  decompressor->stream.next_out = outbuf;
+  decompressor->stream.avail_out = outbuf_size;
+
+  res = inflate (&decompressor->stream, Z_NO_FLUSH);
+
+  if (res == Z_DATA_ERROR || res == Z_NEED_DICT)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			   _("Invalid compressed data"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res == Z_MEM_ERROR)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			   _("Not enough memory"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res == Z_STREAM_ERROR)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+		   _("Internal error"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res == Z_BUF_ERROR)
+    {
+      if (flags & G_CONVERTER_FLUSH)
+	return G_CONVERTER_FLUSHED;
+
+      /* Z_FINISH not set, so this means no progress could be made
+       * We do have output space, so this should only happen if we
+       * have no input but need some.
+       */
+
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+			   _("Need more input"));
+      return G_CONVERTER_ERROR;
+    }
+
+  g_assert (res == Z_OK || res == Z_STREAM_END);
+
+  *bytes_read = inbuf_size - decompressor->stream.avail_in;
+  *bytes_written = outbuf_size - decompressor->stream.avail_out;
+
+  if (res == Z_STREAM_END)
+    {
+      /* End of a member - another one may follow */
+      inflateReset (&decompressor->stream);
+      decompressor->end_of_member = TRUE;
+
+      if (decompressor->stream.avail_in > 0 &&
+          ((const guint8 *) decompressor->stream.next_in)[0] != 0x1f)
+        {
+          decompressor->trailing_garbage = TRUE;
+          *bytes_read = inbuf_size;
+        }
+
+      if (*bytes_read == inbuf_size && (flags & G_CONVERTER_INPUT_AT_END))
+        return G_CONVERTER_FINISHED;
+    }
+  else if (*bytes_read > 0)
+    {
+      decompressor->end_of_member = FALSE;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+gdu_gzip_decompressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = gdu_gzip_decompressor_convert;
+  iface->reset = gdu_gzip_decompressor_reset;
+}
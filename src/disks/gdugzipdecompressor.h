@@ -0,0 +1,38 @@
+/* Gzip Decompressor - based on GLib's GZLibDecompressor
+ *
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ *         Alexander Larsson <alexl@redhat.com>
+ */
+
+#ifndef __GDU_GZIP_DECOMPRESSOR_H__
+#define __GDU_GZIP_DECOMPRESSOR_H__
+
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+#define GDU_TYPE_GZIP_DECOMPRESSOR         (gdu_gzip_decompressor_get_type ())
+#define GDU_GZIP_DECOMPRESSOR(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GDU_TYPE_GZIP_DECOMPRESSOR, GduGzipDecompressor))
+#define GDU_GZIP_DECOMPRESSOR_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), GDU_TYPE_GZIP_DECOMPRESSOR, GduGzipDecompressorClass))
+#define GDU_IS_GZIP_DECOMPRESSOR(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), GDU_TYPE_GZIP_DECOMPRESSOR))
+#define GDU_IS_GZIP_DECOMPRESSOR_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), GDU_TYPE_GZIP_DECOMPRESSOR))
+#define GDU_GZIP_DECOMPRESSOR_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), GDU_TYPE_GZIP_DECOMPRESSOR, GduGzipDecompressorClass))
+
+typedef struct GduGzipDecompressorClass   GduGzipDecompressorClass;
+
+struct GduGzipDecompressorClass
+{
+  GObjectClass parent_class;
+};
+
+GType                gdu_gzip_decompressor_get_type (void) G_GNUC_CONST;
+GduGzipDecompressor *gdu_gzip_decompressor_new      (void);
+
+G_END_DECLS
+
+#endif /* __GDU_GZIP_DECOMPRESSOR_H__ */
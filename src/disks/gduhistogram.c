@@ -0,0 +1,182 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "gduhistogram.h"
+
+/* A log-linear histogram of latencies (in micro-seconds), in the same
+ * spirit as HdrHistogram: each power of two is split into SUB_BUCKETS
+ * linear buckets so any recorded value can be recovered with a relative
+ * error of less than 1/SUB_BUCKETS no matter how large it is, using a
+ * fixed (and small) amount of memory.
+ *
+ * There is no locking - callers recording from several threads either
+ * use a histogram per thread and merge them or hold their own lock.
+ */
+
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+struct GduHistogram
+{
+  guint64 count;
+  guint64 buckets[NUM_BUCKETS];
+};
+
+static guint
+value_to_bucket (guint64 value)
+{
+  guint shift = 0;
+
+  if (value < SUB_BUCKETS)
+    return value;
+
+  while ((value >> shift) >= 2 * SUB_BUCKETS)
+    shift++;
+  return (shift + 1) * SUB_BUCKETS + (guint) ((value >> shift) - SUB_BUCKETS);
+}
+
+/* Returns the smallest value that ends up in @bucket and the width of the bucket */
+static guint64
+bucket_to_value (guint    bucket,
+                 guint64 *out_width)
+{
+  guint shift;
+
+  if (bucket < SUB_BUCKETS)
+    {
+      *out_width = 1;
+      return bucket;
+    }
+
+  shift = bucket / SUB_BUCKETS - 1;
+  *out_width = G_GUINT64_CONSTANT (1) << shift;
+  return ((guint64) (SUB_BUCKETS + bucket % SUB_BUCKETS)) << shift;
+}
+
+GduHistogram *
+gdu_histogram_new (void)
+{
+  return g_new0 (GduHistogram, 1);
+}
+
+void
+gdu_histogram_free (GduHistogram *histogram)
+{
+  g_free (histogram);
+}
+
+void
+gdu_histogram_clear (GduHistogram *histogram)
+{
+  memset (histogram, 0, sizeof (GduHistogram));
+}
+
+void
+gdu_histogram_add (GduHistogram *histogram,
+                   guint64       usec)
+{
+  gdu_histogram_add_count (histogram, usec, 1);
+}
+
+void
+gdu_histogram_add_count (GduHistogram *histogram,
+                         guint64       usec,
+                         guint64       count)
+{
+  histogram->buckets[value_to_bucket (usec)] += count;
+  histogram->count += count;
+}
+
+/* Adds all values recorded in @other to @histogram */
+void
+gdu_histogram_merge (GduHistogram *histogram,
+                     GduHistogram *other)
+{
+  guint n;
+
+  for (n = 0; n < NUM_BUCKETS; n++)
+    histogram->buckets[n] += other->buckets[n];
+  histogram->count += other->count;
+}
+
+guint64
+gdu_histogram_get_count (GduHistogram *histogram)
+{
+  return histogram->count;
+}
+
+/* Returns the value below which @percentile percent (e.g. 99.9) of the
+ * recorded values fall, or 0 if nothing has been recorded
+ */
+guint64
+gdu_histogram_get_percentile (GduHistogram *histogram,
+                              gdouble       percentile)
+{
+  guint64 wanted;
+  guint64 seen = 0;
+  guint n;
+
+  if (histogram->count == 0)
+    return 0;
+
+  wanted = (guint64) (histogram->count * CLAMP (percentile, 0.0, 100.0) / 100.0 + 0.5);
+  wanted = CLAMP (wanted, 1, histogram->count);
+  for (n = 0; n < NUM_BUCKETS; n++)
+    {
+      seen += histogram->buckets[n];
+      if (seen >= wanted)
+        {
+          guint64 width;
+          guint64 value;
+          /* report the middle of the bucket */
+          value = bucket_to_value (n, &width);
+          return value + width / 2;
+        }
+    }
+  g_assert_not_reached ();
+  return 0;
+}
+
+/* Only non-empty buckets are serialized, as (smallest value, count)
+ * pairs, so the format doesn't depend on the bucket layout
+ */
+GVariant *
+gdu_histogram_to_gvariant (GduHistogram *histogram)
+{
+  GVariantBuilder builder;
+  guint n;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(tt)"));
+  for (n = 0; n < NUM_BUCKETS; n++)
+    {
+      guint64 width;
+      if (histogram->buckets[n] > 0)
+        g_variant_builder_add (&builder, "(tt)", bucket_to_value (n, &width), histogram->buckets[n]);
+    }
+  return g_variant_builder_end (&builder);
+}
+
+void
+gdu_histogram_set_from_gvariant (GduHistogram *histogram,
+                                 GVariant     *value)
+{
+  GVariantIter iter;
+  guint64 usec;
+  guint64 count;
+
+  gdu_histogram_clear (histogram);
+  g_variant_iter_init (&iter, value);
+  while (g_variant_iter_next (&iter, "(tt)", &usec, &count))
+    gdu_histogram_add_count (histogram, usec, count);
+}
@@ -0,0 +1,40 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_HISTOGRAM_H__
+#define __GDU_HISTOGRAM_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+GduHistogram *gdu_histogram_new                (void);
+void          gdu_histogram_free               (GduHistogram  *histogram);
+void          gdu_histogram_clear              (GduHistogram  *histogram);
+
+void          gdu_histogram_add                (GduHistogram  *histogram,
+                                                guint64        usec);
+void          gdu_histogram_add_count          (GduHistogram  *histogram,
+                                                guint64        usec,
+                                                guint64        count);
+void          gdu_histogram_merge              (GduHistogram  *histogram,
+                                                GduHistogram  *other);
+
+guint64       gdu_histogram_get_count          (GduHistogram  *histogram);
+guint64       gdu_histogram_get_percentile     (GduHistogram  *histogram,
+                                                gdouble        percentile);
+
+GVariant     *gdu_histogram_to_gvariant        (GduHistogram  *histogram);
+void          gdu_histogram_set_from_gvariant  (GduHistogram  *histogram,
+                                                GVariant      *value);
+
+G_END_DECLS
+
+#endif /* __GDU_HISTOGRAM_H__ */
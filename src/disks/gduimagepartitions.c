@@ -0,0 +1,220 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <zlib.h>
+
+#include "gduimagepartitions.h"
+
+/* Finds the partitions of a whole-disk image from the first
+ * GDU_IMAGE_PARTITIONS_HEADER_SIZE bytes of it. Both the GPT and the
+ * MBR partitioning schemes are supported, the former with 512 and
+ * 4096 byte sectors. Logical partitions inside an extended MBR
+ * partition are not listed since the chain of EBRs may be located
+ * anywhere in the image.
+ */
+
+static guint32
+get_le32 (const guchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+}
+
+static guint64
+get_le64 (const guchar *p)
+{
+  return get_le32 (p) | ((guint64) get_le32 (p + 4) << 32);
+}
+
+void
+gdu_image_partition_free (GduImagePartition *partition)
+{
+  g_free (partition->type);
+  g_free (partition->name);
+  g_free (partition);
+}
+
+static gboolean
+partition_is_sane (guint64 offset,
+                   guint64 size,
+                   guint64 image_size)
+{
+  if (size == 0 || size > G_MAXUINT64 - offset)
+    return FALSE;
+  /* the size of a compressed image may not be known */
+  if (image_size > 0 && (offset >= image_size || size > image_size - offset))
+    return FALSE;
+  return TRUE;
+}
+
+static GList *
+parse_gpt (const guchar *header,
+           gsize         header_size,
+           guint64       image_size,
+           guint         sector_size)
+{
+  GList *ret = NULL;
+  const guchar *gpt;
+  guint32 gpt_header_size;
+  guint32 crc;
+  guchar gpt_copy[512];
+  guint64 entries_lba;
+  guint32 num_entries;
+  guint32 entry_size;
+  const guchar *entries;
+  guint n;
+
+  if (header_size < 2 * sector_size)
+    goto out;
+  gpt = header + sector_size;
+  if (memcmp (gpt, "EFI PART", 8) != 0)
+    goto out;
+
+  gpt_header_size = get_le32 (gpt + 12);
+  if (gpt_header_size < 92 || gpt_header_size > sizeof gpt_copy)
+    goto out;
+  memcpy (gpt_copy, gpt, gpt_header_size);
+  memset (gpt_copy + 16, 0, 4);
+  crc = crc32 (0, gpt_copy, gpt_header_size);
+  if (crc != get_le32 (gpt + 16))
+    goto out;
+
+  entries_lba = get_le64 (gpt + 72);
+  num_entries = get_le32 (gpt + 80);
+  entry_size = get_le32 (gpt + 84);
+  if (entry_size < 128 || num_entries > 1024)
+    goto out;
+  /* The entries are right after the header in practice. The GPT is
+   * ignored if they are located beyond the data we have.
+   */
+  if (entries_lba > header_size / sector_size ||
+      (guint64) num_entries * entry_size > header_size - entries_lba * sector_size)
+    goto out;
+  entries = header + entries_lba * sector_size;
+  if (crc32 (0, entries, num_entries * entry_size) != get_le32 (gpt + 88))
+    goto out;
+
+  for (n = 0; n < num_entries; n++)
+    {
+      const guchar *entry = entries + n * entry_size;
+      static const guchar unused[16] = {0};
+      GduImagePartition *partition;
+      guint64 first_lba, last_lba;
+      gunichar2 name[36];
+      guint m;
+
+      if (memcmp (entry, unused, 16) == 0)
+        continue;
+
+      first_lba = get_le64 (entry + 32);
+      last_lba = get_le64 (entry + 40);
+      /* don't let the offset or size overflow - they aren't checked against the size of compressed images */
+      if (last_lba < first_lba ||
+          last_lba >= G_MAXUINT64 / sector_size ||
+          !partition_is_sane (first_lba * sector_size, (last_lba - first_lba + 1) * sector_size, image_size))
+        continue;
+
+      partition = g_new0 (GduImagePartition, 1);
+      partition->number = n + 1;
+      partition->offset = first_lba * sector_size;
+      partition->size = (last_lba - first_lba + 1) * sector_size;
+      partition->scheme = "gpt";
+      /* the first three fields of the GUID are little-endian */
+      partition->type = g_strdup_printf ("%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                                         get_le32 (entry),
+                                         entry[4] | (entry[5] << 8),
+                                         entry[6] | (entry[7] << 8),
+                                         entry[8], entry[9],
+                                         entry[10], entry[11], entry[12], entry[13], entry[14], entry[15]);
+      for (m = 0; m < G_N_ELEMENTS (name); m++)
+        name[m] = entry[56 + 2*m] | (entry[56 + 2*m + 1] << 8);
+      partition->name = g_utf16_to_utf8 (name, G_N_ELEMENTS (name), NULL, NULL, NULL);
+      if (partition->name != NULL && strlen (partition->name) == 0)
+        {
+          g_free (partition->name);
+          partition->name = NULL;
+        }
+      ret = g_list_prepend (ret, partition);
+    }
+  ret = g_list_reverse (ret);
+
+ out:
+  return ret;
+}
+
+static GList *
+parse_mbr (const guchar *header,
+           gsize         header_size,
+           guint64       image_size)
+{
+  GList *ret = NULL;
+  guint n;
+
+  if (header_size < 512 || header[510] != 0x55 || header[511] != 0xaa)
+    goto out;
+
+  for (n = 0; n < 4; n++)
+    {
+      const guchar *entry = header + 446 + n * 16;
+      GduImagePartition *partition;
+      guint type = entry[4];
+      guint64 offset = (guint64) get_le32 (entry + 8) * 512;
+      guint64 size = (guint64) get_le32 (entry + 12) * 512;
+
+      /* skip unused, extended and GPT protective partitions */
+      if (type == 0x00 || type == 0x05 || type == 0x0f || type == 0x85 || type == 0xee)
+        continue;
+      if (!partition_is_sane (offset, size, image_size))
+        continue;
+
+      partition = g_new0 (GduImagePartition, 1);
+      partition->number = n + 1;
+      partition->offset = offset;
+      partition->size = size;
+      partition->scheme = "dos";
+      partition->type = g_strdup_printf ("0x%02x", type);
+      ret = g_list_prepend (ret, partition);
+    }
+  ret = g_list_reverse (ret);
+
+ out:
+  return ret;
+}
+
+/**
+ * gdu_image_partitions_parse:
+ * @header: The start of the disk image.
+ * @header_size: The number of bytes in @header, at most %GDU_IMAGE_PARTITIONS_HEADER_SIZE is used.
+ * @image_size: The size of the disk image or 0 if not known.
+ *
+ * Finds the partitions in a whole-disk image.
+ *
+ * Returns: A list of #GduImagePartition ordered by partition number or
+ * %NULL if no partitions were found. Free with
+ * g_list_free_full() and gdu_image_partition_free().
+ */
+GList *
+gdu_image_partitions_parse (const guchar *header,
+                            gsize         header_size,
+                            guint64       image_size)
+{
+  GList *ret;
+
+  header_size = MIN (header_size, GDU_IMAGE_PARTITIONS_HEADER_SIZE);
+
+  ret = parse_gpt (header, header_size, image_size, 512);
+  if (ret == NULL)
+    ret = parse_gpt (header, header_size, image_size, 4096);
+  if (ret == NULL)
+    ret = parse_mbr (header, header_size, image_size);
+  return ret;
+}
@@ -0,0 +1,42 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_IMAGE_PARTITIONS_H__
+#define __GDU_IMAGE_PARTITIONS_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+/* The amount of data at the start of a disk image needed to find its partitions */
+#define GDU_IMAGE_PARTITIONS_HEADER_SIZE (1024 * 1024)
+
+struct GduImagePartition
+{
+  guint    number;
+  /* the byte range of the partition in the disk image */
+  guint64  offset;
+  guint64  size;
+  /* as used by udisks, e.g. "dos" and "gpt" */
+  const gchar *scheme;
+  /* e.g. "0x83" or "0fc63daf-8483-4772-8e79-3d69d8477de4" */
+  gchar   *type;
+  /* the GPT partition name or %NULL */
+  gchar   *name;
+};
+
+GList *gdu_image_partitions_parse (const guchar *header,
+                                   gsize         header_size,
+                                   guint64       image_size);
+void   gdu_image_partition_free   (GduImagePartition *partition);
+
+G_END_DECLS
+
+#endif /* __GDU_IMAGE_PARTITIONS_H__ */
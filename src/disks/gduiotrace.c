@@ -0,0 +1,281 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "gduiotrace.h"
+
+/* An I/O trace to replay in the benchmark. The native format is text
+ * with one request per line:
+ *
+ *   <time in micro-seconds> <R|W> <offset in bytes> <size in bytes>
+ *
+ * Empty lines and lines starting with # are ignored. So traces captured
+ * with blktrace(8) can be used without converting them first, the output
+ * of blkparse(1) with its default format is also understood - of each
+ * request only the event for when it was issued to the device ("D") is
+ * used and everything else, e.g. the summary at the end, is ignored.
+ */
+
+struct GduIOTrace
+{
+  GArray *entries; /* of GduIOTraceEntry, sorted by time */
+  guint32 max_size;
+};
+
+/* Splits @line at whitespace, skipping empty tokens */
+static gchar **
+split_line (const gchar *line)
+{
+  gchar **tokens;
+  guint n, m;
+
+  tokens = g_strsplit_set (line, " \t\r", -1);
+  for (n = 0, m = 0; tokens[n] != NULL; n++)
+    {
+      if (tokens[n][0] == '\0')
+        g_free (tokens[n]);
+      else
+        tokens[m++] = tokens[n];
+    }
+  tokens[m] = NULL;
+  return tokens;
+}
+
+static gboolean
+parse_uint64 (const gchar *str,
+              guint64     *out_value)
+{
+  gchar *endp;
+
+  if (!g_ascii_isdigit (str[0]))
+    return FALSE;
+  *out_value = g_ascii_strtoull (str, &endp, 10);
+  return *endp == '\0';
+}
+
+/* Parses a line in the native format */
+static gboolean
+parse_native_line (gchar           **tokens,
+                   GduIOTraceEntry  *entry,
+                   guint64          *out_size)
+{
+  if (g_strv_length (tokens) != 4)
+    return FALSE;
+
+  if (g_ascii_strcasecmp (tokens[1], "R") == 0)
+    entry->write = FALSE;
+  else if (g_ascii_strcasecmp (tokens[1], "W") == 0)
+    entry->write = TRUE;
+  else
+    return FALSE;
+
+  return parse_uint64 (tokens[0], &entry->time_usec) &&
+         parse_uint64 (tokens[2], &entry->offset) &&
+         parse_uint64 (tokens[3], out_size) &&
+         *out_size > 0;
+}
+
+/* Parses a line of blkparse(1) output, e.g.
+ *
+ *   8,0    3        1     0.000000000   697  D   W 223490 + 8 [kjournald]
+ *
+ * Returns FALSE if the line isn't a read or write being issued to the device
+ */
+static gboolean
+parse_blkparse_line (gchar           **tokens,
+                     GduIOTraceEntry  *entry,
+                     guint64          *out_size)
+{
+  gdouble time_sec;
+  guint64 sector;
+  guint64 num_sectors;
+  gchar *endp;
+
+  if (g_strv_length (tokens) < 10)
+    return FALSE;
+  if (strcmp (tokens[5], "D") != 0 || strcmp (tokens[8], "+") != 0)
+    return FALSE;
+
+  /* the RWBS field - anything else is e.g. a discard or a flush */
+  if (strchr (tokens[6], 'R') != NULL)
+    entry->write = FALSE;
+  else if (strchr (tokens[6], 'W') != NULL)
+    entry->write = TRUE;
+  else
+    return FALSE;
+
+  time_sec = g_ascii_strtod (tokens[3], &endp);
+  if (*endp != '\0' || time_sec < 0.0)
+    return FALSE;
+  if (!parse_uint64 (tokens[7], &sector) || !parse_uint64 (tokens[9], &num_sectors) || num_sectors == 0)
+    return FALSE;
+
+  /* blktrace always uses 512-byte sectors */
+  entry->time_usec = time_sec * G_USEC_PER_SEC + 0.5;
+  entry->offset = sector * 512;
+  *out_size = num_sectors * 512;
+  return TRUE;
+}
+
+static gint
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  const GduIOTraceEntry *ea = a;
+  const GduIOTraceEntry *eb = b;
+
+  if (ea->time_usec < eb->time_usec)
+    return -1;
+  else if (ea->time_usec > eb->time_usec)
+    return 1;
+  return 0;
+}
+
+GduIOTrace *
+gdu_io_trace_load (const gchar  *filename,
+                   GError      **error)
+{
+  GduIOTrace *ret = NULL;
+  GArray *entries = NULL;
+  gchar *contents = NULL;
+  gchar *line;
+  gchar *next;
+  guint line_number;
+  gboolean format_known = FALSE;
+  gboolean blkparse = FALSE;
+  guint64 first_usec;
+  guint32 max_size = 0;
+  guint n;
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    goto out;
+
+  entries = g_array_new (FALSE, /* zero-terminated */
+                         FALSE, /* clear */
+                         sizeof (GduIOTraceEntry));
+  for (line = contents, line_number = 1; line != NULL; line = next, line_number++)
+    {
+      GduIOTraceEntry entry = {0};
+      gchar **tokens;
+      guint64 size = 0;
+
+      next = strchr (line, '\n');
+      if (next != NULL)
+        *next++ = '\0';
+
+      tokens = split_line (line);
+      if (tokens[0] == NULL || tokens[0][0] == '#')
+        {
+          g_strfreev (tokens);
+          continue;
+        }
+
+      /* blkparse(1) output starts with the major,minor of the device */
+      if (!format_known)
+        {
+          blkparse = (strchr (tokens[0], ',') != NULL);
+          format_known = TRUE;
+        }
+
+      if (blkparse)
+        {
+          if (!parse_blkparse_line (tokens, &entry, &size))
+            {
+              g_strfreev (tokens);
+              continue;
+            }
+        }
+      else if (!parse_native_line (tokens, &entry, &size))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       C_("benchmark-trace", "Line %u of the I/O trace is not a valid request"),
+                       line_number);
+          g_strfreev (tokens);
+          goto out;
+        }
+      g_strfreev (tokens);
+
+      if (size > GDU_IO_TRACE_MAX_REQUEST_SIZE)
+        {
+          gchar *s = g_format_size_full (GDU_IO_TRACE_MAX_REQUEST_SIZE, G_FORMAT_SIZE_IEC_UNITS);
+          /* Translators: %u is the line number, %s is the largest size supported, e.g. "16.0 MiB" */
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       C_("benchmark-trace", "The request on line %u of the I/O trace is larger than %s"),
+                       line_number, s);
+          g_free (s);
+          goto out;
+        }
+      entry.size = size;
+      max_size = MAX (max_size, entry.size);
+      g_array_append_val (entries, entry);
+    }
+
+  if (entries->len == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   C_("benchmark-trace", "The I/O trace contains no reads or writes"));
+      goto out;
+    }
+
+  /* make the times relative to the first request */
+  g_array_sort (entries, compare_entries);
+  first_usec = g_array_index (entries, GduIOTraceEntry, 0).time_usec;
+  for (n = 0; n < entries->len; n++)
+    g_array_index (entries, GduIOTraceEntry, n).time_usec -= first_usec;
+
+  ret = g_new0 (GduIOTrace, 1);
+  ret->entries = entries;
+  ret->max_size = max_size;
+  entries = NULL;
+
+ out:
+  if (entries != NULL)
+    g_array_unref (entries);
+  g_free (contents);
+  return ret;
+}
+
+void
+gdu_io_trace_free (GduIOTrace *trace)
+{
+  g_array_unref (trace->entries);
+  g_free (trace);
+}
+
+guint
+gdu_io_trace_get_num_entries (GduIOTrace *trace)
+{
+  return trace->entries->len;
+}
+
+const GduIOTraceEntry *
+gdu_io_trace_get_entry (GduIOTrace *trace,
+                        guint       index)
+{
+  g_return_val_if_fail (index < trace->entries->len, NULL);
+  return &g_array_index (trace->entries, GduIOTraceEntry, index);
+}
+
+/* Returns the time between the first and the last request */
+guint64
+gdu_io_trace_get_duration_usec (GduIOTrace *trace)
+{
+  return g_array_index (trace->entries, GduIOTraceEntry, trace->entries->len - 1).time_usec;
+}
+
+/* Returns the size of the largest request */
+guint32
+gdu_io_trace_get_max_size (GduIOTrace *trace)
+{
+  return trace->max_size;
+}
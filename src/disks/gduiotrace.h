@@ -0,0 +1,41 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_IO_TRACE_H__
+#define __GDU_IO_TRACE_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+/* The largest request a trace may contain */
+#define GDU_IO_TRACE_MAX_REQUEST_SIZE (16 * 1024 * 1024)
+
+typedef struct
+{
+  guint64  time_usec;  /* since the first request of the trace */
+  guint64  offset;
+  guint32  size;
+  gboolean write;
+} GduIOTraceEntry;
+
+GduIOTrace            *gdu_io_trace_load               (const gchar  *filename,
+                                                        GError      **error);
+void                   gdu_io_trace_free               (GduIOTrace   *trace);
+
+guint                  gdu_io_trace_get_num_entries    (GduIOTrace   *trace);
+const GduIOTraceEntry *gdu_io_trace_get_entry          (GduIOTrace   *trace,
+                                                        guint         index);
+guint64                gdu_io_trace_get_duration_usec  (GduIOTrace   *trace);
+guint32                gdu_io_trace_get_max_size       (GduIOTrace   *trace);
+
+G_END_DECLS
+
+#endif /* __GDU_IO_TRACE_H__ */
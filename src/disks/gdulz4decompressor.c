@@ -0,0 +1,189 @@
+/* LZ4 Decompressor - based on GLib's GZLibDecompressor
+ *
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ *         Alexander Larsson <alexl@redhat.com>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "gdulz4decompressor.h"
+
+#include <string.h>
+
+#include <lz4frame.h>
+
+static void gdu_lz4_decompressor_iface_init          (GConverterIface *iface);
+
+struct GduLz4Decompressor
+{
+  GObject parent_instance;
+
+  LZ4F_dctx *dctx;
+  /* TRUE if the last frame was decoded completely */
+  gboolean end_of_frame;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GduLz4Decompressor, gdu_lz4_decompressor, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+						gdu_lz4_decompressor_iface_init))
+
+static void
+gdu_lz4_decompressor_finalize (GObject *object)
+{
+  GduLz4Decompressor *decompressor = GDU_LZ4_DECOMPRESSOR (object);
+
+  LZ4F_freeDecompressionContext (decompressor->dctx);
+
+  G_OBJECT_CLASS (gdu_lz4_decompressor_parent_class)->finalize (object);
+}
+
+static void
+gdu_lz4_decompressor_init (GduLz4Decompressor *decompressor)
+{
+  LZ4F_errorCode_t ret;
+  ret = LZ4F_createDecompressionContext (&decompressor->dctx, LZ4F_VERSION);
+  if (LZ4F_isError (ret))
+    g_critical ("Error initalizing lz4 decoder: %s", LZ4F_getErrorName (ret));
+  decompressor->end_of_frame = TRUE;
+}
+
+static void
+gdu_lz4_decompressor_class_init (GduLz4DecompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gdu_lz4_decompressor_finalize;
+}
+
+GduLz4Decompressor *
+gdu_lz4_decompressor_new (void)
+{
+  GduLz4Decompressor *decompressor;
+
+  decompressor = g_object_new (GDU_TYPE_LZ4_DECOMPRESSOR,
+			       NULL);
+
+  return decompressor;
+}
+
+static void
+gdu_lz4_decompressor_reset (GConverter *converter)
+{
+  GduLz4Decompressor *decompressor = GDU_LZ4_DECOMPRESSOR (converter);
+  LZ4F_freeDecompressionContext (decompressor->dctx);
+  gdu_lz4_decompressor_init (decompressor);
+}
+
+static GConverterResult
+gdu_lz4_decompressor_convert (GConverter *converter,
+			      const void *inbuf,
+			      gsize       inbuf_size,
+			      void       *outbuf,
+			      gsize       outbuf_size,
+			      GConverterFlags flags,
+			      gsize      *bytes_read,
+			      gsize      *bytes_written,
+			      GError    **error)
+{
+  GduLz4Decompressor *decompressor = GDU_LZ4_DECOMPRESSOR (converter);
+  size_t src_size = inbuf_size;
+  size_t dst_size = outbuf_size;
+  size_t res;
+
+  /* After a frame has been decoded the context is ready for the next one */
+  res = LZ4F_decompress (decompressor->dctx, outbuf, &dst_size, inbuf, &src_size, NULL);
+  if (LZ4F_isError (res))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Invalid compressed data (%s)"),
+                   LZ4F_getErrorName (res));
+      return G_CONVERTER_ERROR;
+    }
+
+  *bytes_read = src_size;
+  *bytes_written = dst_size;
+
+  /* res is 0 when a frame has been completely decoded and flushed */
+  if (res == 0)
+    decompressor->end_of_frame = TRUE;
+  else if (src_size > 0)
+    decompressor->end_of_frame = FALSE;
+
+  if (src_size == inbuf_size && (flags & G_CONVERTER_INPUT_AT_END))
+    {
+      if (decompressor->end_of_frame)
+        return G_CONVERTER_FINISHED;
+
+      if (dst_size == 0)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                               _("Need more input"));
+          return G_CONVERTER_ERROR;
+        }
+    }
+
+  if (src_size == 0 && dst_size == 0)
+    {
+      if (flags & G_CONVERTER_FLUSH)
+	return G_CONVERTER_FLUSHED;
+
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+			   _("Need more input"));
+      return G_CONVERTER_ERROR;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+gdu_lz4_decompressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = gdu_lz4_decompressor_convert;
+  iface->reset = gdu_lz4_decompressor_reset;
+}
+
+/* Returns the uncompressed size or 0 if it isn't known, e.g. if the
+ * frame header doesn't include the size (the lz4(1) default).
+ */
+gsize
+gdu_lz4_decompressor_get_uncompressed_size (GFile *compressed_file)
+{
+  gsize ret = 0;
+  GFileInputStream *stream = NULL;
+  LZ4F_dctx *dctx = NULL;
+  LZ4F_frameInfo_t frame_info;
+  guint8 header[LZ4F_HEADER_SIZE_MAX];
+  gsize header_size = 0;
+  size_t src_size;
+  size_t res;
+
+  stream = g_file_read (compressed_file, NULL, NULL);
+  if (stream == NULL)
+    goto out;
+  if (!g_input_stream_read_all (G_INPUT_STREAM (stream), header, sizeof header, &header_size, NULL, NULL))
+    goto out;
+
+  if (LZ4F_isError (LZ4F_createDecompressionContext (&dctx, LZ4F_VERSION)))
+    goto out;
+
+  memset (&frame_info, 0, sizeof frame_info);
+  src_size = header_size;
+  res = LZ4F_getFrameInfo (dctx, &frame_info, header, &src_size);
+  if (LZ4F_isError (res))
+    goto out;
+
+  ret = frame_info.contentSize;
+
+ out:
+  if (dctx != NULL)
+    LZ4F_freeDecompressionContext (dctx);
+  g_clear_object (&stream);
+  return ret;
+}
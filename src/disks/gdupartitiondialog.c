@@ -9,13 +9,28 @@
 
 #include "config.h"
 
-#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <zlib.h>
+
+#include <canberra-gtk.h>
 
 #include "gduapplication.h"
 #include "gduwindow.h"
 #include "gdupartitiondialog.h"
 #include "gduvolumegrid.h"
+#include "gduestimator.h"
+#include "gdulocaljob.h"
+#include "gdubufferring.h"
+#include "gducopyutils.h"
 
 /* ---------------------------------------------------------------------------------------------------- */
 
@@ -388,3 +403,1457 @@ gdu_partition_dialog_show (GduWindow    *window,
 
   edit_partition_data_free (data);
 }
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Moves a partition to another offset on the same disk. The data is
+ * read by one thread and written by another, in the direction that
+ * never overwrites data not yet read: front to back when moving towards
+ * the start of the disk and back to front otherwise. Only once all data
+ * has been moved is the partition table updated.
+ *
+ * Since the old and new location usually overlap, an interrupted move
+ * leaves the partition unusable. To allow resuming it, how much has been
+ * moved is recorded in a journal and nothing further than |new offset -
+ * old offset| bytes past that point is ever written - that way the data
+ * still to be moved can't have been overwritten when resuming.
+ *
+ * When moving by less than a chunk that would mean syncing every few
+ * sectors, so instead each chunk is copied to a backup file next to the
+ * journal before it is written. Only the chunk itself and the one before
+ * it, which is synced by then, can be overwritten by writing it, so
+ * resuming reads the chunk back from the backup. The two backup files
+ * are used in turn so the one the journal refers to is never overwritten.
+ */
+
+/* How much is read and written at a time, at most - also the smallest
+ * move done without backing up each chunk
+ */
+#define MOVE_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* How many chunks reading may run ahead of writing */
+#define MOVE_RING_NUM_BUFFERS 16
+
+/* How often the journal is updated, at most */
+#define MOVE_JOURNAL_INTERVAL (64 * 1024 * 1024)
+
+/* Partitions are moved to offsets that are a multiple of this */
+#define MOVE_ALIGNMENT (1024 * 1024)
+
+typedef struct
+{
+  volatile gint ref_count;
+
+  GduWindow *window;
+  UDisksObject *object;
+  UDisksPartition *partition;
+  UDisksPartitionTable *partition_table;
+  gchar *partition_table_type;
+  UDisksObject *disk_object;
+  UDisksBlock *disk_block;
+
+  /* where the partition is and where it can be moved to */
+  guint64 offset;
+  guint64 size;
+  guint64 min_offset;
+  guint64 max_end;
+  gdouble initial_free_preceding;
+  guint64 new_offset;
+
+  /* the journal of an interrupted move, if any */
+  gchar *journal_path;
+  gboolean resume;
+  guint64 resume_cursor;
+  gboolean other_move_pending;
+  guchar *resume_backup; /* the chunk at resume_cursor, if it was backed up */
+  gsize resume_backup_size;
+  GError *journal_error; /* set if the journal exists but can't be used */
+
+  GtkBuilder *builder;
+  GtkWidget *dialog;
+
+  GtkWidget *infobar_vbox;
+  GtkWidget *info_infobar;
+  GtkWidget *info_label;
+  GtkWidget *error_infobar;
+  GtkWidget *error_label;
+
+  GtkWidget *partition_label;
+  GtkWidget *free_preceding_spinbutton;
+  GtkAdjustment *free_preceding_adjustment;
+  GtkWidget *free_following_label;
+
+  GCancellable *cancellable;
+  gsize chunk_size;
+  guint64 journal_interval;
+
+  /* the backup of the chunk being written, for moves by less than MOVE_CHUNK_SIZE */
+  gboolean use_backup;
+  guint backup_slot;
+  guint64 backup_cursor;
+  gsize backup_size; /* 0 if nothing has been backed up */
+
+  /* the partition is read into this ring and written back from it */
+  gint fd;
+  GduBufferRing *ring;
+
+  /* must hold copy_lock when reading/writing these */
+  GMutex copy_lock;
+  GduEstimator *estimator;
+  guint update_id;
+  GError *read_error;
+
+  GError *copy_error;
+
+  gulong response_signal_handler_id;
+  gboolean completed;
+
+  guint inhibit_cookie;
+
+  GduLocalJob *local_job;
+} MovePartitionData;
+
+static const struct {
+  goffset offset;
+  const gchar *name;
+} move_widget_mapping[] = {
+  {G_STRUCT_OFFSET (MovePartitionData, infobar_vbox), "infobar-vbox"},
+  {G_STRUCT_OFFSET (MovePartitionData, partition_label), "partition-label"},
+  {G_STRUCT_OFFSET (MovePartitionData, free_preceding_spinbutton), "free-preceding-spinbutton"},
+  {G_STRUCT_OFFSET (MovePartitionData, free_preceding_adjustment), "free-preceding-adjustment"},
+  {G_STRUCT_OFFSET (MovePartitionData, free_following_label), "free-following-label"},
+  {0, NULL}
+};
+
+static MovePartitionData *
+move_partition_data_ref (MovePartitionData *data)
+{
+  g_atomic_int_inc (&data->ref_count);
+  return data;
+}
+
+static void
+move_partition_data_terminate_job (MovePartitionData *data)
+{
+  if (data->local_job != NULL)
+    {
+      gdu_application_destroy_local_job (gdu_window_get_application (data->window), data->local_job);
+      data->local_job = NULL;
+    }
+}
+
+static void
+move_partition_data_uninhibit (MovePartitionData *data)
+{
+  if (data->inhibit_cookie > 0)
+    {
+      gtk_application_uninhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+                                 data->inhibit_cookie);
+      data->inhibit_cookie = 0;
+    }
+}
+
+static void
+move_partition_data_hide (MovePartitionData *data)
+{
+  if (data->dialog != NULL)
+    {
+      GtkWidget *dialog;
+      if (data->response_signal_handler_id != 0)
+        g_signal_handler_disconnect (data->dialog, data->response_signal_handler_id);
+      dialog = data->dialog;
+      data->dialog = NULL;
+      gtk_widget_hide (dialog);
+      gtk_widget_destroy (dialog);
+    }
+}
+
+static void
+move_partition_data_unref (MovePartitionData *data)
+{
+  if (g_atomic_int_dec_and_test (&data->ref_count))
+    {
+      move_partition_data_terminate_job (data);
+      move_partition_data_uninhibit (data);
+      move_partition_data_hide (data);
+
+      g_clear_object (&data->cancellable);
+      g_object_unref (data->window);
+      g_object_unref (data->object);
+      g_object_unref (data->partition);
+      g_object_unref (data->partition_table);
+      g_free (data->partition_table_type);
+      g_clear_object (&data->disk_object);
+      g_clear_object (&data->disk_block);
+      g_free (data->journal_path);
+      g_free (data->resume_backup);
+      g_clear_error (&data->journal_error);
+      if (data->builder != NULL)
+        g_object_unref (data->builder);
+      g_clear_object (&data->info_infobar);
+      g_clear_object (&data->error_infobar);
+      g_clear_object (&data->estimator);
+      g_clear_error (&data->read_error);
+      g_mutex_clear (&data->copy_lock);
+      g_free (data);
+    }
+}
+
+static gboolean
+move_partition_unref_in_idle (gpointer user_data)
+{
+  MovePartitionData *data = user_data;
+  move_partition_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+static void
+move_partition_data_complete_and_unref (MovePartitionData *data)
+{
+  if (!data->completed)
+    {
+      data->completed = TRUE;
+      g_cancellable_cancel (data->cancellable);
+    }
+  move_partition_data_uninhibit (data);
+  move_partition_data_hide (data);
+  move_partition_data_unref (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* The journal is kept outside of the disk since no part of the disk is
+ * safe from being overwritten while moving. It's named after the drive
+ * rather than the device file since the latter may change across reboots.
+ */
+static gchar *
+move_partition_get_journal_path (MovePartitionData *data)
+{
+  UDisksDrive *drive;
+  gchar *id;
+  gchar *basename;
+  gchar *ret;
+  guint n;
+
+  drive = udisks_client_get_drive_for_block (gdu_window_get_client (data->window), data->disk_block);
+  if (drive != NULL && strlen (udisks_drive_get_id (drive)) > 0)
+    id = udisks_drive_dup_id (drive);
+  else
+    id = udisks_block_dup_device (data->disk_block);
+  g_clear_object (&drive);
+
+  for (n = 0; id[n] != '\0'; n++)
+    {
+      if (id[n] == '/')
+        id[n] = '_';
+    }
+  basename = g_strdup_printf ("partition-move-%s.ini", id);
+  ret = g_build_filename (g_get_user_data_dir (), "gnome-disks", basename, NULL);
+  g_free (basename);
+  g_free (id);
+  return ret;
+}
+
+static gchar *
+move_partition_get_backup_path (MovePartitionData *data,
+                                guint              slot)
+{
+  return g_strdup_printf ("%s.%u", data->journal_path, slot);
+}
+
+static gboolean
+move_partition_remove_journal (MovePartitionData  *data,
+                               GError            **error)
+{
+  gboolean ret = TRUE;
+  guint slot;
+
+  /* the backups are useless without the journal, so remove that first */
+  if (g_unlink (data->journal_path) != 0 && errno != ENOENT)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error removing %s: %m"), data->journal_path);
+      ret = FALSE;
+      goto out;
+    }
+  for (slot = 0; slot < 2; slot++)
+    {
+      gchar *path = move_partition_get_backup_path (data, slot);
+      if (g_unlink (path) != 0 && errno != ENOENT && ret)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       _("Error removing %s: %m"), path);
+          ret = FALSE;
+        }
+      g_free (path);
+    }
+
+ out:
+  return ret;
+}
+
+/* Makes sure the entries of @dir, e.g. a file just renamed or created in
+ * it, are on stable storage - syncing the files alone doesn't do that
+ */
+static gboolean
+move_partition_sync_dir (const gchar  *dir,
+                         GError      **error)
+{
+  gboolean ret = FALSE;
+  gint fd;
+
+  fd = g_open (dir, O_RDONLY | O_DIRECTORY, 0);
+  if (fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error opening %s: %m"), dir);
+      goto out;
+    }
+  if (fsync (fd) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error syncing %s: %m"), dir);
+      close (fd);
+      goto out;
+    }
+  close (fd);
+  ret = TRUE;
+
+ out:
+  return ret;
+}
+
+/* Records that the first @cursor bytes (in the direction of the move)
+ * have been moved. Since nothing past that may be written before the
+ * journal is on stable storage, it's written to a temporary file which
+ * is synced and then renamed over the old journal.
+ */
+static gboolean
+move_partition_write_journal (MovePartitionData  *data,
+                              guint64             cursor,
+                              GError            **error)
+{
+  GKeyFile *key_file;
+  gchar *contents = NULL;
+  gsize length;
+  gchar *dir = NULL;
+  gchar *tmp_path = NULL;
+  gint fd = -1;
+  gboolean ret = FALSE;
+
+  key_file = g_key_file_new ();
+  g_key_file_set_string (key_file, "Move", "Disk", udisks_block_get_device (data->disk_block));
+  g_key_file_set_uint64 (key_file, "Move", "Offset", data->offset);
+  g_key_file_set_uint64 (key_file, "Move", "Size", data->size);
+  g_key_file_set_uint64 (key_file, "Move", "NewOffset", data->new_offset);
+  g_key_file_set_uint64 (key_file, "Move", "Cursor", cursor);
+  if (data->backup_size > 0)
+    {
+      g_key_file_set_uint64 (key_file, "Move", "BackupCursor", data->backup_cursor);
+      g_key_file_set_uint64 (key_file, "Move", "BackupSize", data->backup_size);
+      g_key_file_set_integer (key_file, "Move", "BackupSlot", data->backup_slot);
+    }
+  contents = g_key_file_to_data (key_file, &length, NULL);
+
+  dir = g_path_get_dirname (data->journal_path);
+  if (!g_file_test (dir, G_FILE_TEST_IS_DIR))
+    {
+      gchar *parent;
+      gboolean synced;
+
+      if (g_mkdir_with_parents (dir, 0700) != 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       _("Error creating directory %s: %m"), dir);
+          goto out;
+        }
+      parent = g_path_get_dirname (dir);
+      synced = move_partition_sync_dir (parent, error);
+      g_free (parent);
+      if (!synced)
+        goto out;
+    }
+
+  tmp_path = g_strdup_printf ("%s.tmp", data->journal_path);
+  fd = g_open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error opening %s: %m"), tmp_path);
+      goto out;
+    }
+  if (!gdu_copy_utils_pwrite_all (fd, (const guchar *) contents, length, 0, error))
+    goto out;
+  if (fsync (fd) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error syncing %s: %m"), tmp_path);
+      goto out;
+    }
+  if (g_rename (tmp_path, data->journal_path) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error renaming %s: %m"), tmp_path);
+      goto out;
+    }
+  /* otherwise an older journal may be what is found after a crash */
+  if (!move_partition_sync_dir (dir, error))
+    goto out;
+
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  if (!ret)
+    g_prefix_error (error, _("Error writing journal: "));
+  g_free (tmp_path);
+  g_free (dir);
+  g_free (contents);
+  g_key_file_free (key_file);
+  return ret;
+}
+
+/* Copies the chunk of @size bytes at @cursor (in the direction of the
+ * move) to the backup file not referred to by the journal. The journal
+ * must be updated afterwards for the backup to be used.
+ */
+static gboolean
+move_partition_write_backup (MovePartitionData  *data,
+                             guint64             cursor,
+                             const guchar       *buffer,
+                             gsize               size,
+                             GError            **error)
+{
+  guint slot = data->backup_size > 0 ? 1 - data->backup_slot : 0;
+  gchar *path;
+  gint fd = -1;
+  gboolean ret = FALSE;
+
+  path = move_partition_get_backup_path (data, slot);
+  fd = g_open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error opening %s: %m"), path);
+      goto out;
+    }
+  if (!gdu_copy_utils_pwrite_all (fd, buffer, size, 0, error))
+    goto out;
+  if (fsync (fd) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   _("Error syncing %s: %m"), path);
+      goto out;
+    }
+
+  data->backup_slot = slot;
+  data->backup_cursor = cursor;
+  data->backup_size = size;
+  ret = TRUE;
+
+ out:
+  if (fd != -1)
+    close (fd);
+  if (!ret)
+    g_prefix_error (error, _("Error writing backup: "));
+  g_free (path);
+  return ret;
+}
+
+static gboolean
+move_partition_get_journal_value (GKeyFile     *key_file,
+                                  const gchar  *key,
+                                  guint64      *out_value,
+                                  GError      **error)
+{
+  GError *local_error = NULL;
+
+  *out_value = g_key_file_get_uint64 (key_file, "Move", key, &local_error);
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Loads the backup of the chunk at the cursor of an interrupted move.
+ * Since the chunk may have been partly overwritten by itself, reading it
+ * from the disk instead would silently corrupt it - so the move can't
+ * be resumed without it.
+ */
+static gboolean
+move_partition_load_backup (MovePartitionData  *data,
+                            GKeyFile           *key_file,
+                            GError            **error)
+{
+  GError *local_error = NULL;
+  gchar *path;
+  guint64 backup_size;
+  gsize expected_size;
+  gboolean ret = FALSE;
+
+  data->backup_slot = g_key_file_get_integer (key_file, "Move", "BackupSlot", NULL) != 0 ? 1 : 0;
+  data->backup_cursor = data->resume_cursor;
+  path = move_partition_get_backup_path (data, data->backup_slot);
+
+  if (!move_partition_get_journal_value (key_file, "BackupSize", &backup_size, &local_error))
+    goto out;
+  expected_size = MIN (MOVE_CHUNK_SIZE, data->size - data->resume_cursor);
+  if (!g_file_get_contents (path, (gchar **) &data->resume_backup, &data->resume_backup_size, &local_error))
+    goto out;
+  if (backup_size != expected_size || data->resume_backup_size != expected_size)
+    {
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("It is truncated or has the wrong size"));
+      g_free (data->resume_backup);
+      data->resume_backup = NULL;
+      goto out;
+    }
+  data->backup_size = backup_size;
+  ret = TRUE;
+
+ out:
+  if (local_error != NULL)
+    {
+      /* Translators: The first %s is the path of the backup file, the second the path of the journal and the third the error */
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Moving this partition was interrupted but can't be resumed since the backup %s "
+                     "referred to by the journal %s can't be used: %s. "
+                     "Both have been kept so the data can be recovered."),
+                   path, data->journal_path, local_error->message);
+      g_error_free (local_error);
+    }
+  g_free (path);
+  return ret;
+}
+
+/* Checks whether moving this or another partition on the disk was
+ * interrupted. If the journal exists but can't be used, data->journal_error
+ * is set and the journal is kept - moving must not be resumed then since
+ * it could silently corrupt the data.
+ */
+static void
+move_partition_check_journal (MovePartitionData *data)
+{
+  GKeyFile *key_file;
+  GError *error = NULL;
+  guint64 offset;
+  guint64 size;
+  guint64 new_offset;
+  guint64 cursor;
+  guint64 backup_cursor;
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file, data->journal_path, G_KEY_FILE_NONE, &error))
+    {
+      if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_clear_error (&error);
+      goto out;
+    }
+
+  if (!move_partition_get_journal_value (key_file, "Offset", &offset, &error) ||
+      !move_partition_get_journal_value (key_file, "Size", &size, &error) ||
+      !move_partition_get_journal_value (key_file, "NewOffset", &new_offset, &error) ||
+      !move_partition_get_journal_value (key_file, "Cursor", &cursor, &error))
+    goto out;
+
+  if (size == data->size && offset == data->offset && cursor <= size && new_offset != offset)
+    {
+      data->resume = TRUE;
+      data->resume_cursor = cursor;
+      data->new_offset = new_offset;
+
+      /* the chunk at the cursor may have been partly overwritten by itself */
+      if (g_key_file_has_key (key_file, "Move", "BackupCursor", NULL))
+        {
+          if (!move_partition_get_journal_value (key_file, "BackupCursor", &backup_cursor, &error))
+            goto out;
+          if (backup_cursor == cursor && !move_partition_load_backup (data, key_file, &data->journal_error))
+            goto out;
+        }
+    }
+  else if (size == data->size && new_offset == data->offset)
+    {
+      /* the partition table was updated but we didn't get to remove the journal */
+      move_partition_remove_journal (data, NULL);
+    }
+  else
+    {
+      /* the journal is needed to resume the other move */
+      data->other_move_pending = TRUE;
+    }
+
+ out:
+  if (error != NULL)
+    {
+      /* Translators: The first %s is the path of the journal, the second the error */
+      data->journal_error = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                         _("Moving a partition on this disk was interrupted but can't be "
+                                           "resumed since its journal %s can't be read: %s. "
+                                           "It has been kept so the data can be recovered."),
+                                         data->journal_path, error->message);
+      g_error_free (error);
+    }
+  g_key_file_free (key_file);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+move_partition_compute_limits (MovePartitionData *data)
+{
+  GList *partitions, *l;
+  guint64 end = data->offset + data->size;
+
+  /* leave room for the partition table and, for GPT, its backup at the end of the disk */
+  data->min_offset = MOVE_ALIGNMENT;
+  data->max_end = udisks_block_get_size (data->disk_block);
+  if (g_strcmp0 (data->partition_table_type, "gpt") == 0 && data->max_end > MOVE_ALIGNMENT)
+    data->max_end -= MOVE_ALIGNMENT;
+
+  partitions = udisks_client_get_partitions (gdu_window_get_client (data->window), data->partition_table);
+  for (l = partitions; l != NULL; l = l->next)
+    {
+      UDisksPartition *partition = UDISKS_PARTITION (l->data);
+      guint64 p_offset = udisks_partition_get_offset (partition);
+      guint64 p_end = p_offset + udisks_partition_get_size (partition);
+
+      /* logical partitions are within the extended partition which is considered instead */
+      if (partition == data->partition || udisks_partition_get_is_contained (partition))
+        continue;
+      if (p_end <= data->offset)
+        data->min_offset = MAX (data->min_offset, p_end);
+      else if (p_offset >= end)
+        data->max_end = MIN (data->max_end, p_offset);
+    }
+  g_list_foreach (partitions, (GFunc) g_object_unref, NULL);
+  g_list_free (partitions);
+
+  /* never offer less room than the partition already has */
+  data->min_offset = MIN (data->min_offset, data->offset);
+  data->max_end = MAX (data->max_end, end);
+}
+
+static void
+move_partition_update (MovePartitionData *data)
+{
+  gboolean can_proceed = FALSE;
+  guint64 free_following;
+  gchar *s;
+
+  if (data->dialog == NULL)
+    goto out;
+
+  if (!data->resume)
+    {
+      gdouble value = gtk_adjustment_get_value (data->free_preceding_adjustment);
+
+      data->new_offset = data->offset;
+      if (value != data->initial_free_preceding)
+        {
+          guint64 lowest = (data->min_offset + MOVE_ALIGNMENT - 1) / MOVE_ALIGNMENT * MOVE_ALIGNMENT;
+          guint64 highest = (data->max_end - data->size) / MOVE_ALIGNMENT * MOVE_ALIGNMENT;
+          guint64 requested = data->min_offset + (guint64) (value * 1000 * 1000);
+
+          if (lowest <= highest)
+            {
+              requested = (requested + MOVE_ALIGNMENT / 2) / MOVE_ALIGNMENT * MOVE_ALIGNMENT;
+              data->new_offset = CLAMP (requested, lowest, highest);
+            }
+        }
+    }
+
+  free_following = 0;
+  if (data->new_offset + data->size < data->max_end)
+    free_following = data->max_end - (data->new_offset + data->size);
+  s = udisks_client_get_size_for_display (gdu_window_get_client (data->window), free_following, FALSE, FALSE);
+  gtk_label_set_text (GTK_LABEL (data->free_following_label), s);
+  g_free (s);
+
+  can_proceed = (data->new_offset != data->offset) && !data->other_move_pending && data->journal_error == NULL;
+  gtk_dialog_set_response_sensitive (GTK_DIALOG (data->dialog), GTK_RESPONSE_OK, can_proceed);
+
+ out:
+  ;
+}
+
+static void
+on_move_partition_free_preceding_changed (GtkAdjustment *adjustment,
+                                          gpointer       user_data)
+{
+  MovePartitionData *data = user_data;
+  move_partition_update (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+move_partition_update_job (MovePartitionData *data,
+                           gboolean           done)
+{
+  guint64 bytes_completed = 0;
+  guint64 bytes_target = 0;
+  guint64 bytes_per_sec = 0;
+  guint64 usec_remaining = 0;
+  gdouble progress = 0.0;
+
+  g_mutex_lock (&data->copy_lock);
+  if (data->estimator != NULL)
+    {
+      bytes_per_sec = gdu_estimator_get_bytes_per_sec (data->estimator);
+      usec_remaining = gdu_estimator_get_usec_remaining (data->estimator);
+      bytes_completed = gdu_estimator_get_completed_bytes (data->estimator);
+      bytes_target = gdu_estimator_get_target_bytes (data->estimator);
+    }
+  data->update_id = 0;
+  g_mutex_unlock (&data->copy_lock);
+
+  if (data->local_job != NULL)
+    {
+      udisks_job_set_bytes (UDISKS_JOB (data->local_job), bytes_target);
+      udisks_job_set_rate (UDISKS_JOB (data->local_job), bytes_per_sec);
+
+      if (done)
+        {
+          progress = 1.0;
+        }
+      else
+        {
+          if (bytes_target != 0)
+            progress = ((gdouble) bytes_completed) / ((gdouble) bytes_target);
+          else
+            progress = 0.0;
+        }
+      udisks_job_set_progress (UDISKS_JOB (data->local_job), progress);
+
+      if (usec_remaining == 0)
+        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), 0);
+      else
+        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), usec_remaining + g_get_real_time ());
+    }
+}
+
+static gboolean
+on_move_partition_update_job (gpointer user_data)
+{
+  MovePartitionData *data = user_data;
+  move_partition_update_job (data, FALSE);
+  move_partition_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+static gboolean
+on_move_partition_show_error (gpointer user_data)
+{
+  MovePartitionData *data = user_data;
+
+  move_partition_data_uninhibit (data);
+
+  g_assert (data->copy_error != NULL);
+  gdu_utils_show_error (GTK_WINDOW (data->window),
+                        _("Error moving partition"),
+                        data->copy_error);
+  g_clear_error (&data->copy_error);
+
+  move_partition_data_complete_and_unref (data);
+
+  move_partition_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+static gboolean
+on_move_partition_success (gpointer user_data)
+{
+  MovePartitionData *data = user_data;
+  const gchar *sound_message;
+
+  move_partition_update_job (data, TRUE);
+
+  /* Translators: A descriptive string for the 'complete' sound, see CA_PROP_EVENT_DESCRIPTION */
+  sound_message = _("Partition move complete");
+  ca_gtk_play_for_widget (GTK_WIDGET (data->window), 0,
+                          CA_PROP_EVENT_ID, "complete",
+                          CA_PROP_EVENT_DESCRIPTION, sound_message,
+                          NULL);
+
+  move_partition_data_uninhibit (data);
+  move_partition_data_complete_and_unref (data);
+
+  move_partition_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static guint32
+get_le32 (const guchar *p)
+{
+  return ((guint32) p[0]) | (((guint32) p[1]) << 8) | (((guint32) p[2]) << 16) | (((guint32) p[3]) << 24);
+}
+
+static guint64
+get_le64 (const guchar *p)
+{
+  return ((guint64) get_le32 (p)) | (((guint64) get_le32 (p + 4)) << 32);
+}
+
+static void
+put_le32 (guchar  *p,
+          guint32  value)
+{
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = (value >> 16) & 0xff;
+  p[3] = (value >> 24) & 0xff;
+}
+
+static void
+put_le64 (guchar  *p,
+          guint64  value)
+{
+  put_le32 (p, value & 0xffffffff);
+  put_le32 (p + 4, value >> 32);
+}
+
+/* Points the entry for the moved partition in the GPT header at
+ * @header_lba (and its partition entry array) to the new location.
+ */
+static gboolean
+move_partition_update_gpt (MovePartitionData  *data,
+                           guint               sector_size,
+                           guint64             header_lba,
+                           guint64            *out_alternate_lba,
+                           GError            **error)
+{
+  static const guchar unused_type[16] = {0};
+  guchar *header;
+  guchar *entries = NULL;
+  guchar *entry = NULL;
+  guint32 header_size;
+  guint32 num_entries;
+  guint32 entry_size;
+  guint64 entries_lba;
+  gsize entries_size;
+  guint64 old_lba = data->offset / sector_size;
+  guint64 new_lba = data->new_offset / sector_size;
+  gboolean ret = FALSE;
+  guint n;
+
+  header = g_malloc (sector_size);
+  if (!gdu_copy_utils_pread_all (data->fd, header, sector_size, header_lba * sector_size, error))
+    goto out;
+
+  header_size = get_le32 (header + 12);
+  entries_lba = get_le64 (header + 72);
+  num_entries = get_le32 (header + 80);
+  entry_size = get_le32 (header + 84);
+  if (memcmp (header, "EFI PART", 8) != 0 || header_size < 92 || header_size > sector_size ||
+      entry_size < 128 || num_entries == 0 || num_entries > 4096)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No valid GPT header at LBA %" G_GUINT64_FORMAT, header_lba);
+      goto out;
+    }
+
+  entries_size = ((gsize) num_entries) * entry_size;
+  entries = g_malloc (entries_size);
+  if (!gdu_copy_utils_pread_all (data->fd, entries, entries_size, entries_lba * sector_size, error))
+    goto out;
+
+  for (n = 0; n < num_entries; n++)
+    {
+      guchar *e = entries + ((gsize) n) * entry_size;
+      if (memcmp (e, unused_type, sizeof unused_type) != 0 && get_le64 (e + 32) == old_lba)
+        {
+          entry = e;
+          break;
+        }
+    }
+  if (entry == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Partition not found in GPT at LBA %" G_GUINT64_FORMAT, header_lba);
+      goto out;
+    }
+
+  put_le64 (entry + 40, get_le64 (entry + 40) - old_lba + new_lba);
+  put_le64 (entry + 32, new_lba);
+
+  put_le32 (header + 88, crc32 (0, entries, entries_size));
+  put_le32 (header + 16, 0);
+  put_le32 (header + 16, crc32 (0, header, header_size));
+
+  if (!gdu_copy_utils_pwrite_all (data->fd, entries, entries_size, entries_lba * sector_size, error) ||
+      !gdu_copy_utils_pwrite_all (data->fd, header, sector_size, header_lba * sector_size, error))
+    goto out;
+
+  if (out_alternate_lba != NULL)
+    *out_alternate_lba = get_le64 (header + 32);
+
+  ret = TRUE;
+
+ out:
+  g_free (entries);
+  g_free (header);
+  return ret;
+}
+
+static gboolean
+move_partition_update_mbr (MovePartitionData  *data,
+                           guint               sector_size,
+                           GError            **error)
+{
+  guchar *mbr;
+  gboolean ret = FALSE;
+  guint n;
+
+  mbr = g_malloc (sector_size);
+  if (!gdu_copy_utils_pread_all (data->fd, mbr, sector_size, 0, error))
+    goto out;
+
+  if (mbr[510] != 0x55 || mbr[511] != 0xaa)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "No valid MBR found");
+      goto out;
+    }
+
+  for (n = 0; n < 4; n++)
+    {
+      guchar *entry = mbr + 446 + n * 16;
+      if (entry[4] != 0 && ((guint64) get_le32 (entry + 8)) * sector_size == data->offset)
+        break;
+    }
+  if (n == 4)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Partition not found in MBR");
+      goto out;
+    }
+
+  put_le32 (mbr + 446 + n * 16 + 8, data->new_offset / sector_size);
+  /* we don't bother with CHS addresses - mark them as not used */
+  memcpy (mbr + 446 + n * 16 + 1, "\xfe\xff\xff", 3);
+  memcpy (mbr + 446 + n * 16 + 5, "\xfe\xff\xff", 3);
+
+  if (!gdu_copy_utils_pwrite_all (data->fd, mbr, sector_size, 0, error))
+    goto out;
+
+  ret = TRUE;
+
+ out:
+  g_free (mbr);
+  return ret;
+}
+
+/* udisks has no way to move a partition so the partition table is
+ * updated directly. This keeps everything else about the partition,
+ * e.g. its number, type, name and UUID.
+ */
+static gboolean
+move_partition_update_partition_table (MovePartitionData  *data,
+                                       guint               sector_size,
+                                       GError            **error)
+{
+  gboolean ret = FALSE;
+
+  if (g_strcmp0 (data->partition_table_type, "gpt") == 0)
+    {
+      guint64 alternate_lba = 0;
+      if (!move_partition_update_gpt (data, sector_size, 1, &alternate_lba, error))
+        goto out;
+      if (!move_partition_update_gpt (data, sector_size, alternate_lba, NULL, error))
+        goto out;
+    }
+  else
+    {
+      if (!move_partition_update_mbr (data, sector_size, error))
+        goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Reads the partition, chunk by chunk and in the direction of the move, into the ring */
+static gpointer
+move_read_thread_func (gpointer user_data)
+{
+  MovePartitionData *data = user_data;
+  gboolean forward = (data->new_offset < data->offset);
+  GError *error = NULL;
+  guint64 done;
+
+  for (done = data->resume_cursor; done < data->size; )
+    {
+      gsize size = MIN (data->chunk_size, data->size - done);
+      guint64 pos = forward ? done : data->size - done - size;
+      guchar *buffer;
+
+      buffer = gdu_buffer_ring_begin_write (data->ring);
+      if (buffer == NULL)
+        goto out;
+      if (data->resume_backup != NULL && done == data->resume_cursor && size == data->resume_backup_size)
+        memcpy (buffer, data->resume_backup, size);
+      else if (!gdu_copy_utils_pread_all (data->fd, buffer, size, data->offset + pos, &error))
+        goto out;
+      gdu_buffer_ring_end_write (data->ring, pos, size);
+      done += size;
+    }
+
+ out:
+  if (error != NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      data->read_error = error;
+      g_mutex_unlock (&data->copy_lock);
+      gdu_buffer_ring_abort (data->ring);
+    }
+  else
+    {
+      gdu_buffer_ring_close (data->ring);
+    }
+  return NULL;
+}
+
+/* Writes what move_read_thread_func() reads to the new location */
+static gpointer
+move_thread_func (gpointer user_data)
+{
+  MovePartitionData *data = user_data;
+  GThread *read_thread = NULL;
+  GError *error = NULL;
+  GError *error2 = NULL;
+  GError *remove_error = NULL;
+  gint64 last_update_usec = -1;
+  gint sector_size = 0;
+  guint64 delta;
+  guint64 done = data->resume_cursor;
+  guint64 journaled = data->resume_cursor;
+
+  /* the dialog doesn't allow this but never resume without a usable journal */
+  if (data->journal_error != NULL)
+    {
+      error = g_error_copy (data->journal_error);
+      goto out;
+    }
+
+  data->fd = gdu_copy_utils_open_for_restore (data->disk_block, &error);
+  if (data->fd == -1)
+    goto out;
+
+  if (ioctl (data->fd, BLKSSZGET, &sector_size) != 0)
+    {
+      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                           "%s", strerror (errno));
+      g_prefix_error (&error, _("Error determining sector size of device: "));
+      goto out;
+    }
+  if (sector_size < 512 || data->offset % sector_size != 0 || data->new_offset % sector_size != 0)
+    {
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("The partition is not aligned to the sector size of %d bytes"),
+                           sector_size);
+      goto out;
+    }
+
+  /* see the comment at the top of this section - the closer the
+   * new location is to the old one, the more often we must sync
+   */
+  delta = data->new_offset > data->offset ? data->new_offset - data->offset : data->offset - data->new_offset;
+  data->chunk_size = MOVE_CHUNK_SIZE;
+  data->journal_interval = MIN (MOVE_JOURNAL_INTERVAL, delta);
+  data->use_backup = (delta < MOVE_CHUNK_SIZE);
+
+  g_mutex_lock (&data->copy_lock);
+  data->estimator = gdu_estimator_new (data->size);
+  data->update_id = 0;
+  g_mutex_unlock (&data->copy_lock);
+
+  /* the journal must exist before anything is overwritten */
+  if (!move_partition_write_journal (data, done, &error))
+    goto out;
+
+  data->ring = gdu_buffer_ring_new (MOVE_RING_NUM_BUFFERS, data->chunk_size, 1);
+  read_thread = g_thread_new ("move-partition-read-thread",
+                              move_read_thread_func,
+                              data);
+
+  while (TRUE)
+    {
+      const guchar *buffer;
+      guint64 pos;
+      gsize size;
+      gint64 now_usec;
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, &error))
+        goto out;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          /* only count what is known to have been moved */
+          if (journaled > 0)
+            gdu_estimator_add_sample (data->estimator, journaled);
+          if (data->update_id == 0)
+            data->update_id = g_idle_add (on_move_partition_update_job, move_partition_data_ref (data));
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      buffer = gdu_buffer_ring_begin_read (data->ring, 0, &pos, &size);
+      if (buffer == NULL)
+        break;
+
+      if (data->use_backup)
+        {
+          /* the previous chunk must be in place before its backup can be replaced by this one */
+          if (fdatasync (data->fd) != 0)
+            {
+              error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                                   "Error syncing device: %s", strerror (errno));
+              goto out;
+            }
+          if (!move_partition_write_backup (data, done, buffer, size, &error))
+            goto out;
+          if (!move_partition_write_journal (data, done, &error))
+            goto out;
+          journaled = done;
+        }
+      /* never write more than journal_interval bytes past what the journal says has been moved */
+      else if (done + size - journaled > data->journal_interval)
+        {
+          if (fdatasync (data->fd) != 0)
+            {
+              error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                                   "Error syncing device: %s", strerror (errno));
+              goto out;
+            }
+          if (!move_partition_write_journal (data, done, &error))
+            goto out;
+          journaled = done;
+        }
+
+      if (!gdu_copy_utils_pwrite_all (data->fd, buffer, size, data->new_offset + pos, &error))
+        goto out;
+      gdu_buffer_ring_end_read (data->ring, 0);
+      done += size;
+    }
+
+  /* the ring is aborted if reading failed */
+  g_mutex_lock (&data->copy_lock);
+  if (data->read_error != NULL)
+    {
+      error = data->read_error;
+      data->read_error = NULL;
+    }
+  g_mutex_unlock (&data->copy_lock);
+  if (error != NULL)
+    goto out;
+
+  /* all data has been moved - record that before pointing the partition table at it */
+  if (fdatasync (data->fd) != 0)
+    {
+      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                           "Error syncing device: %s", strerror (errno));
+      goto out;
+    }
+  if (!move_partition_write_journal (data, done, &error))
+    goto out;
+  journaled = done;
+
+  if (!move_partition_update_partition_table (data, sector_size, &error))
+    goto out;
+  if (fdatasync (data->fd) != 0)
+    {
+      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                           "Error syncing device: %s", strerror (errno));
+      goto out;
+    }
+
+  /* the move is complete, so failing to remove the journal isn't fatal */
+  if (!move_partition_remove_journal (data, &remove_error))
+    g_prefix_error (&remove_error, _("The partition has been moved but its journal couldn't be removed: "));
+
+ out:
+  if (read_thread != NULL)
+    {
+      /* stop reading if writing failed or was canceled */
+      gdu_buffer_ring_abort (data->ring);
+      g_thread_join (read_thread);
+    }
+  if (data->ring != NULL)
+    {
+      gdu_buffer_ring_free (data->ring);
+      data->ring = NULL;
+    }
+
+  if (data->fd != -1)
+    {
+      if (close (data->fd) != 0)
+        g_warning ("Error closing fd: %m");
+      data->fd = -1;
+    }
+
+  if (error != NULL)
+    {
+      if (done == 0 && !data->resume && data->journal_error == NULL)
+        {
+          /* nothing was overwritten so there's nothing to resume */
+          move_partition_remove_journal (data, NULL);
+          if (error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED)
+            g_clear_error (&error);
+        }
+      else if (data->journal_error == NULL)
+        {
+          /* the data is now partly at the old and partly at the new location */
+          g_prefix_error (&error,
+                          _("The partition can't be used until it has been moved completely. "
+                            "Select “Move Partition…” again to resume moving it.\n\n"));
+        }
+      if (error != NULL)
+        {
+          data->copy_error = error; error = NULL;
+          g_idle_add (on_move_partition_show_error, move_partition_data_ref (data));
+        }
+    }
+  else if (remove_error != NULL)
+    {
+      data->copy_error = remove_error; remove_error = NULL;
+      g_idle_add (on_move_partition_show_error, move_partition_data_ref (data));
+    }
+  else
+    {
+      /* success */
+      g_idle_add (on_move_partition_success, move_partition_data_ref (data));
+    }
+
+  /* finally, request that the core OS / kernel rescans the partition table */
+  if (!udisks_block_call_rescan_sync (data->disk_block,
+                                      g_variant_new ("a{sv}", NULL), /* options */
+                                      NULL, /* cancellable */
+                                      &error2))
+    {
+      g_warning ("Error rescanning device: %s (%s, %d)",
+                 error2->message, g_quark_to_string (error2->domain), error2->code);
+      g_clear_error (&error2);
+    }
+
+  g_idle_add (move_partition_unref_in_idle, data); /* unref on main thread */
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_move_partition_local_job_canceled (GduLocalJob  *job,
+                                      gpointer      user_data)
+{
+  MovePartitionData *data = user_data;
+  if (!data->completed)
+    {
+      move_partition_data_terminate_job (data);
+      move_partition_data_complete_and_unref (data);
+      move_partition_update_job (data, FALSE);
+    }
+}
+
+static void
+move_partition_start (MovePartitionData *data)
+{
+  data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+                                                  GTK_WINDOW (data->dialog),
+                                                  GTK_APPLICATION_INHIBIT_SUSPEND |
+                                                  GTK_APPLICATION_INHIBIT_LOGOUT,
+                                                  /* Translators: Reason why suspend/logout is being inhibited */
+                                                  C_("move-inhibit-message", "Moving partition"));
+
+  data->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
+                                                      data->object);
+  udisks_job_set_operation (UDISKS_JOB (data->local_job), "x-gdu-move-partition");
+  /* Translators: this is the description of the job */
+  gdu_local_job_set_description (data->local_job, _("Moving Partition"));
+  udisks_job_set_progress_valid (UDISKS_JOB (data->local_job), TRUE);
+  udisks_job_set_cancelable (UDISKS_JOB (data->local_job), TRUE);
+  g_signal_connect (data->local_job, "canceled",
+                    G_CALLBACK (on_move_partition_local_job_canceled),
+                    data);
+
+  move_partition_data_hide (data);
+
+  g_thread_new ("move-partition-thread",
+                move_thread_func,
+                move_partition_data_ref (data));
+}
+
+static void
+move_partition_ensure_unused_cb (GduWindow     *window,
+                                 GAsyncResult  *res,
+                                 gpointer       user_data)
+{
+  MovePartitionData *data = user_data;
+  if (gdu_window_ensure_unused_finish (window, res, NULL))
+    {
+      move_partition_start (data);
+    }
+  else
+    {
+      move_partition_data_complete_and_unref (data);
+    }
+}
+
+static void
+on_move_partition_dialog_response (GtkDialog     *dialog,
+                                   gint           response,
+                                   gpointer       user_data)
+{
+  MovePartitionData *data = user_data;
+  GList *objects = NULL;
+
+  if (data->dialog == NULL)
+    goto out;
+
+  switch (response)
+    {
+    case GTK_RESPONSE_OK:
+      objects = g_list_append (NULL, data->object);
+      if (!gdu_utils_show_confirmation (GTK_WINDOW (data->dialog),
+                                        _("Are you sure you want to move the partition?"),
+                                        _("If moving the partition is interrupted, e.g. by a power failure, "
+                                          "its data can't be used until moving it has been resumed. "
+                                          "Make sure you have a backup of important data"),
+                                        _("_Move"),
+                                        NULL, NULL,
+                                        gdu_window_get_client (data->window), objects))
+        {
+          move_partition_data_complete_and_unref (data);
+          goto out;
+        }
+
+      /* the whole disk is written to, so ensure all of it is unused (e.g. unmounted) */
+      gdu_window_ensure_unused (data->window,
+                                data->disk_object,
+                                (GAsyncReadyCallback) move_partition_ensure_unused_cb,
+                                NULL, /* GCancellable */
+                                data);
+      break;
+
+    default: /* explicit fallthrough */
+    case GTK_RESPONSE_CANCEL:
+      move_partition_data_complete_and_unref (data);
+      break;
+    }
+ out:
+  g_list_free (objects);
+}
+
+void
+gdu_partition_dialog_show_move (GduWindow    *window,
+                                UDisksObject *object)
+{
+  MovePartitionData *data;
+  UDisksObjectInfo *info;
+  guint n;
+
+  data = g_new0 (MovePartitionData, 1);
+  data->ref_count = 1;
+  g_mutex_init (&data->copy_lock);
+  data->window = g_object_ref (window);
+  data->object = g_object_ref (object);
+  data->partition = udisks_object_get_partition (object);
+  g_assert (data->partition != NULL);
+  data->partition_table = udisks_client_get_partition_table (gdu_window_get_client (window), data->partition);
+  g_assert (data->partition_table != NULL);
+  data->partition_table_type = udisks_partition_table_dup_type_ (data->partition_table);
+  data->disk_object = (UDisksObject *) g_dbus_interface_dup_object (G_DBUS_INTERFACE (data->partition_table));
+  data->disk_block = udisks_object_get_block (data->disk_object);
+  g_assert (data->disk_block != NULL);
+  data->cancellable = g_cancellable_new ();
+  data->fd = -1;
+
+  data->offset = udisks_partition_get_offset (data->partition);
+  data->size = udisks_partition_get_size (data->partition);
+  data->new_offset = data->offset;
+  move_partition_compute_limits (data);
+
+  data->journal_path = move_partition_get_journal_path (data);
+  move_partition_check_journal (data);
+
+  data->dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (window),
+                                                         "move-partition-dialog.ui",
+                                                         "move-partition-dialog",
+                                                         &data->builder));
+  for (n = 0; move_widget_mapping[n].name != NULL; n++)
+    {
+      gpointer *p = (gpointer *) ((char *) data + move_widget_mapping[n].offset);
+      *p = gtk_builder_get_object (data->builder, move_widget_mapping[n].name);
+    }
+
+  data->info_infobar = gdu_utils_create_info_bar (GTK_MESSAGE_INFO, "", &data->info_label);
+  gtk_box_pack_start (GTK_BOX (data->infobar_vbox), data->info_infobar, TRUE, TRUE, 0);
+  gtk_widget_set_no_show_all (data->info_infobar, TRUE);
+  g_object_ref (data->info_infobar);
+
+  data->error_infobar = gdu_utils_create_info_bar (GTK_MESSAGE_ERROR, "", &data->error_label);
+  gtk_box_pack_start (GTK_BOX (data->infobar_vbox), data->error_infobar, TRUE, TRUE, 0);
+  gtk_widget_set_no_show_all (data->error_infobar, TRUE);
+  g_object_ref (data->error_infobar);
+
+  info = udisks_client_get_object_info (gdu_window_get_client (window), object);
+  gtk_label_set_text (GTK_LABEL (data->partition_label), udisks_object_info_get_one_liner (info));
+  g_clear_object (&info);
+
+  /* the spin button is in megabytes, as in the Create Partition dialog */
+  gtk_adjustment_configure (data->free_preceding_adjustment,
+                            0,                                                         /* value */
+                            0,                                                         /* lower */
+                            (data->max_end - data->size - data->min_offset) / 1e6,    /* upper */
+                            1,                                                         /* step increment */
+                            100,                                                       /* page increment */
+                            0);                                                        /* page_size */
+  data->initial_free_preceding = (data->new_offset - data->min_offset) / (1000 * 1000);
+  gtk_adjustment_set_value (data->free_preceding_adjustment, data->initial_free_preceding);
+
+  if (data->journal_error != NULL)
+    {
+      gtk_label_set_text (GTK_LABEL (data->error_label), data->journal_error->message);
+      gtk_widget_show (data->error_infobar);
+      gtk_widget_set_sensitive (data->free_preceding_spinbutton, FALSE);
+    }
+  else if (data->resume)
+    {
+      gtk_label_set_text (GTK_LABEL (data->info_label),
+                          _("Moving this partition was interrupted. It must be moved to the location it was "
+                            "being moved to before its data can be used again."));
+      gtk_widget_show (data->info_infobar);
+      gtk_widget_set_sensitive (data->free_preceding_spinbutton, FALSE);
+    }
+  else if (data->other_move_pending)
+    {
+      gtk_label_set_text (GTK_LABEL (data->error_label),
+                          _("Moving another partition on this disk was interrupted. "
+                            "Finish moving it before moving this partition."));
+      gtk_widget_show (data->error_infobar);
+      gtk_widget_set_sensitive (data->free_preceding_spinbutton, FALSE);
+    }
+
+  g_signal_connect (data->free_preceding_adjustment,
+                    "value-changed", G_CALLBACK (on_move_partition_free_preceding_changed), data);
+  move_partition_update (data);
+
+  data->response_signal_handler_id = g_signal_connect (data->dialog,
+                                                       "response",
+                                                       G_CALLBACK (on_move_partition_dialog_response),
+                                                       data);
+
+  gtk_window_set_transient_for (GTK_WINDOW (data->dialog), GTK_WINDOW (window));
+  gtk_window_present (GTK_WINDOW (data->dialog));
+}
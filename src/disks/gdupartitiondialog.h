@@ -15,8 +15,10 @@
 
 G_BEGIN_DECLS
 
-void     gdu_partition_dialog_show (GduWindow    *window,
-                                    UDisksObject *object);
+void     gdu_partition_dialog_show      (GduWindow    *window,
+                                         UDisksObject *object);
+void     gdu_partition_dialog_show_move (GduWindow    *window,
+                                         UDisksObject *object);
 
 G_END_DECLS
 
@@ -9,9 +9,13 @@
 
 #include "config.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <glib/gi18n.h>
 #include <gio/gunixfdlist.h>
 #include <gio/gunixoutputstream.h>
+#include <gio/gfiledescriptorbased.h>
 
 #include <glib-unix.h>
 #include <sys/ioctl.h>
@@ -26,11 +30,88 @@
 #include "gduestimator.h"
 #include "gdulocaljob.h"
 #include "gdudevicetreemodel.h"
-#include "gduxzdecompressor.h"
+#include "gdudecoder.h"
+#include "gduimagepartitions.h"
+#include "gdubufferring.h"
+#include "gducopyutils.h"
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* A range of the (uncompressed) disk image containing data */
+typedef struct
+{
+  guint64 offset;
+  guint64 size;
+} Extent;
+
+struct DialogData;
+typedef struct DialogData DialogData;
+
+/* The format, size and partitions of a disk image */
+typedef struct
+{
+  const GduDecoder *decoder;
+  guint64 size;            /* 0 if not known */
+  guint64 compressed_size;
+  gboolean size_unknown;
+  GList *partitions;
+  gchar *error_message;
+} ImageProbe;
+
+static void
+image_probe_free (ImageProbe *probe)
+{
+  g_list_free_full (probe->partitions, (GDestroyNotify) gdu_image_partition_free);
+  g_free (probe->error_message);
+  g_free (probe);
+}
+
+/* A range of the device that was written, queued for verification */
 typedef struct
+{
+  guint64 offset;
+  guint64 size;     /* 0 marks the end of the queue */
+  gboolean is_hole; /* if TRUE, the range was zeroed */
+  guint8 digest[16];
+} VerifyRange;
+
+/* A device the disk image is written to */
+typedef struct
+{
+  DialogData *data; /* not a reference */
+  guint index;      /* our consumer index in data->image_ring */
+
+  UDisksObject *object;
+  UDisksBlock *block;
+  guint64 device_size;
+
+  GCancellable *cancellable;
+  GThread *thread;
+
+  /* opened with O_DIRECT, for reading back what is on the device */
+  gint read_fd;
+  guint logical_block_size;
+
+  /* only write the parts of the image that differ from what is on the device */
+  GduBufferRing *read_ahead_ring;
+
+  /* ranges written, waiting to be read back and verified */
+  GAsyncQueue *verify_queue;
+
+  /* must hold data->copy_lock when reading/writing these */
+  GduEstimator *estimator;
+  guint update_id;
+  GError *error;
+  GError *read_ahead_error;
+  guint64 num_bytes_unchanged;
+  GError *verify_error;
+  guint64 num_bytes_verified;
+  gboolean writing_done;
+
+  GduLocalJob *local_job;
+} RestoreTarget;
+
+struct DialogData
 {
   volatile gint ref_count;
 
@@ -59,11 +140,29 @@ typedef struct
   GtkWidget *image_size_key_label;
   GtkWidget *image_size_label;
 
+  GtkWidget *partition_label;
+  GtkWidget *partition_combobox;
+  /* the partitions of partitions_file - if any, the user can choose to only restore one of them */
+  GFile *partitions_file;
+  GList *image_partitions;
+
+  /* what is known about probe_file - NULL while it is still being probed, see probe_image() */
+  GFile *probe_file;
+  ImageProbe *probe;
+  GCancellable *probe_cancellable;
+
   GtkWidget *destination_key_label;
   GtkWidget *destination_label;
   GtkWidget *selectable_destination_label;
   GtkWidget *selectable_destination_combobox;
 
+  GtkWidget *additional_destinations_label;
+  GtkWidget *additional_destinations_treeview;
+  GduDeviceTreeModel *additional_destinations_model;
+
+  GtkWidget *write_changed_only_checkbutton;
+  GtkWidget *verify_checkbutton;
+
   GtkWidget *start_copying_button;
   GtkWidget *cancel_button;
 
@@ -76,24 +175,49 @@ typedef struct
   GInputStream *input_stream;
   guint64 input_size;
 
-  guchar *buffer;
-  guint64 total_bytes_read;
-  guint64 buffer_bytes_written;
-  guint64 buffer_bytes_to_write;
+  /* the data extents of the input, sorted by offset - everything else is a hole.
+   * This is NULL for compressed disk images which are decompressed until the end.
+   */
+  GArray *extents;
+  guint64 input_data_size;
+
+  /* set if the disk image is compressed */
+  const GduDecoder *decoder;
+  GInputStream *compressed_stream;
+  guint64 compressed_size;
+  /* FALSE if the size is only known once the disk image has been decompressed */
+  gboolean input_size_known;
+
+  /* when only restoring a partition: the offset of the partition in
+   * the disk image and, for compressed disk images, how much of the
+   * decompressed data to skip to get there
+   */
+  gboolean restore_partition;
+  guint64 range_offset;
+  guint64 num_bytes_to_skip;
+
+  gboolean write_changed_only;
+  gboolean verify;
+  gsize chunk_size;
+
+  /* the devices to write to, the first one is @object */
+  GPtrArray *targets;
+
+  /* the disk image is read once into this ring and each target consumes it */
+  GduBufferRing *image_ring;
+  /* for reading the disk image again if a target falls behind */
+  GFile *image_file;
 
   /* must hold copy_lock when reading/writing these */
   GMutex copy_lock;
-  GduEstimator *estimator;
-  guint update_id;
-  GError *copy_error;
+  GError *read_error;
+  guint64 num_compressed_bytes_read;
 
   guint inhibit_cookie;
 
   gulong response_signal_handler_id;
   gboolean completed;
-
-  GduLocalJob *local_job;
-} DialogData;
+};
 
 
 static const struct {
@@ -110,11 +234,20 @@ static const struct {
   {G_STRUCT_OFFSET (DialogData, image_size_key_label), "image-size-key-label"},
   {G_STRUCT_OFFSET (DialogData, image_size_label), "image-size-label"},
 
+  {G_STRUCT_OFFSET (DialogData, partition_label), "partition-label"},
+  {G_STRUCT_OFFSET (DialogData, partition_combobox), "partition-combobox"},
+
   {G_STRUCT_OFFSET (DialogData, destination_key_label), "destination-key-label"},
   {G_STRUCT_OFFSET (DialogData, destination_label), "destination-label"},
   {G_STRUCT_OFFSET (DialogData, selectable_destination_label), "selectable-destination-label"},
   {G_STRUCT_OFFSET (DialogData, selectable_destination_combobox), "selectable-destination-combobox"},
 
+  {G_STRUCT_OFFSET (DialogData, additional_destinations_label), "additional-destinations-label"},
+  {G_STRUCT_OFFSET (DialogData, additional_destinations_treeview), "additional-destinations-treeview"},
+
+  {G_STRUCT_OFFSET (DialogData, write_changed_only_checkbutton), "write-changed-only-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, verify_checkbutton), "verify-checkbutton"},
+
   {G_STRUCT_OFFSET (DialogData, start_copying_button), "start-copying-button"},
   {G_STRUCT_OFFSET (DialogData, cancel_button), "cancel-button"},
   {0, NULL}
@@ -129,16 +262,65 @@ dialog_data_ref (DialogData *data)
   return data;
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
+
+static RestoreTarget *
+restore_target_new (DialogData   *data,
+                    UDisksObject *object,
+                    guint         index)
+{
+  RestoreTarget *target;
+
+  target = g_new0 (RestoreTarget, 1);
+  target->data = data;
+  target->index = index;
+  target->object = g_object_ref (object);
+  target->block = udisks_object_get_block (object);
+  target->cancellable = g_cancellable_new ();
+  target->read_fd = -1;
+  return target;
+}
+
 static void
-dialog_data_terminate_job (DialogData *data)
+restore_target_terminate_job (RestoreTarget *target)
 {
-  if (data->local_job != NULL)
+  if (target->local_job != NULL)
     {
-      gdu_application_destroy_local_job (gdu_window_get_application (data->window), data->local_job);
-      data->local_job = NULL;
+      gdu_application_destroy_local_job (gdu_window_get_application (target->data->window), target->local_job);
+      target->local_job = NULL;
     }
 }
 
+static void
+restore_target_free (RestoreTarget *target)
+{
+  restore_target_terminate_job (target);
+  g_clear_object (&target->object);
+  g_clear_object (&target->block);
+  g_clear_object (&target->cancellable);
+  g_clear_object (&target->estimator);
+  g_clear_error (&target->error);
+  g_clear_error (&target->read_ahead_error);
+  g_clear_error (&target->verify_error);
+  if (target->verify_queue != NULL)
+    g_async_queue_unref (target->verify_queue);
+  g_free (target);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+dialog_data_terminate_job (DialogData *data)
+{
+  guint n;
+
+  if (data->targets == NULL)
+    return;
+
+  for (n = 0; n < data->targets->len; n++)
+    restore_target_terminate_job (g_ptr_array_index (data->targets, n));
+}
+
 static void
 dialog_data_uninhibit (DialogData *data)
 {
@@ -184,12 +366,26 @@ dialog_data_unref (DialogData *data)
       g_free (data->disk_image_filename);
       if (data->builder != NULL)
         g_object_unref (data->builder);
-      g_free (data->buffer);
-      g_clear_object (&data->estimator);
+      g_clear_object (&data->additional_destinations_model);
 
       g_clear_object (&data->cancellable);
       g_clear_object (&data->input_stream);
+      g_clear_object (&data->compressed_stream);
+      g_clear_object (&data->image_file);
+      g_clear_object (&data->partitions_file);
+      g_list_free_full (data->image_partitions, (GDestroyNotify) gdu_image_partition_free);
+      g_clear_object (&data->probe_file);
+      if (data->probe != NULL)
+        image_probe_free (data->probe);
+      g_clear_object (&data->probe_cancellable);
       g_clear_object (&data->block_stream);
+      if (data->extents != NULL)
+        g_array_unref (data->extents);
+      if (data->targets != NULL)
+        g_ptr_array_unref (data->targets);
+      if (data->image_ring != NULL)
+        gdu_buffer_ring_free (data->image_ring);
+      g_clear_error (&data->read_error);
       g_mutex_clear (&data->copy_lock);
       g_free (data);
     }
@@ -228,6 +424,281 @@ dialog_data_complete_and_unref (DialogData *data)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Returns TRUE if @block can be selected as an additional destination */
+static gboolean
+is_usable_additional_destination (DialogData  *data,
+                                  UDisksBlock *block)
+{
+  if (block == NULL)
+    return FALSE;
+  if (udisks_block_get_size (block) == 0 || udisks_block_get_read_only (block))
+    return FALSE;
+  /* already the main destination */
+  if (data->block != NULL &&
+      g_strcmp0 (udisks_block_get_device (block), udisks_block_get_device (data->block)) == 0)
+    return FALSE;
+  return TRUE;
+}
+
+/* Returns a list of #UDisksBlock instances, free with g_list_free_full() and g_object_unref() */
+static GList *
+get_additional_destinations (DialogData *data)
+{
+  GList *ret = NULL;
+  GList *blocks;
+  GList *l;
+
+  if (data->additional_destinations_model == NULL)
+    goto out;
+
+  blocks = gdu_device_tree_model_get_selected_blocks (data->additional_destinations_model);
+  for (l = blocks; l != NULL; l = l->next)
+    {
+      UDisksBlock *block = UDISKS_BLOCK (l->data);
+      if (is_usable_additional_destination (data, block))
+        ret = g_list_prepend (ret, g_object_ref (block));
+    }
+  ret = g_list_reverse (ret);
+  g_list_free_full (blocks, g_object_unref);
+
+ out:
+  return ret;
+}
+
+static GduImagePartition *
+get_selected_partition (DialogData *data)
+{
+  gint active;
+
+  active = gtk_combo_box_get_active (GTK_COMBO_BOX (data->partition_combobox));
+  if (active <= 0)
+    return NULL;
+  /* the first item is the whole disk image */
+  return g_list_nth_data (data->image_partitions, active - 1);
+}
+
+static GList *
+read_image_partitions (GFile            *file,
+                       const GduDecoder *decoder,
+                       guint64           image_size)
+{
+  GList *ret = NULL;
+  GInputStream *stream = NULL;
+  guchar *header = NULL;
+  gsize header_size = 0;
+
+  stream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
+  if (stream == NULL)
+    goto out;
+
+  if (decoder != NULL)
+    {
+      GConverter *decompressor;
+      GInputStream *decompressed_stream;
+
+      decompressor = gdu_decoder_new_converter (decoder);
+      decompressed_stream = g_converter_input_stream_new (stream, decompressor);
+      g_object_unref (decompressor);
+      g_object_unref (stream);
+      stream = decompressed_stream;
+    }
+
+  header = g_malloc (GDU_IMAGE_PARTITIONS_HEADER_SIZE);
+  if (!g_input_stream_read_all (stream, header, GDU_IMAGE_PARTITIONS_HEADER_SIZE, &header_size, NULL, NULL))
+    goto out;
+
+  ret = gdu_image_partitions_parse (header, header_size, image_size);
+
+ out:
+  g_free (header);
+  g_clear_object (&stream);
+  return ret;
+}
+
+static void on_partition_changed (GtkComboBox *combobox,
+                                  gpointer     user_data);
+
+/* Lists @partitions, the partitions of @restore_file - takes ownership of @partitions */
+static void
+update_image_partitions (DialogData *data,
+                         GFile      *restore_file,
+                         GList      *partitions)
+{
+  GList *l;
+
+  g_clear_object (&data->partitions_file);
+  g_list_free_full (data->image_partitions, (GDestroyNotify) gdu_image_partition_free);
+  data->image_partitions = NULL;
+
+  g_signal_handlers_block_by_func (data->partition_combobox, on_partition_changed, data);
+  gtk_combo_box_text_remove_all (GTK_COMBO_BOX_TEXT (data->partition_combobox));
+
+  if (restore_file != NULL)
+    {
+      data->partitions_file = g_object_ref (restore_file);
+      data->image_partitions = partitions;
+    }
+
+  if (data->image_partitions != NULL)
+    {
+      gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (data->partition_combobox), _("Whole Disk Image"));
+      for (l = data->image_partitions; l != NULL; l = l->next)
+        {
+          GduImagePartition *partition = l->data;
+          const gchar *type_str;
+          gchar *size_str;
+          gchar *s;
+
+          size_str = udisks_client_get_size_for_display (gdu_window_get_client (data->window), partition->size, FALSE, FALSE);
+          type_str = udisks_client_get_partition_type_for_display (gdu_window_get_client (data->window),
+                                                                   partition->scheme,
+                                                                   partition->type);
+          if (type_str == NULL)
+            type_str = partition->type;
+          if (partition->name != NULL)
+            {
+              /* Translators: An item in the Partition combo box of the restore dialog.
+               *              The %u is the partition number, the first %s is the size (ex. "10 GB"),
+               *              the second %s is the partition type (ex. "Linux Filesystem") and the
+               *              third %s is the name of the partition (ex. "root").
+               */
+              s = g_strdup_printf (_("Partition %u — %s %s (“%s”)"), partition->number, size_str, type_str, partition->name);
+            }
+          else
+            {
+              /* Translators: An item in the Partition combo box of the restore dialog.
+               *              The %u is the partition number, the first %s is the size (ex. "10 GB"),
+               *              the second %s is the partition type (ex. "Linux Filesystem").
+               */
+              s = g_strdup_printf (_("Partition %u — %s %s"), partition->number, size_str, type_str);
+            }
+          gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (data->partition_combobox), s);
+          g_free (s);
+          g_free (size_str);
+        }
+      gtk_combo_box_set_active (GTK_COMBO_BOX (data->partition_combobox), 0);
+      gtk_widget_show (data->partition_label);
+      gtk_widget_show (data->partition_combobox);
+    }
+  else
+    {
+      gtk_widget_hide (data->partition_label);
+      gtk_widget_hide (data->partition_combobox);
+    }
+
+  g_signal_handlers_unblock_by_func (data->partition_combobox, on_partition_changed, data);
+}
+
+static void restore_disk_image_update (DialogData *data);
+
+/* Runs in a thread since decompressors may have to read a lot of the file */
+static void
+probe_image_thread_func (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+  GFile *file = task_data;
+  ImageProbe *probe;
+  GFileInfo *info;
+  GError *error = NULL;
+
+  probe = g_new0 (ImageProbe, 1);
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            &error);
+  if (info == NULL)
+    {
+      probe->error_message = g_strdup (error->message);
+      g_error_free (error);
+      goto out;
+    }
+  probe->decoder = gdu_decoder_find (file, g_file_info_get_content_type (info));
+  probe->size = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  if (probe->decoder != NULL)
+    {
+      probe->compressed_size = probe->size;
+      probe->size = gdu_decoder_get_uncompressed_size (probe->decoder, file);
+      if (probe->size == 0)
+        probe->size_unknown = TRUE;
+    }
+
+  if (!g_cancellable_is_cancelled (cancellable))
+    probe->partitions = read_image_partitions (file, probe->decoder, probe->size);
+
+ out:
+  g_task_return_pointer (task, probe, (GDestroyNotify) image_probe_free);
+}
+
+static void
+on_image_probed (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  DialogData *data = user_data;
+  ImageProbe *probe;
+
+  /* fails if another disk image was selected in the meantime */
+  probe = g_task_propagate_pointer (G_TASK (res), NULL);
+  if (probe == NULL)
+    goto out;
+
+  if (data->dialog == NULL)
+    {
+      image_probe_free (probe);
+      goto out;
+    }
+
+  data->probe = probe;
+  update_image_partitions (data, data->probe_file, probe->partitions);
+  probe->partitions = NULL;
+  restore_disk_image_update (data);
+
+ out:
+  dialog_data_unref (data);
+}
+
+/* Finds out the format, size and partitions of @file without blocking
+ * the UI - this is only done once for every disk image selected.
+ */
+static void
+probe_image (DialogData *data,
+             GFile      *file)
+{
+  GTask *task;
+
+  if (data->probe_cancellable != NULL)
+    {
+      g_cancellable_cancel (data->probe_cancellable);
+      g_clear_object (&data->probe_cancellable);
+    }
+  if (data->probe != NULL)
+    {
+      image_probe_free (data->probe);
+      data->probe = NULL;
+    }
+  g_clear_object (&data->probe_file);
+  update_image_partitions (data, NULL, NULL);
+
+  if (file == NULL)
+    goto out;
+
+  data->probe_file = g_object_ref (file);
+  data->probe_cancellable = g_cancellable_new ();
+  task = g_task_new (NULL, data->probe_cancellable, on_image_probed, dialog_data_ref (data));
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  g_task_run_in_thread (task, probe_image_thread_func);
+  g_object_unref (task);
+
+ out:
+  ;
+}
+
 static void
 restore_disk_image_update (DialogData *data)
 {
@@ -240,52 +711,55 @@ restore_disk_image_update (DialogData *data)
   if (data->dialog == NULL)
     goto out;
 
-  /* don't update if we're already copying */
-  if (data->buffer != NULL)
-    goto out;
-
   /* Check if we have a file */
   if (data->disk_image_filename != NULL)
     restore_file = g_file_new_for_commandline_arg (data->disk_image_filename);
   else
     restore_file = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (data->selectable_image_fcbutton));
 
-  if (restore_file != NULL)
+  /* only probe the disk image again if another one was selected */
+  if (restore_file != NULL ?
+      (data->probe_file == NULL || !g_file_equal (data->probe_file, restore_file)) :
+      data->probe_file != NULL)
+    probe_image (data, restore_file);
+
+  if (restore_file != NULL && data->probe == NULL)
+    {
+      /* Translators: Shown in the "Size" field while the disk image is being examined */
+      image_size_str = g_strdup (_("Checking…"));
+    }
+  else if (restore_file != NULL && data->probe->error_message != NULL)
+    {
+      restore_error = g_strdup (data->probe->error_message);
+    }
+  else if (restore_file != NULL)
     {
-      gboolean is_xz_compressed = FALSE;
-      GFileInfo *info;
-      guint64 size;
+      GduImagePartition *partition;
+      gboolean size_unknown = data->probe->size_unknown;
+      guint64 size = data->probe->size;
       gchar *s;
 
-      info = g_file_query_info (restore_file,
-                                G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
-                                G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                G_FILE_QUERY_INFO_NONE,
-                                NULL,
-                                NULL);
-      if (g_str_has_suffix (g_file_info_get_content_type (info), "-xz-compressed"))
-        is_xz_compressed = TRUE;
-      size = g_file_info_get_size (info);
-      g_object_unref (info);
-
-      if (is_xz_compressed)
+      if (data->probe->decoder != NULL)
         {
-          gsize uncompressed_size;
-          uncompressed_size = gdu_xz_decompressor_get_uncompressed_size (restore_file);
-          if (uncompressed_size == 0)
+          if (size_unknown)
             {
-              restore_error = g_strdup (_("File does not appear to be XZ compressed"));
-              size = 0;
+              s = udisks_client_get_size_for_display (gdu_window_get_client (data->window),
+                                                      data->probe->compressed_size, FALSE, TRUE);
+              /* Translators: Shown for a compressed disk image in the "Size" field if the format
+               *              doesn't record the uncompressed size (e.g. gzip).
+               *              The %s is the compressed size as a long string, e.g. "4.2 MB (4,300,123 bytes)".
+               */
+              image_size_str = g_strdup_printf (_("%s compressed, unknown when decompressed"), s);
+              g_free (s);
             }
           else
             {
-              s = udisks_client_get_size_for_display (gdu_window_get_client (data->window), uncompressed_size, FALSE, TRUE);
+              s = udisks_client_get_size_for_display (gdu_window_get_client (data->window), size, FALSE, TRUE);
               /* Translators: Shown for a compressed disk image in the "Size" field.
                *              The %s is the uncompressed size as a long string, e.g. "4.2 MB (4,300,123 bytes)".
                */
               image_size_str = g_strdup_printf (_("%s when decompressed"), s);
               g_free (s);
-              size = uncompressed_size;
             }
         }
       else
@@ -293,7 +767,20 @@ restore_disk_image_update (DialogData *data)
           image_size_str = udisks_client_get_size_for_display (gdu_window_get_client (data->window), size, FALSE, TRUE);
         }
 
-      if (data->block_size > 0)
+      /* if only a partition is restored, that's what has to fit */
+      partition = get_selected_partition (data);
+      if (partition != NULL)
+        {
+          size = partition->size;
+          size_unknown = FALSE;
+        }
+
+      if (data->block_size > 0 && size_unknown)
+        {
+          restore_warning = g_strdup (_("The size of the disk image is not known until it is decompressed so it is not known if it will fit on the device"));
+          can_proceed = TRUE;
+        }
+      else if (data->block_size > 0)
         {
           if (size == 0)
             {
@@ -326,6 +813,31 @@ restore_disk_image_update (DialogData *data)
               can_proceed = TRUE;
             }
         }
+
+      /* the disk image must also fit on every additional destination */
+      if (can_proceed && !size_unknown)
+        {
+          GList *blocks;
+          GList *l;
+
+          blocks = get_additional_destinations (data);
+          for (l = blocks; l != NULL; l = l->next)
+            {
+              UDisksBlock *block = UDISKS_BLOCK (l->data);
+              if (size > udisks_block_get_size (block))
+                {
+                  s = udisks_client_get_size_for_display (gdu_window_get_client (data->window),
+                                                          size - udisks_block_get_size (block), FALSE, FALSE);
+                  /* Translators: The first %s is a size (ex. "1.2 GB"), the second %s is a device (ex. "/dev/sdb") */
+                  restore_error = g_strdup_printf (_("The disk image is %s bigger than %s"),
+                                                   s, udisks_block_get_preferred_device (block));
+                  g_free (s);
+                  can_proceed = FALSE;
+                  break;
+                }
+            }
+          g_list_free_full (blocks, g_object_unref);
+        }
     }
 
   if (restore_warning != NULL)
@@ -372,6 +884,18 @@ on_file_set (GtkFileChooserButton   *button,
   ;
 }
 
+static void
+on_partition_changed (GtkComboBox *combobox,
+                      gpointer     user_data)
+{
+  DialogData *data = user_data;
+  if (data->dialog == NULL)
+    goto out;
+  restore_disk_image_update (data);
+ out:
+  ;
+}
+
 static void
 on_notify (GObject    *object,
            GParamSpec *pspec,
@@ -460,6 +984,8 @@ on_destination_combobox_notify_active (GObject    *gobject,
       g_clear_object (&block);
     }
   set_destination_object (data, object);
+  /* the main destination can't also be an additional destination */
+  gtk_widget_queue_draw (data->additional_destinations_treeview);
   restore_disk_image_update (data);
   g_clear_object (&object);
 }
@@ -511,28 +1037,126 @@ populate_destination_combobox (DialogData *data)
 /* ---------------------------------------------------------------------------------------------------- */
 
 static void
-restore_disk_image_populate (DialogData *data)
+additional_destinations_sensitive_cb (GtkTreeViewColumn *column,
+                                      GtkCellRenderer   *renderer,
+                                      GtkTreeModel      *model,
+                                      GtkTreeIter       *iter,
+                                      gpointer           user_data)
 {
-  gdu_utils_configure_file_chooser_for_disk_images (GTK_FILE_CHOOSER (data->selectable_image_fcbutton),
-                                                    TRUE,   /* set file types */
-                                                    TRUE);  /* allow_compressed */
+  DialogData *data = user_data;
+  UDisksBlock *block = NULL;
 
-  /* Image: Show label if image is known, otherwise show a filechooser button */
-  if (data->disk_image_filename != NULL)
-    {
-      gchar *s;
-      s = gdu_utils_unfuse_path (data->disk_image_filename);
-      gtk_label_set_text (GTK_LABEL (data->image_label), s);
-      g_free (s);
+  gtk_tree_model_get (model, iter,
+                      GDU_DEVICE_TREE_MODEL_COLUMN_BLOCK, &block,
+                      -1);
+  gtk_cell_renderer_set_sensitive (renderer, is_usable_additional_destination (data, block));
+  g_clear_object (&block);
+}
 
-      gtk_widget_hide (data->selectable_image_label);
-      gtk_widget_hide (data->selectable_image_fcbutton);
-    }
-  else
-    {
-      gtk_widget_hide (data->image_key_label);
-      gtk_widget_hide (data->image_label);
-    }
+static void
+on_additional_destination_toggled (GtkCellRendererToggle *renderer,
+                                   const gchar           *path_string,
+                                   gpointer               user_data)
+{
+  DialogData *data = user_data;
+  UDisksBlock *block = NULL;
+  GtkTreeIter iter;
+
+  if (!gtk_tree_model_get_iter_from_string (GTK_TREE_MODEL (data->additional_destinations_model),
+                                            &iter,
+                                            path_string))
+    goto out;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (data->additional_destinations_model), &iter,
+                      GDU_DEVICE_TREE_MODEL_COLUMN_BLOCK, &block,
+                      -1);
+  if (!is_usable_additional_destination (data, block))
+    goto out;
+
+  gdu_device_tree_model_toggle_selected (data->additional_destinations_model, &iter);
+  restore_disk_image_update (data);
+
+ out:
+  g_clear_object (&block);
+}
+
+static void
+populate_additional_destinations_treeview (DialogData *data)
+{
+  GtkTreeView *treeview;
+  GtkTreeViewColumn *column;
+  GtkCellRenderer *renderer;
+
+  treeview = GTK_TREE_VIEW (data->additional_destinations_treeview);
+  data->additional_destinations_model = gdu_device_tree_model_new (gdu_window_get_application (data->window),
+                                                                   GDU_DEVICE_TREE_MODEL_FLAGS_FLAT |
+                                                                   GDU_DEVICE_TREE_MODEL_FLAGS_ONE_LINE_NAME |
+                                                                   GDU_DEVICE_TREE_MODEL_FLAGS_INCLUDE_DEVICE_NAME);
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (data->additional_destinations_model),
+                                        GDU_DEVICE_TREE_MODEL_COLUMN_SORT_KEY,
+                                        GTK_SORT_ASCENDING);
+  gtk_tree_view_set_model (treeview, GTK_TREE_MODEL (data->additional_destinations_model));
+
+  column = gtk_tree_view_column_new ();
+  gtk_tree_view_append_column (treeview, column);
+
+  renderer = gtk_cell_renderer_toggle_new ();
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_set_attributes (column, renderer,
+                                       "active", GDU_DEVICE_TREE_MODEL_COLUMN_SELECTED,
+                                       NULL);
+  gtk_tree_view_column_set_cell_data_func (column, renderer,
+                                           additional_destinations_sensitive_cb, data, NULL);
+  g_signal_connect (renderer, "toggled", G_CALLBACK (on_additional_destination_toggled), data);
+
+  renderer = gtk_cell_renderer_pixbuf_new ();
+  g_object_set (G_OBJECT (renderer),
+                "stock-size", GTK_ICON_SIZE_MENU,
+                NULL);
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_set_attributes (column, renderer,
+                                       "gicon", GDU_DEVICE_TREE_MODEL_COLUMN_ICON,
+                                       NULL);
+  gtk_tree_view_column_set_cell_data_func (column, renderer,
+                                           additional_destinations_sensitive_cb, data, NULL);
+
+  renderer = gtk_cell_renderer_text_new ();
+  g_object_set (G_OBJECT (renderer),
+                "ellipsize", PANGO_ELLIPSIZE_MIDDLE,
+                NULL);
+  gtk_tree_view_column_pack_start (column, renderer, TRUE);
+  gtk_tree_view_column_set_attributes (column, renderer,
+                                       "markup", GDU_DEVICE_TREE_MODEL_COLUMN_NAME,
+                                       NULL);
+  gtk_tree_view_column_set_cell_data_func (column, renderer,
+                                           additional_destinations_sensitive_cb, data, NULL);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+restore_disk_image_populate (DialogData *data)
+{
+  gdu_utils_configure_file_chooser_for_disk_images (GTK_FILE_CHOOSER (data->selectable_image_fcbutton),
+                                                    TRUE,   /* set file types */
+                                                    TRUE);  /* allow_compressed */
+
+  /* Image: Show label if image is known, otherwise show a filechooser button */
+  if (data->disk_image_filename != NULL)
+    {
+      gchar *s;
+      s = gdu_utils_unfuse_path (data->disk_image_filename);
+      gtk_label_set_text (GTK_LABEL (data->image_label), s);
+      g_free (s);
+
+      gtk_widget_hide (data->selectable_image_label);
+      gtk_widget_hide (data->selectable_image_fcbutton);
+    }
+  else
+    {
+      gtk_widget_hide (data->image_key_label);
+      gtk_widget_hide (data->image_label);
+    }
 
   /* Destination: Show label if device is known, otherwise show a combobox */
   if (data->object != NULL)
@@ -552,35 +1176,67 @@ restore_disk_image_populate (DialogData *data)
 
       populate_destination_combobox (data);
     }
+
+  populate_additional_destinations_treeview (data);
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
 static void
-update_job (DialogData *data,
-            gboolean    done)
+update_job (RestoreTarget *target,
+            gboolean       done)
 {
+  DialogData *data = target->data;
   guint64 bytes_completed = 0;
   guint64 bytes_target = 0;
   guint64 bytes_per_sec = 0;
   guint64 usec_remaining = 0;
+  guint64 num_bytes_unchanged = 0;
+  guint64 num_bytes_verified = 0;
+  gboolean verifying = FALSE;
   gdouble progress = 0.0;
+  gchar *extra_markup = NULL;
 
   g_mutex_lock (&data->copy_lock);
-  if (data->estimator != NULL)
+  if (target->estimator != NULL)
     {
-      bytes_per_sec = gdu_estimator_get_bytes_per_sec (data->estimator);
-      usec_remaining = gdu_estimator_get_usec_remaining (data->estimator);
-      bytes_completed = gdu_estimator_get_completed_bytes (data->estimator);
-      bytes_target = gdu_estimator_get_target_bytes (data->estimator);
+      bytes_per_sec = gdu_estimator_get_bytes_per_sec (target->estimator);
+      usec_remaining = gdu_estimator_get_usec_remaining (target->estimator);
+      bytes_completed = gdu_estimator_get_completed_bytes (target->estimator);
+      bytes_target = gdu_estimator_get_target_bytes (target->estimator);
     }
-  data->update_id = 0;
+  num_bytes_unchanged = target->num_bytes_unchanged;
+  num_bytes_verified = target->num_bytes_verified;
+  verifying = data->verify && target->writing_done && !done;
+  if (verifying)
+    bytes_target = data->input_size;
+  target->update_id = 0;
   g_mutex_unlock (&data->copy_lock);
 
-  if (data->local_job != NULL)
+  /* Once everything is written, the job is about reading back what is left to verify */
+  if (verifying)
+    {
+      bytes_completed = num_bytes_verified;
+      bytes_per_sec = 0;
+      usec_remaining = 0;
+      /* Translators: Shown when all data was written and the device is being read back and compared */
+      extra_markup = g_strdup (_("Verifying…"));
+    }
+  else if (data->write_changed_only && num_bytes_unchanged > 0)
+    {
+      gchar *s;
+      s = g_format_size (num_bytes_unchanged);
+      /* Translators: Shown when only writing the blocks that differ from what is on the device.
+       *              The %s is the amount of data that was not written (ex. "512 MB").
+       */
+      extra_markup = g_strdup_printf (_("%s already up to date"), s);
+      g_free (s);
+    }
+
+  if (target->local_job != NULL)
     {
-      udisks_job_set_bytes (UDISKS_JOB (data->local_job), bytes_target);
-      udisks_job_set_rate (UDISKS_JOB (data->local_job), bytes_per_sec);
+      udisks_job_set_bytes (UDISKS_JOB (target->local_job), bytes_target);
+      udisks_job_set_rate (UDISKS_JOB (target->local_job), bytes_per_sec);
 
       if (done)
         {
@@ -593,13 +1249,17 @@ update_job (DialogData *data,
           else
             progress = 0.0;
         }
-      udisks_job_set_progress (UDISKS_JOB (data->local_job), progress);
+      udisks_job_set_progress (UDISKS_JOB (target->local_job), progress);
 
       if (usec_remaining == 0)
-        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), 0);
+        udisks_job_set_expected_end_time (UDISKS_JOB (target->local_job), 0);
       else
-        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), usec_remaining + g_get_real_time ());
+        udisks_job_set_expected_end_time (UDISKS_JOB (target->local_job), usec_remaining + g_get_real_time ());
+
+      gdu_local_job_set_extra_markup (target->local_job, extra_markup);
     }
+
+  g_free (extra_markup);
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
@@ -629,8 +1289,22 @@ play_complete_sound (DialogData *data)
 static gboolean
 on_update_job (gpointer user_data)
 {
-  DialogData *data = user_data;
-  update_job (data, FALSE);
+  RestoreTarget *target = user_data;
+  DialogData *data = target->data;
+  update_job (target, FALSE);
+  dialog_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Called when writing to a single device failed - the other devices keep going */
+static gboolean
+on_target_failed (gpointer user_data)
+{
+  RestoreTarget *target = user_data;
+  DialogData *data = target->data;
+  restore_target_terminate_job (target);
   dialog_data_unref (data);
   return FALSE; /* remove source */
 }
@@ -638,258 +1312,1130 @@ on_update_job (gpointer user_data)
 /* ---------------------------------------------------------------------------------------------------- */
 
 static gboolean
-on_show_error (gpointer user_data)
+on_finished (gpointer user_data)
 {
   DialogData *data = user_data;
+  GString *message = NULL;
+  GError *error = NULL;
+  guint n;
+
+  /* if everything was canceled there's nothing to report */
+  if (data->completed)
+    goto out;
+
+  for (n = 0; n < data->targets->len; n++)
+    {
+      RestoreTarget *target = g_ptr_array_index (data->targets, n);
+      GError *target_error;
+
+      g_mutex_lock (&data->copy_lock);
+      target_error = target->error;
+      target->error = NULL;
+      g_mutex_unlock (&data->copy_lock);
+
+      if (target_error == NULL)
+        {
+          update_job (target, TRUE);
+          continue;
+        }
+
+      if (!(target_error->domain == G_IO_ERROR && target_error->code == G_IO_ERROR_CANCELLED))
+        {
+          if (data->targets->len == 1)
+            {
+              error = target_error;
+              target_error = NULL;
+            }
+          else
+            {
+              if (message == NULL)
+                message = g_string_new (NULL);
+              else
+                g_string_append_c (message, '\n');
+              g_string_append_printf (message, "%s: %s",
+                                      udisks_block_get_preferred_device (target->block),
+                                      target_error->message);
+            }
+        }
+      g_clear_error (&target_error);
+    }
+
+  if (message != NULL)
+    error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, message->str);
 
   play_complete_sound (data);
   dialog_data_uninhibit (data);
 
-  g_assert (data->copy_error != NULL);
-  gdu_utils_show_error (GTK_WINDOW (data->window),
-                        _("Error restoring disk image"),
-                        data->copy_error);
-  g_clear_error (&data->copy_error);
+  if (error != NULL)
+    {
+      gdu_utils_show_error (GTK_WINDOW (data->window),
+                            _("Error restoring disk image"),
+                            error);
+      g_clear_error (&error);
+    }
 
   dialog_data_complete_and_unref (data);
 
+ out:
+  if (message != NULL)
+    g_string_free (message, TRUE);
   dialog_data_unref (data);
   return FALSE; /* remove source */
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static gboolean
-on_success (gpointer user_data)
+/* Returns the data extents of the file referred to by @fd as reported by
+ * SEEK_DATA / SEEK_HOLE or %NULL if this is not supported by the file system.
+ */
+static GArray *
+get_data_extents (gint    fd,
+                  guint64 file_size)
 {
-  DialogData *data = user_data;
+  GArray *ret = NULL;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  off_t pos = 0;
 
-  update_job (data, TRUE);
+  ret = g_array_new (FALSE, FALSE, sizeof (Extent));
+  while ((guint64) pos < file_size)
+    {
+      off_t data_start;
+      off_t data_end;
+      Extent extent;
 
-  play_complete_sound (data);
-  dialog_data_uninhibit (data);
-  dialog_data_complete_and_unref (data);
+      data_start = lseek (fd, pos, SEEK_DATA);
+      if (data_start < 0)
+        {
+          /* ENXIO means there is no more data, e.g. the rest of the file is a hole */
+          if (errno == ENXIO)
+            break;
+          goto not_supported;
+        }
+      if ((guint64) data_start >= file_size)
+        break;
+      data_end = lseek (fd, data_start, SEEK_HOLE);
+      if (data_end < 0)
+        goto not_supported;
+      if ((guint64) data_end > file_size)
+        data_end = file_size;
+
+      extent.offset = data_start;
+      extent.size = data_end - data_start;
+      g_array_append_val (ret, extent);
+      pos = data_end;
+    }
 
-  dialog_data_unref (data);
-  return FALSE; /* remove source */
+  if (lseek (fd, 0, SEEK_SET) == 0)
+    goto out;
+
+ not_supported:
+  g_array_unref (ret);
+  ret = NULL;
+  if (lseek (fd, 0, SEEK_SET) != 0)
+    g_warning ("Error rewinding disk image: %m");
+
+ out:
+#endif
+  return ret;
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Opens the device for reading with O_DIRECT, e.g. bypassing the page
+ * cache, so what we read is what is actually on the medium.
+ */
+static gint
+open_for_reading (UDisksBlock  *block,
+                  GError      **error)
+{
+  GVariantBuilder options_builder;
+  GUnixFDList *fd_list = NULL;
+  GVariant *fd_index = NULL;
+  gint fd = -1;
+
+  g_variant_builder_init (&options_builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (FALSE));
+  if (!udisks_block_call_open_for_benchmark_sync (block,
+                                                  g_variant_builder_end (&options_builder),
+                                                  NULL, /* fd_list */
+                                                  &fd_index,
+                                                  &fd_list,
+                                                  NULL, /* cancellable */
+                                                  error))
+    goto out;
+
+  fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+  if (fd == -1)
+    {
+      g_prefix_error (error,
+                      "Error extracing fd with handle %d from D-Bus message: ",
+                      g_variant_get_handle (fd_index));
+      goto out;
+    }
+
+ out:
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  g_clear_object (&fd_list);
+  return fd;
+}
+
+/* Reads what is currently on the device for every chunk write_thread_func()
+ * is going to write, in the same order. This runs ahead of the write thread
+ * so reading the device overlaps with reading the disk image and writing
+ * the parts that differ.
+ */
 static gpointer
-copy_thread_func (gpointer user_data)
+read_ahead_thread_func (gpointer user_data)
 {
-  DialogData *data = user_data;
-  guchar *buffer_unaligned = NULL;
-  guchar *buffer = NULL;
-  guint64 block_device_size = 0;
-  long page_size;
+  RestoreTarget *target = user_data;
+  DialogData *data = target->data;
+  guint64 block_mask = ~((guint64) target->logical_block_size - 1);
+  GArray *extents;
   GError *error = NULL;
-  GError *error2 = NULL;
-  gint64 last_update_usec = -1;
-  gint fd = -1;
-  gint buffer_size;
-  guint64 num_bytes_completed = 0;
+  guint n;
 
-  /* default to 1 MiB blocks */
-  buffer_size = (1 * 1024 * 1024);
-
-  /* Most OSes put ACLs for logged-in users on /dev/sr* nodes (this is
-   * so CD burning tools etc. work) so see if we can open the device
-   * file ourselves. If so, great, since this avoids a polkit dialog.
-   *
-   * As opposed to udisks' OpenForBackup() we also avoid O_EXCL since
-   * the disc is read-only by its very nature. As a side-effect this
-   * allows creating a disk image of a mounted disc.
-   */
-  if (g_str_has_prefix (udisks_block_get_device (data->block), "/dev/sr"))
+  if (data->extents != NULL)
     {
-      fd = open (udisks_block_get_device (data->block), O_RDONLY);
+      extents = g_array_ref (data->extents);
     }
+  else
+    {
+      Extent extent;
 
-  /* Otherwise, request the fd from udisks */
-  if (fd == -1)
+      /* a compressed disk image is written until it ends, at the latest at the end of the device */
+      extent.offset = 0;
+      extent.size = target->device_size;
+      extents = g_array_new (FALSE, FALSE, sizeof (Extent));
+      g_array_append_val (extents, extent);
+    }
+
+  for (n = 0; n < extents->len; n++)
     {
-      GUnixFDList *fd_list = NULL;
-      GVariant *fd_index = NULL;
-      if (!udisks_block_call_open_for_restore_sync (data->block,
-                                                    g_variant_new ("a{sv}", NULL), /* options */
-                                                    NULL, /* fd_list */
-                                                    &fd_index,
-                                                    &fd_list,
-                                                    NULL, /* cancellable */
-                                                    &error))
-        goto out;
+      Extent *extent = &g_array_index (extents, Extent, n);
+      guint64 extent_end = extent->offset + extent->size;
+      guint64 pos;
 
-      fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), &error);
-      if (error != NULL)
+      for (pos = extent->offset; pos < extent_end; pos += data->chunk_size)
         {
-          g_prefix_error (&error,
-                          "Error extracing fd with handle %d from D-Bus message: ",
-                          g_variant_get_handle (fd_index));
-          goto out;
+          guint64 size = MIN (data->chunk_size, extent_end - pos);
+          guint64 aligned_start;
+          guint64 aligned_end;
+          guchar *buffer;
+
+          /* O_DIRECT requires reading whole logical blocks */
+          aligned_start = pos & block_mask;
+          aligned_end = (pos + size + target->logical_block_size - 1) & block_mask;
+
+          buffer = gdu_buffer_ring_begin_write (target->read_ahead_ring);
+          if (buffer == NULL)
+            goto out;
+          if (!gdu_copy_utils_pread_all (target->read_fd, buffer, aligned_end - aligned_start, aligned_start, &error))
+            goto out;
+          gdu_buffer_ring_end_write (target->read_ahead_ring, pos, size);
         }
-      if (fd_index != NULL)
-        g_variant_unref (fd_index);
-      g_clear_object (&fd_list);
     }
 
-  g_assert (fd != -1);
+ out:
+  if (error != NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      target->read_ahead_error = error;
+      g_mutex_unlock (&data->copy_lock);
+      gdu_buffer_ring_abort (target->read_ahead_ring);
+    }
+  else
+    {
+      gdu_buffer_ring_close (target->read_ahead_ring);
+    }
+  g_array_unref (extents);
+  return NULL;
+}
+
+/* How many chunks reading the disk image may run ahead of the slowest device */
+#define IMAGE_RING_NUM_BUFFERS 32
 
-  /* We can't use udisks_block_get_size() because the media may have
-   * changed and udisks may not have noticed. TODO: maybe have a
-   * Block.GetSize() method instead...
-   */
-  if (ioctl (fd, BLKGETSIZE64, &block_device_size) != 0)
+/* Reads the (decompressed) disk image in chunks, skipping holes */
+typedef struct
+{
+  DialogData *data; /* not a reference */
+  GInputStream *input_stream;
+  /* only set for compressed disk images */
+  GInputStream *compressed_stream;
+  guint64 num_bytes_to_skip;
+  gboolean eof;
+
+  /* the next offset to read, relative to data->range_offset */
+  guint64 pos;
+  /* for uncompressed disk images: the offset of input_stream in the file */
+  guint64 stream_offset;
+  guint extent_index;
+} ImageReader;
+
+static ImageReader *
+image_reader_new (DialogData   *data,
+                  GInputStream *input_stream,
+                  GInputStream *compressed_stream,
+                  guint64       num_bytes_to_skip,
+                  guint64       pos,
+                  guint64       stream_offset)
+{
+  ImageReader *reader;
+
+  reader = g_new0 (ImageReader, 1);
+  reader->data = data;
+  reader->input_stream = g_object_ref (input_stream);
+  if (compressed_stream != NULL)
+    reader->compressed_stream = g_object_ref (compressed_stream);
+  reader->num_bytes_to_skip = num_bytes_to_skip;
+  reader->pos = pos;
+  reader->stream_offset = stream_offset;
+  return reader;
+}
+
+static void
+image_reader_free (ImageReader *reader)
+{
+  g_object_unref (reader->input_stream);
+  g_clear_object (&reader->compressed_stream);
+  g_free (reader);
+}
+
+/* Opens the disk image again, for reading it from @pos on */
+static ImageReader *
+image_reader_open (DialogData    *data,
+                   guint64        pos,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  ImageReader *ret = NULL;
+  GInputStream *stream;
+  GInputStream *decompressed_stream;
+  GConverter *decompressor;
+  guint64 offset = data->range_offset + pos;
+  guint64 compressed_offset = 0;
+  guint64 uncompressed_offset = 0;
+
+  stream = (GInputStream *) g_file_read (data->image_file, cancellable, error);
+  if (stream == NULL)
+    goto out;
+
+  if (data->decoder == NULL)
     {
-      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
-                           "%s", strerror (errno));
-      g_prefix_error (&error, _("Error determining size of device: "));
+      ret = image_reader_new (data, stream, NULL, 0, pos, 0);
       goto out;
     }
 
-  if (block_device_size == 0)
+  if (offset > 0)
+    decompressor = gdu_decoder_new_converter_at (data->decoder, data->image_file, offset,
+                                                 &compressed_offset, &uncompressed_offset);
+  else
+    decompressor = gdu_decoder_new_converter (data->decoder);
+  if (compressed_offset > 0 &&
+      !g_seekable_seek (G_SEEKABLE (stream), compressed_offset, G_SEEK_SET, cancellable, error))
     {
-      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
-                           _("Device is size 0"));
+      g_object_unref (decompressor);
       goto out;
     }
-  data->block_size = block_device_size;
+  decompressed_stream = g_converter_input_stream_new (stream, decompressor);
+  ret = image_reader_new (data, decompressed_stream, stream, offset - uncompressed_offset, pos, 0);
+  g_object_unref (decompressed_stream);
+  g_object_unref (decompressor);
 
-  page_size = sysconf (_SC_PAGESIZE);
-  buffer_unaligned = g_new0 (guchar, buffer_size + page_size);
-  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+ out:
+  g_clear_object (&stream);
+  return ret;
+}
 
-  g_mutex_lock (&data->copy_lock);
-  data->estimator = gdu_estimator_new (data->input_size);
-  data->update_id = 0;
-  data->start_time_usec = g_get_real_time ();
-  g_mutex_unlock (&data->copy_lock);
+/* Reads the next chunk of the disk image into @buffer, which must be
+ * data->chunk_size bytes. Sets @out_size to 0 at the end of the disk image.
+ */
+static gboolean
+image_reader_read (ImageReader   *reader,
+                   guchar        *buffer,
+                   guint64       *out_offset,
+                   gsize         *out_size,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  DialogData *data = reader->data;
+  gsize num_bytes_to_read;
+  gsize num_bytes_read;
+  guint64 extent_end;
+  Extent *extent;
 
-  /* Read huge (e.g. 1 MiB) blocks and write it to the output
-   * device even if it was only partially read.
+  *out_offset = reader->pos;
+  *out_size = 0;
+
+  /* A compressed disk image is decompressed in huge (e.g. 1 MiB) blocks
+   * until the end since the size may not be known in advance.
    */
-  num_bytes_completed = 0;
-  while (num_bytes_completed < data->input_size)
+  if (data->extents == NULL)
     {
-      gsize num_bytes_to_read;
-      gsize num_bytes_read;
-      ssize_t num_bytes_written;
-      gint64 now_usec;
+      if (reader->eof)
+        return TRUE;
 
-      num_bytes_to_read = buffer_size;
-      if (num_bytes_to_read + num_bytes_completed > data->input_size)
-        num_bytes_to_read = data->input_size - num_bytes_completed;
+      /* When restoring a partition, decompression starts at or somewhat before it */
+      while (reader->num_bytes_to_skip > 0)
+        {
+          gssize num_bytes_skipped;
 
-      /* Update GUI - but only every 200 ms and only if last update isn't pending */
-      g_mutex_lock (&data->copy_lock);
-      now_usec = g_get_monotonic_time ();
-      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+          num_bytes_skipped = g_input_stream_skip (reader->input_stream,
+                                                   MIN (reader->num_bytes_to_skip, data->chunk_size),
+                                                   cancellable,
+                                                   error);
+          if (num_bytes_skipped < 0)
+            {
+              g_prefix_error (error,
+                              "Error skipping to offset %" G_GUINT64_FORMAT ": ",
+                              data->range_offset + reader->pos);
+              return FALSE;
+            }
+          if (num_bytes_skipped == 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Disk image ended before offset %" G_GUINT64_FORMAT,
+                           data->range_offset + reader->pos);
+              return FALSE;
+            }
+          reader->num_bytes_to_skip -= num_bytes_skipped;
+        }
+
+      num_bytes_to_read = data->chunk_size;
+      if (data->restore_partition)
         {
-          if (num_bytes_completed > 0)
-            gdu_estimator_add_sample (data->estimator, num_bytes_completed);
-          if (data->update_id == 0)
-            data->update_id = g_idle_add (on_update_job, dialog_data_ref (data));
-          last_update_usec = now_usec;
+          if (reader->pos == data->input_size)
+            return TRUE;
+          if (num_bytes_to_read > data->input_size - reader->pos)
+            num_bytes_to_read = data->input_size - reader->pos;
         }
-      g_mutex_unlock (&data->copy_lock);
 
-      if (!g_input_stream_read_all (data->input_stream,
+      if (!g_input_stream_read_all (reader->input_stream,
                                     buffer,
                                     num_bytes_to_read,
                                     &num_bytes_read,
-                                    data->cancellable,
-                                    &error))
+                                    cancellable,
+                                    error))
         {
-          g_prefix_error (&error,
+          g_prefix_error (error,
                           "Error reading %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": ",
                           num_bytes_to_read,
-                          num_bytes_completed);
-          goto out;
+                          reader->pos);
+          return FALSE;
         }
-      if (num_bytes_read != num_bytes_to_read)
+      if (data->restore_partition && num_bytes_read != num_bytes_to_read)
         {
-          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                        "Requested %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT " but only read %" G_GSIZE_FORMAT " bytes",
-                       num_bytes_read,
-                       num_bytes_completed,
-                       num_bytes_to_read);
-          goto out;
+                       num_bytes_to_read,
+                       reader->pos,
+                       num_bytes_read);
+          return FALSE;
         }
+      if (num_bytes_read < num_bytes_to_read)
+        reader->eof = TRUE;
 
-    copy_write_again:
-      num_bytes_written = write (fd, buffer, num_bytes_read);
-      if (num_bytes_written < 0)
-        {
-          if (errno == EAGAIN || errno == EINTR)
-            goto copy_write_again;
+      *out_size = num_bytes_read;
+      reader->pos += num_bytes_read;
+      return TRUE;
+    }
 
-          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Error writing %" G_GSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %m",
-                       num_bytes_read,
-                       num_bytes_completed);
-          goto out;
-        }
+  /* Read huge (e.g. 1 MiB) blocks from each data extent. Holes are
+   * skipped and zeroed on the devices instead of being read from the
+   * disk image and copied.
+   */
+  for (; reader->extent_index < data->extents->len; reader->extent_index++)
+    {
+      extent = &g_array_index (data->extents, Extent, reader->extent_index);
+      if (reader->pos < extent->offset + extent->size)
+        break;
+    }
+  if (reader->extent_index == data->extents->len)
+    return TRUE;
 
-      /*g_print ("copied %" G_GUINT64_FORMAT " bytes at offset %" G_GUINT64_FORMAT "\n",
-               (guint64) num_bytes_written,
-               num_bytes_completed);*/
+  extent = &g_array_index (data->extents, Extent, reader->extent_index);
+  extent_end = extent->offset + extent->size;
+  if (reader->pos < extent->offset)
+    reader->pos = extent->offset;
 
-      num_bytes_completed += num_bytes_written;
+  if (reader->stream_offset != data->range_offset + reader->pos)
+    {
+      if (!g_seekable_seek (G_SEEKABLE (reader->input_stream),
+                            data->range_offset + reader->pos,
+                            G_SEEK_SET,
+                            cancellable,
+                            error))
+        {
+          g_prefix_error (error,
+                          "Error seeking to offset %" G_GUINT64_FORMAT ": ",
+                          data->range_offset + reader->pos);
+          return FALSE;
+        }
+      reader->stream_offset = data->range_offset + reader->pos;
     }
 
- out:
-  data->end_time_usec = g_get_real_time ();
+  num_bytes_to_read = data->chunk_size;
+  if (num_bytes_to_read > extent_end - reader->pos)
+    num_bytes_to_read = extent_end - reader->pos;
 
-  /* in either case, close the stream */
-  if (!g_input_stream_close (G_INPUT_STREAM (data->input_stream),
-                              NULL, /* cancellable */
-                              &error2))
+  if (!g_input_stream_read_all (reader->input_stream,
+                                buffer,
+                                num_bytes_to_read,
+                                &num_bytes_read,
+                                cancellable,
+                                error))
     {
-      g_warning ("Error closing file input stream: %s (%s, %d)",
-                 error2->message, g_quark_to_string (error2->domain), error2->code);
-      g_clear_error (&error2);
+      g_prefix_error (error,
+                      "Error reading %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": ",
+                      num_bytes_to_read,
+                      reader->pos);
+      return FALSE;
     }
-  g_clear_object (&data->input_stream);
-
-  if (fd != -1 )
+  reader->stream_offset += num_bytes_read;
+  if (num_bytes_read != num_bytes_to_read)
     {
-      if (close (fd) != 0)
-        g_warning ("Error closing fd: %m");
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Requested %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT " but only read %" G_GSIZE_FORMAT " bytes",
+                   num_bytes_to_read,
+                   reader->pos,
+                   num_bytes_read);
+      return FALSE;
     }
 
-  if (error != NULL)
+  *out_offset = reader->pos;
+  *out_size = num_bytes_read;
+  reader->pos += num_bytes_read;
+  return TRUE;
+}
+
+/* Granularity used when comparing the disk image to the device */
+#define COMPARE_BLOCK_SIZE (64 * 1024)
+
+/* Writes the parts of @image that differ from @device (what is currently
+ * on the device at @offset), coalescing adjacent differing blocks into a
+ * single write. The number of bytes not written is added to @num_unchanged.
+ */
+static gboolean
+write_changed_blocks (gint           fd,
+                      const guchar  *image,
+                      const guchar  *device,
+                      gsize          size,
+                      guint64        offset,
+                      guint64       *num_unchanged,
+                      GError       **error)
+{
+  gsize pos = 0;
+
+  while (pos < size)
     {
-      /* show error in GUI */
-      if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+      gsize run_start;
+      gsize len;
+
+      /* No need for hashing - memcmp() is vectorized in any libc worth its salt */
+      len = MIN (COMPARE_BLOCK_SIZE, size - pos);
+      if (memcmp (image + pos, device + pos, len) == 0)
         {
-          data->copy_error = error; error = NULL;
-          g_idle_add (on_show_error, dialog_data_ref (data));
+          *num_unchanged += len;
+          pos += len;
+          continue;
         }
-      g_clear_error (&error);
 
-      /* Wipe the device */
-      if (!udisks_block_call_format_sync (data->block,
-                                          "empty",
-                                          g_variant_new ("a{sv}", NULL), /* options */
-                                          NULL, /* cancellable */
-                                          &error2))
+      run_start = pos;
+      pos += len;
+      while (pos < size)
         {
-          g_warning ("Error wiping device on error path: %s (%s, %d)",
-                     error2->message, g_quark_to_string (error2->domain), error2->code);
-          g_clear_error (&error2);
+          len = MIN (COMPARE_BLOCK_SIZE, size - pos);
+          if (memcmp (image + pos, device + pos, len) == 0)
+            break;
+          pos += len;
         }
+
+      if (!gdu_copy_utils_pwrite_all (fd, image + run_start, pos - run_start, offset + run_start, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Zeroes the hole of @size bytes at @offset in the disk image on the
+ * device. When only writing changed blocks, the device is read first
+ * and only the parts that aren't zero already are written - @hole_buffer
+ * must then be a page-aligned buffer of data->chunk_size plus two
+ * logical blocks. @zero_buffer is data->chunk_size bytes of zeroes.
+ */
+static gboolean
+write_hole (RestoreTarget  *target,
+            gint            fd,
+            guint64         offset,
+            guint64         size,
+            guchar         *zero_buffer,
+            guchar         *hole_buffer,
+            GError        **error)
+{
+  DialogData *data = target->data;
+  guint64 block_mask = ~((guint64) target->logical_block_size - 1);
+  guint64 end = offset + size;
+  guint64 num_unchanged = 0;
+  guint64 pos;
+  gboolean ret = FALSE;
+
+  if (!data->write_changed_only)
+    return gdu_copy_utils_zero_range (fd, offset, size, zero_buffer, data->chunk_size, error);
+
+  for (pos = offset; pos < end; pos += data->chunk_size)
+    {
+      gsize len = MIN (data->chunk_size, end - pos);
+      guint64 aligned_start;
+      guint64 aligned_end;
+
+      if (g_cancellable_set_error_if_cancelled (target->cancellable, error))
+        goto out;
+
+      /* O_DIRECT requires reading whole logical blocks */
+      aligned_start = pos & block_mask;
+      aligned_end = (pos + len + target->logical_block_size - 1) & block_mask;
+      if (!gdu_copy_utils_pread_all (target->read_fd, hole_buffer, aligned_end - aligned_start, aligned_start, error))
+        goto out;
+      if (!write_changed_blocks (fd,
+                                 zero_buffer,
+                                 hole_buffer + (pos & (target->logical_block_size - 1)),
+                                 len,
+                                 pos,
+                                 &num_unchanged,
+                                 error))
+        goto out;
+    }
+  ret = TRUE;
+
+ out:
+  g_mutex_lock (&data->copy_lock);
+  target->num_bytes_unchanged += num_unchanged;
+  g_mutex_unlock (&data->copy_lock);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Queues a range that was just written for verification. @data is
+ * what was written or %NULL if the range was zeroed.
+ */
+static void
+queue_verify_range (RestoreTarget *target,
+                    guint64        offset,
+                    guint64        size,
+                    const guchar  *data)
+{
+  VerifyRange *range;
+
+  if (target->verify_queue == NULL)
+    return;
+
+  range = g_new0 (VerifyRange, 1);
+  range->offset = offset;
+  range->size = size;
+  if (data != NULL)
+    {
+      GChecksum *checksum;
+      gsize digest_len = sizeof (range->digest);
+
+      checksum = g_checksum_new (G_CHECKSUM_MD5);
+      g_checksum_update (checksum, data, size);
+      g_checksum_get_digest (checksum, range->digest, &digest_len);
+      g_checksum_free (checksum);
     }
   else
     {
-      /* success */
-      g_idle_add (on_success, dialog_data_ref (data));
+      range->is_hole = TRUE;
+    }
+  g_async_queue_push (target->verify_queue, range);
+}
+
+/* Reads back the ranges write_thread_func() queued, right behind the
+ * write cursor. Since the device is opened with O_DIRECT the kernel
+ * has to write out the data before we can read it, so what we compare
+ * with is what is actually on the medium rather than the page cache.
+ */
+static gpointer
+verify_thread_func (gpointer user_data)
+{
+  RestoreTarget *target = user_data;
+  DialogData *data = target->data;
+  guint64 block_mask = ~((guint64) target->logical_block_size - 1);
+  gsize buffer_size = data->chunk_size + 2 * target->logical_block_size;
+  guchar *buffer_unaligned = NULL;
+  guchar *buffer = NULL;
+  GChecksum *checksum = NULL;
+  GError *error = NULL;
+  gint64 last_update_usec = -1;
+  guint64 mismatch_offset = 0;
+  long page_size;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  buffer_unaligned = g_new0 (guchar, buffer_size + page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+  while (TRUE)
+    {
+      VerifyRange *range;
+      guint64 range_end;
+      guint64 pos;
+
+      range = g_async_queue_pop (target->verify_queue);
+      if (range->size == 0)
+        {
+          g_free (range);
+          break;
+        }
+
+      range_end = range->offset + range->size;
+      for (pos = range->offset; pos < range_end; pos += data->chunk_size)
+        {
+          guint64 size = MIN (data->chunk_size, range_end - pos);
+          guint64 aligned_start;
+          guint64 aligned_end;
+          const guchar *p;
+          gint64 now_usec;
+
+          if (g_cancellable_set_error_if_cancelled (target->cancellable, &error))
+            {
+              g_free (range);
+              goto out;
+            }
+
+          /* O_DIRECT requires reading whole logical blocks */
+          aligned_start = pos & block_mask;
+          aligned_end = (pos + size + target->logical_block_size - 1) & block_mask;
+          if (!gdu_copy_utils_pread_all (target->read_fd, buffer, aligned_end - aligned_start, aligned_start, &error))
+            {
+              g_prefix_error (&error, _("Error reading back data for verification: "));
+              g_free (range);
+              goto out;
+            }
+          p = buffer + (pos & (target->logical_block_size - 1));
+
+          if (range->is_hole)
+            {
+              if (p[0] != 0 || memcmp (p, p + 1, size - 1) != 0)
+                {
+                  mismatch_offset = pos;
+                  goto mismatch;
+                }
+            }
+          else
+            {
+              g_checksum_update (checksum, p, size);
+            }
+
+          g_mutex_lock (&data->copy_lock);
+          target->num_bytes_verified += size;
+          /* Only update the GUI here once all data is written - before that the write thread does it */
+          now_usec = g_get_monotonic_time ();
+          if (target->writing_done &&
+              (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0))
+            {
+              if (target->update_id == 0)
+                {
+                  dialog_data_ref (data);
+                  target->update_id = g_idle_add (on_update_job, target);
+                }
+              last_update_usec = now_usec;
+            }
+          g_mutex_unlock (&data->copy_lock);
+        }
+
+      if (!range->is_hole)
+        {
+          guint8 digest[16];
+          gsize digest_len = sizeof (digest);
+
+          g_checksum_get_digest (checksum, digest, &digest_len);
+          g_checksum_reset (checksum);
+          if (memcmp (digest, range->digest, sizeof (digest)) != 0)
+            {
+              mismatch_offset = range->offset;
+              goto mismatch;
+            }
+        }
+      g_free (range);
+      continue;
+
+    mismatch:
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Verification failed: the data at offset %" G_GUINT64_FORMAT " on the device differs from the disk image",
+                   mismatch_offset);
+      g_free (range);
+      goto out;
     }
 
+ out:
+  if (error != NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      target->verify_error = error;
+      g_mutex_unlock (&data->copy_lock);
+      /* no point in writing the rest */
+      g_cancellable_cancel (target->cancellable);
+    }
+  g_checksum_free (checksum);
   g_free (buffer_unaligned);
+  return NULL;
+}
+
+
+/* Writes the disk image, as read by copy_thread_func() into the
+ * image ring, to a single device. There is one of these threads for
+ * each device.
+ */
+static gpointer
+write_thread_func (gpointer user_data)
+{
+  RestoreTarget *target = user_data;
+  DialogData *data = target->data;
+  guchar *zero_buffer = NULL;
+  guchar *hole_buffer_unaligned = NULL;
+  guchar *hole_buffer = NULL;
+  guint64 block_device_size = 0;
+  GError *error = NULL;
+  GError *error2 = NULL;
+  gint64 last_update_usec = -1;
+  gint fd = -1;
+  guint64 num_bytes_completed = 0;
+  guint64 pos;
+  GThread *read_ahead_thread = NULL;
+  GThread *verify_thread = NULL;
+  GduCopyWriteback writeback;
+  ImageReader *reader = NULL;
+  guchar *reader_buffer = NULL;
+
+  gdu_copy_utils_writeback_init (&writeback);
+
+  fd = gdu_copy_utils_open_for_restore (target->block, &error);
+  if (fd == -1)
+    goto out;
+
+  if (!gdu_copy_utils_get_size (fd, &block_device_size, &error))
+    goto out;
+
+  if (block_device_size == 0)
+    {
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Device is size 0"));
+      goto out;
+    }
+
+  target->device_size = block_device_size;
+
+  if (data->input_size_known && block_device_size < data->input_size)
+    {
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("The disk image is bigger than the device"));
+      goto out;
+    }
+
+  if (data->write_changed_only || data->verify)
+    {
+      gint logical_block_size;
+
+      target->read_fd = open_for_reading (target->block, &error);
+      if (target->read_fd == -1)
+        goto out;
+
+      if (ioctl (target->read_fd, BLKSSZGET, &logical_block_size) != 0)
+        {
+          error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                               "%s", strerror (errno));
+          g_prefix_error (&error, _("Error determining logical block size of device: "));
+          goto out;
+        }
+      target->logical_block_size = logical_block_size;
+    }
+
+  /* only used for zeroing holes */
+  zero_buffer = g_malloc0 (data->chunk_size);
+  if (data->write_changed_only)
+    {
+      long page_size = sysconf (_SC_PAGESIZE);
+
+      /* for reading what is on the device where the disk image has holes */
+      hole_buffer_unaligned = g_new0 (guchar, data->chunk_size + 2 * target->logical_block_size + page_size);
+      hole_buffer = (guchar*) (((gintptr) (hole_buffer_unaligned + page_size)) & (~(page_size - 1)));
+    }
+
+  g_mutex_lock (&data->copy_lock);
+  /* if the size isn't known, go by how much of the compressed disk image has been read */
+  if (data->input_size_known)
+    target->estimator = gdu_estimator_new (data->input_data_size);
+  else
+    target->estimator = gdu_estimator_new (data->compressed_size);
+  target->update_id = 0;
+  g_mutex_unlock (&data->copy_lock);
+
+  if (data->write_changed_only)
+    {
+      /* room for aligning the chunk to logical blocks at both ends */
+      target->read_ahead_ring = gdu_buffer_ring_new (4, /* num_buffers */
+                                                     data->chunk_size + 2 * target->logical_block_size,
+                                                     1); /* num_consumers */
+      read_ahead_thread = g_thread_new ("restore-read-ahead-thread",
+                                        read_ahead_thread_func,
+                                        target);
+    }
+
+  if (data->verify)
+    {
+      target->verify_queue = g_async_queue_new_full (g_free);
+      verify_thread = g_thread_new ("restore-verify-thread",
+                                    verify_thread_func,
+                                    target);
+    }
+
+  /* Write each chunk of the disk image to the device. Gaps between
+   * chunks are holes in the disk image and are zeroed on the device
+   * instead, see write_hole().
+   */
+  pos = 0;
+  while (TRUE)
+    {
+      const guchar *buffer;
+      guint64 offset;
+      gsize size;
+      gint64 now_usec;
+
+      if (g_cancellable_set_error_if_cancelled (target->cancellable, &error))
+        goto out;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          guint64 num_bytes_progress;
+          /* only count what actually reached the device, not what is still in the page cache */
+          if (data->input_size_known)
+            num_bytes_progress = writeback.synced_num_bytes;
+          else if (reader != NULL)
+            num_bytes_progress = g_seekable_tell (G_SEEKABLE (reader->compressed_stream));
+          else
+            num_bytes_progress = data->num_compressed_bytes_read;
+          if (num_bytes_progress > 0)
+            gdu_estimator_add_sample (target->estimator, num_bytes_progress);
+          if (target->update_id == 0)
+            {
+              dialog_data_ref (data);
+              target->update_id = g_idle_add (on_update_job, target);
+            }
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      if (reader == NULL)
+        {
+          buffer = gdu_buffer_ring_begin_read (data->image_ring, target->index, &offset, &size);
+          if (buffer == NULL && gdu_buffer_ring_get_lagging (data->image_ring, target->index))
+            {
+              /* This device fell too far behind the others. Instead of
+               * holding them back, read the rest of the disk image again
+               * just for this device.
+               */
+              reader = image_reader_open (data, pos, target->cancellable, &error);
+              if (reader == NULL)
+                goto out;
+              reader_buffer = g_malloc (data->chunk_size);
+            }
+        }
+      if (reader != NULL)
+        {
+          if (!image_reader_read (reader, reader_buffer, &offset, &size, target->cancellable, &error))
+            goto out;
+          buffer = size > 0 ? reader_buffer : NULL;
+        }
+      if (buffer == NULL)
+        break;
+
+      if (offset + size > block_device_size)
+        {
+          error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                               _("The disk image is bigger than the device"));
+          goto out;
+        }
+
+      if (offset > pos)
+        {
+          if (!write_hole (target, fd, pos, offset - pos, zero_buffer, hole_buffer, &error))
+            goto out;
+          queue_verify_range (target, pos, offset - pos, NULL);
+        }
+
+      if (data->write_changed_only)
+        {
+          const guchar *device_buffer;
+          guint64 device_offset;
+          gsize device_size;
+          guint64 num_bytes_unchanged = 0;
+
+          device_buffer = gdu_buffer_ring_begin_read (target->read_ahead_ring, 0, &device_offset, &device_size);
+          if (device_buffer == NULL)
+            {
+              g_mutex_lock (&data->copy_lock);
+              error = target->read_ahead_error;
+              target->read_ahead_error = NULL;
+              g_mutex_unlock (&data->copy_lock);
+              if (error == NULL)
+                error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                     "No data read from device at offset %" G_GUINT64_FORMAT,
+                                     offset);
+              goto out;
+            }
+          if (device_offset != offset || device_size < size)
+            {
+              error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                   "Read %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT " of the device "
+                                   "but expected %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT,
+                                   device_size, device_offset, size, offset);
+              goto out;
+            }
+          device_buffer += offset & (target->logical_block_size - 1);
+
+          if (!write_changed_blocks (fd,
+                                     buffer,
+                                     device_buffer,
+                                     size,
+                                     offset,
+                                     &num_bytes_unchanged,
+                                     &error))
+            goto out;
+          gdu_buffer_ring_end_read (target->read_ahead_ring, 0);
+
+          g_mutex_lock (&data->copy_lock);
+          target->num_bytes_unchanged += num_bytes_unchanged;
+          g_mutex_unlock (&data->copy_lock);
+        }
+      else
+        {
+          if (!gdu_copy_utils_pwrite_all (fd, buffer, size, offset, &error))
+            goto out;
+        }
+      queue_verify_range (target, offset, size, buffer);
+      if (reader == NULL)
+        gdu_buffer_ring_end_read (data->image_ring, target->index);
+
+      pos = offset + size;
+      num_bytes_completed += size;
+
+      if (!gdu_copy_utils_writeback_advance (&writeback, fd, pos, num_bytes_completed, &error))
+        goto out;
+    }
+
+  /* the ring is aborted if reading the disk image failed */
+  if (reader == NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      if (data->read_error != NULL)
+        error = g_error_copy (data->read_error);
+      g_mutex_unlock (&data->copy_lock);
+      if (error != NULL)
+        goto out;
+    }
+
+  /* the image may end with a hole */
+  if (pos < data->input_size)
+    {
+      if (!write_hole (target, fd, pos, data->input_size - pos, zero_buffer, hole_buffer, &error))
+        goto out;
+      queue_verify_range (target, pos, data->input_size - pos, NULL);
+      pos = data->input_size;
+    }
+
+  /* don't report the job as done until all data is on the device */
+  if (!gdu_copy_utils_writeback_finish (&writeback, fd, pos, num_bytes_completed, &error))
+    goto out;
+
+ out:
+  /* don't hold back reading the disk image for the other devices */
+  gdu_buffer_ring_detach (data->image_ring, target->index);
+  if (reader != NULL)
+    image_reader_free (reader);
+  g_free (reader_buffer);
+
+  if (read_ahead_thread != NULL)
+    {
+      gdu_buffer_ring_abort (target->read_ahead_ring);
+      g_thread_join (read_ahead_thread);
+    }
+  if (target->read_ahead_ring != NULL)
+    {
+      gdu_buffer_ring_free (target->read_ahead_ring);
+      target->read_ahead_ring = NULL;
+    }
+
+  if (verify_thread != NULL)
+    {
+      if (error != NULL)
+        g_cancellable_cancel (target->cancellable);
+
+      /* the rest of the job is waiting for verification to catch up */
+      g_mutex_lock (&data->copy_lock);
+      target->writing_done = TRUE;
+      g_mutex_unlock (&data->copy_lock);
+
+      queue_verify_range (target, 0, 0, NULL); /* end of queue */
+      g_thread_join (verify_thread);
+
+      /* a mismatch cancels writing, so report that instead */
+      g_mutex_lock (&data->copy_lock);
+      if (target->verify_error != NULL &&
+          !(target->verify_error->domain == G_IO_ERROR && target->verify_error->code == G_IO_ERROR_CANCELLED))
+        {
+          g_clear_error (&error);
+          error = target->verify_error;
+          target->verify_error = NULL;
+        }
+      g_mutex_unlock (&data->copy_lock);
+    }
+  if (target->read_fd != -1)
+    {
+      close (target->read_fd);
+      target->read_fd = -1;
+    }
+
+  if (fd != -1 )
+    {
+      if (close (fd) != 0)
+        g_warning ("Error closing fd: %m");
+    }
+
+  if (error != NULL)
+    {
+      if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+        {
+          dialog_data_ref (data);
+          g_idle_add (on_target_failed, target);
+        }
+
+      g_mutex_lock (&data->copy_lock);
+      target->error = error;
+      error = NULL;
+      g_mutex_unlock (&data->copy_lock);
+
+      /* Wipe the device */
+      if (!udisks_block_call_format_sync (target->block,
+                                          "empty",
+                                          g_variant_new ("a{sv}", NULL), /* options */
+                                          NULL, /* cancellable */
+                                          &error2))
+        {
+          g_warning ("Error wiping device on error path: %s (%s, %d)",
+                     error2->message, g_quark_to_string (error2->domain), error2->code);
+          g_clear_error (&error2);
+        }
+    }
+
+  g_free (zero_buffer);
+  g_free (hole_buffer_unaligned);
 
   /* finally, request that the core OS / kernel rescans the device */
-  if (!udisks_block_call_rescan_sync (data->block,
+  if (!udisks_block_call_rescan_sync (target->block,
                                       g_variant_new ("a{sv}", NULL), /* options */
                                       NULL, /* cancellable */
                                       &error2))
@@ -899,6 +2445,111 @@ copy_thread_func (gpointer user_data)
       g_clear_error (&error2);
     }
 
+  return NULL;
+}
+
+/* Reads (and decompresses) the disk image once, passing each chunk to
+ * the write thread of every device through the image ring.
+ */
+static gpointer
+copy_thread_func (gpointer user_data)
+{
+  DialogData *data = user_data;
+  ImageReader *reader = NULL;
+  GError *error = NULL;
+  GError *error2 = NULL;
+  guint n;
+
+  g_mutex_lock (&data->copy_lock);
+  data->start_time_usec = g_get_real_time ();
+  g_mutex_unlock (&data->copy_lock);
+
+  for (n = 0; n < data->targets->len; n++)
+    {
+      RestoreTarget *target = g_ptr_array_index (data->targets, n);
+      target->thread = g_thread_new ("restore-disk-image-write-thread",
+                                     write_thread_func,
+                                     target);
+    }
+
+  reader = image_reader_new (data,
+                             data->input_stream,
+                             data->compressed_stream,
+                             data->num_bytes_to_skip,
+                             0, /* pos */
+                             data->range_offset);
+  while (TRUE)
+    {
+      guchar *buffer;
+      guint64 offset;
+      gsize size;
+
+      /* Blocks until the slowest device has caught up - fails if every device failed or was canceled */
+      buffer = gdu_buffer_ring_begin_write (data->image_ring);
+      if (buffer == NULL)
+        goto out;
+
+      if (!image_reader_read (reader, buffer, &offset, &size, data->cancellable, &error))
+        goto out;
+      if (size == 0)
+        break;
+
+      gdu_buffer_ring_end_write (data->image_ring, offset, size);
+
+      if (data->compressed_stream != NULL)
+        {
+          g_mutex_lock (&data->copy_lock);
+          data->num_compressed_bytes_read = g_seekable_tell (G_SEEKABLE (data->compressed_stream));
+          g_mutex_unlock (&data->copy_lock);
+        }
+    }
+
+  /* now we know */
+  if (data->extents == NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      data->input_size = reader->pos;
+      g_mutex_unlock (&data->copy_lock);
+    }
+
+ out:
+  if (error != NULL)
+    {
+      g_mutex_lock (&data->copy_lock);
+      data->read_error = error;
+      error = NULL;
+      g_mutex_unlock (&data->copy_lock);
+      gdu_buffer_ring_abort (data->image_ring);
+    }
+  else
+    {
+      gdu_buffer_ring_close (data->image_ring);
+    }
+  if (reader != NULL)
+    image_reader_free (reader);
+
+  for (n = 0; n < data->targets->len; n++)
+    {
+      RestoreTarget *target = g_ptr_array_index (data->targets, n);
+      g_thread_join (target->thread);
+      target->thread = NULL;
+    }
+
+  data->end_time_usec = g_get_real_time ();
+
+  /* in either case, close the stream */
+  if (!g_input_stream_close (G_INPUT_STREAM (data->input_stream),
+                              NULL, /* cancellable */
+                              &error2))
+    {
+      g_warning ("Error closing file input stream: %s (%s, %d)",
+                 error2->message, g_quark_to_string (error2->domain), error2->code);
+      g_clear_error (&error2);
+    }
+  g_clear_object (&data->input_stream);
+
+  g_idle_add (on_finished, dialog_data_ref (data));
+
   dialog_data_unref_in_idle (data); /* unref on main thread */
   return NULL;
 }
@@ -909,22 +2560,66 @@ static void
 on_local_job_canceled (GduLocalJob  *job,
                        gpointer      user_data)
 {
-  DialogData *data = user_data;
+  RestoreTarget *target = user_data;
+  DialogData *data = target->data;
+  guint n;
+
   if (!data->completed)
     {
-      dialog_data_terminate_job (data);
-      dialog_data_complete_and_unref (data);
-      update_job (data, FALSE);
+      /* only stop writing to this device... */
+      g_cancellable_cancel (target->cancellable);
+      restore_target_terminate_job (target);
+
+      /* ... unless it was the last one */
+      for (n = 0; n < data->targets->len; n++)
+        {
+          RestoreTarget *other = g_ptr_array_index (data->targets, n);
+          if (other->local_job != NULL)
+            break;
+        }
+      if (n == data->targets->len)
+        dialog_data_complete_and_unref (data);
     }
 }
 
+/* Returns the parts of @extents within [@offset, @offset + @size), relative to @offset */
+static GArray *
+clip_extents (GArray  *extents,
+              guint64  offset,
+              guint64  size)
+{
+  GArray *ret;
+  guint n;
+
+  ret = g_array_new (FALSE, FALSE, sizeof (Extent));
+  for (n = 0; n < extents->len; n++)
+    {
+      Extent *extent = &g_array_index (extents, Extent, n);
+      guint64 start = MAX (extent->offset, offset);
+      guint64 end = MIN (extent->offset + extent->size, offset + size);
+
+      if (start < end)
+        {
+          Extent clipped;
+          clipped.offset = start - offset;
+          clipped.size = end - start;
+          g_array_append_val (ret, clipped);
+        }
+    }
+  return ret;
+}
+
 static gboolean
 start_copying (DialogData *data)
 {
   GFile *file = NULL;
   gboolean ret = FALSE;
+  GduImagePartition *partition;
   GFileInfo *info;
   GError *error;
+  GList *blocks = NULL;
+  GList *l;
+  guint n;
 
   error = NULL;
   if (data->disk_image_filename != NULL)
@@ -932,6 +2627,7 @@ start_copying (DialogData *data)
   else
     file = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (data->selectable_image_fcbutton));
 
+  data->image_file = g_object_ref (file);
   data->input_stream = (GInputStream *) g_file_read (file, NULL, &error);
   if (data->input_stream == NULL)
     {
@@ -957,23 +2653,144 @@ start_copying (DialogData *data)
       goto out;
     }
   data->input_size = g_file_info_get_size (info);
-  if (g_str_has_suffix (g_file_info_get_content_type (info), "-xz-compressed"))
+  data->input_size_known = TRUE;
+  data->decoder = gdu_decoder_find (file, g_file_info_get_content_type (info));
+  partition = get_selected_partition (data);
+  if (data->decoder != NULL)
     {
-      GduXzDecompressor *decompressor;
-      GInputStream *decompressed_input_stream;
+      GConverter *decompressor;
 
-      data->input_size = gdu_xz_decompressor_get_uncompressed_size (file);
+      data->compressed_size = data->input_size;
+      data->input_size = gdu_decoder_get_uncompressed_size (data->decoder, file);
+      if (data->input_size == 0)
+        data->input_size_known = FALSE;
 
-      decompressor = gdu_xz_decompressor_new ();
-      decompressed_input_stream = g_converter_input_stream_new (G_INPUT_STREAM (data->input_stream),
-                                                                G_CONVERTER (decompressor));
+      /* keep the compressed stream around for tracking progress if the size isn't known */
+      data->compressed_stream = data->input_stream;
+      if (partition != NULL)
+        {
+          guint64 compressed_offset;
+          guint64 uncompressed_offset;
+
+          /* only decompress what's needed if the format allows it */
+          decompressor = gdu_decoder_new_converter_at (data->decoder,
+                                                       file,
+                                                       partition->offset,
+                                                       &compressed_offset,
+                                                       &uncompressed_offset);
+          error = NULL;
+          if (!g_seekable_seek (G_SEEKABLE (data->compressed_stream),
+                                compressed_offset,
+                                G_SEEK_SET,
+                                NULL,
+                                &error))
+            {
+              gdu_utils_show_error (GTK_WINDOW (data->dialog), _("Error seeking in file"), error);
+              g_error_free (error);
+              g_object_unref (decompressor);
+              g_object_unref (info);
+              dialog_data_complete_and_unref (data);
+              goto out;
+            }
+          data->num_bytes_to_skip = partition->offset - uncompressed_offset;
+        }
+      else
+        {
+          decompressor = gdu_decoder_new_converter (data->decoder);
+        }
+      data->input_stream = g_converter_input_stream_new (data->compressed_stream, decompressor);
       g_clear_object (&decompressor);
+    }
+  else
+    {
+      if (G_IS_FILE_DESCRIPTOR_BASED (data->input_stream))
+        {
+          /* the disk image may be a sparse file - if so, only copy the data and zero the holes */
+          data->extents = get_data_extents (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (data->input_stream)),
+                                            data->input_size);
+        }
+
+      if (data->extents == NULL)
+        {
+          Extent extent;
+          extent.offset = 0;
+          extent.size = data->input_size;
+          data->extents = g_array_new (FALSE, FALSE, sizeof (Extent));
+          g_array_append_val (data->extents, extent);
+        }
+
+      if (partition != NULL)
+        {
+          GArray *extents;
 
-      g_object_unref (data->input_stream);
-      data->input_stream = decompressed_input_stream;
+          extents = clip_extents (data->extents, partition->offset, partition->size);
+          g_array_unref (data->extents);
+          data->extents = extents;
+
+          error = NULL;
+          if (!g_seekable_seek (G_SEEKABLE (data->input_stream),
+                                partition->offset,
+                                G_SEEK_SET,
+                                NULL,
+                                &error))
+            {
+              gdu_utils_show_error (GTK_WINDOW (data->dialog), _("Error seeking in file"), error);
+              g_error_free (error);
+              g_object_unref (info);
+              dialog_data_complete_and_unref (data);
+              goto out;
+            }
+        }
     }
   g_object_unref (info);
 
+  if (partition != NULL)
+    {
+      data->restore_partition = TRUE;
+      data->range_offset = partition->offset;
+      data->input_size = partition->size;
+      data->input_size_known = TRUE;
+    }
+
+  data->write_changed_only = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->write_changed_only_checkbutton));
+  data->verify = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->verify_checkbutton));
+
+  if (data->extents != NULL)
+    {
+      data->input_data_size = 0;
+      for (n = 0; n < data->extents->len; n++)
+        data->input_data_size += g_array_index (data->extents, Extent, n).size;
+    }
+  else
+    {
+      data->input_data_size = data->input_size;
+    }
+
+  data->targets = g_ptr_array_new_with_free_func ((GDestroyNotify) restore_target_free);
+  g_ptr_array_add (data->targets, restore_target_new (data, data->object, 0));
+  blocks = get_additional_destinations (data);
+  for (l = blocks; l != NULL; l = l->next)
+    {
+      UDisksObject *object = (UDisksObject *) g_dbus_interface_get_object (G_DBUS_INTERFACE (l->data));
+      g_ptr_array_add (data->targets, restore_target_new (data, object, data->targets->len));
+    }
+
+  /* default to 1 MiB blocks */
+  data->chunk_size = (1 * 1024 * 1024);
+
+  /* The disk image is only read once and shared by all devices. The
+   * reader can run IMAGE_RING_NUM_BUFFERS chunks ahead of the slowest
+   * device so a device that is briefly stalled doesn't hold back the
+   * others. A device that falls further behind is detached from the
+   * ring and reads the rest of the disk image on its own, see
+   * image_reader_open(). A device that fails or is canceled detaches
+   * from the ring as well.
+   */
+  data->image_ring = gdu_buffer_ring_new (IMAGE_RING_NUM_BUFFERS,
+                                          data->chunk_size,
+                                          data->targets->len);
+  gdu_buffer_ring_set_detach_lagging (data->image_ring, TRUE);
+
   data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
                                                   GTK_WINDOW (data->dialog),
                                                   GTK_APPLICATION_INHIBIT_SUSPEND |
@@ -981,16 +2798,20 @@ start_copying (DialogData *data)
                                                   /* Translators: Reason why suspend/logout is being inhibited */
                                                   C_("restore-inhibit-message", "Copying disk image to device"));
 
-  data->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
-                                                      data->object);
-  udisks_job_set_operation (UDISKS_JOB (data->local_job), "x-gdu-restore-disk-image");
-  /* Translators: this is the description of the job */
-  gdu_local_job_set_description (data->local_job, _("Restoring Disk Image"));
-  udisks_job_set_progress_valid (UDISKS_JOB (data->local_job), TRUE);
-  udisks_job_set_cancelable (UDISKS_JOB (data->local_job), TRUE);
-  g_signal_connect (data->local_job, "canceled",
-                    G_CALLBACK (on_local_job_canceled),
-                    data);
+  for (n = 0; n < data->targets->len; n++)
+    {
+      RestoreTarget *target = g_ptr_array_index (data->targets, n);
+      target->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
+                                                            target->object);
+      udisks_job_set_operation (UDISKS_JOB (target->local_job), "x-gdu-restore-disk-image");
+      /* Translators: this is the description of the job */
+      gdu_local_job_set_description (target->local_job, _("Restoring Disk Image"));
+      udisks_job_set_progress_valid (UDISKS_JOB (target->local_job), TRUE);
+      udisks_job_set_cancelable (UDISKS_JOB (target->local_job), TRUE);
+      g_signal_connect (target->local_job, "canceled",
+                        G_CALLBACK (on_local_job_canceled),
+                        target);
+    }
 
   dialog_data_hide (data);
 
@@ -1003,6 +2824,7 @@ start_copying (DialogData *data)
   ret = TRUE;
 
  out:
+  g_list_free_full (blocks, g_object_unref);
   g_clear_object (&file);
   return ret;
 }
@@ -1013,7 +2835,7 @@ ensure_unused_cb (GduWindow     *window,
                   gpointer       user_data)
 {
   DialogData *data = user_data;
-  if (gdu_window_ensure_unused_finish (window, res, NULL))
+  if (gdu_window_ensure_unused_list_finish (window, res, NULL))
     {
       start_copying (data);
     }
@@ -1030,12 +2852,17 @@ on_dialog_response (GtkDialog     *dialog,
 {
   DialogData *data = user_data;
   GList *objects = NULL;
+  GList *blocks = NULL;
+  GList *l;
   GFile *folder = NULL;
 
   if (data->dialog == NULL)
     goto out;
 
   objects = g_list_append (NULL, data->object);
+  blocks = get_additional_destinations (data);
+  for (l = blocks; l != NULL; l = l->next)
+    objects = g_list_append (objects, g_dbus_interface_get_object (G_DBUS_INTERFACE (l->data)));
 
   switch (response)
     {
@@ -1055,12 +2882,12 @@ on_dialog_response (GtkDialog     *dialog,
       folder = gtk_file_chooser_get_current_folder_file (GTK_FILE_CHOOSER (data->selectable_image_fcbutton));
       gdu_utils_file_chooser_for_disk_images_set_default_folder (folder);
 
-      /* ensure the device is unused (e.g. unmounted) before copying data to it... */
-      gdu_window_ensure_unused (data->window,
-                                data->object,
-                                (GAsyncReadyCallback) ensure_unused_cb,
-                                NULL, /* GCancellable */
-                                data);
+      /* ensure the devices are unused (e.g. unmounted) before copying data to them... */
+      gdu_window_ensure_unused_list (data->window,
+                                     objects,
+                                     (GAsyncReadyCallback) ensure_unused_cb,
+                                     NULL, /* GCancellable */
+                                     data);
       break;
 
     default: /* explicit fallthrough */
@@ -1070,6 +2897,7 @@ on_dialog_response (GtkDialog     *dialog,
     }
  out:
   g_list_free (objects);
+  g_list_free_full (blocks, g_object_unref);
   g_clear_object (&folder);
 }
 
@@ -1101,6 +2929,7 @@ gdu_restore_disk_image_dialog_show (GduWindow    *window,
       *p = gtk_builder_get_object (data->builder, widget_mapping[n].name);
     }
   g_signal_connect (data->selectable_image_fcbutton, "file-set", G_CALLBACK (on_file_set), data);
+  g_signal_connect (data->partition_combobox, "changed", G_CALLBACK (on_partition_changed), data);
 
   data->warning_infobar = gdu_utils_create_info_bar (GTK_MESSAGE_INFO, "", &data->warning_label);
   gtk_box_pack_start (GTK_BOX (data->infobar_vbox), data->warning_infobar, TRUE, TRUE, 0);
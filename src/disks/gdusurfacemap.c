@@ -0,0 +1,201 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "gdusurfacemap.h"
+
+/* The result of reading a whole device, e.g. by Check Surface. The
+ * device is divided into a fixed number of regions and for each region
+ * the read latencies and errors seen so far are recorded.
+ *
+ * Samples are added from the threads doing the reading while the volume
+ * grid renders the map on the main thread, hence the lock.
+ */
+
+typedef struct
+{
+  guint64 num_samples;
+  guint64 total_usec;
+  guint64 max_usec;
+  guint num_errors;
+} Region;
+
+struct GduSurfaceMap
+{
+  volatile gint ref_count;
+
+  guint64 size;
+  guint num_regions;
+
+  GMutex lock;
+  Region *regions;
+  guint num_errors;
+};
+
+GduSurfaceMap *
+gdu_surface_map_new (guint64 size,
+                     guint   num_regions)
+{
+  GduSurfaceMap *map;
+
+  g_return_val_if_fail (num_regions > 0, NULL);
+
+  map = g_new0 (GduSurfaceMap, 1);
+  map->ref_count = 1;
+  map->size = size;
+  map->num_regions = num_regions;
+  map->regions = g_new0 (Region, num_regions);
+  g_mutex_init (&map->lock);
+  return map;
+}
+
+GduSurfaceMap *
+gdu_surface_map_ref (GduSurfaceMap *map)
+{
+  g_atomic_int_inc (&map->ref_count);
+  return map;
+}
+
+void
+gdu_surface_map_unref (GduSurfaceMap *map)
+{
+  if (g_atomic_int_dec_and_test (&map->ref_count))
+    {
+      g_mutex_clear (&map->lock);
+      g_free (map->regions);
+      g_free (map);
+    }
+}
+
+guint64
+gdu_surface_map_get_size (GduSurfaceMap *map)
+{
+  return map->size;
+}
+
+guint
+gdu_surface_map_get_num_regions (GduSurfaceMap *map)
+{
+  return map->num_regions;
+}
+
+guint
+gdu_surface_map_get_region_for_offset (GduSurfaceMap *map,
+                                       guint64        offset)
+{
+  if (map->size == 0 || offset >= map->size)
+    return map->num_regions - 1;
+  /* avoid overflowing for huge devices - rounding may still give num_regions for the very end */
+  return MIN ((guint) (((gdouble) offset) * map->num_regions / map->size), map->num_regions - 1);
+}
+
+/* Records that reading at @offset took @usec and whether it @failed */
+void
+gdu_surface_map_add_sample (GduSurfaceMap *map,
+                            guint64        offset,
+                            guint64        usec,
+                            gboolean       failed)
+{
+  Region *region;
+
+  region = map->regions + gdu_surface_map_get_region_for_offset (map, offset);
+
+  g_mutex_lock (&map->lock);
+  region->num_samples += 1;
+  region->total_usec += usec;
+  region->max_usec = MAX (region->max_usec, usec);
+  if (failed)
+    {
+      region->num_errors += 1;
+      map->num_errors += 1;
+    }
+  g_mutex_unlock (&map->lock);
+}
+
+/* Returns FALSE if nothing has been read from @region yet */
+gboolean
+gdu_surface_map_get_region (GduSurfaceMap *map,
+                            guint          region,
+                            guint64       *out_avg_usec,
+                            guint64       *out_max_usec,
+                            guint         *out_num_errors)
+{
+  Region *r;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (region < map->num_regions, FALSE);
+
+  r = map->regions + region;
+  g_mutex_lock (&map->lock);
+  if (r->num_samples > 0)
+    {
+      if (out_avg_usec != NULL)
+        *out_avg_usec = r->total_usec / r->num_samples;
+      if (out_max_usec != NULL)
+        *out_max_usec = r->max_usec;
+      if (out_num_errors != NULL)
+        *out_num_errors = r->num_errors;
+      ret = TRUE;
+    }
+  g_mutex_unlock (&map->lock);
+
+  return ret;
+}
+
+static gint
+compare_usec (gconstpointer a,
+              gconstpointer b)
+{
+  guint64 ua = *((const guint64 *) a);
+  guint64 ub = *((const guint64 *) b);
+  return ua < ub ? -1 : (ua > ub ? 1 : 0);
+}
+
+/* The median of the average latency of all regions read so far - what
+ * latencies of individual regions should be compared to
+ */
+guint64
+gdu_surface_map_get_typical_usec (GduSurfaceMap *map)
+{
+  guint64 *values;
+  guint num_values = 0;
+  guint64 ret = 0;
+  guint n;
+
+  values = g_new (guint64, map->num_regions);
+  g_mutex_lock (&map->lock);
+  for (n = 0; n < map->num_regions; n++)
+    {
+      if (map->regions[n].num_samples > 0)
+        values[num_values++] = map->regions[n].total_usec / map->regions[n].num_samples;
+    }
+  g_mutex_unlock (&map->lock);
+
+  if (num_values > 0)
+    {
+      qsort (values, num_values, sizeof (guint64), compare_usec);
+      ret = values[num_values / 2];
+    }
+  g_free (values);
+
+  return ret;
+}
+
+guint
+gdu_surface_map_get_num_errors (GduSurfaceMap *map)
+{
+  guint ret;
+  g_mutex_lock (&map->lock);
+  ret = map->num_errors;
+  g_mutex_unlock (&map->lock);
+  return ret;
+}
@@ -0,0 +1,43 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_SURFACE_MAP_H__
+#define __GDU_SURFACE_MAP_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+GduSurfaceMap *gdu_surface_map_new              (guint64         size,
+                                                 guint           num_regions);
+GduSurfaceMap *gdu_surface_map_ref              (GduSurfaceMap  *map);
+void           gdu_surface_map_unref            (GduSurfaceMap  *map);
+
+guint64        gdu_surface_map_get_size         (GduSurfaceMap  *map);
+guint          gdu_surface_map_get_num_regions  (GduSurfaceMap  *map);
+guint          gdu_surface_map_get_region_for_offset (GduSurfaceMap *map,
+                                                      guint64        offset);
+
+void           gdu_surface_map_add_sample       (GduSurfaceMap  *map,
+                                                 guint64         offset,
+                                                 guint64         usec,
+                                                 gboolean        failed);
+
+gboolean       gdu_surface_map_get_region       (GduSurfaceMap  *map,
+                                                 guint           region,
+                                                 guint64        *out_avg_usec,
+                                                 guint64        *out_max_usec,
+                                                 guint          *out_num_errors);
+guint64        gdu_surface_map_get_typical_usec (GduSurfaceMap  *map);
+guint          gdu_surface_map_get_num_errors   (GduSurfaceMap  *map);
+
+G_END_DECLS
+
+#endif /* __GDU_SURFACE_MAP_H__ */
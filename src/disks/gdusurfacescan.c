@@ -0,0 +1,491 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+
+#include <canberra-gtk.h>
+
+#include "gduapplication.h"
+#include "gduwindow.h"
+#include "gduvolumegrid.h"
+#include "gdusurfacescan.h"
+#include "gdusurfacemap.h"
+#include "gduestimator.h"
+#include "gdulocaljob.h"
+#include "gducopyutils.h"
+
+/* Check Surface reads the whole device, bypassing the page cache, and
+ * records how long each chunk took to read and whether reading it
+ * failed. The device is read by several threads at once so the device
+ * always has a few requests queued - this is how it's read during normal
+ * use and it keeps a slow chunk from stalling the whole scan. The result
+ * is shown on top of the volume grid while scanning and after.
+ */
+
+/* How much is read at a time */
+#define SCAN_CHUNK_SIZE (1024 * 1024)
+
+/* How many reads are in flight at any time */
+#define SCAN_QUEUE_DEPTH 8
+
+/* How many regions the device is divided into in the result */
+#define SCAN_NUM_REGIONS 1024
+
+typedef struct
+{
+  volatile gint ref_count;
+
+  GduWindow *window;
+  UDisksObject *object;
+  UDisksBlock *block;
+
+  GCancellable *cancellable;
+  gint fd;
+  guint64 size;
+  glong page_size;
+  GduSurfaceMap *map;
+
+  /* must hold scan_lock when reading/writing these */
+  GMutex scan_lock;
+  guint64 next_offset;
+  guint64 num_bytes_read;
+  GduEstimator *estimator;
+  gint64 last_update_usec;
+  guint update_id;
+
+  GError *scan_error;
+
+  gboolean completed;
+
+  guint inhibit_cookie;
+
+  GduLocalJob *local_job;
+} ScanData;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static ScanData *
+scan_data_ref (ScanData *data)
+{
+  g_atomic_int_inc (&data->ref_count);
+  return data;
+}
+
+static void
+scan_data_terminate_job (ScanData *data)
+{
+  if (data->local_job != NULL)
+    {
+      gdu_application_destroy_local_job (gdu_window_get_application (data->window), data->local_job);
+      data->local_job = NULL;
+    }
+}
+
+static void
+scan_data_uninhibit (ScanData *data)
+{
+  if (data->inhibit_cookie > 0)
+    {
+      gtk_application_uninhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+                                 data->inhibit_cookie);
+      data->inhibit_cookie = 0;
+    }
+}
+
+static void
+scan_data_unref (ScanData *data)
+{
+  if (g_atomic_int_dec_and_test (&data->ref_count))
+    {
+      scan_data_terminate_job (data);
+      scan_data_uninhibit (data);
+
+      g_clear_object (&data->cancellable);
+      g_object_unref (data->window);
+      g_object_unref (data->object);
+      g_object_unref (data->block);
+      if (data->map != NULL)
+        gdu_surface_map_unref (data->map);
+      g_clear_object (&data->estimator);
+      g_mutex_clear (&data->scan_lock);
+      g_free (data);
+    }
+}
+
+static gboolean
+unref_in_idle (gpointer user_data)
+{
+  ScanData *data = user_data;
+  scan_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+static void
+scan_data_complete_and_unref (ScanData *data)
+{
+  if (!data->completed)
+    {
+      data->completed = TRUE;
+      g_cancellable_cancel (data->cancellable);
+    }
+  scan_data_uninhibit (data);
+  scan_data_unref (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+update_job (ScanData *data,
+            gboolean  done)
+{
+  gchar *extra_markup = NULL;
+  guint64 bytes_completed = 0;
+  guint64 bytes_target = 0;
+  guint64 bytes_per_sec = 0;
+  guint64 usec_remaining = 0;
+  guint num_errors = 0;
+  gdouble progress = 0.0;
+  GduSurfaceMap *map = NULL;
+
+  g_mutex_lock (&data->scan_lock);
+  if (data->map != NULL)
+    map = gdu_surface_map_ref (data->map);
+  if (data->estimator != NULL)
+    {
+      bytes_per_sec = gdu_estimator_get_bytes_per_sec (data->estimator);
+      usec_remaining = gdu_estimator_get_usec_remaining (data->estimator);
+      bytes_completed = gdu_estimator_get_completed_bytes (data->estimator);
+      bytes_target = gdu_estimator_get_target_bytes (data->estimator);
+    }
+  data->update_id = 0;
+  g_mutex_unlock (&data->scan_lock);
+
+  if (map != NULL)
+    num_errors = gdu_surface_map_get_num_errors (map);
+  if (num_errors > 0)
+    {
+      /* Translators: Shown while checking the surface of a disk.
+       *              The %u is the number of chunks that could not be read.
+       */
+      extra_markup = g_strdup_printf (ngettext ("%u unreadable region",
+                                                "%u unreadable regions",
+                                                num_errors),
+                                      num_errors);
+    }
+
+  if (data->local_job != NULL)
+    {
+      udisks_job_set_bytes (UDISKS_JOB (data->local_job), bytes_target);
+      udisks_job_set_rate (UDISKS_JOB (data->local_job), bytes_per_sec);
+
+      if (done)
+        {
+          progress = 1.0;
+        }
+      else
+        {
+          if (bytes_target != 0)
+            progress = ((gdouble) bytes_completed) / ((gdouble) bytes_target);
+          else
+            progress = 0.0;
+        }
+      udisks_job_set_progress (UDISKS_JOB (data->local_job), progress);
+
+      if (usec_remaining == 0)
+        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), 0);
+      else
+        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), usec_remaining + g_get_real_time ());
+
+      gdu_local_job_set_extra_markup (data->local_job, extra_markup);
+    }
+
+  /* the grid may be showing another device by now, in which case this only stores the map */
+  if (map != NULL)
+    {
+      gdu_volume_grid_set_surface_map (GDU_VOLUME_GRID (gdu_window_get_volume_grid (data->window)),
+                                       data->object,
+                                       map);
+      gdu_surface_map_unref (map);
+    }
+
+  g_free (extra_markup);
+}
+
+static gboolean
+on_update_job (gpointer user_data)
+{
+  ScanData *data = user_data;
+  update_job (data, FALSE);
+  scan_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+on_show_error (gpointer user_data)
+{
+  ScanData *data = user_data;
+
+  scan_data_uninhibit (data);
+
+  g_assert (data->scan_error != NULL);
+  gdu_utils_show_error (GTK_WINDOW (data->window),
+                        _("Error checking surface"),
+                        data->scan_error);
+  g_clear_error (&data->scan_error);
+
+  scan_data_complete_and_unref (data);
+
+  scan_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+static gboolean
+on_success (gpointer user_data)
+{
+  ScanData *data = user_data;
+  const gchar *sound_message;
+  guint num_errors;
+
+  update_job (data, TRUE);
+
+  /* Translators: A descriptive string for the 'complete' sound, see CA_PROP_EVENT_DESCRIPTION */
+  sound_message = _("Surface check complete");
+  ca_gtk_play_for_widget (GTK_WIDGET (data->window), 0,
+                          CA_PROP_EVENT_ID, "complete",
+                          CA_PROP_EVENT_DESCRIPTION, sound_message,
+                          NULL);
+
+  scan_data_uninhibit (data);
+
+  /* the heat map shows where, but unreadable data is worth a dialog */
+  num_errors = gdu_surface_map_get_num_errors (data->map);
+  if (num_errors > 0)
+    {
+      GError *error;
+      /* Translators: Shown when checking the surface of a disk found errors.
+       *              The %u is the number of chunks of 1 MiB that could not be read.
+       */
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           ngettext ("%u region of the disk could not be read. "
+                                     "It is marked in dark red on the volume map.",
+                                     "%u regions of the disk could not be read. "
+                                     "They are marked in dark red on the volume map.",
+                                     num_errors),
+                           num_errors);
+      gdu_utils_show_error (GTK_WINDOW (data->window),
+                            _("The disk has unreadable regions"),
+                            error);
+      g_error_free (error);
+    }
+
+  scan_data_complete_and_unref (data);
+
+  scan_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* One of SCAN_QUEUE_DEPTH threads reading the device. Each thread picks
+ * the next chunk not yet read so together they read the device front to
+ * back, with that many reads outstanding.
+ */
+static gpointer
+scan_thread_func (gpointer user_data)
+{
+  ScanData *data = user_data;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+
+  /* O_DIRECT needs an aligned buffer */
+  buffer_unaligned = g_new0 (guchar, SCAN_CHUNK_SIZE + data->page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + data->page_size)) & (~(data->page_size - 1)));
+
+  while (!g_cancellable_is_cancelled (data->cancellable))
+    {
+      guint64 offset;
+      gsize size;
+      gsize num_read;
+      gint64 begin_usec;
+      gint64 now_usec;
+      gboolean failed = FALSE;
+
+      g_mutex_lock (&data->scan_lock);
+      offset = data->next_offset;
+      size = MIN (SCAN_CHUNK_SIZE, data->size - MIN (offset, data->size));
+      data->next_offset += size;
+      g_mutex_unlock (&data->scan_lock);
+      if (size == 0)
+        break;
+
+      begin_usec = g_get_monotonic_time ();
+      num_read = 0;
+      while (num_read < size)
+        {
+          ssize_t ret;
+          ret = pread (data->fd, buffer + num_read, size - num_read, offset + num_read);
+          if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+          if (ret <= 0)
+            {
+              /* as opposed to badblocks we don't care which sectors, just that the region is bad */
+              failed = TRUE;
+              break;
+            }
+          num_read += ret;
+        }
+      now_usec = g_get_monotonic_time ();
+      gdu_surface_map_add_sample (data->map, offset, now_usec - begin_usec, failed);
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->scan_lock);
+      data->num_bytes_read += size;
+      if (now_usec - data->last_update_usec > 200 * G_USEC_PER_SEC / 1000 || data->last_update_usec < 0)
+        {
+          gdu_estimator_add_sample (data->estimator, data->num_bytes_read);
+          if (data->update_id == 0)
+            data->update_id = g_idle_add (on_update_job, scan_data_ref (data));
+          data->last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->scan_lock);
+    }
+
+  g_free (buffer_unaligned);
+  return NULL;
+}
+
+static gpointer
+scan_main_thread_func (gpointer user_data)
+{
+  ScanData *data = user_data;
+  GThread *threads[SCAN_QUEUE_DEPTH] = {NULL};
+  GError *error = NULL;
+  guint n;
+
+  /* this gives us an O_DIRECT fd so we measure the device, not the page cache */
+  data->fd = gdu_copy_utils_open_for_benchmark (data->block, FALSE, data->cancellable, &error);
+  if (data->fd == -1)
+    goto out;
+
+  if (!gdu_copy_utils_get_size (data->fd, &data->size, &error))
+    goto out;
+
+  data->page_size = sysconf (_SC_PAGESIZE);
+  if (data->page_size < 1)
+    {
+      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                           "%s", strerror (errno));
+      g_prefix_error (&error, _("Error getting page size: "));
+      goto out;
+    }
+
+  g_mutex_lock (&data->scan_lock);
+  data->estimator = gdu_estimator_new (data->size);
+  data->map = gdu_surface_map_new (data->size, SCAN_NUM_REGIONS);
+  data->last_update_usec = -1;
+  g_mutex_unlock (&data->scan_lock);
+
+  for (n = 0; n < SCAN_QUEUE_DEPTH; n++)
+    threads[n] = g_thread_new ("surface-scan-thread", scan_thread_func, data);
+  for (n = 0; n < SCAN_QUEUE_DEPTH; n++)
+    g_thread_join (threads[n]);
+
+  g_cancellable_set_error_if_cancelled (data->cancellable, &error);
+
+ out:
+  if (data->fd != -1)
+    {
+      close (data->fd);
+      data->fd = -1;
+    }
+
+  if (error != NULL)
+    {
+      /* show error in GUI - the map is kept, so what was scanned so far is still shown */
+      if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+        {
+          data->scan_error = error; error = NULL;
+          g_idle_add (on_show_error, scan_data_ref (data));
+        }
+      g_clear_error (&error);
+    }
+  else
+    {
+      /* success */
+      g_idle_add (on_success, scan_data_ref (data));
+    }
+
+  g_idle_add (unref_in_idle, data); /* unref on main thread */
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_local_job_canceled (GduLocalJob  *job,
+                       gpointer      user_data)
+{
+  ScanData *data = user_data;
+  if (!data->completed)
+    {
+      scan_data_terminate_job (data);
+      scan_data_complete_and_unref (data);
+      update_job (data, FALSE);
+    }
+}
+
+void
+gdu_surface_scan_start (GduWindow    *window,
+                        UDisksObject *object)
+{
+  ScanData *data;
+
+  data = g_new0 (ScanData, 1);
+  data->ref_count = 1;
+  g_mutex_init (&data->scan_lock);
+  data->window = g_object_ref (window);
+  data->object = g_object_ref (object);
+  data->block = udisks_object_get_block (object);
+  g_assert (data->block != NULL);
+  data->cancellable = g_cancellable_new ();
+  data->fd = -1;
+
+  data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (window)),
+                                                  GTK_WINDOW (window),
+                                                  GTK_APPLICATION_INHIBIT_SUSPEND |
+                                                  GTK_APPLICATION_INHIBIT_LOGOUT,
+                                                  /* Translators: Reason why suspend/logout is being inhibited */
+                                                  C_("surface-scan-inhibit-message", "Checking disk surface"));
+
+  data->local_job = gdu_application_create_local_job (gdu_window_get_application (window), object);
+  udisks_job_set_operation (UDISKS_JOB (data->local_job), "x-gdu-check-surface");
+  /* Translators: this is the description of the job */
+  gdu_local_job_set_description (data->local_job, _("Checking Surface"));
+  udisks_job_set_progress_valid (UDISKS_JOB (data->local_job), TRUE);
+  udisks_job_set_cancelable (UDISKS_JOB (data->local_job), TRUE);
+  g_signal_connect (data->local_job, "canceled",
+                    G_CALLBACK (on_local_job_canceled),
+                    data);
+
+  /* forget the result of any earlier scan */
+  gdu_volume_grid_set_surface_map (GDU_VOLUME_GRID (gdu_window_get_volume_grid (window)), object, NULL);
+
+  g_thread_new ("surface-scan-main-thread",
+                scan_main_thread_func,
+                scan_data_ref (data));
+}
@@ -49,6 +49,36 @@ typedef struct GduLocalJob GduLocalJob;
 struct GduXzDecompressor;
 typedef struct GduXzDecompressor GduXzDecompressor;
 
+struct GduBufferRing;
+typedef struct GduBufferRing GduBufferRing;
+
+struct GduGzipDecompressor;
+typedef struct GduGzipDecompressor GduGzipDecompressor;
+
+struct GduBzip2Decompressor;
+typedef struct GduBzip2Decompressor GduBzip2Decompressor;
+
+struct GduZstdDecompressor;
+typedef struct GduZstdDecompressor GduZstdDecompressor;
+
+struct GduLz4Decompressor;
+typedef struct GduLz4Decompressor GduLz4Decompressor;
+
+struct GduDecoder;
+typedef struct GduDecoder GduDecoder;
+
+struct GduImagePartition;
+typedef struct GduImagePartition GduImagePartition;
+
+struct GduSurfaceMap;
+typedef struct GduSurfaceMap GduSurfaceMap;
+
+struct GduHistogram;
+typedef struct GduHistogram GduHistogram;
+
+struct GduIOTrace;
+typedef struct GduIOTrace GduIOTrace;
+
 G_END_DECLS
 
 #endif /* __GDU_TYPES_H__ */
@@ -17,11 +17,15 @@
 
 #include "gduvolumegrid.h"
 #include "gduapplication.h"
+#include "gdusurfacemap.h"
 
 /* ---------------------------------------------------------------------------------------------------- */
 
 #define ELEMENT_MINIMUM_WIDTH 60
 
+/* height of the strip showing the result of Check Surface */
+#define SURFACE_MAP_HEIGHT 6
+
 typedef enum
 {
   GRID_EDGE_NONE    = 0,
@@ -106,6 +110,9 @@ struct _GduVolumeGrid
   gboolean animating_spinner;
 
   gchar *no_media_string;
+
+  /* object path -> GduSurfaceMap */
+  GHashTable *surface_maps;
 };
 
 struct _GduVolumeGridClass
@@ -171,6 +178,7 @@ gdu_volume_grid_finalize (GObject *object)
   g_object_unref (grid->application);
 
   g_free (grid->no_media_string);
+  g_hash_table_unref (grid->surface_maps);
 
   G_OBJECT_CLASS (gdu_volume_grid_parent_class)->finalize (object);
 }
@@ -589,6 +597,10 @@ gdu_volume_grid_init (GduVolumeGrid *grid)
 {
   gtk_widget_set_can_focus (GTK_WIDGET (grid), TRUE);
   gtk_widget_set_app_paintable (GTK_WIDGET (grid), TRUE);
+  grid->surface_maps = g_hash_table_new_full (g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              (GDestroyNotify) gdu_surface_map_unref);
 }
 
 GtkWidget *
@@ -634,6 +646,34 @@ gdu_volume_grid_set_block_object (GduVolumeGrid *grid,
   ;
 }
 
+/* Sets the result of checking the surface of @block_object, shown whenever
+ * @block_object is shown. Call again whenever @map has changed.
+ */
+void
+gdu_volume_grid_set_surface_map (GduVolumeGrid *grid,
+                                 UDisksObject  *block_object,
+                                 GduSurfaceMap *map)
+{
+  const gchar *object_path;
+
+  g_return_if_fail (GDU_IS_VOLUME_GRID (grid));
+  g_return_if_fail (UDISKS_IS_OBJECT (block_object));
+
+  object_path = g_dbus_object_get_object_path (G_DBUS_OBJECT (block_object));
+  if (map != NULL)
+    {
+      if (g_hash_table_lookup (grid->surface_maps, object_path) != map)
+        g_hash_table_insert (grid->surface_maps, g_strdup (object_path), gdu_surface_map_ref (map));
+    }
+  else
+    {
+      g_hash_table_remove (grid->surface_maps, object_path);
+    }
+
+  if (block_object == grid->block_object)
+    gtk_widget_queue_draw (GTK_WIDGET (grid));
+}
+
 
 static guint
 get_depth (GList *elements)
@@ -991,6 +1031,74 @@ render_slice (GduVolumeGrid *grid,
   return animate_spinner;
 }
 
+/* Draws the result of Check Surface as a strip along the top of each
+ * element, each pixel showing the worst region it covers: green if the
+ * region reads about as fast as the device typically does, shading to
+ * red the slower it is and dark red if reading it failed.
+ */
+static void
+render_surface_map (GduVolumeGrid *grid,
+                    cairo_t       *cr,
+                    GduSurfaceMap *map)
+{
+  guint64 typical_usec;
+  GList *l;
+
+  typical_usec = gdu_surface_map_get_typical_usec (map);
+
+  cairo_save (cr);
+  for (l = grid->elements; l != NULL; l = l->next)
+    {
+      GridElement *element = l->data;
+      guint px;
+      guint width;
+
+      if (element->size <= 0 || element->width <= 2)
+        continue;
+
+      width = element->width - 2;
+      for (px = 0; px < width; px++)
+        {
+          guint64 start = element->offset + element->size * px / width;
+          guint64 end = element->offset + element->size * (px + 1) / width;
+          guint first_region;
+          guint last_region;
+          guint region;
+          gboolean have_data = FALSE;
+          gboolean failed = FALSE;
+          gdouble badness = 0.0;
+
+          first_region = gdu_surface_map_get_region_for_offset (map, start);
+          last_region = gdu_surface_map_get_region_for_offset (map, end > start ? end - 1 : start);
+          for (region = first_region; region <= last_region; region++)
+            {
+              guint64 avg_usec;
+              guint num_errors;
+
+              if (!gdu_surface_map_get_region (map, region, &avg_usec, NULL, &num_errors))
+                continue;
+              have_data = TRUE;
+              if (num_errors > 0)
+                failed = TRUE;
+              /* twice as slow as typical is still fine, ten times as slow is bad */
+              if (typical_usec > 0 && avg_usec > 2 * typical_usec)
+                badness = MAX (badness, log10 (((gdouble) avg_usec) / (2.0 * typical_usec)) / log10 (5.0));
+            }
+          if (!have_data)
+            continue;
+
+          badness = CLAMP (badness, 0.0, 1.0);
+          if (failed)
+            cairo_set_source_rgb (cr, 0.5, 0.0, 0.0);
+          else
+            cairo_set_source_rgb (cr, MIN (1.0, 2.0 * badness), 0.8 * MIN (1.0, 2.0 * (1.0 - badness)), 0.0);
+          cairo_rectangle (cr, element->x + 1 + px, element->y + 1, 1, SURFACE_MAP_HEIGHT);
+          cairo_fill (cr);
+        }
+    }
+  cairo_restore (cr);
+}
+
 static gboolean
 gdu_volume_grid_draw (GtkWidget *widget,
                       cairo_t   *cr)
@@ -998,12 +1106,18 @@ gdu_volume_grid_draw (GtkWidget *widget,
   GduVolumeGrid *grid = GDU_VOLUME_GRID (widget);
   GtkAllocation allocation;
   gboolean animate_spinner;
+  GduSurfaceMap *map = NULL;
 
   gtk_widget_get_allocation (widget, &allocation);
   recompute_size (grid, allocation.width, allocation.height);
 
   animate_spinner = render_slice (grid, cr, grid->elements);
 
+  if (grid->block_object != NULL)
+    map = g_hash_table_lookup (grid->surface_maps, g_dbus_object_get_object_path (G_DBUS_OBJECT (grid->block_object)));
+  if (map != NULL)
+    render_surface_map (grid, cr, map);
+
   if (animate_spinner != grid->animating_spinner)
     {
       if (animate_spinner)
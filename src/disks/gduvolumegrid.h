@@ -39,6 +39,10 @@ UDisksObject             *gdu_volume_grid_get_selected_device   (GduVolumeGrid
 guint64                   gdu_volume_grid_get_selected_offset   (GduVolumeGrid       *grid);
 guint64                   gdu_volume_grid_get_selected_size     (GduVolumeGrid       *grid);
 
+void                      gdu_volume_grid_set_surface_map       (GduVolumeGrid       *grid,
+                                                                 UDisksObject        *block_object,
+                                                                 GduSurfaceMap       *map);
+
 G_END_DECLS
 
 #endif /* __GDU_VOLUME_GRID_H__ */
@@ -35,6 +35,8 @@
 #include "gduformatdiskdialog.h"
 #include "gducreatediskimagedialog.h"
 #include "gdurestorediskimagedialog.h"
+#include "gduclonediskdialog.h"
+#include "gdusurfacescan.h"
 #include "gduchangepassphrasedialog.h"
 #include "gdudisksettingsdialog.h"
 #include "gduerasemultipledisksdialog.h"
@@ -87,7 +89,9 @@ struct _GduWindow
   GtkWidget *generic_drive_menu_item_format_disk;
   GtkWidget *generic_drive_menu_item_create_disk_image;
   GtkWidget *generic_drive_menu_item_restore_disk_image;
+  GtkWidget *generic_drive_menu_item_clone_disk;
   GtkWidget *generic_drive_menu_item_benchmark;
+  GtkWidget *generic_drive_menu_item_check_surface;
   /* Drive-specific items */
   GtkWidget *generic_drive_menu_item_drive_sep_1;
   GtkWidget *generic_drive_menu_item_view_smart;
@@ -103,6 +107,7 @@ struct _GduWindow
   GtkWidget *generic_menu_item_change_passphrase;
   GtkWidget *generic_menu_item_edit_label;
   GtkWidget *generic_menu_item_edit_partition;
+  GtkWidget *generic_menu_item_move_partition;
   GtkWidget *generic_menu_item_format_volume;
   GtkWidget *generic_menu_item_create_volume_image;
   GtkWidget *generic_menu_item_restore_volume_image;
@@ -160,7 +165,9 @@ static const struct {
   {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_format_disk), "generic-drive-menu-item-format-disk"},
   {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_create_disk_image), "generic-drive-menu-item-create-disk-image"},
   {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_restore_disk_image), "generic-drive-menu-item-restore-disk-image"},
+  {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_clone_disk), "generic-drive-menu-item-clone-disk"},
   {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_benchmark), "generic-drive-menu-item-benchmark"},
+  {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_check_surface), "generic-drive-menu-item-check-surface"},
   /* Drive-specific items */
   {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_drive_sep_1), "generic-drive-menu-item-drive-sep-1"},
   {G_STRUCT_OFFSET (GduWindow, generic_drive_menu_item_view_smart), "generic-drive-menu-item-view-smart"},
@@ -176,6 +183,7 @@ static const struct {
   {G_STRUCT_OFFSET (GduWindow, generic_menu_item_change_passphrase), "generic-menu-item-change-passphrase"},
   {G_STRUCT_OFFSET (GduWindow, generic_menu_item_edit_label), "generic-menu-item-edit-label"},
   {G_STRUCT_OFFSET (GduWindow, generic_menu_item_edit_partition), "generic-menu-item-edit-partition"},
+  {G_STRUCT_OFFSET (GduWindow, generic_menu_item_move_partition), "generic-menu-item-move-partition"},
   {G_STRUCT_OFFSET (GduWindow, generic_menu_item_format_volume), "generic-menu-item-format-volume"},
   {G_STRUCT_OFFSET (GduWindow, generic_menu_item_create_volume_image), "generic-menu-item-create-volume-image"},
   {G_STRUCT_OFFSET (GduWindow, generic_menu_item_restore_volume_image), "generic-menu-item-restore-volume-image"},
@@ -232,6 +240,8 @@ typedef enum
   SHOW_FLAGS_DRIVE_MENU_STANDBY_NOW           = (1<<6),
   SHOW_FLAGS_DRIVE_MENU_RESUME_NOW            = (1<<7),
   SHOW_FLAGS_DRIVE_MENU_POWER_OFF             = (1<<8),
+  SHOW_FLAGS_DRIVE_MENU_CLONE_DISK            = (1<<9),
+  SHOW_FLAGS_DRIVE_MENU_CHECK_SURFACE         = (1<<10),
 } ShowFlagsDriveMenu;
 
 typedef enum {
@@ -256,6 +266,7 @@ typedef enum
   SHOW_FLAGS_VOLUME_MENU_CREATE_VOLUME_IMAGE   = (1<<6),
   SHOW_FLAGS_VOLUME_MENU_RESTORE_VOLUME_IMAGE  = (1<<7),
   SHOW_FLAGS_VOLUME_MENU_BENCHMARK             = (1<<8),
+  SHOW_FLAGS_VOLUME_MENU_MOVE_PARTITION        = (1<<9),
 } ShowFlagsVolumeMenu;
 
 typedef struct
@@ -309,8 +320,12 @@ static void on_generic_drive_menu_item_create_disk_image (GtkMenuItem *menu_item
                                                           gpointer   user_data);
 static void on_generic_drive_menu_item_restore_disk_image (GtkMenuItem *menu_item,
                                                            gpointer   user_data);
+static void on_generic_drive_menu_item_clone_disk (GtkMenuItem *menu_item,
+                                                   gpointer   user_data);
 static void on_generic_drive_menu_item_benchmark (GtkMenuItem *menu_item,
                                                   gpointer   user_data);
+static void on_generic_drive_menu_item_check_surface (GtkMenuItem *menu_item,
+                                                      gpointer   user_data);
 
 static void on_generic_menu_item_configure_fstab (GtkMenuItem *menu_item,
                                                   gpointer   user_data);
@@ -322,6 +337,8 @@ static void on_generic_menu_item_edit_label (GtkMenuItem *menu_item,
                                              gpointer   user_data);
 static void on_generic_menu_item_edit_partition (GtkMenuItem *menu_item,
                                                  gpointer   user_data);
+static void on_generic_menu_item_move_partition (GtkMenuItem *menu_item,
+                                                 gpointer   user_data);
 static void on_generic_menu_item_format_volume (GtkMenuItem *menu_item,
                                                 gpointer   user_data);
 static void on_generic_menu_item_create_volume_image (GtkMenuItem *menu_item,
@@ -449,8 +466,12 @@ update_for_show_flags (GduWindow *window,
                             show_flags->drive_menu & SHOW_FLAGS_DRIVE_MENU_CREATE_DISK_IMAGE);
   gtk_widget_set_sensitive (GTK_WIDGET (window->generic_drive_menu_item_restore_disk_image),
                             show_flags->drive_menu & SHOW_FLAGS_DRIVE_MENU_RESTORE_DISK_IMAGE);
+  gtk_widget_set_sensitive (GTK_WIDGET (window->generic_drive_menu_item_clone_disk),
+                            show_flags->drive_menu & SHOW_FLAGS_DRIVE_MENU_CLONE_DISK);
   gtk_widget_set_sensitive (GTK_WIDGET (window->generic_drive_menu_item_benchmark),
                             show_flags->drive_menu & SHOW_FLAGS_DRIVE_MENU_BENCHMARK);
+  gtk_widget_set_sensitive (GTK_WIDGET (window->generic_drive_menu_item_check_surface),
+                            show_flags->drive_menu & SHOW_FLAGS_DRIVE_MENU_CHECK_SURFACE);
 
   gtk_widget_set_sensitive (GTK_WIDGET (window->generic_menu_item_configure_fstab),
                             show_flags->volume_menu & SHOW_FLAGS_VOLUME_MENU_CONFIGURE_FSTAB);
@@ -462,6 +483,8 @@ update_for_show_flags (GduWindow *window,
                             show_flags->volume_menu & SHOW_FLAGS_VOLUME_MENU_EDIT_LABEL);
   gtk_widget_set_sensitive (GTK_WIDGET (window->generic_menu_item_edit_partition),
                             show_flags->volume_menu & SHOW_FLAGS_VOLUME_MENU_EDIT_PARTITION);
+  gtk_widget_set_sensitive (GTK_WIDGET (window->generic_menu_item_move_partition),
+                            show_flags->volume_menu & SHOW_FLAGS_VOLUME_MENU_MOVE_PARTITION);
   gtk_widget_set_sensitive (GTK_WIDGET (window->generic_menu_item_format_volume),
                             show_flags->volume_menu & SHOW_FLAGS_VOLUME_MENU_FORMAT_VOLUME);
   gtk_widget_set_sensitive (GTK_WIDGET (window->generic_menu_item_create_volume_image),
@@ -1273,10 +1296,18 @@ gdu_window_constructed (GObject *object)
                     "activate",
                     G_CALLBACK (on_generic_drive_menu_item_restore_disk_image),
                     window);
+  g_signal_connect (window->generic_drive_menu_item_clone_disk,
+                    "activate",
+                    G_CALLBACK (on_generic_drive_menu_item_clone_disk),
+                    window);
   g_signal_connect (window->generic_drive_menu_item_benchmark,
                     "activate",
                     G_CALLBACK (on_generic_drive_menu_item_benchmark),
                     window);
+  g_signal_connect (window->generic_drive_menu_item_check_surface,
+                    "activate",
+                    G_CALLBACK (on_generic_drive_menu_item_check_surface),
+                    window);
 
   /* volume menu */
   g_signal_connect (window->generic_menu_item_configure_fstab,
@@ -1299,6 +1330,10 @@ gdu_window_constructed (GObject *object)
                     "activate",
                     G_CALLBACK (on_generic_menu_item_edit_partition),
                     window);
+  g_signal_connect (window->generic_menu_item_move_partition,
+                    "activate",
+                    G_CALLBACK (on_generic_menu_item_move_partition),
+                    window);
   g_signal_connect (window->generic_menu_item_format_volume,
                     "activate",
                     G_CALLBACK (on_generic_menu_item_format_volume),
@@ -1527,6 +1562,13 @@ gdu_window_get_client (GduWindow *window)
   return window->client;
 }
 
+GtkWidget *
+gdu_window_get_volume_grid (GduWindow *window)
+{
+  g_return_val_if_fail (GDU_IS_WINDOW (window), NULL);
+  return window->volume_grid;
+}
+
 typedef enum
 {
   SET_MARKUP_FLAGS_NONE = 0,
@@ -2453,7 +2495,9 @@ update_device_page_for_block (GduWindow          *window,
       show_flags->volume_menu |= SHOW_FLAGS_VOLUME_MENU_CREATE_VOLUME_IMAGE;
       show_flags->volume_menu |= SHOW_FLAGS_VOLUME_MENU_BENCHMARK;
       show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_BENCHMARK;
+      show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_CHECK_SURFACE;
       show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_CREATE_DISK_IMAGE;
+      show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_CLONE_DISK;
       if (!read_only)
         show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_RESTORE_DISK_IMAGE;
       if (!read_only)
@@ -2680,7 +2724,21 @@ update_device_page_for_block (GduWindow          *window,
   if (partition != NULL)
     {
       if (!read_only)
-        show_flags->volume_menu |= SHOW_FLAGS_VOLUME_MENU_EDIT_PARTITION;
+        {
+          UDisksPartitionTable *table;
+
+          show_flags->volume_menu |= SHOW_FLAGS_VOLUME_MENU_EDIT_PARTITION;
+
+          /* only partitions listed directly in a GPT or MBR can be moved */
+          table = udisks_client_get_partition_table (window->client, partition);
+          if (table != NULL &&
+              !udisks_partition_get_is_container (partition) &&
+              !udisks_partition_get_is_contained (partition) &&
+              (g_strcmp0 (udisks_partition_table_get_type_ (table), "gpt") == 0 ||
+               g_strcmp0 (udisks_partition_table_get_type_ (table), "dos") == 0))
+            show_flags->volume_menu |= SHOW_FLAGS_VOLUME_MENU_MOVE_PARTITION;
+          g_clear_object (&table);
+        }
     }
   else
     {
@@ -2732,11 +2790,13 @@ update_device_page_for_free_space (GduWindow          *window,
   loop = udisks_object_peek_loop (window->current_object);
 
   show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_BENCHMARK;
+  show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_CHECK_SURFACE;
   if (!read_only)
     {
       show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_FORMAT_DISK;
       show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_CREATE_DISK_IMAGE;
       show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_RESTORE_DISK_IMAGE;
+      show_flags->drive_menu |= SHOW_FLAGS_DRIVE_MENU_CLONE_DISK;
     }
 
   if (loop != NULL)
@@ -2954,6 +3014,18 @@ on_generic_menu_item_edit_partition (GtkMenuItem *menu_item,
   gdu_partition_dialog_show (window, object);
 }
 
+static void
+on_generic_menu_item_move_partition (GtkMenuItem *menu_item,
+                                     gpointer   user_data)
+{
+  GduWindow *window = GDU_WINDOW (user_data);
+  UDisksObject *object;
+
+  object = gdu_volume_grid_get_selected_device (GDU_VOLUME_GRID (window->volume_grid));
+  g_assert (object != NULL);
+  gdu_partition_dialog_show_move (window, object);
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 static void
@@ -2998,6 +3070,20 @@ on_generic_drive_menu_item_restore_disk_image (GtkMenuItem *menu_item,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+on_generic_drive_menu_item_clone_disk (GtkMenuItem *menu_item,
+                                       gpointer   user_data)
+{
+  GduWindow *window = GDU_WINDOW (user_data);
+  UDisksObject *object;
+
+  object = gdu_volume_grid_get_block_object (GDU_VOLUME_GRID (window->volume_grid));
+  g_assert (object != NULL);
+  gdu_clone_disk_dialog_show (window, object);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 on_generic_drive_menu_item_benchmark (GtkMenuItem *menu_item,
                                       gpointer   user_data)
@@ -3012,6 +3098,20 @@ on_generic_drive_menu_item_benchmark (GtkMenuItem *menu_item,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static void
+on_generic_drive_menu_item_check_surface (GtkMenuItem *menu_item,
+                                          gpointer   user_data)
+{
+  GduWindow *window = GDU_WINDOW (user_data);
+  UDisksObject *object;
+
+  object = gdu_volume_grid_get_block_object (GDU_VOLUME_GRID (window->volume_grid));
+  g_assert (object != NULL);
+  gdu_surface_scan_start (window, object);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 on_generic_menu_item_create_volume_image (GtkMenuItem *menu_item,
                                           gpointer   user_data)
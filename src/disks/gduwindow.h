@@ -24,6 +24,7 @@ GduWindow      *gdu_window_new             (GduApplication *application,
                                             UDisksClient   *client);
 GduApplication *gdu_window_get_application (GduWindow      *window);
 UDisksClient   *gdu_window_get_client      (GduWindow      *window);
+GtkWidget      *gdu_window_get_volume_grid (GduWindow      *window);
 
 gboolean        gdu_window_select_object     (GduWindow    *window,
                                               UDisksObject *object);
@@ -22,6 +22,7 @@
 #include <fcntl.h>
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <lzma.h>
@@ -33,18 +34,43 @@ struct GduXzDecompressor
   GObject parent_instance;
 
   lzma_stream stream;
+
+  /* If set, the input is a sequence of blocks rather than a .xz file,
+   * see gdu_xz_decompressor_new_for_blocks()
+   */
+  gboolean blocks_only;
+  lzma_check check;
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  guint8 block_header[LZMA_BLOCK_HEADER_SIZE_MAX];
+  gsize block_header_size;
+  lzma_block block;
+  gboolean in_block;
+  gboolean end_of_blocks;
 };
 
 G_DEFINE_TYPE_WITH_CODE (GduXzDecompressor, gdu_xz_decompressor, G_TYPE_OBJECT,
 			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
 						gdu_xz_decompressor_iface_init))
 
+static void
+free_block_filters (GduXzDecompressor *decompressor)
+{
+  guint n;
+  for (n = 0; n < G_N_ELEMENTS (decompressor->filters); n++)
+    {
+      free (decompressor->filters[n].options);
+      decompressor->filters[n].options = NULL;
+      decompressor->filters[n].id = LZMA_VLI_UNKNOWN;
+    }
+}
+
 static void
 gdu_xz_decompressor_finalize (GObject *object)
 {
   GduXzDecompressor *decompressor = GDU_XZ_DECOMPRESSOR (object);
 
   lzma_end (&decompressor->stream);
+  free_block_filters (decompressor);
 
   G_OBJECT_CLASS (gdu_xz_decompressor_parent_class)->finalize (object);
 }
@@ -54,16 +80,47 @@ init_lzma (GduXzDecompressor *decompressor)
 {
   lzma_ret ret;
   memset (&decompressor->stream, 0, sizeof decompressor->stream);
+#if LZMA_VERSION >= UINT32_C(50040002)
+  {
+    lzma_mt mt;
+    long num_cpus;
+
+    /* Blocks are decoded in parallel if the file was compressed with
+     * several blocks (e.g. xz --threads) and the block headers contain
+     * the sizes. Otherwise this is the same as lzma_stream_decoder().
+     */
+    num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    memset (&mt, 0, sizeof mt);
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = num_cpus > 0 ? num_cpus : 1;
+    mt.memlimit_threading = lzma_physmem () / 4;
+    mt.memlimit_stop = UINT64_MAX;
+    ret = lzma_stream_decoder_mt (&decompressor->stream, &mt);
+  }
+#else
   ret = lzma_stream_decoder (&decompressor->stream,
                              UINT64_MAX, /* memlimit */
-                             0);         /* flags */
+                             LZMA_CONCATENATED);
+#endif
   if (ret != LZMA_OK)
     g_critical ("Error initalizing lzma decoder: %u", ret);
 }
 
+static void
+init_blocks (GduXzDecompressor *decompressor)
+{
+  /* the block decoder is set up once the header of each block has been read */
+  memset (&decompressor->stream, 0, sizeof decompressor->stream);
+  free_block_filters (decompressor);
+  decompressor->block_header_size = 0;
+  decompressor->in_block = FALSE;
+  decompressor->end_of_blocks = FALSE;
+}
+
 static void
 gdu_xz_decompressor_init (GduXzDecompressor *decompressor)
 {
+  free_block_filters (decompressor);
   init_lzma (decompressor);
 }
 
@@ -86,12 +143,169 @@ gdu_xz_decompressor_new (void)
   return decompressor;
 }
 
+/**
+ * gdu_xz_decompressor_new_for_blocks:
+ * @check: The integrity check type used in the stream the blocks are from.
+ *
+ * Creates a decompressor for a sequence of blocks from the middle of
+ * a .xz stream, e.g. starting at an offset found with
+ * gdu_xz_decompressor_locate_block(). Decompression stops at the
+ * index following the last block of the stream.
+ *
+ * Returns: A new #GduXzDecompressor.
+ */
+GduXzDecompressor *
+gdu_xz_decompressor_new_for_blocks (guint check)
+{
+  GduXzDecompressor *decompressor;
+
+  decompressor = gdu_xz_decompressor_new ();
+  lzma_end (&decompressor->stream);
+  decompressor->blocks_only = TRUE;
+  decompressor->check = check;
+  init_blocks (decompressor);
+
+  return decompressor;
+}
+
 static void
 gdu_xz_decompressor_reset (GConverter *converter)
 {
   GduXzDecompressor *decompressor = GDU_XZ_DECOMPRESSOR (converter);
   lzma_end (&decompressor->stream);
-  init_lzma (decompressor);
+  if (decompressor->blocks_only)
+    init_blocks (decompressor);
+  else
+    init_lzma (decompressor);
+}
+
+static GConverterResult
+convert_blocks (GduXzDecompressor *decompressor,
+                const void        *inbuf,
+                gsize              inbuf_size,
+                void              *outbuf,
+                gsize              outbuf_size,
+                GConverterFlags    flags,
+                gsize             *bytes_read,
+                gsize             *bytes_written,
+                GError           **error)
+{
+  const guint8 *in = inbuf;
+  lzma_ret res;
+
+  *bytes_read = 0;
+  *bytes_written = 0;
+
+  if (decompressor->end_of_blocks)
+    {
+      /* ignore the index and whatever follows */
+      *bytes_read = inbuf_size;
+      return G_CONVERTER_FINISHED;
+    }
+
+  if (!decompressor->in_block)
+    {
+      gsize header_size;
+      gsize num_bytes;
+
+      if (inbuf_size == 0)
+        {
+          if ((flags & G_CONVERTER_INPUT_AT_END) && decompressor->block_header_size == 0)
+            return G_CONVERTER_FINISHED;
+          if (flags & G_CONVERTER_FLUSH)
+            return G_CONVERTER_FLUSHED;
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                               _("Need more input"));
+          return G_CONVERTER_ERROR;
+        }
+
+      /* the index starts with a zero byte where a block header size would be */
+      if (decompressor->block_header_size == 0 && in[0] == 0x00)
+        {
+          decompressor->end_of_blocks = TRUE;
+          *bytes_read = inbuf_size;
+          return G_CONVERTER_FINISHED;
+        }
+
+      if (decompressor->block_header_size == 0)
+        header_size = lzma_block_header_size_decode (in[0]);
+      else
+        header_size = lzma_block_header_size_decode (decompressor->block_header[0]);
+      num_bytes = MIN (header_size - decompressor->block_header_size, inbuf_size);
+      memcpy (decompressor->block_header + decompressor->block_header_size, in, num_bytes);
+      decompressor->block_header_size += num_bytes;
+      *bytes_read = num_bytes;
+      if (decompressor->block_header_size < header_size)
+        return G_CONVERTER_CONVERTED;
+
+      memset (&decompressor->block, 0, sizeof decompressor->block);
+      decompressor->block.version = 0;
+      decompressor->block.check = decompressor->check;
+      decompressor->block.filters = decompressor->filters;
+      decompressor->block.header_size = header_size;
+      if (lzma_block_header_decode (&decompressor->block, NULL, decompressor->block_header) != LZMA_OK ||
+          lzma_block_decoder (&decompressor->stream, &decompressor->block) != LZMA_OK)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                               _("Invalid compressed data"));
+          return G_CONVERTER_ERROR;
+        }
+      decompressor->block_header_size = 0;
+      decompressor->in_block = TRUE;
+      return G_CONVERTER_CONVERTED;
+    }
+
+  decompressor->stream.next_in = (void *)inbuf;
+  decompressor->stream.avail_in = inbuf_size;
+
+  decompressor->stream.next_out = outbuf;
+  decompressor->stream.avail_out = outbuf_size;
+
+  res = lzma_code (&decompressor->stream, LZMA_RUN);
+
+  if (res == LZMA_DATA_ERROR || res == LZMA_OPTIONS_ERROR)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			   _("Invalid compressed data"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res == LZMA_MEM_ERROR)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			   _("Not enough memory"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res != LZMA_OK && res != LZMA_STREAM_END && res != LZMA_BUF_ERROR)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+		   _("Internal error"));
+      return G_CONVERTER_ERROR;
+    }
+
+  *bytes_read = inbuf_size - decompressor->stream.avail_in;
+  *bytes_written = outbuf_size - decompressor->stream.avail_out;
+
+  if (res == LZMA_STREAM_END)
+    {
+      /* the end of the block, including padding and check - another block or the index follows */
+      free_block_filters (decompressor);
+      decompressor->in_block = FALSE;
+      return G_CONVERTER_CONVERTED;
+    }
+
+  if (*bytes_read == 0 && *bytes_written == 0)
+    {
+      if (flags & G_CONVERTER_FLUSH)
+	return G_CONVERTER_FLUSHED;
+
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+			   _("Need more input"));
+      return G_CONVERTER_ERROR;
+    }
+
+  return G_CONVERTER_CONVERTED;
 }
 
 static GConverterResult
@@ -108,13 +322,19 @@ gdu_xz_decompressor_convert (GConverter *converter,
   GduXzDecompressor *decompressor = GDU_XZ_DECOMPRESSOR (converter);
   lzma_ret res;
 
+  if (decompressor->blocks_only)
+    return convert_blocks (decompressor, inbuf, inbuf_size, outbuf, outbuf_size,
+                           flags, bytes_read, bytes_written, error);
+
   decompressor->stream.next_in = (void *)inbuf;
   decompressor->stream.avail_in = inbuf_size;
 
   decompressor->stream.next_out = outbuf;
   decompressor->stream.avail_out = outbuf_size;
 
-  res = lzma_code (&decompressor->stream, LZMA_RUN);
+  /* with LZMA_CONCATENATED the decoder only knows the input ended if told so */
+  res = lzma_code (&decompressor->stream,
+                   (flags & G_CONVERTER_INPUT_AT_END) ? LZMA_FINISH : LZMA_RUN);
 
   if (res == LZMA_DATA_ERROR)
     {
@@ -170,11 +390,12 @@ gdu_xz_decompressor_iface_init (GConverterIface *iface)
   iface->reset = gdu_xz_decompressor_reset;
 }
 
-gsize
-gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
+/* Reads the index of a single-stream .xz file */
+static lzma_index *
+read_index (GFile             *compressed_file,
+            lzma_stream_flags *out_stream_flags)
 {
   gchar *path = NULL;
-  gsize ret = 0;
   GMappedFile *mapped_file = NULL;
   size_t bufpos = 0;
   uint64_t memlimit = UINT64_MAX;
@@ -183,7 +404,6 @@ gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
   GError *error = NULL;
   uint8_t *buf;
   gsize len;
-  lzma_stream_flags stream_flags;
   uint8_t *footer, *index;
 
   path = g_file_get_path (compressed_file);
@@ -211,11 +431,11 @@ gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
   if (len < 12)
     goto out;
   footer = buf + len - 12;
-  if (lzma_stream_footer_decode (&stream_flags, footer) != LZMA_OK)
+  if (lzma_stream_footer_decode (out_stream_flags, footer) != LZMA_OK)
     goto out;
-  if (stream_flags.backward_size > len - 12)
+  if (out_stream_flags->backward_size > len - 12)
     goto out;
-  index = footer - stream_flags.backward_size;
+  index = footer - out_stream_flags->backward_size;
 
   res = lzma_index_buffer_decode (&index_object,
                                   &memlimit,
@@ -224,15 +444,79 @@ gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
                                   &bufpos,
                                   footer - index);
   if (res != LZMA_OK)
-    goto out;
-
-  ret = lzma_index_uncompressed_size (index_object);
+    {
+      index_object = NULL;
+      goto out;
+    }
 
  out:
-  if (index_object != NULL)
-    lzma_index_end (index_object, NULL);
   if (mapped_file != NULL)
     g_mapped_file_unref (mapped_file);
   g_free (path);
+  return index_object;
+}
+
+gsize
+gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
+{
+  gsize ret = 0;
+  lzma_index *index_object;
+  lzma_stream_flags stream_flags;
+
+  index_object = read_index (compressed_file, &stream_flags);
+  if (index_object == NULL)
+    goto out;
+
+  ret = lzma_index_uncompressed_size (index_object);
+  lzma_index_end (index_object, NULL);
+
+ out:
+  return ret;
+}
+
+/**
+ * gdu_xz_decompressor_locate_block:
+ * @compressed_file: A .xz file.
+ * @offset: An offset in the uncompressed data.
+ * @out_compressed_offset: Return location for the offset of the block containing @offset in @compressed_file.
+ * @out_uncompressed_offset: Return location for the uncompressed offset the block starts at.
+ * @out_check: Return location for the integrity check type of the stream.
+ *
+ * Uses the index of @compressed_file to find the block containing
+ * @offset so decompression can start there instead of at the
+ * beginning, see gdu_xz_decompressor_new_for_blocks(). This is only
+ * worthwhile if the file was compressed in several blocks, e.g. with
+ * xz --threads or --block-size.
+ *
+ * Returns: %TRUE if the block was found, %FALSE otherwise.
+ */
+gboolean
+gdu_xz_decompressor_locate_block (GFile   *compressed_file,
+                                  guint64  offset,
+                                  guint64 *out_compressed_offset,
+                                  guint64 *out_uncompressed_offset,
+                                  guint   *out_check)
+{
+  gboolean ret = FALSE;
+  lzma_index *index_object;
+  lzma_index_iter iter;
+  lzma_stream_flags stream_flags;
+
+  index_object = read_index (compressed_file, &stream_flags);
+  if (index_object == NULL)
+    goto out;
+
+  lzma_index_iter_init (&iter, index_object);
+  /* returns TRUE on error */
+  if (!lzma_index_iter_locate (&iter, offset))
+    {
+      *out_compressed_offset = iter.block.compressed_file_offset;
+      *out_uncompressed_offset = iter.block.uncompressed_file_offset;
+      *out_check = stream_flags.check;
+      ret = TRUE;
+    }
+  lzma_index_end (index_object, NULL);
+
+ out:
   return ret;
 }
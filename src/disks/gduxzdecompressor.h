@@ -32,8 +32,14 @@ struct GduXzDecompressorClass
 
 GType              gdu_xz_decompressor_get_type      (void) G_GNUC_CONST;
 GduXzDecompressor *gdu_xz_decompressor_new           (void);
+GduXzDecompressor *gdu_xz_decompressor_new_for_blocks (guint check);
 
 gsize              gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file);
+gboolean           gdu_xz_decompressor_locate_block          (GFile   *compressed_file,
+                                                              guint64  offset,
+                                                              guint64 *out_compressed_offset,
+                                                              guint64 *out_uncompressed_offset,
+                                                              guint   *out_check);
 
 G_END_DECLS
 
@@ -0,0 +1,213 @@
+/* Zstandard Decompressor - based on GLib's GZLibDecompressor
+ *
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ *         Alexander Larsson <alexl@redhat.com>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "gduzstddecompressor.h"
+
+#include <string.h>
+
+#include <zstd.h>
+
+static void gdu_zstd_decompressor_iface_init          (GConverterIface *iface);
+
+struct GduZstdDecompressor
+{
+  GObject parent_instance;
+
+  ZSTD_DStream *stream;
+  /* TRUE if the last frame was decoded completely */
+  gboolean end_of_frame;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GduZstdDecompressor, gdu_zstd_decompressor, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+						gdu_zstd_decompressor_iface_init))
+
+static void
+gdu_zstd_decompressor_finalize (GObject *object)
+{
+  GduZstdDecompressor *decompressor = GDU_ZSTD_DECOMPRESSOR (object);
+
+  ZSTD_freeDStream (decompressor->stream);
+
+  G_OBJECT_CLASS (gdu_zstd_decompressor_parent_class)->finalize (object);
+}
+
+static void
+gdu_zstd_decompressor_init (GduZstdDecompressor *decompressor)
+{
+  decompressor->stream = ZSTD_createDStream ();
+  if (decompressor->stream == NULL)
+    g_critical ("Error initalizing zstd decoder");
+  else
+    ZSTD_initDStream (decompressor->stream);
+  decompressor->end_of_frame = TRUE;
+}
+
+static void
+gdu_zstd_decompressor_class_init (GduZstdDecompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gdu_zstd_decompressor_finalize;
+}
+
+GduZstdDecompressor *
+gdu_zstd_decompressor_new (void)
+{
+  GduZstdDecompressor *decompressor;
+
+  decompressor = g_object_new (GDU_TYPE_ZSTD_DECOMPRESSOR,
+			       NULL);
+
+  return decompressor;
+}
+
+static void
+gdu_zstd_decompressor_reset (GConverter *converter)
+{
+  GduZstdDecompressor *decompressor = GDU_ZSTD_DECOMPRESSOR (converter);
+  ZSTD_initDStream (decompressor->stream);
+  decompressor->end_of_frame = TRUE;
+}
+
+static GConverterResult
+gdu_zstd_decompressor_convert (GConverter *converter,
+			       const void *inbuf,
+			       gsize       inbuf_size,
+			       void       *outbuf,
+			       gsize       outbuf_size,
+			       GConverterFlags flags,
+			       gsize      *bytes_read,
+			       gsize      *bytes_written,
+			       GError    **error)
+{
+  GduZstdDecompressor *decompressor = GDU_ZSTD_DECOMPRESSOR (converter);
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  size_t res;
+
+  in.src = inbuf;
+  in.size = inbuf_size;
+  in.pos = 0;
+
+  out.dst = outbuf;
+  out.size = outbuf_size;
+  out.pos = 0;
+
+  /* This also decodes the following frames of a multi-frame file */
+  res = ZSTD_decompressStream (decompressor->stream, &out, &in);
+  if (ZSTD_isError (res))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Invalid compressed data (%s)"),
+                   ZSTD_getErrorName (res));
+      return G_CONVERTER_ERROR;
+    }
+
+  *bytes_read = in.pos;
+  *bytes_written = out.pos;
+
+  /* res is 0 when a frame has been completely decoded and flushed */
+  if (res == 0)
+    decompressor->end_of_frame = TRUE;
+  else if (in.pos > 0)
+    decompressor->end_of_frame = FALSE;
+
+  if (in.pos == in.size && (flags & G_CONVERTER_INPUT_AT_END))
+    {
+      if (decompressor->end_of_frame)
+        return G_CONVERTER_FINISHED;
+
+      if (out.pos == 0)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                               _("Need more input"));
+          return G_CONVERTER_ERROR;
+        }
+    }
+
+  if (in.pos == 0 && out.pos == 0)
+    {
+      if (flags & G_CONVERTER_FLUSH)
+	return G_CONVERTER_FLUSHED;
+
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+			   _("Need more input"));
+      return G_CONVERTER_ERROR;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+gdu_zstd_decompressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = gdu_zstd_decompressor_convert;
+  iface->reset = gdu_zstd_decompressor_reset;
+}
+
+/* Returns the uncompressed size or 0 if it isn't known, e.g. if the
+ * file consists of several frames or if the frame header doesn't
+ * include the size (streaming compression).
+ */
+gsize
+gdu_zstd_decompressor_get_uncompressed_size (GFile *compressed_file)
+{
+  gchar *path = NULL;
+  gsize ret = 0;
+  GMappedFile *mapped_file = NULL;
+  GError *error = NULL;
+  const guint8 *buf;
+  gsize len;
+  unsigned long long content_size;
+
+  path = g_file_get_path (compressed_file);
+  if (path == NULL)
+    {
+      gchar *uri;
+      uri = g_file_get_uri (compressed_file);
+      g_warning ("No path for URI '%s'. Maybe you need to enable FUSE.", uri);
+      g_free (uri);
+      goto out;
+    }
+
+  mapped_file = g_mapped_file_new (path, FALSE /* writable */, &error);
+  if (mapped_file == NULL)
+    {
+      g_warning ("Error mapping file '%s': %s",
+                 path, error->message);
+      g_clear_error (&error);
+      goto out;
+    }
+
+  buf = (const guint8 *) g_mapped_file_get_contents (mapped_file);
+  len = g_mapped_file_get_length (mapped_file);
+
+  /* only trust the size in the frame header if that frame is all there is */
+  if (ZSTD_findFrameCompressedSize (buf, len) != len)
+    goto out;
+
+  content_size = ZSTD_getFrameContentSize (buf, len);
+  if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR)
+    goto out;
+
+  ret = content_size;
+
+ out:
+  if (mapped_file != NULL)
+    g_mapped_file_unref (mapped_file);
+  g_free (path);
+  return ret;
+}
@@ -93,16 +93,48 @@ gdu_utils_configure_file_chooser_for_disk_images (GtkFileChooser *file_chooser,
       gtk_file_filter_add_pattern (filter, "*");
       gtk_file_chooser_add_filter (file_chooser, filter); /* adopts filter */
       filter = gtk_file_filter_new ();
-      if (allow_compressed)
-        gtk_file_filter_set_name (filter, _("Disk Images (*.img, *.img.xz, *.iso)"));
-      else
+      if (!allow_compressed)
         gtk_file_filter_set_name (filter, _("Disk Images (*.img, *.iso)"));
       gtk_file_filter_add_pattern (filter, "*.raw-disk-image");
       gtk_file_filter_add_pattern (filter, "*.img");
       if (allow_compressed)
         {
-          gtk_file_filter_add_pattern (filter, "*.raw-disk-image.xz");
-          gtk_file_filter_add_pattern (filter, "*.img.xz");
+          static const gchar *const compressed_suffixes[] =
+            {
+              "xz", "gz", "bz2",
+#ifdef HAVE_ZSTD
+              "zst",
+#endif
+#ifdef HAVE_LZ4
+              "lz4",
+#endif
+              NULL
+            };
+          GString *patterns;
+          gchar *name;
+          guint n;
+
+          /* only list the formats this build can decompress */
+          patterns = g_string_new ("*.img");
+          for (n = 0; compressed_suffixes[n] != NULL; n++)
+            {
+              gchar *pattern;
+              pattern = g_strdup_printf ("*.raw-disk-image.%s", compressed_suffixes[n]);
+              gtk_file_filter_add_pattern (filter, pattern);
+              g_free (pattern);
+              pattern = g_strdup_printf ("*.img.%s", compressed_suffixes[n]);
+              gtk_file_filter_add_pattern (filter, pattern);
+              g_string_append_printf (patterns, ", %s", pattern);
+              g_free (pattern);
+            }
+          g_string_append (patterns, ", *.iso");
+          /* Translators: The name of a file filter.
+           *              The %s is a list of file name patterns, e.g. "*.img, *.img.xz, *.iso".
+           */
+          name = g_strdup_printf (_("Disk Images (%s)"), patterns->str);
+          gtk_file_filter_set_name (filter, name);
+          g_free (name);
+          g_string_free (patterns, TRUE);
         }
       gtk_file_filter_add_pattern (filter, "*.iso");
       gtk_file_chooser_add_filter (file_chooser, filter); /* adopts filter */